@@ -44,6 +44,13 @@ long basicd_get_last_error(BASICD_STATUS *status)
 
 ////////////////////////////////////////////////////////////////
 
+long basicd_get_error_stats(BASICD_ERROR_STATS *stats)
+{
+  return g_object.get_error_stats(stats);
+}
+
+////////////////////////////////////////////////////////////////
+
 long basicd_check_run_status(void)
 {
   return g_object.check_run_status();
@@ -51,6 +58,132 @@ long basicd_check_run_status(void)
 
 ////////////////////////////////////////////////////////////////
 
+long basicd_check_heartbeat(unsigned periods)
+{
+  return g_object.check_heartbeat(periods);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_get_thread_stats(BASICD_THREAD_STATS *stats)
+{
+  return g_object.get_thread_stats(stats);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_get_log_stats(BASICD_LOG_STATS *stats)
+{
+  return g_object.get_log_stats(stats);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_get_log_level(BASICD_LOG_LEVEL *level)
+{
+  return g_object.get_log_level(level);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_set_log_level(BASICD_LOG_LEVEL level)
+{
+  return g_object.set_log_level(level);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_set_tracing(bool enabled)
+{
+  return g_object.set_tracing(enabled);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_dump_trace(const char *path)
+{
+  return g_object.dump_trace(path);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_set_perf_counters(bool enabled)
+{
+  return g_object.set_perf_counters(enabled);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_start_profiler(double frequency)
+{
+  return g_object.start_profiler(frequency);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_stop_profiler(const char *path)
+{
+  return g_object.stop_profiler(path);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_set_lock_profiling(bool enabled)
+{
+  return g_object.set_lock_profiling(enabled);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_set_adaptive_locks(bool enabled)
+{
+  return g_object.set_adaptive_locks(enabled);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_get_lock_report(char *report, unsigned size)
+{
+  return g_object.get_lock_report(report, size);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_get_ring_stats(BASICD_RING_STATS *stats)
+{
+  return g_object.get_ring_stats(stats);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_startup_phase(const char *name)
+{
+  return g_object.startup_phase(name);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_startup_done(void)
+{
+  return g_object.startup_done();
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_get_startup_stats(BASICD_STARTUP_STATS *stats)
+{
+  return g_object.get_startup_stats(stats);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_set_instance(unsigned instance)
+{
+  return g_object.set_instance(instance);
+}
+
+////////////////////////////////////////////////////////////////
+
 long basicd_initialize(const char *logfile,
 		       double worker_thread_frequency)
 {
@@ -60,7 +193,44 @@ long basicd_initialize(const char *logfile,
 
 ////////////////////////////////////////////////////////////////
 
+long basicd_start_server(const char *address,
+			 unsigned nr_workers)
+{
+  return g_object.start_server(address,
+			       nr_workers);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_start_rings(const char *path)
+{
+  return g_object.start_rings(path);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_reconfigure(const BASICD_CONFIG *config)
+{
+  return g_object.reconfigure(config);
+}
+
+////////////////////////////////////////////////////////////////
+
 long basicd_finalize(void)
 {
   return g_object.finalize();
 }
+
+////////////////////////////////////////////////////////////////
+
+long basicd_handoff_save(int handoff_fd)
+{
+  return g_object.handoff_save(handoff_fd);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_handoff_restore(int handoff_fd)
+{
+  return g_object.handoff_restore(handoff_fd);
+}
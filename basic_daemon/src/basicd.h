@@ -21,6 +21,13 @@ extern "C" {
  */
 #define BASICD_NAME "basicd"
 
+/*
+ * BASICD configuration file
+ */
+#ifndef BASICD_CFG_FILE
+#define BASICD_CFG_FILE "/tmp/" BASICD_NAME ".cfg"
+#endif
+
 /*
  * BASICD Return codes
  */
@@ -43,6 +50,15 @@ extern "C" {
 #define BASICD_THREAD_OPERATION_FAILED    9
 #define BASICD_THREAD_STATUS_NOT_OK       10
 #define BASICD_UNEXPECTED_EXCEPTION       11
+#define BASICD_THREAD_STALLED             12
+
+#define BASICD_NR_ERROR_CODES   13 // BASICD_NO_ERROR .. BASICD_THREAD_STALLED
+#define BASICD_NR_THREAD_CODES   7 // Negated THREAD_xxx return codes
+
+// Size of the counter arrays in BASICD_ERROR_STATS. Room for more
+// codes, so that adding a code does not change the layout.
+#define BASICD_MAX_ERROR_CODES  32
+#define BASICD_MAX_THREAD_CODES 16
 
 /*
  * Error source values
@@ -50,6 +66,15 @@ extern "C" {
 typedef enum {BASICD_INTERNAL_ERROR, 
 	      BASICD_LINUX_ERROR} BASICD_ERROR_SOURCE;
 
+#define BASICD_NR_ERROR_SOURCES  2
+
+/*
+ * Log levels, messages above current level are not written
+ */
+typedef enum {BASICD_LOG_ERROR,
+	      BASICD_LOG_INFO,
+	      BASICD_LOG_DEBUG} BASICD_LOG_LEVEL;
+
 /*
  * API types
  */
@@ -70,11 +95,100 @@ typedef struct {
   BASICD_STRING user;
   BASICD_STRING work_dir;
   BASICD_STRING lock_file;
+  BASICD_STRING ctrl_socket;
+  BASICD_STRING metrics_address;
+  BASICD_STRING server_address;
+  int           server_workers;
+  BASICD_STRING ring_socket;
+  int           processes;
+  bool          pin_processes;
   BASICD_STRING log_file;
   double        supervision_freq;
+  int           watchdog_periods;
+  bool          watchdog_restart;
+  bool          tracing;
+  BASICD_STRING trace_file;
+  bool          perf_counters;
+  int           profiler_freq;
+  BASICD_STRING profile_file;
+  bool          lock_profiling;
+  bool          adaptive_locks;
   double        worker_thread_freq;
 } BASICD_CONFIG;
 
+typedef struct {
+  // Nof reported errors, indexed by [error source][error code],
+  // zero above BASICD_NR_ERROR_CODES
+  unsigned long long error_cnt[BASICD_NR_ERROR_SOURCES][BASICD_MAX_ERROR_CODES];
+  // Nof thread operations, indexed by negated return code
+  // (THREAD_SUCCESS => 0, THREAD_WRONG_STATE => 1 and so on),
+  // zero above BASICD_NR_THREAD_CODES
+  unsigned long long thread_rc_cnt[BASICD_MAX_THREAD_CODES];
+} BASICD_ERROR_STATS;
+
+#define BASICD_NR_EXEC_TIME_BUCKETS  8
+
+/* Events of perf_sum and perf_max, in this order: CPU cycles,
+   instructions, last level cache misses, branch misses,
+   context switches and page faults */
+#define BASICD_NR_PERF_COUNTERS  6
+
+typedef struct {
+  char     name[20];
+  int      tid;       // Linux thread ID
+  unsigned state;     // Thread state (THREAD_STATE_xxx)
+  unsigned status;    // Thread status (bitmask of THREAD_STATUS_xxx)
+  unsigned exe_cnt;   // Nof completed cycles
+  double   frequency; // Current frequency (Hz)
+  // Timing of cycles, all times in nanoseconds
+  unsigned long long cycles;
+  unsigned long long overruns;          // Cycles that ended after next start
+  unsigned long long exec_time_sum;
+  unsigned long long exec_time_max;
+  unsigned long long wakeup_latency_max;
+  unsigned long long cpu_time;
+  unsigned long long heartbeat_age;     // Since last cycle started
+  unsigned long long stalls;            // Nof detected stalls
+  // Bucket i counts execution times up to 10^i us, last bucket the rest
+  unsigned long long exec_time_hist[BASICD_NR_EXEC_TIME_BUCKETS];
+  // Events during cyclic work, see basicd_set_perf_counters
+  unsigned           perf_available; // Bitmask, bit i => event i counted
+  unsigned long long perf_sum[BASICD_NR_PERF_COUNTERS]; // All cycles
+  unsigned long long perf_max[BASICD_NR_PERF_COUNTERS]; // Slowest cycle
+} BASICD_THREAD_STATS;
+
+typedef struct {
+  unsigned long long lines;      // Written messages
+  unsigned long long bytes;      // Written bytes
+  unsigned long long dropped;    // Messages lost, write failed
+  unsigned long long suppressed; // Messages above log level
+} BASICD_LOG_STATS;
+
+typedef struct {
+  unsigned           clients;     // Connected producers
+  unsigned long long connects;    // Accepted producers
+  unsigned long long records;     // Consumed records
+  unsigned long long bytes;       // Consumed record bytes
+  unsigned long long bad_records; // Bad length or never committed, dropped
+  unsigned long long doorbells;   // Wake ups by producers
+  unsigned long long spin_hits;   // Records found when busy-polling
+  unsigned long long spin_ns;     // Current busy-poll time
+} BASICD_RING_STATS;
+
+#define BASICD_MAX_STARTUP_PHASES  12
+
+typedef struct {
+  char               name[16];
+  unsigned long long duration;  // Nanoseconds
+} BASICD_STARTUP_PHASE;
+
+typedef struct {
+  unsigned             nr_phases;
+  bool                 done;    // Startup completed
+  unsigned long long   total;   // Nanoseconds, so far if not done
+  BASICD_STARTUP_PHASE phase[BASICD_MAX_STARTUP_PHASES];
+} BASICD_STARTUP_STATS;
+
 /****************************************************************************
 *
 * Name basicd_prod_info
@@ -120,6 +234,22 @@ extern long basicd_get_config(BASICD_CONFIG *config);
 ****************************************************************************/
 extern long basicd_get_last_error(BASICD_STATUS *status);
 
+/****************************************************************************
+*
+* Name basicd_get_error_stats
+*
+* Description Returns the number of times each error code and each thread
+*             operation return code has occurred since BASICD was loaded.
+*             Counters are never cleared.
+*
+* Parameters stats  IN/OUT  pointer to a buffer to hold the statistics
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE
+*
+****************************************************************************/
+extern long basicd_get_error_stats(BASICD_ERROR_STATS *stats);
+
 /****************************************************************************
 *
 * Name basicd_check_run_status
@@ -134,6 +264,294 @@ extern long basicd_get_last_error(BASICD_STATUS *status);
 ****************************************************************************/
 extern long basicd_check_run_status(void);
 
+/****************************************************************************
+*
+* Name basicd_check_heartbeat
+*
+* Description Checks that the worker thread has started a cycle within
+*             the last 'periods' + 1 cycle periods, i.e. has not missed
+*             more than 'periods' cycles. The stack of a stalled thread
+*             is written to the internal log. A stall is reported once,
+*             until the thread starts a cycle again.
+*
+* Parameters periods  IN  Nof cycles the thread may miss
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE or BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_check_heartbeat(unsigned periods);
+
+/****************************************************************************
+*
+* Name basicd_get_thread_stats
+*
+* Description Returns state, status and execution statistics of the
+*             cyclic worker thread.
+*
+* Parameters stats  IN/OUT  pointer to a buffer to hold the statistics
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE or BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_get_thread_stats(BASICD_THREAD_STATS *stats);
+
+/****************************************************************************
+*
+* Name basicd_get_log_stats
+*
+* Description Returns statistics of the BASICD internal log file since
+*             BASICD was loaded.
+*
+* Parameters stats  IN/OUT  pointer to a buffer to hold the statistics
+*
+* Error handling Returns always BASICD_SUCCESS.
+*
+****************************************************************************/
+extern long basicd_get_log_stats(BASICD_LOG_STATS *stats);
+
+/****************************************************************************
+*
+* Name basicd_get_log_level
+*
+* Description Returns the current level of the BASICD internal log file.
+*
+* Parameters level  IN/OUT  pointer to a buffer to hold the level
+*
+* Error handling Returns always BASICD_SUCCESS.
+*
+****************************************************************************/
+extern long basicd_get_log_level(BASICD_LOG_LEVEL *level);
+
+/****************************************************************************
+*
+* Name basicd_set_log_level
+*
+* Description Sets the level of the BASICD internal log file. Messages
+*             above this level are not written. Default is
+*             BASICD_LOG_DEBUG, every worker thread cycle is logged.
+*
+* Parameters level  IN  The new level
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE
+*
+****************************************************************************/
+extern long basicd_set_log_level(BASICD_LOG_LEVEL level);
+
+/****************************************************************************
+*
+* Name basicd_set_tracing
+*
+* Description Starts or stops recording of trace events: thread phases,
+*             worker thread cycles, sleeps and log writes. Recorded
+*             events are kept when stopped. Default is stopped.
+*
+* Parameters enabled  IN  Record events or not
+*
+* Error handling Returns always BASICD_SUCCESS.
+*
+****************************************************************************/
+extern long basicd_set_tracing(bool enabled);
+
+/****************************************************************************
+*
+* Name basicd_dump_trace
+*
+* Description Writes the latest recorded trace events of each thread to
+*             a file, as Chrome trace event JSON. The file can be opened
+*             in chrome://tracing or ui.perfetto.dev. May be called
+*             while recording.
+*
+* Parameters path  IN  File to write, suffixed by the process instance
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE
+*
+****************************************************************************/
+extern long basicd_dump_trace(const char *path);
+
+/****************************************************************************
+*
+* Name basicd_set_perf_counters
+*
+* Description Starts or stops counting of CPU cycles, instructions,
+*             cache misses, branch misses, context switches and page
+*             faults during each cycle of the worker thread. Events not
+*             supported by the host (e.g. hardware events in a virtual
+*             machine) are left out, see BASICD_THREAD_STATS. Applied at
+*             next cycle. Default is stopped.
+*
+* Parameters enabled  IN  Count events or not
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE or BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_set_perf_counters(bool enabled);
+
+/****************************************************************************
+*
+* Name basicd_start_profiler
+*
+* Description Starts sampling the stacks of the BASICD threads and of
+*             the daemon main thread. Each thread is sampled on its own
+*             CPU time, so idle threads are not sampled. Samples of a
+*             previous start are discarded. Does nothing if already
+*             started.
+*
+* Parameters frequency  IN  Samples per second of CPU time (1..1000)
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE
+*
+****************************************************************************/
+extern long basicd_start_profiler(double frequency);
+
+/****************************************************************************
+*
+* Name basicd_stop_profiler
+*
+* Description Stops sampling and writes the samples as folded stacks,
+*             one line per unique stack, as input to flamegraph.pl.
+*
+* Parameters path  IN  File to write, suffixed by the process instance
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE
+*
+****************************************************************************/
+extern long basicd_stop_profiler(const char *path);
+
+/****************************************************************************
+*
+* Name basicd_set_lock_profiling
+*
+* Description Starts or stops measuring the mutexes of the daemon:
+*             acquisitions, contended acquisitions, wait time and hold
+*             time per lock, as metrics "lock_xxx". Default is stopped.
+*
+* Parameters enabled  IN  Measure or not
+*
+* Error handling Returns always BASICD_SUCCESS.
+*
+****************************************************************************/
+extern long basicd_set_lock_profiling(bool enabled);
+
+/****************************************************************************
+*
+* Name basicd_set_adaptive_locks
+*
+* Description Makes a thread finding a mutex of the daemon locked spin
+*             for a while before it sleeps, or sleep at once. Spinning
+*             is shorter for a mutex that was seldom released in time.
+*             Default is to sleep at once.
+*
+* Parameters enabled  IN  Spin before sleeping or not
+*
+* Error handling Returns always BASICD_SUCCESS.
+*
+****************************************************************************/
+extern long basicd_set_adaptive_locks(bool enabled);
+
+/****************************************************************************
+*
+* Name basicd_get_lock_report
+*
+* Description Gets a text report of the mutexes of the daemon, measured
+*             while lock profiling was started. One line per lock, the
+*             lock with the most time waited for first, followed by a
+*             line naming it. Waiting for that lock grows first when
+*             threads are added.
+*
+* Parameters report  OUT  Null terminated text, truncated to fit
+*            size    IN   Size of report
+*
+* Error handling Returns always BASICD_SUCCESS.
+*
+****************************************************************************/
+extern long basicd_get_lock_report(char *report, unsigned size);
+
+/****************************************************************************
+*
+* Name basicd_get_ring_stats
+*
+* Description Returns statistics of the record rings since they were
+*             started, all zero if not started.
+*
+* Parameters stats  IN/OUT  pointer to a buffer to hold the statistics
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE or BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_get_ring_stats(BASICD_RING_STATS *stats);
+
+/****************************************************************************
+*
+* Name basicd_startup_phase
+*
+* Description Ends the current startup phase, if any, and begins a new
+*             one. Phases are timed with a monotonic clock. The phases
+*             of basicd_initialize are added by BASICD. Ignored when
+*             startup is done.
+*
+* Parameters name  IN  Name of the phase (max 15 characters)
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_startup_phase(const char *name);
+
+/****************************************************************************
+*
+* Name basicd_startup_done
+*
+* Description Ends the last startup phase, the startup profile is then
+*             kept as is. A restart of BASICD is not profiled.
+*
+* Parameters None
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_startup_done(void);
+
+/****************************************************************************
+*
+* Name basicd_get_startup_stats
+*
+* Description Returns the duration of each startup phase.
+*
+* Parameters stats  IN/OUT  pointer to a buffer to hold the statistics
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_get_startup_stats(BASICD_STARTUP_STATS *stats);
+
+/****************************************************************************
+*
+* Name basicd_set_instance
+*
+* Description Sets the instance of BASICD, when several processes are
+*             running. The internal log file and the statistics segment
+*             of an instance are suffixed by ".<instance>". Instance 0
+*             (default) is a single process, no suffix. Only allowed
+*             before basicd_initialize.
+*
+* Parameters instance  IN  Instance of this process, 0 if only one
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE or BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_set_instance(unsigned instance);
+
 /****************************************************************************
 *
 * Name basicd_initialize
@@ -150,6 +568,60 @@ extern long basicd_check_run_status(void);
 extern long basicd_initialize(const char *logfile,
 			      double worker_thread_frequency);
 
+/****************************************************************************
+*
+* Name basicd_start_server
+*
+* Description Starts the request serving front end of an initialized
+*             BASICD. Requests are length prefixed messages, read by one
+*             I/O thread and executed by a pool of worker threads.
+*             The server is stopped by basicd_finalize.
+*
+* Parameters address     IN  Unix socket path or TCP address (a.b.c.d:port)
+*            nr_workers  IN  Nof worker threads (1..32)
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE or BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_start_server(const char *address,
+				unsigned nr_workers);
+
+/****************************************************************************
+*
+* Name basicd_start_rings
+*
+* Description Starts serving shared memory record rings to local
+*             producers, see basicd_ring.h. Records are consumed in
+*             batches by the worker thread, from its next cycle.
+*             The rings are released by basicd_finalize.
+*
+* Parameters path  IN  Unix socket where producers connect
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE or BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_start_rings(const char *path);
+
+/****************************************************************************
+*
+* Name basicd_reconfigure
+*
+* Description Applies a new configuration to an initialized BASICD without
+*             stopping the worker thread. Items that can be changed in
+*             place are the log file (reopened between two writes) and the
+*             worker thread frequency (applied at next cycle boundary).
+*             All other items are ignored.
+*
+* Parameters config  IN  The new configuration
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE or BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_reconfigure(const BASICD_CONFIG *config);
+
 /****************************************************************************
 *
 * Name basicd_finalize
@@ -164,6 +636,42 @@ extern long basicd_initialize(const char *logfile,
 ****************************************************************************/
 extern long basicd_finalize(void);
 
+/****************************************************************************
+*
+* Name basicd_handoff_save
+*
+* Description Finalizes BASICD before a new image of the daemon takes
+*             over. The statistics segment is kept open, worker thread
+*             and error statistics are saved in the handoff file.
+*             Listening sockets are only kept while handing over is on,
+*             see listen_socket.h.
+*
+* Parameters handoff_fd  IN  Handoff file, see handoff.h
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE or BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_handoff_save(int handoff_fd);
+
+/****************************************************************************
+*
+* Name basicd_handoff_restore
+*
+* Description Restores the state saved by basicd_handoff_save, in a new
+*             image or in the old one if the new image failed to execute.
+*             Error statistics are restored at once. The statistics
+*             segment and worker thread statistics are taken over by the
+*             next basicd_initialize, counting continues without a gap.
+*
+* Parameters handoff_fd  IN  Handoff file, see handoff.h
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE or BASICD_MUTEX_FAILURE
+*
+****************************************************************************/
+extern long basicd_handoff_restore(int handoff_fd);
+
 #ifdef  __cplusplus
 }
 #endif
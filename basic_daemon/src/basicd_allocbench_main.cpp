@@ -0,0 +1,230 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "basicd.h"
+#include "excep.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define ALLOCBENCH_WARMUP  16 // Reports before counting, first ones prime
+
+/////////////////////////////////////////////////////////////////////////////
+//               Module global variables
+/////////////////////////////////////////////////////////////////////////////
+
+// Only allocations of the measuring thread are counted,
+// the worker thread of the initialized library runs meanwhile
+static __thread bool          t_counting = false;
+static __thread unsigned long t_allocations = 0;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Function prototypes
+/////////////////////////////////////////////////////////////////////////////
+
+extern "C" {
+  extern void *__libc_malloc(size_t size);
+  extern void *__libc_calloc(size_t nmemb, size_t size);
+  extern void *__libc_realloc(void *ptr, size_t size);
+  extern void __libc_free(void *ptr);
+}
+
+static void allocbench_usage(const char *prog);
+static uint64_t allocbench_now(void);
+static void allocbench_throw(void);
+static unsigned long allocbench_count_throws(unsigned nr);
+static unsigned long allocbench_count_reports(unsigned nr);
+
+////////////////////////////////////////////////////////////////
+
+// Interposed, all allocations of the program end up here
+// (operator new calls malloc)
+
+extern "C" void *malloc(size_t size) throw()
+{
+  if (t_counting) {
+    t_allocations++;
+  }
+  return __libc_malloc(size);
+}
+
+////////////////////////////////////////////////////////////////
+
+extern "C" void *calloc(size_t nmemb, size_t size) throw()
+{
+  if (t_counting) {
+    t_allocations++;
+  }
+  return __libc_calloc(nmemb, size);
+}
+
+////////////////////////////////////////////////////////////////
+
+extern "C" void *realloc(void *ptr, size_t size) throw()
+{
+  if (t_counting) {
+    t_allocations++;
+  }
+  return __libc_realloc(ptr, size);
+}
+
+////////////////////////////////////////////////////////////////
+
+extern "C" void free(void *ptr) throw()
+{
+  __libc_free(ptr);
+}
+
+////////////////////////////////////////////////////////////////
+
+static void allocbench_usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-n reports] [-l logfile]\n", prog);
+  fprintf(stderr, "Counts memory allocations while %s reports errors "
+	  "(set_error, update_error)\n"
+	  "and prints allocations and time per report.\n"
+	  "The thrown exception object itself is measured separately,\n"
+	  "it is allocated by the C++ runtime.\n"
+	  "Exit status is non-zero if reporting allocates.\n", BASICD_NAME);
+}
+
+////////////////////////////////////////////////////////////////
+
+static uint64_t allocbench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void allocbench_throw(void)
+{
+  // As the library, same information
+  THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_ALREADY_INITIALIZED,
+	    "Already initialized");
+}
+
+////////////////////////////////////////////////////////////////
+
+static unsigned long allocbench_count_throws(unsigned nr)
+{
+  t_allocations = 0;
+  t_counting = true;
+  for (unsigned i=0; i < nr; i++) {
+    try {
+      allocbench_throw();
+    }
+    catch (excep &exp) {
+    }
+  }
+  t_counting = false;
+
+  return t_allocations;
+}
+
+////////////////////////////////////////////////////////////////
+
+static unsigned long allocbench_count_reports(unsigned nr)
+{
+  t_allocations = 0;
+  t_counting = true;
+  for (unsigned i=0; i < nr; i++) {
+    // Fails since initialized, the error is reported
+    basicd_set_instance(0);
+  }
+  t_counting = false;
+
+  return t_allocations;
+}
+
+////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+  const char *logfile = "/tmp/" BASICD_NAME "_allocbench.log";
+  unsigned nr_reports = 100000;
+  int opt;
+
+  while ( (opt = getopt(argc, argv, "n:l:h")) != -1 ) {
+    switch (opt) {
+    case 'n':
+      nr_reports = atoi(optarg);
+      break;
+    case 'l':
+      logfile = optarg;
+      break;
+    default:
+      allocbench_usage(argv[0]);
+      return (opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  if (!nr_reports) {
+    allocbench_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // Initialized, so that errors are also published to monitors
+  if (basicd_initialize(logfile, 1.0) != BASICD_SUCCESS) {
+    fprintf(stderr, "basicd_initialize failed\n");
+    return EXIT_FAILURE;
+  }
+
+  BASICD_ERROR_STATS before;
+  basicd_get_error_stats(&before);
+
+  allocbench_count_throws(ALLOCBENCH_WARMUP);
+  allocbench_count_reports(ALLOCBENCH_WARMUP);
+
+  const unsigned long throw_allocations =
+    allocbench_count_throws(nr_reports);
+
+  const uint64_t start = allocbench_now();
+  const unsigned long report_allocations =
+    allocbench_count_reports(nr_reports);
+  const double elapsed = (allocbench_now() - start) / 1e9;
+
+  BASICD_ERROR_STATS after;
+  basicd_get_error_stats(&after);
+
+  const unsigned long long counted =
+    after.error_cnt[BASICD_INTERNAL_ERROR][BASICD_ALREADY_INITIALIZED] -
+    before.error_cnt[BASICD_INTERNAL_ERROR][BASICD_ALREADY_INITIALIZED];
+
+  basicd_finalize();
+
+  // Reporting allocates nothing beyond what throwing alone does
+  const unsigned long allocations =
+    (report_allocations > throw_allocations ?
+     report_allocations - throw_allocations : 0);
+
+  printf("reports     : %u (%llu counted)\n",
+	 nr_reports, counted - ALLOCBENCH_WARMUP);
+  printf("throw alone : %.3f allocations/throw\n",
+	 (double)throw_allocations / nr_reports);
+  printf("report      : %.3f allocations/report (throw included)\n",
+	 (double)report_allocations / nr_reports);
+  printf("reporting   : %lu allocations\n", allocations);
+  printf("time        : %.0f ns/report\n", elapsed * 1e9 / nr_reports);
+
+  return (allocations ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -9,110 +9,109 @@
 // *                                                                      *
 // ************************************************************************
 
+#include <string.h>
+
 #include "basicd_cfg_file.h"
-#include "basicd.h"
 
 /////////////////////////////////////////////////////////////////////////////
-//               Definition of macros
-/////////////////////////////////////////////////////////////////////////////
-
-// Valid item names
-#define DAEMONIZE          "daemonize"
-#define USER_NAME          "user_name"
-#define WORK_DIR           "work_dir"
-#define LOCK_FILE          "lock_file"
-#define LOG_FILE           "log_file"
-#define SUPERVISION_FREQ   "supervision_freq"
-#define WORKER_THREAD_FREQ "worker_thread_freq"
-
-// Default configuration values
-#define DEF_DAEMONIZE           true
-#define DEF_USER                "root"
-#define DEF_WORK_DIR            "/"
-#define DEF_LOCK_FILE           "/var/run/"BASICD_NAME".pid"
-#define DEF_LOG_FILE            "/var/log/"BASICD_NAME".log"
-#define DEF_SUPERVISION_FREQ    1.0 // Hz
-#define DEF_WORKER_THREAD_FREQ  0.2 // Hz
-
-/////////////////////////////////////////////////////////////////////////////
-//               Public member functions
+//               Private member functions
 /////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////
 
-basicd_cfg_file::basicd_cfg_file(string file_name) : cfg_file(file_name)
+static inline bool in_range(double value, double min, double max)
 {
-  // Define default values for all items that
-  // can be found in a config file
-  // Note!
-  // - Using anything but 'dec' on double will lead to error
-  // - Specifier on string is not used and has no effect.
-  set_default_item_value(DAEMONIZE, bool(DEF_DAEMONIZE), boolalpha);
-  set_default_item_value(USER_NAME, string(DEF_USER),      left);
-  set_default_item_value(WORK_DIR,  string(DEF_WORK_DIR),  left);
-  set_default_item_value(LOCK_FILE, string(DEF_LOCK_FILE), left);
-  set_default_item_value(LOG_FILE,  string(DEF_LOG_FILE),  left);
-  set_default_item_value(SUPERVISION_FREQ,   double(DEF_SUPERVISION_FREQ),   dec);
-  set_default_item_value(WORKER_THREAD_FREQ, double(DEF_WORKER_THREAD_FREQ), dec);
-
-  /*
-    Example on how to use hex/dec integers   
-  set_default_item_value("int_test_hex", int(0), hex);
-  set_default_item_value("int_test_dec", int(0), dec);
-  */
+  return (value >= min) && (value <= max);
 }
 
-////////////////////////////////////////////////////////////////
-
-basicd_cfg_file::~basicd_cfg_file(void)
+static inline bool in_range(int value, double min, double max)
 {
+  return (value >= min) && (value <= max);
 }
 
-////////////////////////////////////////////////////////////////
-
-long basicd_cfg_file::get_daemonize(bool &value)
+static inline bool in_range(bool, double, double)
 {
-  return get_item_value(DAEMONIZE, value);
+  return true;
 }
 
-////////////////////////////////////////////////////////////////
-
-long basicd_cfg_file::get_user_name(string &value)
+static inline bool in_range(const string &, double, double)
 {
-  return get_item_value(USER_NAME, value);
+  return true;
 }
 
 ////////////////////////////////////////////////////////////////
 
-long basicd_cfg_file::get_work_dir(string &value)
+static inline void copy_value(BASICD_STRING &dst, const string &src)
 {
-  return get_item_value(WORK_DIR, value);
+  strncpy(dst, src.c_str(), sizeof(BASICD_STRING));
+  dst[sizeof(BASICD_STRING) - 1] = '\0';
 }
 
-////////////////////////////////////////////////////////////////
-
-long basicd_cfg_file::get_lock_file(string &value)
+template <typename T>
+static inline void copy_value(T &dst, const T &src)
 {
-  return get_item_value(LOCK_FILE, value);
+  dst = src;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////////
 
-long basicd_cfg_file::get_log_file(string &value)
+basicd_cfg_file::basicd_cfg_file(string file_name) : cfg_file(file_name)
 {
-  return get_item_value(LOG_FILE, value);
+  // Define default values for all items that
+  // can be found in a config file.
+  // Items are stored in schema order, so BASICD_CFG_ITEM
+  // can be used as index.
+#define BASICD_CFG_DEFAULT(ID, name, field, type, def, fmt, min, max) \
+  set_default_item_value(#name, type(def), fmt);
+  BASICD_CFG_ITEMS(BASICD_CFG_DEFAULT)
+#undef BASICD_CFG_DEFAULT
+
+  /*
+    Example on how to use hex/dec integers   
+  set_default_item_value("int_test_hex", int(0), hex);
+  set_default_item_value("int_test_dec", int(0), dec);
+  */
 }
 
 ////////////////////////////////////////////////////////////////
 
-long basicd_cfg_file::get_supervision_freq(double &value)
+basicd_cfg_file::~basicd_cfg_file(void)
 {
-  return get_item_value(SUPERVISION_FREQ, value);
 }
 
 ////////////////////////////////////////////////////////////////
 
-long basicd_cfg_file::get_worker_thread_freq(double &value)
+long basicd_cfg_file::get_config(BASICD_CONFIG *config,
+				 const char **bad_item)
 {
-  return get_item_value(WORKER_THREAD_FREQ, value);
+  long rc;
+  BASICD_CONFIG new_config;
+
+  *bad_item = NULL;
+
+#define BASICD_CFG_POPULATE(ID, name, field, type, def, fmt, min, max) \
+  {									\
+    type value;								\
+    rc = get_item_value_at(BASICD_CFG_ITEM_##ID, value);		\
+    if (rc != CFG_FILE_SUCCESS) {					\
+      *bad_item = #name;						\
+      return rc;							\
+    }									\
+    if (!in_range(value, min, max)) {					\
+      *bad_item = #name;						\
+      return CFG_FILE_VALUE_OUT_OF_RANGE;				\
+    }									\
+    copy_value(new_config.field, value);				\
+  }
+  BASICD_CFG_ITEMS(BASICD_CFG_POPULATE)
+#undef BASICD_CFG_POPULATE
+
+  // Caller's config is only changed when all items are valid
+  *config = new_config;
+
+  return CFG_FILE_SUCCESS;
 }
@@ -13,9 +13,85 @@
 #define __BASICD_CFG_FILE_H__
 
 #include "cfg_file.h"
+#include "basicd.h"
 
 using namespace std;
 
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Configuration schema, all items that can be found in a config file.
+// Everything else (defaults, accessors, validation and population of
+// BASICD_CONFIG) is generated from this table at compile time.
+//
+// X(ID, item name, BASICD_CONFIG field, type, default, format, min, max)
+//
+// Note!
+// - Using anything but 'dec' on double will lead to error
+// - Specifier on string is not used and has no effect.
+// - Range (min, max) is only checked for numeric types.
+#define BASICD_CFG_ITEMS(X)						\
+  X(DAEMONIZE,          daemonize,          daemonize,          bool,   \
+    true,                            boolalpha, 0,     0)		\
+  X(USER_NAME,          user_name,          user,               string, \
+    "root",                          left,      0,     0)		\
+  X(WORK_DIR,           work_dir,           work_dir,           string, \
+    "/",                             left,      0,     0)		\
+  X(LOCK_FILE,          lock_file,          lock_file,          string, \
+    "/var/run/" BASICD_NAME ".pid",  left,      0,     0)		\
+  X(CTRL_SOCKET,        ctrl_socket,        ctrl_socket,        string, \
+    "/var/run/" BASICD_NAME ".ctrl", left,      0,     0)		\
+  X(METRICS_ADDRESS,    metrics_address,    metrics_address,    string, \
+    "none",                          left,      0,     0)		\
+  X(SERVER_ADDRESS,     server_address,     server_address,     string, \
+    "none",                          left,      0,     0)		\
+  X(SERVER_WORKERS,     server_workers,     server_workers,     int,    \
+    4,                               dec,       1,     32)		\
+  X(RING_SOCKET,        ring_socket,        ring_socket,        string, \
+    "none",                          left,      0,     0)		\
+  X(PROCESSES,          processes,          processes,          int,    \
+    1,                               dec,       1,     16)		\
+  X(PIN_PROCESSES,      pin_processes,      pin_processes,      bool,   \
+    true,                            boolalpha, 0,     0)		\
+  X(LOG_FILE,           log_file,           log_file,           string, \
+    "/var/log/" BASICD_NAME ".log",  left,      0,     0)		\
+  X(SUPERVISION_FREQ,   supervision_freq,   supervision_freq,   double, \
+    1.0,                             dec,       0.001, 1000.0)		\
+  X(WATCHDOG_PERIODS,   watchdog_periods,   watchdog_periods,   int,    \
+    3,                               dec,       0,     1000)		\
+  X(WATCHDOG_RESTART,   watchdog_restart,   watchdog_restart,   bool,   \
+    false,                           boolalpha, 0,     0)		\
+  X(TRACING,            tracing,            tracing,            bool,   \
+    false,                           boolalpha, 0,     0)		\
+  X(TRACE_FILE,         trace_file,         trace_file,         string, \
+    "/tmp/" BASICD_NAME ".trace.json", left,    0,     0)		\
+  X(PERF_COUNTERS,      perf_counters,      perf_counters,      bool,   \
+    false,                           boolalpha, 0,     0)		\
+  X(PROFILER_FREQ,      profiler_freq,      profiler_freq,      int,    \
+    99,                              dec,       1,     1000)		\
+  X(PROFILE_FILE,       profile_file,       profile_file,       string, \
+    "/tmp/" BASICD_NAME ".folded",   left,      0,     0)		\
+  X(LOCK_PROFILING,     lock_profiling,     lock_profiling,     bool,   \
+    false,                           boolalpha, 0,     0)		\
+  X(ADAPTIVE_LOCKS,     adaptive_locks,     adaptive_locks,     bool,   \
+    false,                           boolalpha, 0,     0)		\
+  X(WORKER_THREAD_FREQ, worker_thread_freq, worker_thread_freq, double, \
+    0.2,                             dec,       0.001, 1000.0)
+
+/////////////////////////////////////////////////////////////////////////////
+//               Class support types
+/////////////////////////////////////////////////////////////////////////////
+
+// Item index, equal to the position in the item storage
+#define BASICD_CFG_ITEM_ID(ID, name, field, type, def, fmt, min, max) \
+  BASICD_CFG_ITEM_##ID,
+typedef enum {
+  BASICD_CFG_ITEMS(BASICD_CFG_ITEM_ID)
+  BASICD_CFG_NR_ITEMS
+} BASICD_CFG_ITEM;
+#undef BASICD_CFG_ITEM_ID
+
 /////////////////////////////////////////////////////////////////////////////
 //               Definition of classes
 /////////////////////////////////////////////////////////////////////////////
@@ -26,13 +102,19 @@ class basicd_cfg_file : public cfg_file {
   basicd_cfg_file(string file_name);
   ~basicd_cfg_file(void);
 
-  long get_daemonize(bool &value);
-  long get_user_name(string &value);
-  long get_work_dir(string &value);
-  long get_lock_file(string &value);
-  long get_log_file(string &value);
-  long get_supervision_freq(double &value);
-  long get_worker_thread_freq(double &value);
+  // Typed accessors, e.g. get_daemonize(bool &value)
+#define BASICD_CFG_ACCESSOR(ID, name, field, type, def, fmt, min, max) \
+  long get_##name(type &value)						\
+  {									\
+    return get_item_value_at(BASICD_CFG_ITEM_##ID, value);		\
+  }
+  BASICD_CFG_ITEMS(BASICD_CFG_ACCESSOR)
+#undef BASICD_CFG_ACCESSOR
+
+  // Validates and copies all items to caller,
+  // name of any item out of range is returned in bad_item
+  long get_config(BASICD_CONFIG *config,
+		  const char **bad_item);
 };
 
 #endif // __BASICD_CFG_FILE_H__
@@ -15,8 +15,9 @@
 #include <errno.h>
 #include <error.h>
 #include <unistd.h>
-#include <sstream>
-#include <iomanip>
+#include <time.h>
+#include <execinfo.h>
+#include <stdlib.h>
 
 #include "basicd_core.h"
 #include "basicd_log.h"
@@ -24,6 +25,12 @@
 #include "daemon_utility.h"
 #include "timer.h"
 #include "delay.h"
+#include "handoff.h"
+#include "thread_stack.h"
+#include "metrics_registry.h"
+#include "trace.h"
+#include "sdt_probe.h"
+#include "profiler.h"
 
 /////////////////////////////////////////////////////////////////////////////
 //               Definition of macros
@@ -31,47 +38,121 @@
 #define PRODUCT_NUMBER   "BASICD"
 #define RSTATE           "R1A02"
 
-#ifndef BASICD_CFG_FILE
-#define CFG_FILE "/tmp/"BASICD_NAME".cfg"
-#endif
-
 #define WORKER_THREAD_NAME           "BASICD_WT"
 #define WORKER_THREAD_START_TIMEOUT    1.0 // Seconds
 #define WORKER_THREAD_EXECUTE_TIMEOUT  0.5 // Seconds
+#define WORKER_THREAD_STOP_TIMEOUT     1.0 // Seconds
+#define WORKER_THREAD_POLL_INTERVAL  0.001 // Seconds
+#define WORKER_THREAD_STACK_TIMEOUT    0.1 // Seconds
+
+#define ERROR_POOL_SIZE  16 // Nof error records waiting to be reported
+
+// Thread statistics are copied as is
+typedef char check_nr_buckets[(BASICD_NR_EXEC_TIME_BUCKETS ==
+			       BASICD_STAT_NR_BUCKETS) ? 1 : -1];
+
+typedef char check_nr_perf_counters[( (BASICD_NR_PERF_COUNTERS ==
+					 PERF_COUNTERS_NR) &&
+				       (BASICD_NR_PERF_COUNTERS ==
+					BASICD_STAT_NR_PERF_COUNTERS) ) ? 1 : -1];
+
+// Startup phases are copied as is
+typedef char check_nr_phases[(BASICD_MAX_STARTUP_PHASES ==
+			      PHASE_TIMER_MAX_PHASES) ? 1 : -1];
+
+// New codes fit in the published error statistics
+typedef char check_nr_codes[( (BASICD_NR_ERROR_CODES <=
+				BASICD_MAX_ERROR_CODES) &&
+			      (BASICD_NR_THREAD_CODES <=
+			       BASICD_MAX_THREAD_CODES) ) ? 1 : -1];
+
+// Layout of error statistics counters
+#define ERROR_CNT_INDEX(source, code) \
+  ((source) * BASICD_NR_ERROR_CODES + (code))
+#define THREAD_RC_CNT_INDEX(rc) \
+  (BASICD_NR_ERROR_SOURCES * BASICD_NR_ERROR_CODES - (rc))
+#define NR_ERROR_COUNTERS \
+  (BASICD_NR_ERROR_SOURCES * BASICD_NR_ERROR_CODES + BASICD_NR_THREAD_CODES)
 
 #define MUTEX_LOCK(mutex) \
-  ({ if (pthread_mutex_lock(&mutex)) { \
+  ({ if ((mutex).lock()) { \
       return BASICD_MUTEX_FAILURE; \
     } })
 
 #define MUTEX_UNLOCK(mutex) \
-  ({ if (pthread_mutex_unlock(&mutex)) { \
+  ({ if ((mutex).unlock()) { \
       return BASICD_MUTEX_FAILURE; \
     } })
 
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of types
+/////////////////////////////////////////////////////////////////////////////
+
+// Record in handoff file
+typedef struct {
+  int32_t             stat_fd; // -1 if not published
+  CYCLIC_THREAD_STATS worker_stats;
+  uint64_t            error_counters[NR_ERROR_COUNTERS];
+} CORE_HANDOFF;
+
 /////////////////////////////////////////////////////////////////////////////
 //               Public member functions
 /////////////////////////////////////////////////////////////////////////////
 
 /////////////////////////////////////////////////////////////////////////////
 
-basicd_core::basicd_core(void)
+basicd_core::basicd_core(void) : m_error_mutex("error"),
+				 m_error_pool(ERROR_POOL_SIZE),
+				 m_init_mutex("init")
 {
   m_error_source    = BASICD_INTERNAL_ERROR;
   m_error_code      = BASICD_NO_ERROR;
   m_last_error_read = true;
-  pthread_mutex_init(&m_error_mutex, NULL); // Use default mutex attributes
+
+  m_reported_dropped = 0;
+
+  // Error statistics, one counter per source and code
+  metrics_registry *metrics = metrics_registry::instance();
+  char labels[METRICS_REGISTRY_LABELS_LEN];
+  for (unsigned src=0; src < BASICD_NR_ERROR_SOURCES; src++) {
+    for (unsigned code=0; code < BASICD_NR_ERROR_CODES; code++) {
+      snprintf(labels, sizeof(labels),
+	       "source=\"%u\",code=\"%u\"", src, code);
+      m_error_cnt_ids[ERROR_CNT_INDEX(src, code)] =
+	metrics->add_counter("errors_total", labels, 1.0);
+    }
+  }
+  for (unsigned i=0; i < BASICD_NR_THREAD_CODES; i++) {
+    snprintf(labels, sizeof(labels), "rc=\"%ld\"", -(long)i);
+    m_error_cnt_ids[THREAD_RC_CNT_INDEX(-(long)i)] =
+      metrics->add_counter("thread_operations_total", labels, 1.0);
+  }
 
   m_initialized = false;
-  pthread_mutex_init(&m_init_mutex, NULL); // Use default mutex attributes
+
+  m_startup_done = false;
+
+  m_instance = 0;
+
+  m_worker_thread_stat = NULL;
+
+  memset(&m_worker_final_stats, 0, sizeof(m_worker_final_stats));
+  m_worker_stalled  = false;
+  m_worker_stall_id =
+    metrics->add_counter("thread_stalls_total",
+			 "thread=\"" WORKER_THREAD_NAME "\"", 1.0);
+
+  m_resume         = false;
+  m_resume_stat_fd = -1;
+  memset(&m_resume_worker_stats, 0, sizeof(m_resume_worker_stats));
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
 basicd_core::~basicd_core(void)
 {
-  pthread_mutex_destroy(&m_error_mutex);
-  pthread_mutex_destroy(&m_init_mutex);
+  // Don't lose any errors not yet reported
+  report_errors();
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -89,44 +170,648 @@ long basicd_core::get_prod_info(BASICD_PROD_INFO *prod_info)
 
 /////////////////////////////////////////////////////////////////////////////
 
-long basicd_core::get_config(BASICD_CONFIG *config)
+long basicd_core::get_config(BASICD_CONFIG *config)
+{
+  try {
+    // Do the actual work
+    return internal_get_config(config);
+  }
+  catch (excep &exp) {
+    return set_error(exp);
+  }
+  catch (...) {
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::get_last_error(BASICD_STATUS *status)
+{
+  try {
+    // Report any pending errors before they are cleared
+    report_errors();
+
+    MUTEX_LOCK(m_error_mutex);
+    status->error_source = m_error_source;
+    status->error_code   = m_error_code;
+    
+    // Clear internal error information
+    m_error_source    = BASICD_INTERNAL_ERROR;
+    m_error_code      = BASICD_NO_ERROR;
+    m_last_error_read = true;
+    MUTEX_UNLOCK(m_error_mutex);
+    return BASICD_SUCCESS;
+  }
+  catch (...) {
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::get_error_stats(BASICD_ERROR_STATS *stats)
+{
+  try {
+    uint64_t values[NR_ERROR_COUNTERS];
+
+    // Sum all threads' counters, no locking needed
+    snapshot_error_counters(values);
+
+    // Unused codes are zero
+    memset(stats, 0, sizeof(*stats));
+    for (unsigned src=0; src < BASICD_NR_ERROR_SOURCES; src++) {
+      for (unsigned code=0; code < BASICD_NR_ERROR_CODES; code++) {
+	stats->error_cnt[src][code] = values[ERROR_CNT_INDEX(src, code)];
+      }
+    }
+    for (unsigned i=0; i < BASICD_NR_THREAD_CODES; i++) {
+      stats->thread_rc_cnt[i] = values[THREAD_RC_CNT_INDEX(-(long)i)];
+    }
+
+    return BASICD_SUCCESS;
+  }
+  catch (...) {
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::check_run_status(void)
+{
+  try {
+    // Supervision is the place to report errors,
+    // never the path where the error is created
+    report_errors();
+
+    MUTEX_LOCK(m_init_mutex);
+
+    // Check if initialized
+    if (!m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_NOT_INITIALIZED,
+		"Not initialized");
+    }
+
+    // Do the actual work
+    internal_check_run_status();
+
+    // Check completed
+    MUTEX_UNLOCK(m_init_mutex);
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(exp);
+  }
+  catch (...) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::check_heartbeat(unsigned periods)
+{
+  try {
+    MUTEX_LOCK(m_init_mutex);
+
+    // Check if initialized
+    if (!m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_NOT_INITIALIZED,
+		"Not initialized");
+    }
+
+    // Do the actual work
+    internal_check_heartbeat(periods);
+
+    // Check completed
+    MUTEX_UNLOCK(m_init_mutex);
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(exp);
+  }
+  catch (...) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::get_thread_stats(BASICD_THREAD_STATS *stats)
+{
+  try {
+    MUTEX_LOCK(m_init_mutex);
+
+    // Check if initialized
+    if (!m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_NOT_INITIALIZED,
+		"Not initialized");
+    }
+
+    stats->tid       = m_worker_thread_auto->get_tid();
+    stats->state     = m_worker_thread_auto->get_state();
+    stats->status    = m_worker_thread_auto->get_status();
+    stats->exe_cnt   = m_worker_thread_auto->get_exe_cnt();
+    stats->frequency = m_worker_thread_auto->get_frequency();
+
+    CYCLIC_THREAD_HEARTBEAT heartbeat;
+    stats->heartbeat_age = worker_heartbeat_age(heartbeat);
+
+    // Timing as published by the thread itself
+    BASICD_STAT_THREAD record;
+    uint32_t seq;
+    do {
+      seq = seqlock_read_begin(&m_worker_thread_stat->seq);
+      memcpy(&record, m_worker_thread_stat, sizeof(record));
+    } while (seqlock_read_retry(&m_worker_thread_stat->seq, seq));
+
+    strncpy(stats->name, record.name, sizeof(stats->name));
+    stats->name[sizeof(stats->name) - 1] = '\0';
+    stats->cycles             = record.cycles;
+    stats->overruns           = record.overruns;
+    stats->exec_time_sum      = record.exec_time_sum_ns;
+    stats->exec_time_max      = record.exec_time_max_ns;
+    stats->wakeup_latency_max = record.wakeup_latency_max_ns;
+    stats->cpu_time           = record.cpu_time_ns;
+    stats->stalls             =
+      metrics_registry::instance()->read(m_worker_stall_id);
+    for (unsigned i=0; i < BASICD_NR_EXEC_TIME_BUCKETS; i++) {
+      stats->exec_time_hist[i] = record.exec_time_hist[i];
+    }
+    stats->perf_available     = record.perf_available;
+    for (unsigned i=0; i < BASICD_NR_PERF_COUNTERS; i++) {
+      stats->perf_sum[i] = record.perf_sum[i];
+      stats->perf_max[i] = record.perf_max[i];
+    }
+
+    MUTEX_UNLOCK(m_init_mutex);
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(exp);
+  }
+  catch (...) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::get_log_stats(BASICD_LOG_STATS *stats)
+{
+  basicd_log_get_stats(stats);
+
+  return BASICD_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::get_log_level(BASICD_LOG_LEVEL *level)
+{
+  *level = basicd_log_get_level();
+
+  return BASICD_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::set_log_level(BASICD_LOG_LEVEL level)
+{
+  try {
+    // Check input values
+    if ( (level < BASICD_LOG_ERROR) || (level > BASICD_LOG_DEBUG) ) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_BAD_ARGUMENT,
+		"Illegal log level (%d)", level);
+    }
+
+    basicd_log_set_level(level);
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    return set_error(exp);
+  }
+  catch (...) {
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::set_tracing(bool enabled)
+{
+  trace_set_enabled(enabled);
+
+  return BASICD_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::dump_trace(string path)
+{
+  try {
+    // Each process of a supervisor has its own trace
+    const string trace_file = instance_name(path);
+    if (trace_dump(trace_file.c_str()) != TRACE_SUCCESS) {
+      THROW_EXP(BASICD_LINUX_ERROR, BASICD_FILE_OPERATION_FAILED,
+		"Error writing trace (%s)", trace_file.c_str());
+    }
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    return set_error(exp);
+  }
+  catch (...) {
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::set_perf_counters(bool enabled)
+{
+  try {
+    MUTEX_LOCK(m_init_mutex);
+
+    // Check if initialized
+    if (!m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_NOT_INITIALIZED,
+		"Not initialized");
+    }
+
+    // Opened or closed by the thread itself, at next cycle
+    m_worker_thread_auto->set_perf_counters(enabled);
+
+    MUTEX_UNLOCK(m_init_mutex);
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(exp);
+  }
+  catch (...) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::start_profiler(double frequency)
+{
+  try {
+    // Check input values
+    if ( (frequency < 1.0) || (frequency > PROFILER_MAX_FREQUENCY) ) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_BAD_ARGUMENT,
+		"Illegal profiler frequency (%f)", frequency);
+    }
+
+    if (profiler_start(frequency) != PROFILER_SUCCESS) {
+      THROW_EXP(BASICD_LINUX_ERROR, BASICD_TIME_ERROR,
+		"Error starting profiler timers");
+    }
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    return set_error(exp);
+  }
+  catch (...) {
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::stop_profiler(string path)
+{
+  try {
+    profiler_stop();
+
+    // Each process of a supervisor has its own profile
+    const string profile_file = instance_name(path);
+    if (profiler_dump(profile_file.c_str()) != PROFILER_SUCCESS) {
+      THROW_EXP(BASICD_LINUX_ERROR, BASICD_FILE_OPERATION_FAILED,
+		"Error writing profile (%s)", profile_file.c_str());
+    }
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    return set_error(exp);
+  }
+  catch (...) {
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::set_lock_profiling(bool enabled)
+{
+  profiled_mutex::set_profiling(enabled);
+
+  return BASICD_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::set_adaptive_locks(bool enabled)
+{
+  profiled_mutex::set_adaptive(enabled);
+
+  return BASICD_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::get_lock_report(char *report, unsigned size)
+{
+  profiled_mutex::report(report, size);
+
+  return BASICD_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::get_ring_stats(BASICD_RING_STATS *stats)
+{
+  try {
+    MUTEX_LOCK(m_init_mutex);
+
+    // Check if initialized
+    if (!m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_NOT_INITIALIZED,
+		"Not initialized");
+    }
+
+    // All zero when not started
+    memset(stats, 0, sizeof(*stats));
+    if (m_rings_auto.get()) {
+      m_rings_auto->get_stats(stats);
+    }
+
+    MUTEX_UNLOCK(m_init_mutex);
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(exp);
+  }
+  catch (...) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::startup_phase(string name)
+{
+  MUTEX_LOCK(m_init_mutex);
+  profile_startup(name.c_str());
+  MUTEX_UNLOCK(m_init_mutex);
+
+  return BASICD_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::startup_done(void)
+{
+  MUTEX_LOCK(m_init_mutex);
+  m_startup.end();
+  m_startup_done = true;
+  MUTEX_UNLOCK(m_init_mutex);
+
+  return BASICD_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::get_startup_stats(BASICD_STARTUP_STATS *stats)
+{
+  MUTEX_LOCK(m_init_mutex);
+
+  memset(stats, 0, sizeof(*stats));
+  stats->nr_phases = m_startup.get_nr_phases();
+  stats->done      = m_startup_done;
+  stats->total     = m_startup.get_total();
+  for (unsigned i=0; i < stats->nr_phases; i++) {
+    strncpy(stats->phase[i].name, m_startup.get_name(i),
+	    sizeof(stats->phase[i].name) - 1);
+    stats->phase[i].duration = m_startup.get_duration(i);
+  }
+
+  MUTEX_UNLOCK(m_init_mutex);
+
+  return BASICD_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::set_instance(unsigned instance)
+{
+  try {
+    MUTEX_LOCK(m_init_mutex);
+
+    // Names are given when initialized
+    if (m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_ALREADY_INITIALIZED,
+		"Already initialized");
+    }
+
+    m_instance = instance;
+    MUTEX_UNLOCK(m_init_mutex);
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(exp);
+  }
+  catch (...) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::initialize(string logfile,
+			     double worker_thread_frequency)
+{
+  try {
+    MUTEX_LOCK(m_init_mutex);
+
+    // Check if already initialized
+    if (m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_ALREADY_INITIALIZED,
+		"Already initialized");
+    }
+
+    // Check input values
+    if (worker_thread_frequency < 0.0) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_BAD_ARGUMENT,
+		"Illegal worker thread frequency (%f)",
+		worker_thread_frequency);
+    }
+
+    // Do the actual initialization
+    internal_initialize(logfile,
+			worker_thread_frequency);
+
+    // Initialization completed
+    m_initialized = true;
+    MUTEX_UNLOCK(m_init_mutex);
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(exp);
+  }
+  catch (...) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::start_server(string address,
+			       unsigned nr_workers)
+{
+  try {
+    MUTEX_LOCK(m_init_mutex);
+
+    // Check if initialized
+    if (!m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_NOT_INITIALIZED,
+		"Not initialized");
+    }
+
+    // Check if already started
+    if (m_server_auto.get()) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_ALREADY_INITIALIZED,
+		"Request server already started");
+    }
+
+    // Check input values
+    if ( (nr_workers == 0) || (nr_workers > REQUEST_SERVER_MAX_WORKERS) ) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_BAD_ARGUMENT,
+		"Illegal nof request server workers (%u)", nr_workers);
+    }
+
+    // Do the actual start
+    internal_start_server(address, nr_workers);
+
+    // Start completed
+    MUTEX_UNLOCK(m_init_mutex);
+
+    return BASICD_SUCCESS;
+  }
+  catch (excep &exp) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(exp);
+  }
+  catch (...) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::start_rings(string path)
 {
   try {
-    // Do the actual work
-    return internal_get_config(config);
+    MUTEX_LOCK(m_init_mutex);
+
+    // Check if initialized
+    if (!m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_NOT_INITIALIZED,
+		"Not initialized");
+    }
+
+    // Check if already started
+    if (m_rings_auto.get()) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_ALREADY_INITIALIZED,
+		"Rings already started");
+    }
+
+    // Do the actual start
+    internal_start_rings(path);
+
+    // Start completed
+    MUTEX_UNLOCK(m_init_mutex);
+
+    return BASICD_SUCCESS;
   }
   catch (excep &exp) {
+    MUTEX_UNLOCK(m_init_mutex);
     return set_error(exp);
   }
   catch (...) {
+    MUTEX_UNLOCK(m_init_mutex);
     return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
   }
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
-long basicd_core::get_last_error(BASICD_STATUS *status)
+long basicd_core::reconfigure(const BASICD_CONFIG *config)
 {
   try {
-    MUTEX_LOCK(m_error_mutex);
-    status->error_source = m_error_source;
-    status->error_code   = m_error_code;
-    
-    // Clear internal error information
-    m_error_source    = BASICD_INTERNAL_ERROR;
-    m_error_code      = BASICD_NO_ERROR;
-    m_last_error_read = true;
-    MUTEX_UNLOCK(m_error_mutex);
+    MUTEX_LOCK(m_init_mutex);
+
+    // Check if initialized
+    if (!m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_NOT_INITIALIZED,
+		"Not initialized");
+    }
+
+    // Check input values
+    if (config->worker_thread_freq < 0.0) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_BAD_ARGUMENT,
+		"Illegal worker thread frequency (%f)",
+		config->worker_thread_freq);
+    }
+
+    // Do the actual reconfiguration
+    internal_reconfigure(config);
+
+    // Reconfiguration completed
+    MUTEX_UNLOCK(m_init_mutex);
+
     return BASICD_SUCCESS;
   }
+  catch (excep &exp) {
+    MUTEX_UNLOCK(m_init_mutex);
+    return set_error(exp);
+  }
   catch (...) {
+    MUTEX_UNLOCK(m_init_mutex);
     return set_error(EXP(BASICD_INTERNAL_ERROR, BASICD_UNEXPECTED_EXCEPTION, NULL));
   }
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
-long basicd_core::check_run_status(void)
+long basicd_core::finalize(void)
 {
   try {
     MUTEX_LOCK(m_init_mutex);
@@ -137,10 +822,11 @@ long basicd_core::check_run_status(void)
 		"Not initialized");
     }
 
-    // Do the actual work
-    internal_check_run_status();
+    // Do the actual finalization
+    internal_finalize();
 
-    // Check completed
+    // Finalization completed
+    m_initialized = false;
     MUTEX_UNLOCK(m_init_mutex);
 
     return BASICD_SUCCESS;
@@ -157,31 +843,25 @@ long basicd_core::check_run_status(void)
 
 /////////////////////////////////////////////////////////////////////////////
 
-long basicd_core::initialize(string logfile,
-			     double worker_thread_frequency)
+long basicd_core::handoff_save(int handoff_fd)
 {
   try {
-    MUTEX_LOCK(m_init_mutex);
+    // Pending errors are reported by this image
+    report_errors();
 
-    // Check if already initialized
-    if (m_initialized) {
-      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_ALREADY_INITIALIZED,
-		"Already initialized");
-    }
+    MUTEX_LOCK(m_init_mutex);
 
-    // Check input values
-    if (worker_thread_frequency < 0.0) {
-      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_BAD_ARGUMENT,
-		"Illegal worker thread frequency (%f)",
-		worker_thread_frequency);
+    // Check if initialized
+    if (!m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_NOT_INITIALIZED,
+		"Not initialized");
     }
 
-    // Do the actual initialization
-    internal_initialize(logfile,
-			worker_thread_frequency);
+    // Do the actual save, finalized also on failure
+    m_initialized = false;
+    internal_handoff_save(handoff_fd);
 
-    // Initialization completed
-    m_initialized = true;
+    // Save completed
     MUTEX_UNLOCK(m_init_mutex);
 
     return BASICD_SUCCESS;
@@ -198,22 +878,21 @@ long basicd_core::initialize(string logfile,
 
 /////////////////////////////////////////////////////////////////////////////
 
-long basicd_core::finalize(void)
+long basicd_core::handoff_restore(int handoff_fd)
 {
   try {
     MUTEX_LOCK(m_init_mutex);
 
-    // Check if initialized
-    if (!m_initialized) {
-      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_NOT_INITIALIZED,
-		"Not initialized");
+    // Check if already initialized
+    if (m_initialized) {
+      THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_ALREADY_INITIALIZED,
+		"Already initialized");
     }
 
-    // Do the actual finalization
-    internal_finalize();
+    // Do the actual restore
+    internal_handoff_restore(handoff_fd);
 
-    // Finalization completed
-    m_initialized = false;
+    // Restore completed
     MUTEX_UNLOCK(m_init_mutex);
 
     return BASICD_SUCCESS;
@@ -234,70 +913,55 @@ long basicd_core::finalize(void)
 
 /////////////////////////////////////////////////////////////////////////////
 
-long basicd_core::set_error(excep exp)
+long basicd_core::set_error(const excep &exp)
 {
-  // Get the stack trace
-  STACK_FRAMES frames;
-  exp.get_stack_frames(frames);
+  // Note!!
+  // This function must not allocate any memory.
+  // The error record is copied to the preallocated pool and
+  // the expensive formatting is done later by 'report_errors'.
+  ERROR_RECORD record;
+  exp.get_record(record);
 
-  ostringstream oss_msg;
-  char buffer[18];
+  BASICD_PROBE4(error, record.source, record.code, record.linux_errno,
+		record.info);
 
-  // Note!!
-  // To avoid problems with syslog multiline-messages (embedded '\n')
-  // we use '\\n' as a newline separator.
-  // This message can be decoded as a multiline message by examine
-  // the error log using sed-command:
-  // tail -f /var/log/errors.log | sed 's/\\n/\n/g'
-
-  oss_msg << "\\n";
-  oss_msg << "\tstack frames:" << (int) frames.active_frames << "\\n";
-
-  for (unsigned i=0; i < frames.active_frames; i++) {
-    sprintf(buffer, "0x%016lx", frames.frames[i]);
-    oss_msg << "\tframe:" << dec << setw(2) << setfill('0') << i
-	    << "  addr:" << buffer << "\\n";
-  }
-
-  // Get info from predefined macros
-  oss_msg << "\tViolator: " << exp.get_file() 
-	  << ":" << exp.get_line()
-	  << ", " << exp.get_function() << "\\n";
-
-  // Get the internal info
-  oss_msg << "\tSource: " << exp.get_source()
-	  << ", Code: " << exp.get_code() << "\\n";
-
-  oss_msg << "\tInfo: " << exp.get_info() << "\\n";
-
-  // Source of error (last multi-line, terminate with '\n')
-  switch (exp.get_source()) {
-  case BASICD_INTERNAL_ERROR:
-    oss_msg << "\tBASICD INTERNAL ERROR\n";
-    break;
-  case BASICD_LINUX_ERROR:
-    oss_msg << "\tBASICD LINUX ERROR - errno:" 
-	    << errno << " => " << strerror(errno) << "\n";
-    break;
-  }
-  
-  // Print all info
-  syslog_error(oss_msg.str().c_str());
+  m_error_pool.put(record); // Counted as dropped if pool is full
 
   // Update internal error information
-  return update_error(exp);
+  return update_error(record);
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
-long basicd_core::update_error(excep exp)
+long basicd_core::update_error(const ERROR_RECORD &record)
 {
+  // Keep statistics for all errors, not only the latched one
+  if ( (record.source >= 0) && (record.source < BASICD_NR_ERROR_SOURCES) &&
+       (record.code >= 0) && (record.code < BASICD_NR_ERROR_CODES) ) {
+    metrics_registry::instance()->
+      inc(m_error_cnt_ids[ERROR_CNT_INDEX(record.source, record.code)]);
+  }
+
   MUTEX_LOCK(m_error_mutex);
   if (m_last_error_read) {
-    m_error_source    = (BASICD_ERROR_SOURCE)exp.get_source();
-    m_error_code      = exp.get_code();
+    m_error_source    = (BASICD_ERROR_SOURCE)record.source;
+    m_error_code      = record.code;
     m_last_error_read = false; // Latch last error until read
   }
+
+  // Publish to monitors, the mutex makes this the only writer
+  BASICD_STAT_ERROR *last_error = m_stat.get_last_error();
+  if (last_error) {
+    seqlock_write_begin(&last_error->seq);
+    last_error->error_source = record.source;
+    last_error->error_code   = record.code;
+    last_error->linux_errno  = record.linux_errno;
+    last_error->nr_errors++;
+    last_error->time         = time(NULL);
+    snprintf(last_error->info, sizeof(last_error->info), "%.*s",
+	     (int)(sizeof(last_error->info) - 1), record.info);
+    seqlock_write_end(&last_error->seq);
+  }
   MUTEX_UNLOCK(m_error_mutex);
 
   return BASICD_FAILURE;
@@ -305,6 +969,158 @@ long basicd_core::update_error(excep exp)
 
 /////////////////////////////////////////////////////////////////////////////
 
+void basicd_core::report_errors(void)
+{
+  ERROR_RECORD record;
+  char msg[SYSLOG_MAX_MESSAGE_LENGTH];
+  char function[128];
+  unsigned len;
+
+  while (m_error_pool.get(record)) {
+
+    // Note!!
+    // To avoid problems with syslog multiline-messages (embedded '\n')
+    // we use '\\n' as a newline separator.
+    // This message can be decoded as a multiline message by examine
+    // the error log using sed-command:
+    // tail -f /var/log/errors.log | sed 's/\\n/\n/g'
+
+    len = snprintf(msg, sizeof(msg), "\\n\tstack frames:%d\\n",
+		   (int) record.stack.active_frames);
+
+    for (unsigned i=0; i < record.stack.active_frames; i++) {
+      if (len < sizeof(msg)) {
+	len += snprintf(msg + len, sizeof(msg) - len,
+			"\tframe:%02u  addr:0x%016lx\\n",
+			i, (unsigned long) record.stack.frames[i]);
+      }
+    }
+
+    // Get info from predefined macros
+    get_class_method(record.pretty_function, function, sizeof(function));
+    if (len < sizeof(msg)) {
+      len += snprintf(msg + len, sizeof(msg) - len,
+		      "\tViolator: %s:%d, %s\\n",
+		      record.file, record.line, function);
+    }
+
+    // Get the internal info
+    if (len < sizeof(msg)) {
+      len += snprintf(msg + len, sizeof(msg) - len,
+		      "\tSource: %ld, Code: %ld\\n\tInfo: %s\\n",
+		      record.source, record.code, record.info);
+    }
+
+    // Source of error (last multi-line, terminate with '\n')
+    if (len < sizeof(msg)) {
+      switch (record.source) {
+      case BASICD_INTERNAL_ERROR:
+	snprintf(msg + len, sizeof(msg) - len,
+		 "\tBASICD INTERNAL ERROR\n");
+	break;
+      case BASICD_LINUX_ERROR:
+	snprintf(msg + len, sizeof(msg) - len,
+		 "\tBASICD LINUX ERROR - errno:%d => %s\n",
+		 record.linux_errno, strerror(record.linux_errno));
+	break;
+      }
+    }
+
+    // Print all info
+    syslog_error("%s", msg);
+  }
+
+  // Report if the pool has been full. Reported by several threads,
+  // each one claims what it reports so no count is reported twice.
+  const unsigned dropped = m_error_pool.get_dropped();
+  unsigned reported = __atomic_load_n(&m_reported_dropped, __ATOMIC_RELAXED);
+  while ((int)(dropped - reported) > 0) {
+    if (__atomic_compare_exchange_n(&m_reported_dropped, &reported, dropped,
+				    0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      syslog_error("Error pool full, %u error(s) not reported",
+		   dropped - reported);
+      break;
+    }
+    // Lost the race, reported now holds what the other thread claimed
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+long basicd_core::count_thread_rc(long rc)
+{
+  if ( (rc <= 0) && (rc > -BASICD_NR_THREAD_CODES) ) {
+    metrics_registry::instance()->inc(m_error_cnt_ids[THREAD_RC_CNT_INDEX(rc)]);
+  }
+  return rc;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void basicd_core::snapshot_error_counters(uint64_t *values)
+{
+  metrics_registry *metrics = metrics_registry::instance();
+
+  for (unsigned i=0; i < NR_ERROR_COUNTERS; i++) {
+    values[i] = metrics->read(m_error_cnt_ids[i]);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void basicd_core::profile_startup(const char *phase)
+{
+  // Only the first start is profiled, not a restart
+  if (!m_startup_done) {
+    m_startup.begin(phase);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+string basicd_core::instance_name(string name)
+{
+  // One of several processes, each with its own resources
+  if (m_instance) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%u", m_instance);
+    name += suffix;
+  }
+  return name;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+uint64_t basicd_core::worker_heartbeat_age(CYCLIC_THREAD_HEARTBEAT &heartbeat)
+{
+  struct timespec now;
+
+  // Nanoseconds since the last cycle started, zero before the first
+  m_worker_thread_auto->get_heartbeat(heartbeat);
+  if ( (!heartbeat.time) || clock_gettime(get_clock_id(), &now) ) {
+    return 0;
+  }
+  const uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+  return (now_ns > heartbeat.time ? now_ns - heartbeat.time : 0);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+uint32_t basicd_core::execute_request(const uint8_t *request,
+				      uint32_t request_len,
+				      uint8_t *response,
+				      void *arg)
+{
+  // Executed by request server workers, any number at a time.
+  // No requests are defined yet, the request is echoed.
+  memcpy(response, request, request_len);
+
+  return request_len;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
 long basicd_core::internal_get_prod_info(BASICD_PROD_INFO *prod_info)
 {
   long rc = BASICD_SUCCESS;
@@ -325,93 +1141,43 @@ long basicd_core::internal_get_prod_info(BASICD_PROD_INFO *prod_info)
 long basicd_core::internal_get_config(BASICD_CONFIG *config)
 {
   long rc;
-  basicd_cfg_file *cfg_f = new basicd_cfg_file(CFG_FILE);
+  basicd_cfg_file cfg_f(BASICD_CFG_FILE);
 
   // Parse configuration file
-  rc = cfg_f->parse();
+  rc = cfg_f.parse();
   if ( (rc != CFG_FILE_SUCCESS) &&         // Use values from file
        (rc != CFG_FILE_FILE_NOT_FOUND) ) { // Use default values
-    delete cfg_f;
     switch(rc) {
     case CFG_FILE_FILE_IO_ERROR:
       THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_FILE_OPERATION_FAILED,
 		"I/O error parsing config file %s",
-		CFG_FILE);
+		BASICD_CFG_FILE);
       break;
     case CFG_FILE_BAD_FILE_FORMAT:
     case CFG_FILE_BAD_VALUE_FORMAT:
       THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_CFG_FILE_BAD_FORMAT,
 		"Bad format parsing config file %s",
-		CFG_FILE);
+		BASICD_CFG_FILE);
       break;
     default:
       THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_CFG_FILE_UNEXCPECTED_ERROR,
 		"Unexpected error(%ld) parsing config file %s",
-		rc, CFG_FILE);
+		rc, BASICD_CFG_FILE);
     }
   }
 
-  // Get configuration values
-  bool daemonize;
-  rc = cfg_f->get_daemonize(daemonize);
-  if (rc != CFG_FILE_SUCCESS) {
-    delete cfg_f;
-    THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_CFG_FILE_UNEXCPECTED_ERROR,
-	      "Unexpected error(%ld) get_daemonize", rc);
-  }
-  string user;
-  rc = cfg_f->get_user_name(user);
-  if (rc != CFG_FILE_SUCCESS) {
-    delete cfg_f;
-    THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_CFG_FILE_UNEXCPECTED_ERROR,
-	      "Unexpected error(%ld) get_user_name", rc);
-  }
-  string work_dir;
-  rc = cfg_f->get_work_dir(work_dir);
-  if (rc != CFG_FILE_SUCCESS) {
-    delete cfg_f;
-    THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_CFG_FILE_UNEXCPECTED_ERROR,
-	      "Unexpected error(%ld) get_work_dir", rc);
-  }
-  string lock_file;
-  rc = cfg_f->get_lock_file(lock_file);
-  if (rc != CFG_FILE_SUCCESS) {
-    delete cfg_f;
-    THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_CFG_FILE_UNEXCPECTED_ERROR,
-	      "Unexpected error(%ld) get_lock_file", rc);
-  }
-  string log_file;
-  rc = cfg_f->get_log_file(log_file);
-  if (rc != CFG_FILE_SUCCESS) {
-    delete cfg_f;
-    THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_CFG_FILE_UNEXCPECTED_ERROR,
-	      "Unexpected error(%ld) get_log_file", rc);
-  }
-  double s_freq;
-  rc = cfg_f->get_supervision_freq(s_freq);
-  if (rc != CFG_FILE_SUCCESS) {
-    delete cfg_f;
-    THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_CFG_FILE_UNEXCPECTED_ERROR,
-	      "Unexpected error(%ld) get_supervison_freq", rc);
+  // Validate and copy configuration values to caller
+  const char *bad_item;
+  rc = cfg_f.get_config(config, &bad_item);
+  if (rc == CFG_FILE_VALUE_OUT_OF_RANGE) {
+    THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_CFG_FILE_BAD_FORMAT,
+	      "Value out of range, item %s in config file %s",
+	      bad_item, BASICD_CFG_FILE);
   }
-  double wt_freq;
-  rc = cfg_f->get_worker_thread_freq(wt_freq);
   if (rc != CFG_FILE_SUCCESS) {
-    delete cfg_f;
     THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_CFG_FILE_UNEXCPECTED_ERROR,
-	      "Unexpected error(%ld) get_worker_thread_freq", rc);
+	      "Unexpected error(%ld) get item %s", rc, bad_item);
   }
-  
-  // Copy configuration values to caller
-  config->daemonize = daemonize;
-  strncpy(config->user,      user.c_str(),      sizeof(BASICD_STRING));
-  strncpy(config->work_dir,  work_dir.c_str(),  sizeof(BASICD_STRING));
-  strncpy(config->lock_file, lock_file.c_str(), sizeof(BASICD_STRING));
-  strncpy(config->log_file,  log_file.c_str(),  sizeof(BASICD_STRING));
-  config->supervision_freq   = s_freq;
-  config->worker_thread_freq = wt_freq;
-  
-  delete cfg_f;
 
   return BASICD_SUCCESS;
 }
@@ -439,27 +1205,119 @@ void basicd_core::internal_check_run_status(void)
 
 /////////////////////////////////////////////////////////////////////////////
 
+void basicd_core::internal_check_heartbeat(unsigned periods)
+{
+  CYCLIC_THREAD_HEARTBEAT heartbeat;
+
+  // Only an executing thread is expected to beat,
+  // the state itself is checked by internal_check_run_status
+  const uint64_t age = worker_heartbeat_age(heartbeat);
+  if ( (!periods) || (!heartbeat.time) ||
+       (m_worker_thread_auto->get_state() != THREAD_STATE_EXECUTING) ) {
+    return;
+  }
+
+  const double period = 1.0 / m_worker_thread_auto->get_frequency();
+  if ( (age / 1e9) <= ((periods + 1) * period) ) {
+    m_worker_stalled = false;
+    return;
+  }
+  if (m_worker_stalled) {
+    return; // Already reported
+  }
+  m_worker_stalled = true;
+  metrics_registry::instance()->inc(m_worker_stall_id);
+
+  // Where the thread is stuck
+  basicd_log_writeln(string("++++++++ Stalled thread ") +
+		     m_worker_thread_auto->get_name() + ", stack:");
+  void *frames[THREAD_STACK_MAX_FRAMES];
+  const int nr_frames = thread_stack_capture(m_worker_thread_auto->get_tid(),
+					     frames,
+					     THREAD_STACK_MAX_FRAMES,
+					     WORKER_THREAD_STACK_TIMEOUT);
+  if (nr_frames < 0) {
+    basicd_log_writeln(string("\tnot captured, ") + strerror(errno));
+  }
+  else {
+    char **symbols = backtrace_symbols(frames, nr_frames);
+    for (int i=0; symbols && (i < nr_frames); i++) {
+      basicd_log_writeln(string("\t") + symbols[i]);
+    }
+    free(symbols);
+  }
+
+  THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_THREAD_STALLED,
+	    "Cyclic worker thread stalled, no cycle for %.3f s, cycles:%llu",
+	    age / 1e9, (unsigned long long) heartbeat.cycles);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
 void basicd_core::internal_initialize(string logfile,
 				      double worker_thread_frequency)
 {
   // Initialize the logfile singleton object
-  basicd_log_initialize(logfile);
+  profile_startup("log_open");
+  basicd_log_initialize(instance_name(logfile));
+  m_logfile = logfile;
+
+  // Publish statistics segment, kept over a restart.
+  // Taken over from a previous image if possible.
+  if (!m_stat.is_open()) {
+    profile_startup("stat_segment");
+    const string shm_name = instance_name(BASICD_STAT_SHM_NAME);
+    if ( ( (m_resume_stat_fd == -1) ||
+	   (m_stat.inherit(shm_name,
+			   m_resume_stat_fd) != BASICD_STAT_SEGMENT_SUCCESS) ) &&
+	 (m_stat.open(shm_name) != BASICD_STAT_SEGMENT_SUCCESS) ) {
+      THROW_EXP(BASICD_LINUX_ERROR, BASICD_FILE_OPERATION_FAILED,
+		"shm_open failed, statistics segment (%s)",
+		shm_name.c_str());
+    }
+    m_worker_thread_stat = m_stat.add_thread(0, WORKER_THREAD_NAME);
+  }
+
+  // Publish first configuration snapshot, only the
+  // items given here are known until reconfigured
+  BASICD_CONFIG *config = new BASICD_CONFIG;
+  memset(config, 0, sizeof(*config));
+  strncpy(config->log_file, logfile.c_str(), sizeof(BASICD_STRING) - 1);
+  config->worker_thread_freq = worker_thread_frequency;
+  m_config_snapshot.publish(config);
 
   // Create the cyclic worker thread object with garbage collector
   basicd_cyclic_thread *thread_ptr = 
     new basicd_cyclic_thread(WORKER_THREAD_NAME,
-			     worker_thread_frequency);
+			     worker_thread_frequency,
+			     &m_config_snapshot,
+			     m_worker_thread_stat);
 
   m_worker_thread_auto = auto_ptr<basicd_cyclic_thread>(thread_ptr);
+  m_worker_stalled     = false;
+
+  // Stack of a stalled thread is captured by a signal
+  if (thread_stack_init() != THREAD_STACK_SUCCESS) {
+    THROW_EXP(BASICD_LINUX_ERROR, BASICD_THREAD_OPERATION_FAILED,
+	      "sigaction failed, thread stack capture");
+  }
+
+  // Counting continues where the previous image stopped
+  if (m_resume) {
+    m_worker_thread_auto->resume_stats(m_resume_worker_stats);
+    m_resume         = false;
+    m_resume_stat_fd = -1;
+  }
 
   ////////////////////////////////////////////
   // Initialize cyclic worker thread object
   ////////////////////////////////////////////
 
   basicd_log_writeln("++++++++ About to start cyclic worker thread");
+  profile_startup("thread_setup");
 
   // Step 1: Start thread
-  if ( m_worker_thread_auto->start(NULL) != THREAD_SUCCESS ) {
+  if ( count_thread_rc(m_worker_thread_auto->start(NULL)) != THREAD_SUCCESS ) {
     THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_THREAD_OPERATION_FAILED,
 	      "Error start cyclic worker thread");
   }
@@ -477,7 +1335,7 @@ void basicd_core::internal_initialize(string logfile,
       thread_timeout = false;
       break;
     }
-    if ( delay(0.1) != DELAY_SUCCESS ) {
+    if ( delay(WORKER_THREAD_POLL_INTERVAL) != DELAY_SUCCESS ) {
       THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_TIME_ERROR,
 	      "Delay operation failed");
     }
@@ -494,7 +1352,8 @@ void basicd_core::internal_initialize(string logfile,
   }
 
   // Step 3: Release thread
-  if ( m_worker_thread_auto->release() != THREAD_SUCCESS ) {
+  profile_startup("thread_release");
+  if ( count_thread_rc(m_worker_thread_auto->release()) != THREAD_SUCCESS ) {
     THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_THREAD_OPERATION_FAILED,
 	      "Error release cyclic worker thread");
   }
@@ -511,7 +1370,7 @@ void basicd_core::internal_initialize(string logfile,
       thread_timeout = false;
       break;
     }
-    if ( delay(0.1) != DELAY_SUCCESS ) {
+    if ( delay(WORKER_THREAD_POLL_INTERVAL) != DELAY_SUCCESS ) {
       THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_TIME_ERROR,
 	      "Delay operation failed");
     }
@@ -530,14 +1389,73 @@ void basicd_core::internal_initialize(string logfile,
 
 /////////////////////////////////////////////////////////////////////////////
 
+void basicd_core::internal_start_server(string address,
+					unsigned nr_workers)
+{
+  auto_ptr<request_server> server(new request_server);
+
+  if (server->open(address.c_str(),
+		   nr_workers,
+		   execute_request,
+		   this) != REQUEST_SERVER_SUCCESS) {
+    THROW_EXP(BASICD_LINUX_ERROR, BASICD_FILE_OPERATION_FAILED,
+	      "Error open request server (%s), errno:%d",
+	      address.c_str(), errno);
+  }
+
+  m_server_auto = server;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void basicd_core::internal_start_rings(string path)
+{
+  auto_ptr<basicd_ring_server> rings(new basicd_ring_server);
+
+  if (rings->open(path.c_str()) != BASICD_RING_SERVER_SUCCESS) {
+    THROW_EXP(BASICD_LINUX_ERROR, BASICD_FILE_OPERATION_FAILED,
+	      "Error open rings (%s), errno:%d",
+	      path.c_str(), errno);
+  }
+
+  // Consumed by the cyclic worker thread from next cycle
+  m_rings_auto = rings;
+  m_worker_thread_auto->attach_rings(m_rings_auto.get());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void basicd_core::internal_reconfigure(const BASICD_CONFIG *config)
+{
+  // Switch logfile, no messages are lost
+  if (m_logfile != config->log_file) {
+    basicd_log_writeln(string("++++++++ Switching logfile to ") +
+		       config->log_file);
+    basicd_log_reopen(instance_name(config->log_file));
+    m_logfile = config->log_file;
+  }
+
+  // Publish new snapshot, picked up by the cyclic worker
+  // thread in its next cycle, no restart needed.
+  // Replaced snapshot is deleted when no longer read.
+  BASICD_CONFIG *snapshot = new BASICD_CONFIG;
+  *snapshot = *config;
+  m_config_snapshot.publish(snapshot);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
 void basicd_core::internal_finalize(void)
 {  
+  // Stop serving requests, ongoing ones are completed
+  m_server_auto.reset();
+
   /////////////////////////////////////////////
   // Finalize the cyclic worker thread object
   /////////////////////////////////////////////
   
   // Step 1: Stop thread
-  if ( m_worker_thread_auto->stop() != THREAD_SUCCESS ) {    
+  if ( count_thread_rc(m_worker_thread_auto->stop()) != THREAD_SUCCESS ) {    
     THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_THREAD_OPERATION_FAILED,
 	      "Error stop cyclic worker thread, status:0x%x, state:%u",
 	      m_worker_thread_auto->get_status(),
@@ -545,11 +1463,9 @@ void basicd_core::internal_finalize(void)
   }
 
   // Step 2: Wait for thread to complete
-  //         We must wait at least thread's periode time
-  //         Add one extra second to get a safety factor
-  const double thread_done_timeout =
-    ( 1.0 / m_worker_thread_auto->get_frequency() ) + 1.0;
-  if ( m_worker_thread_auto->wait_timed(thread_done_timeout)
+  //         A sleeping thread is woken up by stop, so we
+  //         only wait for the current cycle to complete
+  if ( count_thread_rc(m_worker_thread_auto->wait_timed(WORKER_THREAD_STOP_TIMEOUT))
        != THREAD_SUCCESS ) {
     THROW_EXP(BASICD_INTERNAL_ERROR, BASICD_THREAD_OPERATION_FAILED,
 	      "Error wait_timed cyclic worker thread, status:0x%x, state:%u",
@@ -557,9 +1473,77 @@ void basicd_core::internal_finalize(void)
 	      m_worker_thread_auto->get_state());
   }
 
-  // Step 3: Delete the cyclic worker thread object
+  // Step 3: Publish final state, the thread has no more updates
+  m_worker_thread_auto->get_stats(m_worker_final_stats);
+  if (m_worker_thread_stat) {
+    seqlock_write_begin(&m_worker_thread_stat->seq);
+    m_worker_thread_stat->state  = THREAD_STATE_DONE;
+    m_worker_thread_stat->status = m_worker_thread_auto->get_status();
+    seqlock_write_end(&m_worker_thread_stat->seq);
+  }
+
+  // Step 4: Delete the cyclic worker thread object
   m_worker_thread_auto.reset();
 
+  // No longer consumed, producers are disconnected
+  m_rings_auto.reset();
+
   // Finalize the logfile singleton object
   basicd_log_finalize();
 }
+
+/////////////////////////////////////////////////////////////////////////////
+
+void basicd_core::internal_handoff_save(int handoff_fd)
+{
+  CORE_HANDOFF record;
+
+  // Stop as usual, listening sockets are kept by the caller
+  internal_finalize();
+
+  memset(&record, 0, sizeof(record));
+  record.stat_fd      = m_stat.get_fd();
+  record.worker_stats = m_worker_final_stats;
+  snapshot_error_counters(record.error_counters);
+
+  // Segment is left open, readers see no change
+  if ( (record.stat_fd != -1) &&
+       (handoff_keep_fd(record.stat_fd) != HANDOFF_SUCCESS) ) {
+    THROW_EXP(BASICD_LINUX_ERROR, BASICD_FILE_OPERATION_FAILED,
+	      "Error keeping statistics segment, errno:%d", errno);
+  }
+
+  if (handoff_put(handoff_fd, HANDOFF_TAG_CORE,
+		  &record, sizeof(record)) != HANDOFF_SUCCESS) {
+    THROW_EXP(BASICD_LINUX_ERROR, BASICD_FILE_OPERATION_FAILED,
+	      "Error saving handoff state, errno:%d", errno);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void basicd_core::internal_handoff_restore(int handoff_fd)
+{
+  CORE_HANDOFF record;
+
+  if (handoff_get(handoff_fd, HANDOFF_TAG_CORE,
+		  &record, sizeof(record)) != HANDOFF_SUCCESS) {
+    THROW_EXP(BASICD_LINUX_ERROR, BASICD_FILE_OPERATION_FAILED,
+	      "Error restoring handoff state, errno:%d", errno);
+  }
+
+  // Only what is missing is added, so restoring
+  // in the image that saved the state changes nothing
+  uint64_t values[NR_ERROR_COUNTERS];
+  snapshot_error_counters(values);
+  for (unsigned i=0; i < NR_ERROR_COUNTERS; i++) {
+    if (record.error_counters[i] > values[i]) {
+      metrics_registry::instance()->add(m_error_cnt_ids[i],
+					record.error_counters[i] - values[i]);
+    }
+  }
+
+  m_resume              = true;
+  m_resume_stat_fd      = record.stat_fd;
+  m_resume_worker_stats = record.worker_stats;
+}
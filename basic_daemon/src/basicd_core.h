@@ -18,6 +18,12 @@
 #include "basicd.h"
 #include "basicd_cyclic_thread.h"
 #include "excep.h"
+#include "error_pool.h"
+#include "basicd_stat_segment.h"
+#include "request_server.h"
+#include "basicd_ring_server.h"
+#include "phase_timer.h"
+#include "profiled_mutex.h"
 
 using namespace std;
 
@@ -37,30 +43,130 @@ public:
 
   long get_last_error(BASICD_STATUS *status);
 
+  long get_error_stats(BASICD_ERROR_STATS *stats);
+
   long check_run_status(void);
 
+  long check_heartbeat(unsigned periods);
+
+  long get_thread_stats(BASICD_THREAD_STATS *stats);
+
+  long get_log_stats(BASICD_LOG_STATS *stats);
+
+  long get_log_level(BASICD_LOG_LEVEL *level);
+
+  long set_log_level(BASICD_LOG_LEVEL level);
+
+  long set_tracing(bool enabled);
+
+  long dump_trace(string path);
+
+  long set_perf_counters(bool enabled);
+
+  long start_profiler(double frequency);
+
+  long stop_profiler(string path);
+
+  long set_lock_profiling(bool enabled);
+
+  long set_adaptive_locks(bool enabled);
+
+  long get_lock_report(char *report, unsigned size);
+
+  long get_ring_stats(BASICD_RING_STATS *stats);
+
+  long startup_phase(string name);
+
+  long startup_done(void);
+
+  long get_startup_stats(BASICD_STARTUP_STATS *stats);
+
+  long set_instance(unsigned instance);
+
   long initialize(string logfile,
 		  double worker_thread_frequency);
 
+  long start_server(string address,
+		    unsigned nr_workers);
+
+  long start_rings(string path);
+
+  long reconfigure(const BASICD_CONFIG *config);
+
   long finalize(void);
 
+  long handoff_save(int handoff_fd);
+
+  long handoff_restore(int handoff_fd);
+
 private:
   // Error handling information
   BASICD_ERROR_SOURCE  m_error_source;
   long                 m_error_code;
   bool                 m_last_error_read;
-  pthread_mutex_t      m_error_mutex;
+  profiled_mutex       m_error_mutex;
+
+  // Preallocated error records, waiting to be reported
+  error_pool           m_error_pool;
+  unsigned             m_reported_dropped; // Claimed atomically
+
+  // Error statistics, ids in the metrics registry (see ERROR_CNT_INDEX)
+  int                  m_error_cnt_ids[BASICD_NR_ERROR_SOURCES *
+				       BASICD_NR_ERROR_CODES +
+				       BASICD_NR_THREAD_CODES];
 
   // Keep track of initialization
   bool             m_initialized;
-  pthread_mutex_t  m_init_mutex;
+  profiled_mutex   m_init_mutex;
+
+  // Profile of first startup, guarded by init mutex
+  phase_timer      m_startup;
+  bool             m_startup_done;
+
+  // Process instance, suffix of per process names
+  unsigned         m_instance;
+
+  // Currently used logfile, as configured
+  string           m_logfile;
+
+  // Statistics published to monitors, kept while loaded
+  basicd_stat_segment  m_stat;
+  BASICD_STAT_THREAD  *m_worker_thread_stat;
+
+  // Configuration snapshots, read by worker threads
+  rcu_ptr<BASICD_CONFIG> m_config_snapshot;
 
   // The cyclic worker thread object
   auto_ptr<basicd_cyclic_thread> m_worker_thread_auto;
+  CYCLIC_THREAD_STATS            m_worker_final_stats; // When last stopped
+  bool                           m_worker_stalled;     // Stall reported
+  int                            m_worker_stall_id;    // Metrics registry
+
+  // State of a previous image, taken over by next initialize
+  bool                 m_resume;
+  int                  m_resume_stat_fd;
+  CYCLIC_THREAD_STATS  m_resume_worker_stats;
+
+  // The request serving front end, optional
+  auto_ptr<request_server> m_server_auto;
+
+  // Shared memory rings of local producers, optional
+  auto_ptr<basicd_ring_server> m_rings_auto;
 
   // Private member functions
-  long set_error(excep exp);
-  long update_error(excep exp);
+  long set_error(const excep &exp);
+  long update_error(const ERROR_RECORD &record);
+  void report_errors(void);
+  long count_thread_rc(long rc);
+  void snapshot_error_counters(uint64_t *values);
+  void profile_startup(const char *phase);
+  string instance_name(string name);
+  uint64_t worker_heartbeat_age(CYCLIC_THREAD_HEARTBEAT &heartbeat);
+
+  static uint32_t execute_request(const uint8_t *request,
+				  uint32_t request_len,
+				  uint8_t *response,
+				  void *arg);
 
   long internal_get_prod_info(BASICD_PROD_INFO *prod_info);
 
@@ -68,10 +174,23 @@ private:
 
   void internal_check_run_status(void);
 
+  void internal_check_heartbeat(unsigned periods);
+
   void internal_initialize(string logfile,
 			   double worker_thread_frequency);
 
+  void internal_start_server(string address,
+			     unsigned nr_workers);
+
+  void internal_start_rings(string path);
+
+  void internal_reconfigure(const BASICD_CONFIG *config);
+
   void internal_finalize(void);  
+
+  void internal_handoff_save(int handoff_fd);
+
+  void internal_handoff_restore(int handoff_fd);
 };
 
 #endif // __BASICD_CORE_H__
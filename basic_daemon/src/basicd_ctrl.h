@@ -0,0 +1,74 @@
+/************************************************************************
+ *                                                                      *
+ * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+ *                                                                      *
+ * This program is free software; you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation; either version 2 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef __BASICD_CTRL_H__
+#define __BASICD_CTRL_H__
+
+#include <stdint.h>
+
+#include "basicd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * BASICD control socket protocol
+ *
+ * The daemon listens on a unix domain stream socket (ctrl_socket in the
+ * configuration file). A client sends requests, each request is answered
+ * by exactly one response, in order. Requests may be pipelined.
+ *
+ * Both requests and responses are a BASICD_CTRL_HEADER followed by
+ * 'length' bytes of payload. All values are in host byte order.
+ * A response repeats the command of the request and sets the status.
+ * The payload of a successful response is the type listed per command.
+ *
+ * A header with bad magic or a too large length closes the connection.
+ */
+#define BASICD_CTRL_MAGIC        0x42434431 /* "BCD1" */
+#define BASICD_CTRL_MAX_PAYLOAD  4096
+
+/*
+ * Commands                                  request  => response
+ */
+#define BASICD_CTRL_GET_PROD_INFO     1  /*  -        => BASICD_PROD_INFO    */
+#define BASICD_CTRL_GET_CONFIG        2  /*  -        => BASICD_CONFIG       */
+#define BASICD_CTRL_CHECK_RUN_STATUS  3  /*  -        => -                   */
+#define BASICD_CTRL_GET_THREAD_STATS  4  /*  -        => BASICD_THREAD_STATS */
+#define BASICD_CTRL_GET_LOG_LEVEL     5  /*  -        => uint32_t            */
+#define BASICD_CTRL_SET_LOG_LEVEL     6  /*  uint32_t => -                   */
+#define BASICD_CTRL_RELOAD            7  /*  -        => -                   */
+#define BASICD_CTRL_DUMP_TRACE        8  /*  -        => -                   */
+#define BASICD_CTRL_START_PROFILER    9  /*  -        => -                   */
+#define BASICD_CTRL_STOP_PROFILER    10  /*  -        => -                   */
+#define BASICD_CTRL_GET_LOCK_REPORT  11  /*  -        => char[] (text)       */
+
+/*
+ * Response status
+ */
+#define BASICD_CTRL_OK            0
+#define BASICD_CTRL_FAILED       -1 /* Command failed in daemon */
+#define BASICD_CTRL_BAD_COMMAND  -2 /* Unknown command */
+#define BASICD_CTRL_BAD_PAYLOAD  -3 /* Bad payload length or value */
+
+typedef struct {
+  uint32_t magic;   /* BASICD_CTRL_MAGIC */
+  uint16_t command; /* BASICD_CTRL_xxx command */
+  int16_t  status;  /* Response status, zero in a request */
+  uint32_t length;  /* Nof payload bytes following the header */
+} BASICD_CTRL_HEADER;
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* __BASICD_CTRL_H__ */
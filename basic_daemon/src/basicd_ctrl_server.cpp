@@ -0,0 +1,289 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "basicd_ctrl_server.h"
+#include "listen_socket.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+basicd_ctrl_server::basicd_ctrl_server(void)
+{
+  m_listen_fd = -1;
+  m_loop      = NULL;
+  m_handler   = NULL;
+  m_arg       = NULL;
+
+  for (unsigned i=0; i < BASICD_CTRL_SERVER_MAX_CLIENTS; i++) {
+    m_clients[i].fd     = -1;
+    m_clients[i].server = this;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+basicd_ctrl_server::~basicd_ctrl_server(void)
+{
+  close();
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_ctrl_server::open(const char *path,
+			      event_loop *loop,
+			      BASICD_CTRL_HANDLER handler,
+			      void *arg)
+{
+  // Never a TCP address
+  if (path[0] != '/') {
+    errno = EINVAL;
+    return BASICD_CTRL_SERVER_FAILURE;
+  }
+
+  m_loop    = loop;
+  m_handler = handler;
+  m_arg     = arg;
+
+  // Any socket left by a previous instance is removed,
+  // the lock file prevents two instances
+  m_listen_fd = open_listen_socket(path, 0, BASICD_CTRL_SERVER_MAX_CLIENTS);
+  if (m_listen_fd == -1) {
+    return BASICD_CTRL_SERVER_FAILURE;
+  }
+
+  // Only daemon user and group may connect
+  if ( (chmod(path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) == -1) ||
+       (m_loop->add_fd(m_listen_fd, EPOLLIN,
+		       on_accept, this) != EVENT_LOOP_SUCCESS) ) {
+    close();
+    return BASICD_CTRL_SERVER_FAILURE;
+  }
+
+  return BASICD_CTRL_SERVER_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ctrl_server::close(void)
+{
+  for (unsigned i=0; i < BASICD_CTRL_SERVER_MAX_CLIENTS; i++) {
+    close_client(&m_clients[i]);
+  }
+
+  if (m_listen_fd != -1) {
+    m_loop->remove_fd(m_listen_fd);
+    close_listen_socket(m_listen_fd); // Socket path is removed
+    m_listen_fd = -1;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ctrl_server::on_accept(int fd, uint32_t events, void *arg)
+{
+  ((basicd_ctrl_server *)arg)->accept_client();
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ctrl_server::on_client(int fd, uint32_t events, void *arg)
+{
+  CLIENT *client = (CLIENT *)arg;
+
+  client->server->serve_client(client, events);
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ctrl_server::accept_client(void)
+{
+  int fd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd == -1) {
+    return; // Client gone, or out of descriptors
+  }
+
+  // Find a free slot, if none the client is refused
+  CLIENT *client = NULL;
+  for (unsigned i=0; i < BASICD_CTRL_SERVER_MAX_CLIENTS; i++) {
+    if (m_clients[i].fd == -1) {
+      client = &m_clients[i];
+      break;
+    }
+  }
+  if ( (!client) ||
+       (m_loop->add_fd(fd, EPOLLIN, on_client, client) != EVENT_LOOP_SUCCESS) ) {
+    ::close(fd);
+    return;
+  }
+
+  client->fd      = fd;
+  client->writing = false;
+  client->in_len  = 0;
+  client->out_len = 0;
+  client->out_pos = 0;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ctrl_server::serve_client(CLIENT *client, uint32_t events)
+{
+  // Complete previous response before reading more
+  if (client->out_len) {
+    if (!send_response(client)) {
+      close_client(client);
+      return;
+    }
+  }
+
+  if ( (events & EPOLLIN) && (!client->out_len) ) {
+    const ssize_t n = read(client->fd,
+			   client->in + client->in_len,
+			   BASICD_CTRL_SERVER_BUFFER_SIZE - client->in_len);
+    if ( (n == 0) ||
+	 ((n == -1) && (errno != EAGAIN) && (errno != EINTR)) ) {
+      close_client(client); // Client closed connection
+      return;
+    }
+    if (n > 0) {
+      client->in_len += n;
+    }
+  }
+  else if ( (events & (EPOLLHUP | EPOLLERR)) && (!client->out_len) ) {
+    close_client(client);
+    return;
+  }
+
+  // Serve all complete requests, as long as responses are sent
+  while (!client->out_len) {
+    if (!process_request(client)) {
+      close_client(client);
+      return;
+    }
+    if (!client->out_len) {
+      break; // No complete request
+    }
+    if (!send_response(client)) {
+      close_client(client);
+      return;
+    }
+  }
+
+  // Wait for socket to be writable, when response is not yet sent
+  const bool writing = (client->out_len != 0);
+  if (writing != client->writing) {
+    if (m_loop->modify_fd(client->fd,
+			  writing ? EPOLLOUT : EPOLLIN) != EVENT_LOOP_SUCCESS) {
+      close_client(client);
+      return;
+    }
+    client->writing = writing;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+bool basicd_ctrl_server::process_request(CLIENT *client)
+{
+  BASICD_CTRL_HEADER request;
+  BASICD_CTRL_HEADER response;
+
+  if (client->in_len < sizeof(request)) {
+    return true; // Wait for more data
+  }
+
+  memcpy(&request, client->in, sizeof(request));
+  if ( (request.magic != BASICD_CTRL_MAGIC) ||
+       (request.length > BASICD_CTRL_MAX_PAYLOAD) ) {
+    return false; // Can't find next request
+  }
+
+  const uint32_t frame_len = sizeof(request) + request.length;
+  if (client->in_len < frame_len) {
+    return true; // Wait for more data
+  }
+
+  // Execute request, response payload directly into send buffer
+  response.magic   = BASICD_CTRL_MAGIC;
+  response.command = request.command;
+  response.length  = 0;
+  response.status  = m_handler(request.command,
+			       client->in + sizeof(request),
+			       request.length,
+			       client->out + sizeof(response),
+			       &response.length,
+			       m_arg);
+  if (response.length > BASICD_CTRL_MAX_PAYLOAD) {
+    response.status = BASICD_CTRL_FAILED;
+    response.length = 0;
+  }
+  memcpy(client->out, &response, sizeof(response));
+  client->out_len = sizeof(response) + response.length;
+  client->out_pos = 0;
+
+  // Keep any pipelined requests
+  client->in_len -= frame_len;
+  memmove(client->in, client->in + frame_len, client->in_len);
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////
+
+bool basicd_ctrl_server::send_response(CLIENT *client)
+{
+  while (client->out_pos < client->out_len) {
+    const ssize_t n = send(client->fd,
+			   client->out + client->out_pos,
+			   client->out_len - client->out_pos,
+			   MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EAGAIN) {
+	return true; // Continue when writable
+      }
+      if (errno == EINTR) {
+	continue;
+      }
+      return false;
+    }
+    client->out_pos += n;
+  }
+
+  // Response completed
+  client->out_len = 0;
+  client->out_pos = 0;
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ctrl_server::close_client(CLIENT *client)
+{
+  if (client->fd != -1) {
+    m_loop->remove_fd(client->fd);
+    ::close(client->fd);
+    client->fd = -1;
+  }
+}
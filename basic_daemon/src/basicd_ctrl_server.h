@@ -0,0 +1,98 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __BASICD_CTRL_SERVER_H__
+#define __BASICD_CTRL_SERVER_H__
+
+#include <stdint.h>
+#include <string>
+
+#include "basicd_ctrl.h"
+#include "event_loop.h"
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define BASICD_CTRL_SERVER_SUCCESS   0
+#define BASICD_CTRL_SERVER_FAILURE  -1
+
+#define BASICD_CTRL_SERVER_MAX_CLIENTS  8
+
+// Room for one complete request or response
+#define BASICD_CTRL_SERVER_BUFFER_SIZE \
+  (sizeof(BASICD_CTRL_HEADER) + BASICD_CTRL_MAX_PAYLOAD)
+
+/////////////////////////////////////////////////////////////////////////////
+//               Class support types
+/////////////////////////////////////////////////////////////////////////////
+
+// Executes one request, response payload is written to rsp_payload
+// (at most BASICD_CTRL_MAX_PAYLOAD bytes). Returns response status.
+typedef int16_t (*BASICD_CTRL_HANDLER)(uint16_t command,
+				       const uint8_t *req_payload,
+				       uint32_t req_length,
+				       uint8_t *rsp_payload,
+				       uint32_t *rsp_length,
+				       void *arg);
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+class basicd_ctrl_server {
+
+ public:
+  basicd_ctrl_server(void);
+  ~basicd_ctrl_server(void);
+
+  // Served from the event loop, handler is called for each request
+  long open(const char *path,
+	    event_loop *loop,
+	    BASICD_CTRL_HANDLER handler,
+	    void *arg);
+
+  void close(void);
+
+ private:
+  // All buffers are preallocated, no allocation per request
+  typedef struct {
+    int                 fd;      // -1 when slot is free
+    bool                writing; // Waiting for EPOLLOUT
+    uint32_t            in_len;
+    uint32_t            out_len;
+    uint32_t            out_pos;
+    basicd_ctrl_server *server;
+    uint8_t             in[BASICD_CTRL_SERVER_BUFFER_SIZE];
+    uint8_t             out[BASICD_CTRL_SERVER_BUFFER_SIZE];
+  } CLIENT;
+
+  int                  m_listen_fd;
+  event_loop          *m_loop;
+  BASICD_CTRL_HANDLER  m_handler;
+  void                *m_arg;
+
+  CLIENT m_clients[BASICD_CTRL_SERVER_MAX_CLIENTS];
+
+  static void on_accept(int fd, uint32_t events, void *arg);
+  static void on_client(int fd, uint32_t events, void *arg);
+
+  void accept_client(void);
+  void serve_client(CLIENT *client, uint32_t events);
+  bool process_request(CLIENT *client);
+  bool send_response(CLIENT *client);
+  void close_client(CLIENT *client);
+};
+
+#endif // __BASICD_CTRL_SERVER_H__
@@ -12,6 +12,11 @@
 #include "basicd_cyclic_thread.h"
 #include "basicd_log.h"
 #include "daemon_utility.h"
+#include "seqlock.h"
+
+// Histogram is published as is
+typedef char check_nr_buckets[(BASICD_STAT_NR_BUCKETS ==
+			       CYCLIC_THREAD_NR_BUCKETS) ? 1 : -1];
 
 /////////////////////////////////////////////////////////////////////////////
 //               Public member functions
@@ -20,9 +25,16 @@
 ////////////////////////////////////////////////////////////////
 
 basicd_cyclic_thread::basicd_cyclic_thread(string thread_name,
-					   double frequency) : cyclic_thread(thread_name,
-									     frequency)
+					   double frequency,
+					   rcu_ptr<BASICD_CONFIG> *config,
+					   BASICD_STAT_THREAD *stat) : cyclic_thread(thread_name,
+										     frequency)
 {
+  m_config = config;
+  m_config_reader = RCU_BAD_READER;
+  m_stat = stat;
+  m_new_rings = NULL;
+
   init_members();
 }
 
@@ -32,6 +44,13 @@ basicd_cyclic_thread::~basicd_cyclic_thread(void)
 {
 }
 
+////////////////////////////////////////////////////////////////
+
+void basicd_cyclic_thread::attach_rings(basicd_ring_server *rings)
+{
+  __atomic_store_n(&m_new_rings, rings, __ATOMIC_RELEASE);
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //               Protected member functions
 /////////////////////////////////////////////////////////////////////////////
@@ -44,6 +63,12 @@ long basicd_cyclic_thread::setup(void)
 
   basicd_log_writeln(get_name() + " : setup");
 
+  // Become a reader of configuration snapshots
+  m_config_reader = m_config->register_reader();
+  if (m_config_reader == RCU_BAD_READER) {
+    return THREAD_INTERNAL_ERROR;
+  }
+
   return THREAD_SUCCESS;
 }
 
@@ -53,6 +78,11 @@ long basicd_cyclic_thread::cleanup(void)
 {
   basicd_log_writeln(get_name() + " : cleanup");
 
+  if (m_config_reader != RCU_BAD_READER) {
+    m_config->unregister_reader(m_config_reader);
+    m_config_reader = RCU_BAD_READER;
+  }
+
   return THREAD_SUCCESS;
 }
 
@@ -60,13 +90,81 @@ long basicd_cyclic_thread::cleanup(void)
 
 long basicd_cyclic_thread::cyclic_execute(void)
 {
-  basicd_log_writeln(get_name() + " : cyclic_execute");
+  basicd_log_writeln(BASICD_LOG_DEBUG, get_name() + " : cyclic_execute");
+
+  // Use latest configuration, no locks needed
+  const BASICD_CONFIG *config = m_config->read_lock(m_config_reader);
+  if ( config &&
+       (config->worker_thread_freq != get_frequency()) ) {
+    // Applied at the end of this cycle
+    set_frequency(config->worker_thread_freq);
+    basicd_log_writeln(get_name() + " : frequency changed");
+  }
+  m_config->read_unlock(m_config_reader);
+
+  // Wait for records between cycles
+  basicd_ring_server *rings = __atomic_load_n(&m_new_rings, __ATOMIC_ACQUIRE);
+  if (rings != m_rings) {
+    m_rings = rings;
+    set_event_fd(m_rings ? m_rings->get_fd() : -1);
+    basicd_log_writeln(get_name() + " : rings attached");
+  }
+  if (m_rings) {
+    m_rings->poll(consume_record, this);
+  }
 
   // return THREAD_INTERNAL_ERROR to signal error
 
   return THREAD_SUCCESS;
 }
 
+////////////////////////////////////////////////////////////////
+
+void basicd_cyclic_thread::cycle_done(const CYCLIC_THREAD_STATS &stats)
+{
+  if (!m_stat) {
+    return;
+  }
+
+  // Publish to monitors, this thread is the only writer
+  seqlock_write_begin(&m_stat->seq);
+  m_stat->tid                    = get_tid();
+  m_stat->state                  = get_state();
+  m_stat->status                 = get_status();
+  m_stat->exe_cnt                = get_exe_cnt();
+  m_stat->frequency              = get_frequency();
+  m_stat->cycles                 = stats.cycles;
+  m_stat->overruns               = stats.overruns;
+  m_stat->exec_time_last_ns      = stats.exec_time_last;
+  m_stat->exec_time_min_ns       = stats.exec_time_min;
+  m_stat->exec_time_max_ns       = stats.exec_time_max;
+  m_stat->exec_time_sum_ns       = stats.exec_time_sum;
+  m_stat->wakeup_latency_last_ns = stats.wakeup_latency_last;
+  m_stat->wakeup_latency_max_ns  = stats.wakeup_latency_max;
+  m_stat->cpu_time_ns            = stats.cpu_time;
+  for (unsigned i=0; i < BASICD_STAT_NR_BUCKETS; i++) {
+    m_stat->exec_time_hist[i]    = stats.exec_time_hist[i];
+  }
+  m_stat->perf_available         = stats.perf_available;
+  for (unsigned i=0; i < BASICD_STAT_NR_PERF_COUNTERS; i++) {
+    m_stat->perf_sum[i]          = stats.perf_sum[i];
+    m_stat->perf_max[i]          = stats.perf_max[i];
+  }
+  seqlock_write_end(&m_stat->seq);
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_cyclic_thread::event_execute(void)
+{
+  // Records in batches, then back to sleep until next cycle
+  if (m_rings) {
+    m_rings->poll(consume_record, this);
+  }
+
+  return THREAD_SUCCESS;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //               Private member functions
 /////////////////////////////////////////////////////////////////////////////
@@ -75,4 +173,15 @@ long basicd_cyclic_thread::cyclic_execute(void)
 
 void basicd_cyclic_thread::init_members(void)
 {
+  m_rings = NULL;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_cyclic_thread::consume_record(const uint8_t *record,
+					  uint32_t len,
+					  void *arg)
+{
+  // No records are defined yet, they are only
+  // counted (see basicd_get_ring_stats)
 }
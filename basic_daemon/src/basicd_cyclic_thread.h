@@ -13,6 +13,10 @@
 #define __BASICD_CYCLIC_THREAD_H__
 
 #include "cyclic_thread.h"
+#include "rcu_ptr.h"
+#include "basicd.h"
+#include "basicd_stat.h"
+#include "basicd_ring_server.h"
 
 using namespace std;
 
@@ -24,16 +28,36 @@ class basicd_cyclic_thread : public cyclic_thread {
 
  public:
   basicd_cyclic_thread(string thread_name,
-		       double frequency);
+		       double frequency,
+		       rcu_ptr<BASICD_CONFIG> *config,
+		       BASICD_STAT_THREAD *stat);
   ~basicd_cyclic_thread(void);
 
+  // Records of the rings are consumed by this thread,
+  // attached at next cycle. Must be open until thread is stopped.
+  void attach_rings(basicd_ring_server *rings);
+
  protected:
   virtual long setup(void);   // Implements pure virtual function from base class
   virtual long cleanup(void); // Implements pure virtual function from base class
 
   virtual long cyclic_execute(void); // Implements pure virtual function from base class
+
+  virtual void cycle_done(const CYCLIC_THREAD_STATS &stats);
+
+  virtual long event_execute(void);
     
  private:
+  rcu_ptr<BASICD_CONFIG> *m_config; // Latest configuration snapshot
+  int                     m_config_reader;
+  BASICD_STAT_THREAD     *m_stat;          // Published statistics, may be NULL
+  basicd_ring_server     *m_new_rings;     // Accessed atomically
+  basicd_ring_server     *m_rings;         // Attached, only used by thread
+
+  static void consume_record(const uint8_t *record,
+			     uint32_t len,
+			     void *arg);
+
   void init_members(void);
 };
 
@@ -0,0 +1,398 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+
+#include "basicd.h"
+#include "request_server.h"
+#include "basicd_ring.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define LOADGEN_MAX_CONNECTIONS  REQUEST_SERVER_MAX_CONNECTIONS
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of types
+/////////////////////////////////////////////////////////////////////////////
+
+// One client thread per connection, blocking I/O
+typedef struct {
+  pthread_t  thread;
+  const char *address;
+  unsigned   nr_requests;
+  unsigned   size;
+  unsigned   ring_mode; // Zero for request server
+  uint64_t  *latency;   // Nanoseconds, one per request
+  unsigned   completed;
+  int        error;     // errno of first failure
+} LOADGEN_CLIENT;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Function prototypes
+/////////////////////////////////////////////////////////////////////////////
+
+static void loadgen_usage(const char *prog);
+static uint64_t loadgen_now(void);
+static int loadgen_connect(const char *address);
+static int loadgen_write_all(int fd, const uint8_t *buf, uint32_t len);
+static int loadgen_read_all(int fd, uint8_t *buf, uint32_t len);
+static void *loadgen_client(void *arg);
+static void *loadgen_ring_client(void *arg);
+static int loadgen_compare(const void *a, const void *b);
+static void loadgen_print(uint64_t *latency, unsigned nr, double elapsed);
+
+////////////////////////////////////////////////////////////////
+
+static void loadgen_usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s -a address [-c connections] "
+	  "[-n requests_per_connection] [-s request_size] "
+	  "[-r spsc|mpsc]\n", prog);
+  fprintf(stderr, "Sends requests to the request server of %s and "
+	  "prints requests per second and latency percentiles.\n"
+	  "Address is a unix socket path or a.b.c.d:port\n"
+	  "With -r, records are written to rings (address is ring_socket),\n"
+	  "latency is then the time to enqueue a record\n", BASICD_NAME);
+}
+
+////////////////////////////////////////////////////////////////
+
+static uint64_t loadgen_now(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////
+
+static int loadgen_connect(const char *address)
+{
+  int fd;
+
+  if (address[0] == '/') {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, address, sizeof(addr.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ( (fd != -1) &&
+	 (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  char host[32];
+  const char *colon = strrchr(address, ':');
+  if ( (!colon) || ((unsigned)(colon - address) >= sizeof(host)) ) {
+    errno = EINVAL;
+    return -1;
+  }
+  memcpy(host, address, colon - address);
+  host[colon - address] = '\0';
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(atoi(colon + 1));
+  if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if ( (fd != -1) &&
+       (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ) {
+    close(fd);
+    return -1;
+  }
+
+  // Small requests, don't wait for more data
+  const int one = 1;
+  if (fd != -1) {
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  return fd;
+}
+
+////////////////////////////////////////////////////////////////
+
+static int loadgen_write_all(int fd, const uint8_t *buf, uint32_t len)
+{
+  while (len) {
+    const ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////
+
+static int loadgen_read_all(int fd, uint8_t *buf, uint32_t len)
+{
+  while (len) {
+    const ssize_t n = read(fd, buf, len);
+    if (n == 0) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void *loadgen_client(void *arg)
+{
+  LOADGEN_CLIENT *client = (LOADGEN_CLIENT *)arg;
+  uint8_t request[REQUEST_SERVER_FRAME_SIZE];
+  uint8_t response[REQUEST_SERVER_FRAME_SIZE];
+  uint32_t len;
+
+  const int fd = loadgen_connect(client->address);
+  if (fd == -1) {
+    client->error = errno;
+    return NULL;
+  }
+
+  len = htonl(client->size);
+  memcpy(request, &len, sizeof(len));
+  memset(request + sizeof(len), 'x', client->size);
+
+  // One request at a time, latency is the round trip
+  for (unsigned i=0; i < client->nr_requests; i++) {
+    const uint64_t start = loadgen_now();
+
+    if ( (loadgen_write_all(fd, request, sizeof(len) + client->size) == -1) ||
+	 (loadgen_read_all(fd, response, sizeof(len)) == -1) ) {
+      client->error = errno;
+      break;
+    }
+    memcpy(&len, response, sizeof(len));
+    len = ntohl(len);
+    if ( (len > REQUEST_SERVER_MAX_MESSAGE) ||
+	 (loadgen_read_all(fd, response + sizeof(len), len) == -1) ) {
+      client->error = (len > REQUEST_SERVER_MAX_MESSAGE ? EPROTO : errno);
+      break;
+    }
+
+    client->latency[i] = loadgen_now() - start;
+    client->completed++;
+  }
+
+  close(fd);
+
+  return NULL;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void *loadgen_ring_client(void *arg)
+{
+  LOADGEN_CLIENT *client = (LOADGEN_CLIENT *)arg;
+  BASICD_RING_CLIENT ring;
+
+  if (basicd_ring_connect(client->address,
+			  client->ring_mode, &ring) != BASICD_SUCCESS) {
+    client->error = errno;
+    return NULL;
+  }
+
+  // Written in place, waits while ring is full
+  for (unsigned i=0; i < client->nr_requests; i++) {
+    const uint64_t start = loadgen_now();
+
+    uint8_t *record;
+    while ( (record = basicd_ring_reserve(&ring)) == NULL ) {
+      sched_yield();
+    }
+    memset(record, 'x', client->size);
+    basicd_ring_commit(&ring, record, client->size);
+
+    client->latency[i] = loadgen_now() - start;
+    client->completed++;
+  }
+
+  basicd_ring_close(&ring);
+
+  return NULL;
+}
+
+////////////////////////////////////////////////////////////////
+
+static int loadgen_compare(const void *a, const void *b)
+{
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+
+  return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+////////////////////////////////////////////////////////////////
+
+static void loadgen_print(uint64_t *latency, unsigned nr, double elapsed)
+{
+  static const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+
+  printf("requests : %u\n", nr);
+  printf("elapsed  : %.3f s\n", elapsed);
+  printf("rate     : %.0f requests/s\n", nr / elapsed);
+
+  if (!nr) {
+    return;
+  }
+
+  qsort(latency, nr, sizeof(uint64_t), loadgen_compare);
+
+  for (unsigned i=0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+    unsigned index = (unsigned)(percentiles[i] / 100.0 * nr);
+    if (index >= nr) {
+      index = nr - 1;
+    }
+    printf("p%-7g : %.1f us\n", percentiles[i], latency[index] / 1000.0);
+  }
+  printf("max      : %.1f us\n", latency[nr - 1] / 1000.0);
+}
+
+////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+  const char *address = NULL;
+  unsigned nr_connections = 1;
+  unsigned nr_requests = 10000;
+  unsigned size = 64;
+  unsigned ring_mode = 0;
+  int opt;
+
+  while ( (opt = getopt(argc, argv, "a:c:n:s:r:h")) != -1 ) {
+    switch (opt) {
+    case 'a':
+      address = optarg;
+      break;
+    case 'c':
+      nr_connections = atoi(optarg);
+      break;
+    case 'n':
+      nr_requests = atoi(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 'r':
+      ring_mode = (!strcmp(optarg, "spsc") ? BASICD_RING_SPSC :
+		   (!strcmp(optarg, "mpsc") ? BASICD_RING_MPSC : ~0U));
+      break;
+    default:
+      loadgen_usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if ( (!address) ||
+       (nr_connections == 0) || (nr_connections > LOADGEN_MAX_CONNECTIONS) ||
+       (size > REQUEST_SERVER_MAX_MESSAGE) ||
+       (ring_mode == ~0U) ||
+       ( (ring_mode) && (size > BASICD_RING_MAX_RECORD) ) ) {
+    loadgen_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // All latencies are kept, allocated before measuring
+  LOADGEN_CLIENT *clients = (LOADGEN_CLIENT *)calloc(nr_connections,
+					       sizeof(LOADGEN_CLIENT));
+  uint64_t *latency = (uint64_t *)calloc((size_t)nr_connections * nr_requests,
+					 sizeof(uint64_t));
+  if ( (!clients) || (!latency) ) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  const uint64_t start = loadgen_now();
+
+  for (unsigned i=0; i < nr_connections; i++) {
+    clients[i].address     = address;
+    clients[i].nr_requests = nr_requests;
+    clients[i].size        = size;
+    clients[i].ring_mode   = ring_mode;
+    clients[i].latency     = latency + (size_t)i * nr_requests;
+    if (pthread_create(&clients[i].thread, NULL,
+		       (ring_mode ? loadgen_ring_client : loadgen_client),
+		       &clients[i])) {
+      fprintf(stderr, "Can't create client thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  unsigned nr_completed = 0;
+  int failed = 0;
+  for (unsigned i=0; i < nr_connections; i++) {
+    pthread_join(clients[i].thread, NULL);
+
+    // Pack completed latencies
+    memmove(latency + nr_completed, clients[i].latency,
+	    clients[i].completed * sizeof(uint64_t));
+    nr_completed += clients[i].completed;
+
+    if (clients[i].error) {
+      fprintf(stderr, "Connection %u failed, code=%d (%s)\n",
+	      i, clients[i].error, strerror(clients[i].error));
+      failed = 1;
+    }
+  }
+
+  const double elapsed = (loadgen_now() - start) / 1e9;
+
+  loadgen_print(latency, nr_completed, elapsed);
+
+  free(latency);
+  free(clients);
+
+  exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
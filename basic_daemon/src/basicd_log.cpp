@@ -18,6 +18,9 @@
 #include "basicd_log.h"
 #include "basicd.h"
 #include "excep.h"
+#include "metrics_registry.h"
+#include "trace.h"
+#include "sdt_probe.h"
 
 basicd_log* basicd_log::m_instance = NULL;
 
@@ -29,7 +32,6 @@ basicd_log* basicd_log::m_instance = NULL;
 
 basicd_log::~basicd_log(void)
 {
-  pthread_mutex_destroy(&m_write_mutex);
 }
 
 ////////////////////////////////////////////////////////////////
@@ -84,11 +86,87 @@ void basicd_log::finalize(void)
 
 ////////////////////////////////////////////////////////////////
 
+void basicd_log::reopen(string logfile)
+{
+  int rc;
+
+  // Open new logfile first, writers are not blocked meanwhile
+  rc = open(logfile.c_str(), 
+	    O_WRONLY | O_CREAT,
+	    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+  if (rc == -1) {
+    THROW_EXP(BASICD_LINUX_ERROR, BASICD_FILE_OPERATION_FAILED,
+	      "open failed, logfile (%s)", logfile.c_str());
+  }
+  const int new_fd = rc;
+
+  // Move to end of file
+  if ( lseek(new_fd, 0, SEEK_END) == -1 ) {
+    close(new_fd);
+    THROW_EXP(BASICD_LINUX_ERROR, BASICD_FILE_OPERATION_FAILED,
+	      "lseek failed, logfile (%s)", logfile.c_str());
+  }
+
+  // Switch logfile between two writes
+  m_write_mutex.lock();
+  const int old_fd = m_fd;
+  m_fd      = new_fd;
+  m_logfile = logfile;
+  m_write_mutex.unlock();
+
+  // Close old logfile
+  rc = close(old_fd);
+  if (rc == -1) {
+    THROW_EXP(BASICD_LINUX_ERROR, BASICD_FILE_OPERATION_FAILED,
+	      "close failed, old logfile (fd=%d)", old_fd);
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+BASICD_LOG_LEVEL basicd_log::get_level(void)
+{
+  return (BASICD_LOG_LEVEL) __atomic_load_n(&m_level, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_log::set_level(BASICD_LOG_LEVEL level)
+{
+  __atomic_store_n(&m_level, (int) level, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_log::get_stats(BASICD_LOG_STATS *stats)
+{
+  metrics_registry *metrics = metrics_registry::instance();
+
+  stats->lines      = metrics->read(m_lines_id);
+  stats->bytes      = metrics->read(m_bytes_id);
+  stats->dropped    = metrics->read(m_dropped_id);
+  stats->suppressed = metrics->read(m_suppressed_id);
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_log::writeln(BASICD_LOG_LEVEL level, string str)
+{
+  if (level <= get_level()) {
+    writeln(str);
+  }
+  else {
+    metrics_registry::instance()->inc(m_suppressed_id);
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
 void basicd_log::writeln(string str)
 {
   try {
     // Lockdown write operation
-    pthread_mutex_lock(&m_write_mutex);
+    m_write_mutex.lock();
 
     // Decorate message with date and time prefix
     char prefix[40];
@@ -98,15 +176,24 @@ void basicd_log::writeln(string str)
     string the_message = prefix + str + "\n";
 
     // Write message to file
-    write_all(m_fd,
-	      (uint8_t *)the_message.c_str(),
-	      the_message.length());
+    BASICD_PROBE2(log_write, the_message.c_str(), the_message.length());
+    {
+      TRACE_SCOPE("log_write");
+      write_all(m_fd,
+		(uint8_t *)the_message.c_str(),
+		the_message.length());
+    }
+    BASICD_PROBE1(log_written, the_message.length());
+
+    metrics_registry::instance()->inc(m_lines_id);
+    metrics_registry::instance()->add(m_bytes_id, the_message.length());
 
     // Lockup write operation
-    pthread_mutex_unlock(&m_write_mutex);
+    m_write_mutex.unlock();
   }
   catch (...) {
-    pthread_mutex_unlock(&m_write_mutex);
+    metrics_registry::instance()->inc(m_dropped_id);
+    m_write_mutex.unlock();
     throw;
   }
 }
@@ -117,12 +204,17 @@ void basicd_log::writeln(string str)
 
 ////////////////////////////////////////////////////////////////
 
-basicd_log::basicd_log(void)
+basicd_log::basicd_log(void) : m_write_mutex("log_write")
 {
   m_logfile = "";
   m_fd      = -1;
+  m_level   = BASICD_LOG_DEBUG;
 
-  pthread_mutex_init(&m_write_mutex, NULL); // Use default mutex attributes
+  metrics_registry *metrics = metrics_registry::instance();
+  m_lines_id      = metrics->add_counter("log_lines_total", "", 1.0);
+  m_bytes_id      = metrics->add_counter("log_bytes_total", "", 1.0);
+  m_dropped_id    = metrics->add_counter("log_dropped_total", "", 1.0);
+  m_suppressed_id = metrics->add_counter("log_suppressed_total", "", 1.0);
 }
 
 ////////////////////////////////////////////////////////////////
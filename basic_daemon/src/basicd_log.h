@@ -16,6 +16,9 @@
 #include <stdint.h>
 #include <string>
 
+#include "basicd.h"
+#include "profiled_mutex.h"
+
 using namespace std;
 
 /////////////////////////////////////////////////////////////////////////////
@@ -24,7 +27,11 @@ using namespace std;
 
 #define basicd_log_initialize basicd_log::instance()->initialize
 #define basicd_log_finalize   basicd_log::instance()->finalize
+#define basicd_log_reopen     basicd_log::instance()->reopen
 #define basicd_log_writeln    basicd_log::instance()->writeln
+#define basicd_log_get_level  basicd_log::instance()->get_level
+#define basicd_log_set_level  basicd_log::instance()->set_level
+#define basicd_log_get_stats  basicd_log::instance()->get_stats
 
 /////////////////////////////////////////////////////////////////////////////
 //               Definition of classes
@@ -38,14 +45,28 @@ class basicd_log {
 
   void initialize(string logfile);
   void finalize(void);
+  void reopen(string logfile); // Switch logfile without losing messages
+
+  BASICD_LOG_LEVEL get_level(void);
+  void set_level(BASICD_LOG_LEVEL level);
 
-  void writeln(string str);
+  void get_stats(BASICD_LOG_STATS *stats);
+
+  void writeln(string str);                         // Level info
+  void writeln(BASICD_LOG_LEVEL level, string str); // Skipped above level
 
  private:
   static basicd_log *m_instance;
   string            m_logfile;
   int               m_fd;
-  pthread_mutex_t   m_write_mutex;
+  profiled_mutex    m_write_mutex;
+  int               m_level;       // Read without locks
+
+  // Statistics, ids in the metrics registry
+  int               m_lines_id;
+  int               m_bytes_id;
+  int               m_dropped_id;
+  int               m_suppressed_id;
 
   basicd_log(void); // Private constructor
                     // so it can't be called
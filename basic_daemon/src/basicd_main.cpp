@@ -12,12 +12,32 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/signalfd.h>
 #include <sstream>
 #include <exception>
 
 #include "basicd.h"
 #include "daemon_utility.h"
-#include "delay.h"
+#include "file_watch.h"
+#include "event_loop.h"
+#include "listen_socket.h"
+#include "handoff.h"
+#include "prefork.h"
+#include "request_server.h"
+#include "basicd_ring_server.h"
+#include "basicd_ctrl_server.h"
+#include "basicd_metrics_server.h"
+#include "metrics_registry.h"
+#include "trace.h"
+#include "profiler.h"
 
 using namespace std;
 
@@ -25,20 +45,81 @@ using namespace std;
 //               Definition of macros
 /////////////////////////////////////////////////////////////////////////////
 
+// Bitmask values for configuration changes
+#define CONFIG_CHANGED_START_ONLY   0x01 // Items only valid during start
+#define CONFIG_CHANGED_SUPERVISION  0x02 // Items applied by main loop
+#define CONFIG_CHANGED_CORE         0x04 // Items applied in place by daemon
+
+#define CONFIG_RELOAD_DEBOUNCE  0.2 // Seconds without changes before reload
+
+#define PROCESSES_STOP_TIMEOUT  5.0 // Seconds for processes to terminate
+
+#define WATCHDOG_CHECK_PERIOD  0.1 // Seconds between worker heartbeat checks
+
 /////////////////////////////////////////////////////////////////////////////
 //               Definition of types
 /////////////////////////////////////////////////////////////////////////////
 
+// Record in handoff file, see daemon_upgrade
+typedef struct {
+  int32_t       fd_lock_file;
+  int64_t       start_time;
+  uint32_t      reload_failures;
+  BASICD_CONFIG config;          // Start only items are kept
+} DAEMON_HANDOFF;
+
+// Configuration is returned whole by a control request
+typedef char check_config_size[(sizeof(BASICD_CONFIG) <=
+				BASICD_CTRL_MAX_PAYLOAD) ? 1 : -1];
+
 /////////////////////////////////////////////////////////////////////////////
 //               Function prototypes
 /////////////////////////////////////////////////////////////////////////////
 
 static void daemon_terminate(void);
-static void daemon_signal_handler(int sig);
 static void daemon_exit_on_error(int fd_lock_file);
 static void daemon_report_prod_info(void);
+static void daemon_report_error_stats(void);
+static void daemon_report_startup(void);
+static void daemon_report_health(void);
 static int  daemon_get_config(BASICD_CONFIG *config);
 static int  daemon_check_status(void);
+static void daemon_start_services(void);
+static int  daemon_start_core(void);
+static void daemon_open_endpoints(void);
+static int  daemon_restore(int handoff_fd);
+static void daemon_upgrade(void);
+static int  daemon_lend_socket(const char *address, int backlog);
+static void daemon_supervise(void);
+static unsigned daemon_diff_config(const BASICD_CONFIG *old_config,
+				   const BASICD_CONFIG *new_config);
+static int  daemon_reload(void);
+static void daemon_fail(const char *reason);
+static int  daemon_start_profiler(void);
+static int  daemon_stop_profiler(void);
+static void daemon_on_signal(int fd, uint32_t events, void *arg);
+static void daemon_on_supervision(int fd, uint32_t events, void *arg);
+static void daemon_on_watchdog(int fd, uint32_t events, void *arg);
+static void daemon_on_config_changed(int fd, uint32_t events, void *arg);
+static void daemon_on_reload_timer(int fd, uint32_t events, void *arg);
+static int16_t daemon_on_ctrl_request(uint16_t command,
+				      const uint8_t *req_payload,
+				      uint32_t req_length,
+				      uint8_t *rsp_payload,
+				      uint32_t *rsp_length,
+				      void *arg);
+static unsigned daemon_render_metrics(char *buffer,
+				      unsigned size,
+				      void *arg);
+static void daemon_render_registry(char *buffer,
+				   unsigned size,
+				   unsigned *len);
+static void daemon_on_supervisor_signal(int fd, uint32_t events, void *arg);
+static void daemon_on_supervisor_check(int fd, uint32_t events, void *arg);
+static void daemon_on_process_start(int fd, uint32_t events, void *arg);
+static unsigned daemon_render_supervisor_metrics(char *buffer,
+						 unsigned size,
+						 void *arg);
 
 /////////////////////////////////////////////////////////////////////////////
 //               Global variables
@@ -54,10 +135,31 @@ public:
 // Install as soon as possible, efore main starts
 static the_terminate_handler g_terminate_handler;
 
-static volatile sig_atomic_t g_received_sighup  = 0;
-static volatile sig_atomic_t g_received_sigterm = 0;
-
 static BASICD_CONFIG g_config;
+static int           g_fd_lock_file = DAEMON_BAD_FD_LOCK_FILE;
+
+static event_loop g_event_loop;           // Main supervision and control loop
+static int        g_signal_fd      = -1;  // SIGHUP, SIGTERM, SIGUSR1/2, SIGCHLD
+static int        g_supervision_fd = -1;  // Periodic daemon status check
+static int        g_watchdog_fd    = -1;  // Periodic worker heartbeat check
+static int        g_reload_fd      = -1;  // Debounce of configuration changes
+
+static file_watch g_config_watch;     // Detects changed configuration file
+static basicd_ctrl_server g_ctrl_server; // Control plane
+static basicd_metrics_server g_metrics_server; // Prometheus scrapes
+static time_t     g_start_time;
+static unsigned   g_reload_failures = 0;
+
+static char       g_exe_path[PATH_MAX]; // Executed again on upgrade
+static char     **g_argv;
+
+static unsigned   g_instance = 0; // Process of a supervisor (1..), else 0
+static prefork    g_prefork;      // Supervised processes
+
+// Names of counted events, indexed as BASICD_THREAD_STATS perf_sum
+static const char *g_perf_event_names[BASICD_NR_PERF_COUNTERS] =
+  {"cycles", "instructions", "cache_misses",
+   "branch_misses", "context_switches", "page_faults"};
 
 ////////////////////////////////////////////////////////////////
 
@@ -72,24 +174,18 @@ static void daemon_terminate(void)
 
 ////////////////////////////////////////////////////////////////
 
-static void daemon_signal_handler(int sig)
+static void daemon_exit_on_error(int fd_lock_file)
 {
-  switch (sig) {
-  case SIGHUP:
-    g_received_sighup = 1;
-    break;
-  case SIGTERM:
-    g_received_sigterm = 1;
-    break;
-  default:
-    ;
+  // Report reason, this also reports any pending errors
+  BASICD_STATUS status;
+  if ( (basicd_get_last_error(&status) == BASICD_SUCCESS) &&
+       (status.error_code != BASICD_NO_ERROR) ) {
+    syslog_error("Daemon error, source:%d, code:%ld\n",
+		 status.error_source, status.error_code);
   }
-}
 
-////////////////////////////////////////////////////////////////
+  daemon_report_error_stats();
 
-static void daemon_exit_on_error(int fd_lock_file)
-{
   syslog_info("Terminated bad");
   syslog_close();
 
@@ -115,6 +211,105 @@ static void daemon_report_prod_info(void)
 
 ////////////////////////////////////////////////////////////////
 
+static void daemon_report_error_stats(void)
+{
+  BASICD_ERROR_STATS stats;
+  if (basicd_get_error_stats(&stats) != BASICD_SUCCESS) {
+    syslog_error("Can't get error statistics");
+    return;
+  }
+
+  // Note!!
+  // Newline separator '\\n', see daemon_get_config.
+  // Only counters that are non-zero are reported.
+
+  ostringstream oss_msg;
+  oss_msg << "Error statistics:" << "\\n";
+  for (unsigned src=0; src < BASICD_NR_ERROR_SOURCES; src++) {
+    for (unsigned code=0; code < BASICD_NR_ERROR_CODES; code++) {
+      if (stats.error_cnt[src][code]) {
+	oss_msg << "\tsource:" << src << ", code:" << code
+		<< " => " << stats.error_cnt[src][code] << "\\n";
+      }
+    }
+  }
+  for (unsigned i=0; i < BASICD_NR_THREAD_CODES; i++) {
+    if (stats.thread_rc_cnt[i]) {
+      oss_msg << "\tthread rc:" << -(long)i
+	      << " => " << stats.thread_rc_cnt[i] << "\\n";
+    }
+  }
+  oss_msg << "\n";
+
+  // Print all info
+  syslog_info("%s", oss_msg.str().c_str());
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_report_startup(void)
+{
+  BASICD_STARTUP_STATS stats;
+  char phases[SYSLOG_MAX_MESSAGE_LENGTH / 2];
+  unsigned len = 0;
+
+  basicd_startup_done();
+  if (basicd_get_startup_stats(&stats) != BASICD_SUCCESS) {
+    return;
+  }
+
+  // All phases in one line, milliseconds
+  phases[0] = '\0';
+  for (unsigned i=0; i < stats.nr_phases; i++) {
+    const int n = snprintf(phases + len, sizeof(phases) - len,
+			   "%s%s:%.3f", (i ? " " : ""),
+			   stats.phase[i].name,
+			   stats.phase[i].duration / 1e6);
+    if ( (n < 0) || (len + n >= sizeof(phases)) ) {
+      break;
+    }
+    len += n;
+  }
+  syslog_info("Startup %.3f ms, phases (ms) %s", stats.total / 1e6, phases);
+
+  // Workers are executing and all sockets are open
+  if (notify_service_manager("READY=1\n"
+			     "STATUS=Running, startup %.3f ms\n"
+			     "MAINPID=%d",
+			     stats.total / 1e6, (int) getpid()) != DAEMON_SUCCESS) {
+    syslog_error("Can't notify service manager, code=%d (%s)",
+		 errno, strerror(errno));
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_report_health(void)
+{
+  BASICD_THREAD_STATS thread_stats;
+  BASICD_ERROR_STATS error_stats;
+  uint64_t errors = 0;
+
+  // Status already checked, so these can't fail
+  memset(&thread_stats, 0, sizeof(thread_stats));
+  basicd_get_thread_stats(&thread_stats);
+  if (basicd_get_error_stats(&error_stats) == BASICD_SUCCESS) {
+    for (unsigned src=0; src < BASICD_NR_ERROR_SOURCES; src++) {
+      for (unsigned code=0; code < BASICD_NR_ERROR_CODES; code++) {
+	errors += error_stats.error_cnt[src][code];
+      }
+    }
+  }
+
+  // Read by the supervisor
+  prefork_child_heartbeat(1.0 / g_config.supervision_freq,
+			  thread_stats.cycles,
+			  thread_stats.overruns,
+			  errors);
+}
+
+////////////////////////////////////////////////////////////////
+
 static int daemon_get_config(BASICD_CONFIG *config)
 {
   if (basicd_get_config(config) != BASICD_SUCCESS) {
@@ -138,8 +333,24 @@ static int daemon_get_config(BASICD_CONFIG *config)
   oss_msg << "\tuser     :" << config->user << "\\n";
   oss_msg << "\twork_dir :" << config->work_dir << "\\n";
   oss_msg << "\tlock_file:" << config->lock_file  << "\\n";
+  oss_msg << "\tctrl_sock:" << config->ctrl_socket  << "\\n";
+  oss_msg << "\tmetrics  :" << config->metrics_address  << "\\n";
+  oss_msg << "\tserver   :" << config->server_address  << "\\n";
+  oss_msg << "\tsrv_wrks :" << config->server_workers  << "\\n";
+  oss_msg << "\trings    :" << config->ring_socket  << "\\n";
+  oss_msg << "\tprocs    :" << config->processes  << "\\n";
+  oss_msg << "\tpin_procs:" << config->pin_processes  << "\\n";
   oss_msg << "\tlog_file :" << config->log_file  << "\\n";
   oss_msg << "\tsup_freq :" << config->supervision_freq << "\\n";
+  oss_msg << "\twd_prds  :" << config->watchdog_periods << "\\n";
+  oss_msg << "\twd_rstrt :" << config->watchdog_restart << "\\n";
+  oss_msg << "\ttracing  :" << config->tracing << "\\n";
+  oss_msg << "\ttrc_file :" << config->trace_file << "\\n";
+  oss_msg << "\tperf_cnt :" << config->perf_counters << "\\n";
+  oss_msg << "\tprf_freq :" << config->profiler_freq << "\\n";
+  oss_msg << "\tprf_file :" << config->profile_file << "\\n";
+  oss_msg << "\tlck_prof :" << config->lock_profiling << "\\n";
+  oss_msg << "\tlck_adpt :" << config->adaptive_locks << "\\n";
   oss_msg << "\twt_freq  :" << config->worker_thread_freq << "\n";
 
   // Print all info
@@ -176,105 +387,1285 @@ static int daemon_check_status(void)
 
 ////////////////////////////////////////////////////////////////
 
-int main(int argc, char *argv[])
+static void daemon_start_services(void)
 {
-  long rc;
-  int fd_lock_file = DAEMON_BAD_FD_LOCK_FILE;
+  BASICD_STATUS status;
 
-  // Initialize handling of messages sent to system logger
-  syslog_open(BASICD_NAME);
+  // Daemon keeps running without these services.
+  // Errors are consumed, or supervision will terminate daemon.
 
-  // Report product number and the RState
-  daemon_report_prod_info();
+  if ( strcmp(g_config.server_address, "none") &&
+       (basicd_start_server(g_config.server_address,
+			    g_config.server_workers) != BASICD_SUCCESS) ) {
+    basicd_get_last_error(&status);
+    syslog_error("Can't start request server %s, source:%d, code:%ld\n",
+		 g_config.server_address,
+		 status.error_source, status.error_code);
+  }
 
-  // Read configuration file
-  if (!daemon_get_config(&g_config)) {
-    daemon_exit_on_error(fd_lock_file);
+  if ( strcmp(g_config.ring_socket, "none") &&
+       (basicd_start_rings(g_config.ring_socket) != BASICD_SUCCESS) ) {
+    basicd_get_last_error(&status);
+    syslog_error("Can't start rings %s, source:%d, code:%ld\n",
+		 g_config.ring_socket,
+		 status.error_source, status.error_code);
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static int daemon_start_core(void)
+{
+  // Before threads are started, to include their setup
+  basicd_set_tracing(g_config.tracing);
+  basicd_set_lock_profiling(g_config.lock_profiling);
+  basicd_set_adaptive_locks(g_config.adaptive_locks);
+
+  if (basicd_initialize(g_config.log_file,
+			g_config.worker_thread_freq) != BASICD_SUCCESS) {
+    return 0;
+  }
+  basicd_set_perf_counters(g_config.perf_counters);
+  basicd_startup_phase("services");
+  daemon_start_services();
+
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_open_endpoints(void)
+{
+  char ctrl_socket[sizeof(BASICD_STRING) + 16];
+
+  // Each process of a supervisor has its own control socket
+  if (g_instance) {
+    snprintf(ctrl_socket, sizeof(ctrl_socket), "%s.%u",
+	     g_config.ctrl_socket, g_instance);
+  }
+  else {
+    snprintf(ctrl_socket, sizeof(ctrl_socket), "%s", g_config.ctrl_socket);
   }
 
-  // Define handler for SIGHUP to tell daemon to restart.
-  // The daemon will reread its configuration file and
-  // reopen its log file
-  rc = define_signal_handler(SIGHUP, daemon_signal_handler);
-  if (rc != DAEMON_SUCCESS) {
-    daemon_exit_on_error(fd_lock_file);
+  // Serve control requests from local clients
+  if (g_ctrl_server.open(ctrl_socket,
+			 &g_event_loop,
+			 daemon_on_ctrl_request,
+			 NULL) != BASICD_CTRL_SERVER_SUCCESS) {
+    syslog_error("Can't open control socket %s, code=%d (%s)",
+		 ctrl_socket, errno, strerror(errno));
   }
 
-  // Define handler for SIGTERM to tell daemon to terminate.  
-  rc = define_signal_handler(SIGTERM, daemon_signal_handler);
-  if (rc != DAEMON_SUCCESS) {
-    daemon_exit_on_error(fd_lock_file);
+  // Serve metrics to a local Prometheus scraper,
+  // the supervisor serves metrics of all processes
+  if ( (!g_instance) && strcmp(g_config.metrics_address, "none") ) {
+    if (g_metrics_server.open(g_config.metrics_address,
+			      &g_event_loop,
+			      daemon_render_metrics,
+			      NULL) != BASICD_METRICS_SERVER_SUCCESS) {
+      syslog_error("Can't open metrics address %s, code=%d (%s)",
+		   g_config.metrics_address, errno, strerror(errno));
+    }
   }
-  
-  // Go through the steps in becoming a daemon (or not)
-  if (g_config.daemonize) {
-    rc = become_daemon(g_config.user,
-		       g_config.work_dir,
-		       g_config.lock_file,		     
-		       &fd_lock_file);
-    if (rc != DAEMON_SUCCESS) {
-      daemon_exit_on_error(fd_lock_file);
+
+  // Sockets of a previous image that are no longer configured
+  close_unused_listen_sockets();
+}
+
+////////////////////////////////////////////////////////////////
+
+static int daemon_restore(int handoff_fd)
+{
+  DAEMON_HANDOFF record;
+  BASICD_STATUS status;
+
+  // Started by a supervisor, as one of its processes
+  g_instance = prefork_child_inherit(handoff_fd);
+
+  if (handoff_get(handoff_fd, HANDOFF_TAG_DAEMON,
+		  &record, sizeof(record)) == HANDOFF_SUCCESS) {
+    // Already running as a daemon, with the lock file held
+    g_fd_lock_file    = record.fd_lock_file;
+    g_start_time      = record.start_time;
+    g_reload_failures = record.reload_failures;
+    if (g_fd_lock_file != DAEMON_BAD_FD_LOCK_FILE) {
+      fcntl(g_fd_lock_file, F_SETFD, FD_CLOEXEC);
+    }
+
+    // Start only items, as when previous image was started
+    g_config.daemonize     = record.config.daemonize;
+    g_config.processes     = record.config.processes;
+    g_config.pin_processes = record.config.pin_processes;
+    memcpy(g_config.user,      record.config.user,      sizeof(BASICD_STRING));
+    memcpy(g_config.work_dir,  record.config.work_dir,  sizeof(BASICD_STRING));
+    memcpy(g_config.lock_file, record.config.lock_file, sizeof(BASICD_STRING));
+
+    // Not fatal, statistics start from zero
+    if (basicd_handoff_restore(handoff_fd) != BASICD_SUCCESS) {
+      basicd_get_last_error(&status);
+      syslog_error("Can't restore core state, source:%d, code:%ld\n",
+		   status.error_source, status.error_code);
     }
+    syslog_info("Started, taking over from previous image");
+  }
+  else if (g_instance && (errno == ENOENT)) {
+    // First image of the process, the supervisor is the daemon
+    g_start_time = time(NULL);
+    syslog_info("Started, process %u", g_instance);
+  }
+  else {
+    syslog_error("Can't restore handoff state, code=%d (%s)",
+		 errno, strerror(errno));
+    return 0;
   }
-  
-  // We are now running as a daemon (or not)
-  syslog_info("Started");
 
-  // Initialize daemon
-  if (basicd_initialize(g_config.log_file,
-			g_config.worker_thread_freq) != BASICD_SUCCESS) {
-    daemon_exit_on_error(fd_lock_file);
+  // Not fatal, new sockets are opened
+  if (restore_listen_sockets(handoff_fd) != LISTEN_SOCKET_SUCCESS) {
+    syslog_error("Can't restore listening sockets, code=%d (%s)",
+		 errno, strerror(errno));
   }
 
-  // Daemon main supervision and control loop
-  for (;;) {
-    // Check if time to restart
-    if (g_received_sighup) {
-      syslog_info("Got SIGHUP, restarting");
-      g_received_sighup = 0;
-      // Finalize
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_upgrade(void)
+{
+  DAEMON_HANDOFF record;
+  BASICD_STATUS status;
+
+  // The binary is normally replaced on disk by now
+  if ( (!g_exe_path[0]) || (access(g_exe_path, X_OK) == -1) ) {
+    syslog_error("Can't upgrade, '%s' not executable", g_exe_path);
+    return;
+  }
+
+  const int handoff_fd = handoff_create();
+  if (handoff_fd == -1) {
+    syslog_error("Can't create handoff file, code=%d (%s)",
+		 errno, strerror(errno));
+    return;
+  }
+
+  // Listening sockets stay open from here, connections
+  // are queued until accepted by the new image
+  notify_service_manager("RELOADING=1\nSTATUS=Upgrading");
+  handoff_listen_sockets(true);
+  g_metrics_server.close();
+  g_ctrl_server.close();
+
+  memset(&record, 0, sizeof(record));
+  record.fd_lock_file    = g_fd_lock_file;
+  record.start_time      = g_start_time;
+  record.reload_failures = g_reload_failures;
+  record.config          = g_config;
+
+  if (basicd_handoff_save(handoff_fd) != BASICD_SUCCESS) {
+    basicd_get_last_error(&status);
+    syslog_error("Can't save core state, source:%d, code:%ld\n",
+		 status.error_source, status.error_code);
+  }
+  else if ( (handoff_put(handoff_fd, HANDOFF_TAG_DAEMON,
+			 &record, sizeof(record)) != HANDOFF_SUCCESS) ||
+	    (save_listen_sockets(handoff_fd) != LISTEN_SOCKET_SUCCESS) ||
+	    (prefork_child_save(handoff_fd) != PREFORK_SUCCESS) ||
+	    ( (g_fd_lock_file != DAEMON_BAD_FD_LOCK_FILE) &&
+	      (handoff_keep_fd(g_fd_lock_file) != HANDOFF_SUCCESS) ) ) {
+    syslog_error("Can't save handoff state, code=%d (%s)",
+		 errno, strerror(errno));
+  }
+  else {
+    syslog_info("Upgrading, executing %s", g_exe_path);
+    handoff_exec(handoff_fd, g_exe_path, g_argv);
+    syslog_error("Can't execute %s, code=%d (%s)",
+		 g_exe_path, errno, strerror(errno));
+  }
+
+  // Still this image, take over what was handed over
+  syslog_info("Upgrade failed, continuing");
+  if (g_fd_lock_file != DAEMON_BAD_FD_LOCK_FILE) {
+    fcntl(g_fd_lock_file, F_SETFD, FD_CLOEXEC);
+  }
+  handoff_listen_sockets(false);
+  if (basicd_handoff_restore(handoff_fd) != BASICD_SUCCESS) {
+    basicd_get_last_error(&status); // Statistics start from zero
+  }
+  close(handoff_fd);
+
+  if (!daemon_start_core()) {
+    daemon_fail("Upgrade failed");
+  }
+  daemon_open_endpoints();
+  notify_service_manager("READY=1\nSTATUS=Running, upgrade failed");
+}
+
+////////////////////////////////////////////////////////////////
+
+static int daemon_lend_socket(const char *address, int backlog)
+{
+  if (!strcmp(address, "none")) {
+    return -1;
+  }
+
+  // Connections are accepted by any of the processes
+  const int fd = open_listen_socket(address, 0, backlog);
+  if (fd == -1) {
+    syslog_error("Can't open %s for processes, code=%d (%s)",
+		 address, errno, strerror(errno));
+    return -1;
+  }
+  lend_listen_socket(fd);
+
+  return fd;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_supervise(void)
+{
+  // Note!!
+  // The supervisor never initializes the daemon core, and stays
+  // single threaded. Each process is started with fork and exec.
+
+  basicd_startup_phase("processes");
+  const int server_fd = daemon_lend_socket(g_config.server_address,
+					   REQUEST_SERVER_MAX_CONNECTIONS);
+  const int rings_fd  = daemon_lend_socket(g_config.ring_socket,
+					   BASICD_RING_SERVER_MAX_CLIENTS);
+
+  if (g_prefork.open(g_config.processes,
+		     g_config.pin_processes,
+		     g_exe_path,
+		     g_argv) != PREFORK_SUCCESS) {
+    syslog_error("Can't supervise processes, code=%d (%s)",
+		 errno, strerror(errno));
+    daemon_exit_on_error(g_fd_lock_file);
+  }
+  g_prefork.start_due();
+
+  // Supervision and metrics of all processes
+  basicd_startup_phase("main_loop");
+  g_supervision_fd = create_timer_fd();
+  if ( (g_event_loop.open() != EVENT_LOOP_SUCCESS) ||
+       (g_supervision_fd == -1) ) {
+    syslog_error("Can't create event loop, code=%d (%s)",
+		 errno, strerror(errno));
+    daemon_fail("Event loop failed");
+  }
+
+  const double supervision_period = 1.0 / g_config.supervision_freq;
+  if ( (set_timer_fd(g_supervision_fd,
+		     supervision_period,
+		     supervision_period) != EVENT_LOOP_SUCCESS) ||
+       (g_event_loop.add_fd(g_signal_fd, EPOLLIN,
+			    daemon_on_supervisor_signal,
+			    NULL) != EVENT_LOOP_SUCCESS) ||
+       (g_event_loop.add_fd(g_supervision_fd, EPOLLIN,
+			    daemon_on_supervisor_check,
+			    NULL) != EVENT_LOOP_SUCCESS) ||
+       (g_event_loop.add_fd(g_prefork.get_fd(), EPOLLIN,
+			    daemon_on_process_start,
+			    NULL) != EVENT_LOOP_SUCCESS) ) {
+    syslog_error("Can't add to event loop, code=%d (%s)",
+		 errno, strerror(errno));
+    daemon_fail("Event loop failed");
+  }
+
+  if ( strcmp(g_config.metrics_address, "none") &&
+       (g_metrics_server.open(g_config.metrics_address,
+			      &g_event_loop,
+			      daemon_render_supervisor_metrics,
+			      NULL) != BASICD_METRICS_SERVER_SUCCESS) ) {
+    syslog_error("Can't open metrics address %s, code=%d (%s)",
+		 g_config.metrics_address, errno, strerror(errno));
+  }
+
+  // Processes are started, not necessarily ready
+  daemon_report_startup();
+
+  // Returns on SIGTERM
+  if (g_event_loop.run() != EVENT_LOOP_SUCCESS) {
+    syslog_error("Error when wait, code=%d (%s)", errno, strerror(errno));
+    g_prefork.stop(PROCESSES_STOP_TIMEOUT);
+    daemon_exit_on_error(g_fd_lock_file);
+  }
+
+  // Cleanup and exit
+  g_metrics_server.close();
+  g_prefork.stop(PROCESSES_STOP_TIMEOUT);
+  g_prefork.close();
+  if (server_fd != -1) {
+    close_listen_socket(server_fd);
+  }
+  if (rings_fd != -1) {
+    close_listen_socket(rings_fd);
+  }
+  g_event_loop.close();
+  close(g_supervision_fd);
+  close(g_signal_fd);
+
+  syslog_info("Terminated ok");
+  syslog_close();
+
+  if (g_fd_lock_file != DAEMON_BAD_FD_LOCK_FILE) {
+    close(g_fd_lock_file);
+    unlink(g_config.lock_file);
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+////////////////////////////////////////////////////////////////
+
+static unsigned daemon_diff_config(const BASICD_CONFIG *old_config,
+				   const BASICD_CONFIG *new_config)
+{
+  unsigned changed = 0;
+
+  if ( (old_config->daemonize != new_config->daemonize) ||
+       strcmp(old_config->user,      new_config->user) ||
+       strcmp(old_config->work_dir,  new_config->work_dir) ||
+       strcmp(old_config->lock_file, new_config->lock_file) ||
+       strcmp(old_config->ctrl_socket, new_config->ctrl_socket) ||
+       strcmp(old_config->metrics_address, new_config->metrics_address) ||
+       strcmp(old_config->server_address, new_config->server_address) ||
+       (old_config->server_workers != new_config->server_workers) ||
+       strcmp(old_config->ring_socket, new_config->ring_socket) ||
+       (old_config->processes != new_config->processes) ||
+       (old_config->pin_processes != new_config->pin_processes) ) {
+    changed |= CONFIG_CHANGED_START_ONLY;
+  }
+
+  if ( (old_config->supervision_freq != new_config->supervision_freq) ||
+       (old_config->watchdog_periods != new_config->watchdog_periods) ||
+       (old_config->watchdog_restart != new_config->watchdog_restart) ||
+       (old_config->tracing != new_config->tracing) ||
+       strcmp(old_config->trace_file, new_config->trace_file) ||
+       (old_config->perf_counters != new_config->perf_counters) ||
+       (old_config->profiler_freq != new_config->profiler_freq) ||
+       strcmp(old_config->profile_file, new_config->profile_file) ||
+       (old_config->lock_profiling != new_config->lock_profiling) ||
+       (old_config->adaptive_locks != new_config->adaptive_locks) ) {
+    changed |= CONFIG_CHANGED_SUPERVISION;
+  }
+
+  if ( strcmp(old_config->log_file, new_config->log_file) ||
+       (old_config->worker_thread_freq != new_config->worker_thread_freq) ) {
+    changed |= CONFIG_CHANGED_CORE;
+  }
+
+  return changed;
+}
+
+////////////////////////////////////////////////////////////////
+
+static int daemon_reload(void)
+{
+  BASICD_CONFIG new_config;
+
+  // Read configuration file,
+  // a bad file is reported but keeps current configuration
+  if (!daemon_get_config(&new_config)) {
+    g_reload_failures++;
+    syslog_error("Reload failed, keeping current configuration, failures:%u",
+		 g_reload_failures);
+    notify_service_manager("STATUS=Running, reload failed (%u)",
+			   g_reload_failures);
+    return 1;
+  }
+
+  // Only apply what has changed
+  const unsigned changed = daemon_diff_config(&g_config, &new_config);
+
+  if (!changed) {
+    syslog_info("Configuration unchanged");
+    return 1;
+  }
+
+  if (changed & CONFIG_CHANGED_START_ONLY) {
+    syslog_info("Changed daemonize, user, work_dir, lock_file, "
+		"ctrl_socket, metrics_address, server_address, "
+		"server_workers, ring_socket, processes or pin_processes "
+		"requires a new start, ignored");
+  }
+
+  if (changed & CONFIG_CHANGED_SUPERVISION) {
+    g_config.supervision_freq = new_config.supervision_freq;
+    g_config.watchdog_periods = new_config.watchdog_periods;
+    g_config.watchdog_restart = new_config.watchdog_restart;
+    g_config.tracing = new_config.tracing;
+    strncpy(g_config.trace_file, new_config.trace_file, sizeof(BASICD_STRING));
+    basicd_set_tracing(g_config.tracing);
+    g_config.perf_counters = new_config.perf_counters;
+    basicd_set_perf_counters(g_config.perf_counters);
+    g_config.profiler_freq = new_config.profiler_freq;
+    strncpy(g_config.profile_file, new_config.profile_file,
+	    sizeof(BASICD_STRING));
+    g_config.lock_profiling = new_config.lock_profiling;
+    basicd_set_lock_profiling(g_config.lock_profiling);
+    g_config.adaptive_locks = new_config.adaptive_locks;
+    basicd_set_adaptive_locks(g_config.adaptive_locks);
+    const double supervision_period = 1.0 / g_config.supervision_freq;
+    if (set_timer_fd(g_supervision_fd,
+		     supervision_period,
+		     supervision_period) != EVENT_LOOP_SUCCESS) {
+      return 0;
+    }
+  }
+
+  if (changed & CONFIG_CHANGED_CORE) {
+    strncpy(g_config.log_file, new_config.log_file, sizeof(BASICD_STRING));
+    g_config.worker_thread_freq = new_config.worker_thread_freq;
+
+    // Apply in place, worker thread keeps running
+    if (basicd_reconfigure(&g_config) != BASICD_SUCCESS) {
+      // Consume the error, or supervision will terminate daemon
+      BASICD_STATUS status;
+      basicd_get_last_error(&status);
+      syslog_error("Reconfigure failed, source:%d, code:%ld, restarting\n",
+		   status.error_source, status.error_code);
+
+      // Fall back to a restart of the daemon core
       if (basicd_finalize() != BASICD_SUCCESS) {
-	daemon_exit_on_error(fd_lock_file);
+	return 0;
       }
-      // Read configuration file
-      if (!daemon_get_config(&g_config)) {
-	daemon_exit_on_error(fd_lock_file);
-      }
-      // Initialize
-      if (basicd_initialize(g_config.log_file,
-			    g_config.worker_thread_freq) != BASICD_SUCCESS) {
-	daemon_exit_on_error(fd_lock_file);
+      if (!daemon_start_core()) {
+	return 0;
       }
     }
-    // Check if time to quit
-    if (g_received_sigterm) {
+  }
+
+  syslog_info("Configuration reloaded, changes:0x%x", changed);
+
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_fail(const char *reason)
+{
+  syslog_info("%s, terminating", reason);
+  basicd_finalize();
+  daemon_exit_on_error(g_fd_lock_file);
+}
+
+////////////////////////////////////////////////////////////////
+
+static int daemon_start_profiler(void)
+{
+  if (basicd_start_profiler(g_config.profiler_freq) != BASICD_SUCCESS) {
+    // Consume the error, or supervision will terminate daemon
+    BASICD_STATUS status;
+    basicd_get_last_error(&status);
+    syslog_error("Start profiler failed, source:%d, code:%ld\n",
+		 status.error_source, status.error_code);
+    return 0;
+  }
+  syslog_info("Profiler started, %d Hz", g_config.profiler_freq);
+
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////
+
+static int daemon_stop_profiler(void)
+{
+  if (basicd_stop_profiler(g_config.profile_file) != BASICD_SUCCESS) {
+    // Consume the error, or supervision will terminate daemon
+    BASICD_STATUS status;
+    basicd_get_last_error(&status);
+    syslog_error("Stop profiler failed, source:%d, code:%ld\n",
+		 status.error_source, status.error_code);
+    return 0;
+  }
+  syslog_info("Profiler stopped, written to %s", g_config.profile_file);
+
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_on_signal(int fd, uint32_t events, void *arg)
+{
+  struct signalfd_siginfo info;
+
+  // Several signals may be queued
+  while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+    switch (info.ssi_signo) {
+    case SIGHUP:
+      // Reread configuration file and apply
+      // what has changed, without restarting threads
+      syslog_info("Got SIGHUP, reloading configuration");
+      clear_timer_fd(g_reload_fd); // Pending file change included
+      if (!daemon_reload()) {
+	daemon_fail("Reload failed");
+      }
+      break;
+    case SIGUSR2:
+      // Execute binary again, which takes over without
+      // restarting. Only returns if that fails.
+      syslog_info("Got SIGUSR2, upgrading");
+      daemon_upgrade();
+      break;
+    case SIGUSR1:
+      // Start profiler, or stop it and write the profile
+      if (profiler_is_running()) {
+	daemon_stop_profiler();
+      }
+      else {
+	daemon_start_profiler();
+      }
+      break;
+    case SIGTERM:
       syslog_info("Got SIGTERM, terminating");
-      g_received_sigterm = 0;
+      notify_service_manager("STOPPING=1");
       if (basicd_finalize() != BASICD_SUCCESS) {
-	daemon_exit_on_error(fd_lock_file);
+	daemon_exit_on_error(g_fd_lock_file);
       }
+      g_event_loop.stop();
+      return;
+    default:
+      ;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_on_supervision(int fd, uint32_t events, void *arg)
+{
+  uint64_t expirations;
+
+  if (read_timer_fd(fd, &expirations) != EVENT_LOOP_SUCCESS) {
+    daemon_fail("Error reading supervision timer");
+  }
+
+  if (expirations && !daemon_check_status()) {
+    daemon_fail("Daemon status not OK");
+  }
+
+  if (expirations && g_instance) {
+    daemon_report_health();
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_on_watchdog(int fd, uint32_t events, void *arg)
+{
+  uint64_t expirations;
+
+  if (read_timer_fd(fd, &expirations) != EVENT_LOOP_SUCCESS) {
+    daemon_fail("Error reading watchdog timer");
+  }
+
+  if ( expirations && g_config.watchdog_periods &&
+       (basicd_check_heartbeat(g_config.watchdog_periods) != BASICD_SUCCESS) ) {
+    // Consume the error, a stall is reported once and
+    // supervision terminates the daemon only if configured
+    BASICD_STATUS status;
+    basicd_get_last_error(&status);
+    syslog_error("Worker thread stalled, source:%d, code:%ld\n",
+		 status.error_source, status.error_code);
+    if (g_config.watchdog_restart) {
+      daemon_fail("Worker thread stalled");
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_on_config_changed(int fd, uint32_t events, void *arg)
+{
+  bool changed;
+
+  if (g_config_watch.check_changed(changed) != FILE_WATCH_SUCCESS) {
+    syslog_error("Error reading configuration file events, "
+		 "code=%d (%s)", errno, strerror(errno));
+    g_event_loop.remove_fd(fd);
+    g_config_watch.close();
+    return;
+  }
+
+  // Editors may write several times, so wait until
+  // file has been left alone for a while.
+  if (changed) {
+    if (set_timer_fd(g_reload_fd,
+		     CONFIG_RELOAD_DEBOUNCE, 0.0) != EVENT_LOOP_SUCCESS) {
+      daemon_fail("Error arming reload timer");
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_on_reload_timer(int fd, uint32_t events, void *arg)
+{
+  uint64_t expirations;
+
+  if (read_timer_fd(fd, &expirations) != EVENT_LOOP_SUCCESS) {
+    daemon_fail("Error reading reload timer");
+  }
+
+  if (expirations) {
+    syslog_info("Configuration file changed, reloading configuration");
+    if (!daemon_reload()) {
+      daemon_fail("Reload failed");
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static int16_t daemon_on_ctrl_request(uint16_t command,
+				      const uint8_t *req_payload,
+				      uint32_t req_length,
+				      uint8_t *rsp_payload,
+				      uint32_t *rsp_length,
+				      void *arg)
+{
+  // Note!!
+  // Executed in the main loop, no allocations on this path.
+  // A failed call leaves its error to be found by supervision.
+
+  switch (command) {
+  case BASICD_CTRL_GET_PROD_INFO:
+    {
+      BASICD_PROD_INFO prod_info;
+      basicd_get_prod_info(&prod_info);
+      memcpy(rsp_payload, &prod_info, sizeof(prod_info));
+      *rsp_length = sizeof(prod_info);
+    }
+    break;
+  case BASICD_CTRL_GET_CONFIG:
+    // The configuration in use, not what is in the file right now
+    memcpy(rsp_payload, &g_config, sizeof(g_config));
+    *rsp_length = sizeof(g_config);
+    break;
+  case BASICD_CTRL_CHECK_RUN_STATUS:
+    if (basicd_check_run_status() != BASICD_SUCCESS) {
+      return BASICD_CTRL_FAILED;
+    }
+    break;
+  case BASICD_CTRL_GET_THREAD_STATS:
+    {
+      BASICD_THREAD_STATS stats;
+      if (basicd_get_thread_stats(&stats) != BASICD_SUCCESS) {
+	return BASICD_CTRL_FAILED;
+      }
+      memcpy(rsp_payload, &stats, sizeof(stats));
+      *rsp_length = sizeof(stats);
+    }
+    break;
+  case BASICD_CTRL_GET_LOG_LEVEL:
+    {
+      BASICD_LOG_LEVEL level;
+      basicd_get_log_level(&level);
+      const uint32_t value = level;
+      memcpy(rsp_payload, &value, sizeof(value));
+      *rsp_length = sizeof(value);
+    }
+    break;
+  case BASICD_CTRL_SET_LOG_LEVEL:
+    {
+      uint32_t value;
+      if (req_length != sizeof(value)) {
+	return BASICD_CTRL_BAD_PAYLOAD;
+      }
+      memcpy(&value, req_payload, sizeof(value));
+      if (value > BASICD_LOG_DEBUG) {
+	return BASICD_CTRL_BAD_PAYLOAD;
+      }
+      basicd_set_log_level((BASICD_LOG_LEVEL) value);
+      syslog_info("Log level set to %u", value);
+    }
+    break;
+  case BASICD_CTRL_DUMP_TRACE:
+    // Writes a file, allocates, only for debugging
+    if (basicd_dump_trace(g_config.trace_file) != BASICD_SUCCESS) {
+      // Consume the error, or supervision will terminate daemon
+      BASICD_STATUS status;
+      basicd_get_last_error(&status);
+      syslog_error("Dump trace failed, source:%d, code:%ld\n",
+		   status.error_source, status.error_code);
+      return BASICD_CTRL_FAILED;
+    }
+    break;
+  case BASICD_CTRL_START_PROFILER:
+    if (!daemon_start_profiler()) {
+      return BASICD_CTRL_FAILED;
+    }
+    break;
+  case BASICD_CTRL_STOP_PROFILER:
+    // Writes a file, allocates, only for debugging
+    if (!daemon_stop_profiler()) {
+      return BASICD_CTRL_FAILED;
+    }
+    break;
+  case BASICD_CTRL_GET_LOCK_REPORT:
+    // Text, truncated to fit
+    basicd_get_lock_report((char *)rsp_payload, BASICD_CTRL_MAX_PAYLOAD);
+    *rsp_length = strlen((char *)rsp_payload) + 1;
+    break;
+  case BASICD_CTRL_RELOAD:
+    {
+      syslog_info("Got control request, reloading configuration");
+      const unsigned failures = g_reload_failures;
+      clear_timer_fd(g_reload_fd); // Pending file change included
+      if (!daemon_reload()) {
+	daemon_fail("Reload failed");
+      }
+      if (g_reload_failures != failures) {
+	return BASICD_CTRL_FAILED; // Bad file, configuration kept
+      }
+    }
+    break;
+  default:
+    return BASICD_CTRL_BAD_COMMAND;
+  }
+
+  return BASICD_CTRL_OK;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void metrics_printf(char *buffer, unsigned size, unsigned *len,
+			   const char *format, ...)
+{
+  if (*len >= size) {
+    return; // Already full
+  }
+
+  va_list ap;
+  va_start(ap, format);
+  const int n = vsnprintf(buffer + *len, size - *len, format, ap);
+  va_end(ap);
+
+  *len = ( (n < 0) ? size : *len + n ); // Truncated => full
+}
+
+////////////////////////////////////////////////////////////////
+
+static unsigned daemon_render_metrics(char *buffer,
+				      unsigned size,
+				      void *arg)
+{
+  // Note!!
+  // Executed in the main loop, no allocations on this path.
+  // Text exposition format, see prometheus.io/docs/instrumenting
+
+  unsigned len = 0;
+
+  metrics_printf(buffer, size, &len,
+		 "# TYPE basicd_up gauge\n"
+		 "basicd_up 1\n"
+		 "# TYPE process_start_time_seconds gauge\n"
+		 "process_start_time_seconds %ld\n",
+		 (long) g_start_time);
+
+  struct timespec cpu_time;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_time) == 0) {
+    metrics_printf(buffer, size, &len,
+		   "# TYPE process_cpu_seconds_total counter\n"
+		   "process_cpu_seconds_total %ld.%09ld\n",
+		   (long) cpu_time.tv_sec, cpu_time.tv_nsec);
+  }
+
+  metrics_printf(buffer, size, &len,
+		 "# TYPE basicd_config_reload_failures_total counter\n"
+		 "basicd_config_reload_failures_total %u\n",
+		 g_reload_failures);
+
+  // Worker thread
+  BASICD_THREAD_STATS thread_stats;
+  if (basicd_get_thread_stats(&thread_stats) == BASICD_SUCCESS) {
+    const char *name = thread_stats.name;
+    metrics_printf(buffer, size, &len,
+		   "# TYPE basicd_thread_state gauge\n"
+		   "basicd_thread_state{thread=\"%s\"} %u\n"
+		   "# TYPE basicd_thread_frequency_hz gauge\n"
+		   "basicd_thread_frequency_hz{thread=\"%s\"} %g\n"
+		   "# TYPE basicd_thread_cycles_total counter\n"
+		   "basicd_thread_cycles_total{thread=\"%s\"} %llu\n"
+		   "# TYPE basicd_thread_overruns_total counter\n"
+		   "basicd_thread_overruns_total{thread=\"%s\"} %llu\n"
+		   "# TYPE basicd_thread_cpu_seconds_total counter\n"
+		   "basicd_thread_cpu_seconds_total{thread=\"%s\"} %.9f\n"
+		   "# TYPE basicd_thread_wakeup_latency_max_seconds gauge\n"
+		   "basicd_thread_wakeup_latency_max_seconds{thread=\"%s\"} %.9f\n"
+		   "# TYPE basicd_thread_heartbeat_age_seconds gauge\n"
+		   "basicd_thread_heartbeat_age_seconds{thread=\"%s\"} %.9f\n",
+		   name, thread_stats.state,
+		   name, thread_stats.frequency,
+		   name, thread_stats.cycles,
+		   name, thread_stats.overruns,
+		   name, thread_stats.cpu_time / 1e9,
+		   name, thread_stats.wakeup_latency_max / 1e9,
+		   name, thread_stats.heartbeat_age / 1e9);
+
+    // Buckets are cumulative, bucket i ends at 10^i us
+    metrics_printf(buffer, size, &len,
+		   "# TYPE basicd_thread_exec_seconds histogram\n");
+    unsigned long long count = 0;
+    double bound = 1e-6;
+    for (unsigned i=0; i < BASICD_NR_EXEC_TIME_BUCKETS - 1; i++) {
+      count += thread_stats.exec_time_hist[i];
+      metrics_printf(buffer, size, &len,
+		     "basicd_thread_exec_seconds_bucket"
+		     "{thread=\"%s\",le=\"%g\"} %llu\n",
+		     name, bound, count);
+      bound *= 10.0;
+    }
+    metrics_printf(buffer, size, &len,
+		   "basicd_thread_exec_seconds_bucket"
+		   "{thread=\"%s\",le=\"+Inf\"} %llu\n"
+		   "basicd_thread_exec_seconds_sum{thread=\"%s\"} %.9f\n"
+		   "basicd_thread_exec_seconds_count{thread=\"%s\"} %llu\n",
+		   name, thread_stats.cycles,
+		   name, thread_stats.exec_time_sum / 1e9,
+		   name, thread_stats.cycles);
+
+    // Events during cyclic work, only those counted
+    bool first = true;
+    for (unsigned i=0; i < BASICD_NR_PERF_COUNTERS; i++) {
+      if (!(thread_stats.perf_available & (1 << i))) {
+	continue;
+      }
+      if (first) {
+	metrics_printf(buffer, size, &len,
+		       "# TYPE basicd_thread_perf_events_total counter\n");
+	first = false;
+      }
+      metrics_printf(buffer, size, &len,
+		     "basicd_thread_perf_events_total"
+		     "{thread=\"%s\",event=\"%s\"} %llu\n",
+		     name, g_perf_event_names[i], thread_stats.perf_sum[i]);
+    }
+  }
+
+  // Record rings
+  BASICD_RING_STATS ring_stats;
+  if (basicd_get_ring_stats(&ring_stats) == BASICD_SUCCESS) {
+    metrics_printf(buffer, size, &len,
+		   "# TYPE basicd_ring_clients gauge\n"
+		   "basicd_ring_clients %u\n"
+		   "# TYPE basicd_ring_records_total counter\n"
+		   "basicd_ring_records_total %llu\n"
+		   "# TYPE basicd_ring_bytes_total counter\n"
+		   "basicd_ring_bytes_total %llu\n"
+		   "# TYPE basicd_ring_bad_records_total counter\n"
+		   "basicd_ring_bad_records_total %llu\n"
+		   "# TYPE basicd_ring_doorbells_total counter\n"
+		   "basicd_ring_doorbells_total %llu\n"
+		   "# TYPE basicd_ring_spin_hits_total counter\n"
+		   "basicd_ring_spin_hits_total %llu\n",
+		   ring_stats.clients, ring_stats.records,
+		   ring_stats.bytes, ring_stats.bad_records,
+		   ring_stats.doorbells, ring_stats.spin_hits);
+  }
+
+  // Errors, log file, threads and configuration file
+  daemon_render_registry(buffer, size, &len);
+
+  return ( (len < size) ? len : 0 );
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_render_registry(char *buffer,
+				   unsigned size,
+				   unsigned *len)
+{
+  metrics_registry *metrics = metrics_registry::instance();
+  const unsigned nr_metrics = metrics->get_nr_metrics();
+  static const char *type_names[] = {"counter", "gauge", "histogram"};
+  METRICS_SNAPSHOT metric;
+
+  // Series of a family are rendered together, when its first series
+  // is found. The registry is small, a search by name is cheap.
+  for (unsigned i=0; i < nr_metrics; i++) {
+    const char *family = metrics->get_name(i);
+    bool rendered = false;
+    for (unsigned j=0; (j < i) && !rendered; j++) {
+      rendered = !strcmp(metrics->get_name(j), family);
+    }
+    if (rendered) {
+      continue;
+    }
+
+    for (unsigned j=i; j < nr_metrics; j++) {
+      if ( strcmp(metrics->get_name(j), family) ||
+	   (metrics->snapshot(j, &metric) != METRICS_REGISTRY_SUCCESS) ) {
+	continue;
+      }
+      if (j == i) {
+	metrics_printf(buffer, size, len, "# TYPE basicd_%s %s\n",
+		       metric.name, type_names[metric.type]);
+      }
+      const char *sep = (metric.labels[0] ? "," : "");
+
+      if (metric.type != METRICS_HISTOGRAM) {
+	metrics_printf(buffer, size, len,
+		       (metric.labels[0] ? "basicd_%s{%s} " : "basicd_%s%s "),
+		       metric.name, metric.labels);
+	if (metric.scale == 1.0) {
+	  metrics_printf(buffer, size, len, "%lld\n",
+			 (long long) metric.value);
+	}
+	else {
+	  metrics_printf(buffer, size, len, "%.9f\n",
+			 metric.value * metric.scale);
+	}
+	continue;
+      }
+
+      // Buckets are cumulative
+      unsigned long long count = 0;
+      for (unsigned b=0; b <= metric.nr_bounds; b++) {
+	count += metric.buckets[b];
+	if (b < metric.nr_bounds) {
+	  metrics_printf(buffer, size, len,
+			 "basicd_%s_bucket{%s%sle=\"%g\"} %llu\n",
+			 metric.name, metric.labels, sep,
+			 metric.bounds[b] * metric.scale, count);
+	}
+	else {
+	  metrics_printf(buffer, size, len,
+			 "basicd_%s_bucket{%s%sle=\"+Inf\"} %llu\n",
+			 metric.name, metric.labels, sep, count);
+	}
+      }
+      metrics_printf(buffer, size, len,
+		     (metric.labels[0] ?
+		      "basicd_%s_sum{%s} %.9f\nbasicd_%s_count{%s} %llu\n" :
+		      "basicd_%s_sum%s %.9f\nbasicd_%s_count%s %llu\n"),
+		     metric.name, metric.labels, metric.sum * metric.scale,
+		     metric.name, metric.labels, count);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_on_supervisor_signal(int fd, uint32_t events, void *arg)
+{
+  struct signalfd_siginfo info;
+
+  // Several signals may be queued
+  while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+    switch (info.ssi_signo) {
+    case SIGHUP:
+      // Each process reloads its configuration
+      syslog_info("Got SIGHUP, forwarded to processes");
+      g_prefork.signal_all(SIGHUP);
+      break;
+    case SIGUSR2:
+      // Each process upgrades itself, the supervisor is kept
+      syslog_info("Got SIGUSR2, forwarded to processes");
+      g_prefork.signal_all(SIGUSR2);
+      break;
+    case SIGUSR1:
+      // Each process profiles itself
+      syslog_info("Got SIGUSR1, forwarded to processes");
+      g_prefork.signal_all(SIGUSR1);
+      break;
+    case SIGCHLD:
+      // Exited processes are started again after a while
+      g_prefork.reap();
       break;
+    case SIGTERM:
+      syslog_info("Got SIGTERM, terminating processes");
+      notify_service_manager("STOPPING=1");
+      g_event_loop.stop();
+      return;
+    default:
+      ;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_on_supervisor_check(int fd, uint32_t events, void *arg)
+{
+  uint64_t expirations;
+
+  if (read_timer_fd(fd, &expirations) != EVENT_LOOP_SUCCESS) {
+    syslog_error("Error reading supervision timer, code=%d (%s)",
+		 errno, strerror(errno));
+    g_event_loop.stop();
+    return;
+  }
+
+  // Hung processes are killed, and started again
+  if (expirations) {
+    g_prefork.check_health();
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static void daemon_on_process_start(int fd, uint32_t events, void *arg)
+{
+  g_prefork.start_due();
+}
+
+////////////////////////////////////////////////////////////////
+
+static unsigned daemon_render_supervisor_metrics(char *buffer,
+						 unsigned size,
+						 void *arg)
+{
+  // Note!!
+  // Executed in the main loop, no allocations on this path.
+  // All from the health reported by each process.
+
+  PREFORK_CHILD_STATS stats[PREFORK_MAX_CHILDREN];
+  struct timespec now;
+  unsigned len = 0;
+
+  const unsigned nr = g_prefork.get_nr_children();
+  for (unsigned i=0; i < nr; i++) {
+    g_prefork.get_child_stats(i, &stats[i]);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  const uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+  metrics_printf(buffer, size, &len,
+		 "# TYPE basicd_up gauge\n"
+		 "basicd_up 1\n"
+		 "# TYPE process_start_time_seconds gauge\n"
+		 "process_start_time_seconds %ld\n"
+		 "# TYPE basicd_processes gauge\n"
+		 "basicd_processes %u\n"
+		 "# TYPE basicd_processes_running gauge\n"
+		 "basicd_processes_running %u\n",
+		 (long) g_start_time, nr, g_prefork.get_nr_running());
+
+  // One family at a time, labeled by process instance
+  metrics_printf(buffer, size, &len, "# TYPE basicd_process_up gauge\n");
+  for (unsigned i=0; i < nr; i++) {
+    metrics_printf(buffer, size, &len,
+		   "basicd_process_up{instance=\"%u\"} %u\n",
+		   i + 1, (stats[i].pid ? 1 : 0));
+  }
+  metrics_printf(buffer, size, &len,
+		 "# TYPE basicd_process_restarts_total counter\n");
+  for (unsigned i=0; i < nr; i++) {
+    metrics_printf(buffer, size, &len,
+		   "basicd_process_restarts_total{instance=\"%u\"} %u\n",
+		   i + 1, stats[i].restarts);
+  }
+  metrics_printf(buffer, size, &len,
+		 "# TYPE basicd_process_uptime_seconds gauge\n");
+  for (unsigned i=0; i < nr; i++) {
+    metrics_printf(buffer, size, &len,
+		   "basicd_process_uptime_seconds{instance=\"%u\"} %.3f\n",
+		   i + 1, stats[i].uptime);
+  }
+  metrics_printf(buffer, size, &len,
+		 "# TYPE basicd_process_heartbeat_age_seconds gauge\n");
+  for (unsigned i=0; i < nr; i++) {
+    const PREFORK_HEALTH *health = &stats[i].health;
+    const double age = ( (health->pid && (now_ns > health->heartbeat_time)) ?
+			 (now_ns - health->heartbeat_time) / 1e9 : 0.0 );
+    metrics_printf(buffer, size, &len,
+		   "basicd_process_heartbeat_age_seconds{instance=\"%u\"} "
+		   "%.3f\n", i + 1, age);
+  }
+  metrics_printf(buffer, size, &len,
+		 "# TYPE basicd_process_cycles_total counter\n");
+  for (unsigned i=0; i < nr; i++) {
+    metrics_printf(buffer, size, &len,
+		   "basicd_process_cycles_total{instance=\"%u\"} %llu\n",
+		   i + 1, (unsigned long long) stats[i].health.cycles);
+  }
+  metrics_printf(buffer, size, &len,
+		 "# TYPE basicd_process_overruns_total counter\n");
+  for (unsigned i=0; i < nr; i++) {
+    metrics_printf(buffer, size, &len,
+		   "basicd_process_overruns_total{instance=\"%u\"} %llu\n",
+		   i + 1, (unsigned long long) stats[i].health.overruns);
+  }
+  metrics_printf(buffer, size, &len,
+		 "# TYPE basicd_process_errors_total counter\n");
+  for (unsigned i=0; i < nr; i++) {
+    metrics_printf(buffer, size, &len,
+		   "basicd_process_errors_total{instance=\"%u\"} %llu\n",
+		   i + 1, (unsigned long long) stats[i].health.errors);
+  }
+
+  return ( (len < size) ? len : 0 );
+}
+
+////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+  long rc;
+
+  // Path of this binary, which may be replaced before an upgrade
+  const ssize_t len = readlink("/proc/self/exe",
+			       g_exe_path, sizeof(g_exe_path) - 1);
+  g_exe_path[(len > 0) ? len : 0] = '\0';
+  g_argv = argv;
+
+  trace_set_thread_name("BASICD_MAIN");
+
+  // Each startup phase is timed, reported when ready
+  basicd_startup_phase("syslog");
+
+  // Initialize handling of messages sent to system logger
+  syslog_open(BASICD_NAME);
+
+  // Report product number and the RState
+  daemon_report_prod_info();
+
+  // State handed over by a previous image (see daemon_upgrade)
+  const int handoff_fd = handoff_inherit();
+
+  // Read configuration file
+  basicd_startup_phase("config");
+  if (!daemon_get_config(&g_config)) {
+    daemon_exit_on_error(g_fd_lock_file);
+  }
+
+  // SIGHUP tells daemon to reload, SIGTERM tells daemon to terminate,
+  // SIGUSR1 starts or stops the profiler, SIGUSR2 tells daemon to
+  // upgrade, SIGCHLD tells a supervisor that a process exited.
+  // Signals are blocked before any threads are created, so they are
+  // only delivered to the main loop, through a file descriptor.
+  // Mask is kept over an upgrade.
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGUSR1);
+  sigaddset(&mask, SIGUSR2);
+  sigaddset(&mask, SIGCHLD);
+  g_signal_fd = create_signal_fd(&mask);
+  if (g_signal_fd == -1) {
+    syslog_error("Can't create signal fd, code=%d (%s)",
+		 errno, strerror(errno));
+    daemon_exit_on_error(g_fd_lock_file);
+  }
+  
+  // Go through the steps in becoming a daemon (or not),
+  // unless taking over from a previous image or a supervisor
+  if (handoff_fd != -1) {
+    basicd_startup_phase("handoff");
+    if (!daemon_restore(handoff_fd)) {
+      daemon_exit_on_error(g_fd_lock_file);
     }
-    // Check daemon status
-    if (!daemon_check_status()) {
-      syslog_info("Daemon status not OK, terminating");
-      basicd_finalize();
-      daemon_exit_on_error(fd_lock_file);
+    close(handoff_fd);
+  }
+  else {
+    basicd_startup_phase("daemonize");
+    if (g_config.daemonize) {
+      rc = become_daemon(g_config.user,
+			 g_config.work_dir,
+			 g_config.lock_file,
+			 &g_fd_lock_file);
+      if (rc != DAEMON_SUCCESS) {
+	daemon_exit_on_error(g_fd_lock_file);
+      }
     }
-    // Take it easy
-    if ( delay(1.0/g_config.supervision_freq) != DELAY_SUCCESS ) {
-      syslog_info("Error when delay, terminating");
-      basicd_finalize();
-      daemon_exit_on_error(fd_lock_file);
+
+    // We are now running as a daemon (or not)
+    syslog_info("Started");
+    g_start_time = time(NULL);
+
+    // Several processes, this one only supervises them
+    if (g_config.processes > 1) {
+      daemon_supervise(); // Never returns
     }
   }
+
+  // This thread is sampled as well, in this process
+  profiler_thread_attach("BASICD_MAIN");
+
+  // Initialize daemon, as one of several processes or not
+  if (basicd_set_instance(g_instance) != BASICD_SUCCESS) {
+    daemon_exit_on_error(g_fd_lock_file);
+  }
+  if (!daemon_start_core()) {
+    daemon_exit_on_error(g_fd_lock_file);
+  }
+
+  // Daemon main supervision and control loop,
+  // all events are dispatched from here
+  basicd_startup_phase("main_loop");
+  g_supervision_fd = create_timer_fd();
+  g_watchdog_fd    = create_timer_fd();
+  g_reload_fd      = create_timer_fd();
+  if ( (g_event_loop.open() != EVENT_LOOP_SUCCESS) ||
+       (g_supervision_fd == -1) ||
+       (g_watchdog_fd == -1) ||
+       (g_reload_fd == -1) ) {
+    syslog_error("Can't create event loop, code=%d (%s)",
+		 errno, strerror(errno));
+    daemon_fail("Event loop failed");
+  }
+
+  const double supervision_period = 1.0 / g_config.supervision_freq;
+  if ( (set_timer_fd(g_supervision_fd,
+		     supervision_period,
+		     supervision_period) != EVENT_LOOP_SUCCESS) ||
+       (set_timer_fd(g_watchdog_fd,
+		     WATCHDOG_CHECK_PERIOD,
+		     WATCHDOG_CHECK_PERIOD) != EVENT_LOOP_SUCCESS) ||
+       (g_event_loop.add_fd(g_signal_fd, EPOLLIN,
+			    daemon_on_signal, NULL) != EVENT_LOOP_SUCCESS) ||
+       (g_event_loop.add_fd(g_supervision_fd, EPOLLIN,
+			    daemon_on_supervision, NULL) != EVENT_LOOP_SUCCESS) ||
+       (g_event_loop.add_fd(g_watchdog_fd, EPOLLIN,
+			    daemon_on_watchdog, NULL) != EVENT_LOOP_SUCCESS) ||
+       (g_event_loop.add_fd(g_reload_fd, EPOLLIN,
+			    daemon_on_reload_timer, NULL) != EVENT_LOOP_SUCCESS) ) {
+    syslog_error("Can't add to event loop, code=%d (%s)",
+		 errno, strerror(errno));
+    daemon_fail("Event loop failed");
+  }
+
+  // Watch configuration file, changes are reloaded automatically
+  if ( (g_config_watch.open(BASICD_CFG_FILE) != FILE_WATCH_SUCCESS) ||
+       (g_event_loop.add_fd(g_config_watch.get_fd(), EPOLLIN,
+			    daemon_on_config_changed, NULL) != EVENT_LOOP_SUCCESS) ) {
+    syslog_error("Can't watch %s, code=%d (%s), only SIGHUP reloads",
+		 BASICD_CFG_FILE, errno, strerror(errno));
+    g_config_watch.close();
+  }
+
+  // Control and metrics endpoints
+  daemon_open_endpoints();
+
+  // Startup completed
+  daemon_report_startup();
+
+  // Returns on SIGTERM
+  if (g_event_loop.run() != EVENT_LOOP_SUCCESS) {
+    syslog_error("Error when wait, code=%d (%s)", errno, strerror(errno));
+    daemon_fail("Event loop failed");
+  }
   
   // Cleanup and exit
+  g_metrics_server.close();
+  g_ctrl_server.close();
+  g_event_loop.close();
+  g_config_watch.close();
+  close(g_reload_fd);
+  close(g_watchdog_fd);
+  close(g_supervision_fd);
+  close(g_signal_fd);
+
+  daemon_report_error_stats();
+
   syslog_info("Terminated ok");
   syslog_close();
   
-  if (fd_lock_file != DAEMON_BAD_FD_LOCK_FILE) {
-    close(fd_lock_file);
+  if (g_fd_lock_file != DAEMON_BAD_FD_LOCK_FILE) {
+    close(g_fd_lock_file);
     unlink(g_config.lock_file);
   }
 
@@ -0,0 +1,305 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "basicd_metrics_server.h"
+#include "listen_socket.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Body is rendered after room for status line and headers
+#define HEADER_ROOM  256
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+basicd_metrics_server::basicd_metrics_server(void)
+{
+  m_listen_fd = -1;
+  m_loop      = NULL;
+  m_render    = NULL;
+  m_arg       = NULL;
+
+  for (unsigned i=0; i < BASICD_METRICS_SERVER_MAX_CLIENTS; i++) {
+    m_clients[i].fd     = -1;
+    m_clients[i].server = this;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+basicd_metrics_server::~basicd_metrics_server(void)
+{
+  close();
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_metrics_server::open(const char *address,
+				 event_loop *loop,
+				 BASICD_METRICS_RENDER render,
+				 void *arg)
+{
+  m_loop   = loop;
+  m_render = render;
+  m_arg    = arg;
+
+  // Never exposed outside this host
+  m_listen_fd = open_listen_socket(address,
+				   LISTEN_SOCKET_LOOPBACK_ONLY,
+				   BASICD_METRICS_SERVER_MAX_CLIENTS);
+  if (m_listen_fd == -1) {
+    return BASICD_METRICS_SERVER_FAILURE;
+  }
+
+  // The scraper may run as another user
+  if ( ( (address[0] == '/') &&
+	 (chmod(address, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
+		S_IROTH | S_IWOTH) == -1) ) ||
+       (m_loop->add_fd(m_listen_fd, EPOLLIN,
+		       on_accept, this) != EVENT_LOOP_SUCCESS) ) {
+    close();
+    return BASICD_METRICS_SERVER_FAILURE;
+  }
+
+  return BASICD_METRICS_SERVER_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_metrics_server::close(void)
+{
+  for (unsigned i=0; i < BASICD_METRICS_SERVER_MAX_CLIENTS; i++) {
+    close_client(&m_clients[i]);
+  }
+
+  if (m_listen_fd != -1) {
+    m_loop->remove_fd(m_listen_fd);
+    close_listen_socket(m_listen_fd); // Any socket path is removed
+    m_listen_fd = -1;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+void basicd_metrics_server::on_accept(int fd, uint32_t events, void *arg)
+{
+  ((basicd_metrics_server *)arg)->accept_client();
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_metrics_server::on_client(int fd, uint32_t events, void *arg)
+{
+  CLIENT *client = (CLIENT *)arg;
+
+  client->server->serve_client(client, events);
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_metrics_server::accept_client(void)
+{
+  int fd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd == -1) {
+    return; // Client gone, or out of descriptors
+  }
+
+  // Find a free slot, if none the client is refused
+  CLIENT *client = NULL;
+  for (unsigned i=0; i < BASICD_METRICS_SERVER_MAX_CLIENTS; i++) {
+    if (m_clients[i].fd == -1) {
+      client = &m_clients[i];
+      break;
+    }
+  }
+  if ( (!client) ||
+       (m_loop->add_fd(fd, EPOLLIN, on_client, client) != EVENT_LOOP_SUCCESS) ) {
+    ::close(fd);
+    return;
+  }
+
+  client->fd      = fd;
+  client->in_len  = 0;
+  client->out_len = 0;
+  client->out_pos = 0;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_metrics_server::serve_client(CLIENT *client, uint32_t events)
+{
+  // Sending response, connection is closed when done
+  if (client->out_len) {
+    if ( (!send_response(client)) ||
+	 (client->out_pos == client->out_len) ) {
+      close_client(client);
+    }
+    return;
+  }
+
+  if (events & EPOLLIN) {
+    // Keep room for a terminating null
+    const ssize_t n = read(client->fd,
+			   client->in + client->in_len,
+			   sizeof(client->in) - client->in_len - 1);
+    if ( (n == 0) ||
+	 ((n == -1) && (errno != EAGAIN) && (errno != EINTR)) ) {
+      close_client(client);
+      return;
+    }
+    if (n > 0) {
+      client->in_len += n;
+    }
+  }
+  else if (events & (EPOLLHUP | EPOLLERR)) {
+    close_client(client);
+    return;
+  }
+
+  client->in[client->in_len] = '\0';
+
+  // Wait for complete request headers, a body is not expected
+  if (!strstr(client->in, "\r\n\r\n")) {
+    if (client->in_len == sizeof(client->in) - 1) {
+      set_response(client, "431 Request Header Fields Too Large", 0);
+    }
+    else {
+      return;
+    }
+  }
+  else {
+    process_request(client);
+  }
+
+  if ( (!send_response(client)) ||
+       (client->out_pos == client->out_len) ) {
+    close_client(client);
+    return;
+  }
+
+  // Continue when writable
+  if (m_loop->modify_fd(client->fd, EPOLLOUT) != EVENT_LOOP_SUCCESS) {
+    close_client(client);
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_metrics_server::process_request(CLIENT *client)
+{
+  const bool get  = (strncmp(client->in, "GET ", 4) == 0);
+  const bool head = (strncmp(client->in, "HEAD ", 5) == 0);
+
+  if ( (!get) && (!head) ) {
+    set_response(client, "405 Method Not Allowed", 0);
+    return;
+  }
+
+  // Path is followed by a blank and the version
+  const char *path = client->in + (get ? 4 : 5);
+  if ( (strncmp(path, "/metrics ", 9) != 0) &&
+       (strncmp(path, "/ ", 2) != 0) ) {
+    set_response(client, "404 Not Found", 0);
+    return;
+  }
+
+  const unsigned body_len =
+    m_render(client->out + HEADER_ROOM,
+	     sizeof(client->out) - HEADER_ROOM,
+	     m_arg);
+  if (!body_len) {
+    set_response(client, "500 Internal Server Error", 0);
+    return;
+  }
+
+  set_response(client, "200 OK", body_len);
+
+  // Same headers, no body
+  if (head) {
+    client->out_len = HEADER_ROOM;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_metrics_server::set_response(CLIENT *client,
+					 const char *status,
+					 unsigned body_len)
+{
+  char header[HEADER_ROOM];
+
+  // Body is already in place, put status line and headers just before it
+  const int len = snprintf(header, sizeof(header),
+			   "HTTP/1.1 %s\r\n"
+			   "Content-Type: text/plain; version=0.0.4\r\n"
+			   "Content-Length: %u\r\n"
+			   "Connection: close\r\n"
+			   "\r\n",
+			   status, body_len);
+
+  memcpy(client->out + HEADER_ROOM - len, header, len);
+  client->out_pos = HEADER_ROOM - len;
+  client->out_len = HEADER_ROOM + body_len;
+}
+
+////////////////////////////////////////////////////////////////
+
+bool basicd_metrics_server::send_response(CLIENT *client)
+{
+  while (client->out_pos < client->out_len) {
+    const ssize_t n = send(client->fd,
+			   client->out + client->out_pos,
+			   client->out_len - client->out_pos,
+			   MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EAGAIN) {
+	return true; // Continue when writable
+      }
+      if (errno == EINTR) {
+	continue;
+      }
+      return false;
+    }
+    client->out_pos += n;
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_metrics_server::close_client(CLIENT *client)
+{
+  if (client->fd != -1) {
+    m_loop->remove_fd(client->fd);
+    ::close(client->fd);
+    client->fd = -1;
+  }
+  client->in_len  = 0;
+  client->out_len = 0;
+  client->out_pos = 0;
+}
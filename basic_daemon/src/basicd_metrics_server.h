@@ -0,0 +1,98 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __BASICD_METRICS_SERVER_H__
+#define __BASICD_METRICS_SERVER_H__
+
+#include <stdint.h>
+#include <string>
+
+#include "event_loop.h"
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define BASICD_METRICS_SERVER_SUCCESS   0
+#define BASICD_METRICS_SERVER_FAILURE  -1
+
+#define BASICD_METRICS_SERVER_MAX_CLIENTS    4
+#define BASICD_METRICS_SERVER_REQUEST_SIZE   2048  // Request line and headers
+#define BASICD_METRICS_SERVER_RESPONSE_SIZE  32768 // Status line, headers and body
+
+/////////////////////////////////////////////////////////////////////////////
+//               Class support types
+/////////////////////////////////////////////////////////////////////////////
+
+// Renders metrics in text exposition format into buffer.
+// Returns nof bytes, or zero if buffer is too small.
+typedef unsigned (*BASICD_METRICS_RENDER)(char *buffer,
+					  unsigned size,
+					  void *arg);
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// Minimal HTTP/1.1 responder for a Prometheus scraper. Every request is
+// answered and the connection closed. Served from the event loop.
+
+class basicd_metrics_server {
+
+ public:
+  basicd_metrics_server(void);
+  ~basicd_metrics_server(void);
+
+  // Address is a unix socket path ("/...") or a loopback
+  // TCP address ("127.0.0.1:port")
+  long open(const char *address,
+	    event_loop *loop,
+	    BASICD_METRICS_RENDER render,
+	    void *arg);
+
+  void close(void);
+
+ private:
+  // All buffers are preallocated, no allocation per scrape
+  typedef struct {
+    int                    fd;   // -1 when slot is free
+    uint32_t               in_len;
+    uint32_t               out_len;
+    uint32_t               out_pos;
+    basicd_metrics_server *server;
+    char                   in[BASICD_METRICS_SERVER_REQUEST_SIZE];
+    char                   out[BASICD_METRICS_SERVER_RESPONSE_SIZE];
+  } CLIENT;
+
+  int                    m_listen_fd;
+  event_loop            *m_loop;
+  BASICD_METRICS_RENDER  m_render;
+  void                  *m_arg;
+
+  CLIENT m_clients[BASICD_METRICS_SERVER_MAX_CLIENTS];
+
+  static void on_accept(int fd, uint32_t events, void *arg);
+  static void on_client(int fd, uint32_t events, void *arg);
+
+  void accept_client(void);
+  void serve_client(CLIENT *client, uint32_t events);
+  void process_request(CLIENT *client);
+  void set_response(CLIENT *client,
+		    const char *status,
+		    unsigned body_len);
+  bool send_response(CLIENT *client);
+  void close_client(CLIENT *client);
+};
+
+#endif // __BASICD_METRICS_SERVER_H__
@@ -0,0 +1,342 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "basicd.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define NOTIFYTEST_MAX_DATAGRAM  4096
+
+// Expected when ready, in this order
+#define NOTIFYTEST_READY    0
+#define NOTIFYTEST_STATUS   1
+#define NOTIFYTEST_MAINPID  2
+#define NOTIFYTEST_NR_KEYS  3
+
+/////////////////////////////////////////////////////////////////////////////
+//               Module global variables
+/////////////////////////////////////////////////////////////////////////////
+
+static const char *g_keys[NOTIFYTEST_NR_KEYS] = {
+  "READY=1",
+  "STATUS=",
+  "MAINPID="
+};
+
+/////////////////////////////////////////////////////////////////////////////
+//               Function prototypes
+/////////////////////////////////////////////////////////////////////////////
+
+static void notifytest_usage(const char *prog);
+static uint64_t notifytest_now(void);
+static int notifytest_bind(const char *path);
+static pid_t notifytest_start(const char *daemon, const char *path);
+static int notifytest_receive(int fd, uint64_t deadline, char *buffer);
+static bool notifytest_wait_ready(int fd, uint64_t deadline, pid_t *main_pid);
+static bool notifytest_wait_stopping(int fd, uint64_t deadline);
+static bool notifytest_wait_exit(pid_t child, pid_t main_pid,
+				 uint64_t deadline);
+
+////////////////////////////////////////////////////////////////
+
+static void notifytest_usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s -d daemon [-s socket] [-t timeout]\n", prog);
+  fprintf(stderr, "Runs the %s daemon with NOTIFY_SOCKET set and checks "
+	  "the sd_notify protocol:\n"
+	  "READY=1, STATUS= and MAINPID= in this order when started,\n"
+	  "STOPPING=1 when terminated by SIGTERM sent to MAINPID.\n"
+	  "The daemon reads its usual configuration file (%s).\n"
+	  "Timeout in seconds for each step, default 10\n",
+	  BASICD_NAME, BASICD_CFG_FILE);
+}
+
+////////////////////////////////////////////////////////////////
+
+static uint64_t notifytest_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////
+
+static int notifytest_bind(const char *path)
+{
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+////////////////////////////////////////////////////////////////
+
+static pid_t notifytest_start(const char *daemon, const char *path)
+{
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid; // Parent, or failed
+  }
+
+  if (setenv("NOTIFY_SOCKET", path, 1) == 0) {
+    execl(daemon, daemon, (char *)NULL);
+  }
+  fprintf(stderr, "Can't execute %s, errno=%d (%s)\n",
+	  daemon, errno, strerror(errno));
+  _exit(127);
+}
+
+////////////////////////////////////////////////////////////////
+
+static int notifytest_receive(int fd, uint64_t deadline, char *buffer)
+{
+  struct pollfd pfd;
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+
+  for (;;) {
+    const uint64_t now = notifytest_now();
+    if (now >= deadline) {
+      return 0; // Timeout
+    }
+
+    const int rc = poll(&pfd, 1, (int)((deadline - now) / 1000000) + 1);
+    if (rc == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return -1;
+    }
+    if (rc == 0) {
+      continue; // Checked against deadline
+    }
+
+    const ssize_t n = recv(fd, buffer, NOTIFYTEST_MAX_DATAGRAM - 1, 0);
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return -1;
+    }
+    buffer[n] = '\0';
+
+    return (int)n;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static bool notifytest_wait_ready(int fd, uint64_t deadline, pid_t *main_pid)
+{
+  char buffer[NOTIFYTEST_MAX_DATAGRAM];
+  unsigned next = 0; // Next expected key
+  bool ordered = true;
+
+  *main_pid = 0;
+
+  // Each assignment is one line, a datagram may hold several
+  while (next < NOTIFYTEST_NR_KEYS) {
+    const int n = notifytest_receive(fd, deadline, buffer);
+    if (n <= 0) {
+      printf("FAIL : %s not received\n", g_keys[next]);
+      return false;
+    }
+
+    char *save;
+    for (char *line = strtok_r(buffer, "\n", &save); line;
+	 line = strtok_r(NULL, "\n", &save)) {
+      printf("recv : %s\n", line);
+
+      for (unsigned i=0; i < NOTIFYTEST_NR_KEYS; i++) {
+	if (strncmp(line, g_keys[i], strlen(g_keys[i]))) {
+	  continue;
+	}
+	if (i < next) {
+	  continue; // Repeated, as a later status update
+	}
+	if (i > next) {
+	  printf("FAIL : %s before %s\n", g_keys[i], g_keys[next]);
+	  ordered = false;
+	}
+	if (i == NOTIFYTEST_MAINPID) {
+	  *main_pid = atoi(line + strlen(g_keys[i]));
+	}
+	next = i + 1;
+      }
+    }
+  }
+
+  if ( (*main_pid <= 0) || (kill(*main_pid, 0) == -1) ) {
+    printf("FAIL : MAINPID=%d is not a running process\n", (int)*main_pid);
+    return false;
+  }
+
+  return ordered;
+}
+
+////////////////////////////////////////////////////////////////
+
+static bool notifytest_wait_stopping(int fd, uint64_t deadline)
+{
+  char buffer[NOTIFYTEST_MAX_DATAGRAM];
+
+  for (;;) {
+    const int n = notifytest_receive(fd, deadline, buffer);
+    if (n <= 0) {
+      printf("FAIL : STOPPING=1 not received\n");
+      return false;
+    }
+
+    char *save;
+    for (char *line = strtok_r(buffer, "\n", &save); line;
+	 line = strtok_r(NULL, "\n", &save)) {
+      printf("recv : %s\n", line);
+      if (!strcmp(line, "STOPPING=1")) {
+	return true;
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static bool notifytest_wait_exit(pid_t child, pid_t main_pid,
+				 uint64_t deadline)
+{
+  // A daemonized main process is not our child, poll for it
+  while (notifytest_now() < deadline) {
+    if (main_pid == child) {
+      if (waitpid(child, NULL, WNOHANG) == child) {
+	return true;
+      }
+    }
+    else if ( (kill(main_pid, 0) == -1) && (errno == ESRCH) ) {
+      return true;
+    }
+    usleep(10000);
+  }
+
+  printf("FAIL : MAINPID=%d did not exit\n", (int)main_pid);
+  kill(main_pid, SIGKILL);
+
+  return false;
+}
+
+////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+  const char *daemon = NULL;
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  unsigned timeout = 10;
+  int opt;
+
+  snprintf(path, sizeof(path), "/tmp/%s_notify.%d",
+	   BASICD_NAME, (int)getpid());
+
+  while ( (opt = getopt(argc, argv, "d:s:t:h")) != -1 ) {
+    switch (opt) {
+    case 'd':
+      daemon = optarg;
+      break;
+    case 's':
+      snprintf(path, sizeof(path), "%s", optarg);
+      break;
+    case 't':
+      timeout = atoi(optarg);
+      break;
+    default:
+      notifytest_usage(argv[0]);
+      return (opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  if ( (!daemon) || (!timeout) ) {
+    notifytest_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const int fd = notifytest_bind(path);
+  if (fd == -1) {
+    fprintf(stderr, "Can't bind %s, errno=%d (%s)\n",
+	    path, errno, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  const pid_t child = notifytest_start(daemon, path);
+  if (child == -1) {
+    fprintf(stderr, "Can't fork, errno=%d (%s)\n", errno, strerror(errno));
+    close(fd);
+    unlink(path);
+    return EXIT_FAILURE;
+  }
+
+  const uint64_t step = (uint64_t)timeout * 1000000000ULL;
+  pid_t main_pid;
+  bool passed = notifytest_wait_ready(fd, notifytest_now() + step, &main_pid);
+
+  if (main_pid > 0) {
+    // Terminated as by the service manager
+    printf("send : SIGTERM to %d\n", (int)main_pid);
+    kill(main_pid, SIGTERM);
+    passed = notifytest_wait_stopping(fd, notifytest_now() + step) && passed;
+    passed = notifytest_wait_exit(child, main_pid,
+				  notifytest_now() + step) && passed;
+  }
+  else {
+    kill(child, SIGTERM);
+  }
+
+  // A daemonizing parent exits by itself
+  waitpid(child, NULL, 0);
+
+  close(fd);
+  unlink(path);
+
+  printf("%s\n", (passed ? "PASS" : "FAIL"));
+
+  return (passed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,355 @@
+/************************************************************************
+ *                                                                      *
+ * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+ *                                                                      *
+ * This program is free software; you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation; either version 2 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef __BASICD_RING_H__
+#define __BASICD_RING_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "basicd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * BASICD record rings
+ *
+ * Local producers hand records to the daemon through rings in shared
+ * memory, records are written and consumed in place (no copies).
+ *
+ * A producer connects to the ring socket of the daemon (see ring_socket
+ * in the configuration file) and sends one byte, the wanted mode:
+ *
+ *   BASICD_RING_SPSC  A ring of its own, one producer thread only.
+ *                     Released when the connection is closed.
+ *   BASICD_RING_MPSC  The ring shared by all MPSC producers, any number
+ *                     of threads and processes.
+ *
+ * The daemon answers with one byte, a BASICD_RING_STATUS_xxx, and when
+ * ok two descriptors (SCM_RIGHTS): the ring (memfd, to be mapped
+ * shared) and the doorbell (eventfd). The connection is kept open as
+ * long as the ring is used.
+ *
+ * Slot protocol, pos is a 64-bit position that never wraps:
+ *   slot[pos % nr_slots].seq == pos      Free, may be reserved at pos
+ *   slot[pos % nr_slots].seq == pos + 1  Record committed, consumer owns
+ * The consumer sets seq to pos + nr_slots when the record is consumed.
+ *
+ * The consumer sets 'sleeping' before it sleeps. A producer that
+ * finds it set after a commit clears it and rings the doorbell,
+ * one write wakes the consumer.
+ *
+ * Records are consumed in position order, so in the MPSC ring a
+ * reserved record holds back the records of all producers until it
+ * is committed. Keep the connection open while records are reserved.
+ * If an MPSC producer exits between reserve and commit, the daemon
+ * skips its record when it has stayed uncommitted for a second and
+ * counts it as a bad record. A producer that may be stopped for long
+ * with a record reserved should use an SPSC ring of its own.
+ */
+#define BASICD_RING_MAGIC       0x42435247 /* "BCRG" */
+#define BASICD_RING_VERSION     1
+
+#define BASICD_RING_NR_SLOTS    1024 /* Power of two */
+#define BASICD_RING_SLOT_SIZE   256
+#define BASICD_RING_MAX_RECORD  (BASICD_RING_SLOT_SIZE - 16)
+#define BASICD_RING_ALIGN       64   /* Cache line size */
+
+/* Modes */
+#define BASICD_RING_SPSC  1
+#define BASICD_RING_MPSC  2
+
+/* Connect status */
+#define BASICD_RING_STATUS_OK         0
+#define BASICD_RING_STATUS_BAD_MODE   1
+#define BASICD_RING_STATUS_NO_RING    2
+
+#define BASICD_RING_ALIGNED __attribute__((aligned(BASICD_RING_ALIGN)))
+
+typedef struct {
+  uint32_t magic;     /* BASICD_RING_MAGIC */
+  uint32_t version;   /* BASICD_RING_VERSION */
+  uint32_t size;      /* sizeof(BASICD_RING) */
+  uint32_t mode;      /* BASICD_RING_SPSC or BASICD_RING_MPSC */
+  uint32_t nr_slots;  /* BASICD_RING_NR_SLOTS */
+  uint32_t slot_size; /* BASICD_RING_SLOT_SIZE */
+} BASICD_RING_ALIGNED BASICD_RING_HEADER;
+
+typedef struct {
+  uint64_t head;      /* Next position to reserve */
+} BASICD_RING_ALIGNED BASICD_RING_PRODUCER;
+
+typedef struct {
+  uint32_t sleeping;  /* Doorbell wanted */
+} BASICD_RING_ALIGNED BASICD_RING_CONSUMER;
+
+typedef struct {
+  uint64_t seq;
+  uint32_t len;       /* Record length */
+  uint32_t reserved;
+  uint8_t  data[BASICD_RING_MAX_RECORD];
+} BASICD_RING_SLOT;
+
+typedef struct {
+  BASICD_RING_HEADER   header;
+  BASICD_RING_PRODUCER producer;
+  BASICD_RING_CONSUMER consumer;
+  BASICD_RING_SLOT     slots[BASICD_RING_NR_SLOTS];
+} BASICD_RING;
+
+/*
+ * Producer side
+ */
+typedef struct {
+  int          sock_fd;
+  int          doorbell_fd;
+  unsigned     mode;
+  BASICD_RING *ring;
+} BASICD_RING_CLIENT;
+
+/****************************************************************************
+*
+* Name basicd_ring_connect
+*
+* Description Connects to the daemon and maps a ring.
+*
+* Parameters path    IN      Ring socket of the daemon
+*            mode    IN      BASICD_RING_SPSC or BASICD_RING_MPSC
+*            client  IN/OUT  The connected ring
+*
+* Error handling Returns BASICD_SUCCESS if successful
+*                otherwise BASICD_FAILURE, errno tells why
+*
+****************************************************************************/
+static __inline__ long basicd_ring_connect(const char *path,
+					   unsigned mode,
+					   BASICD_RING_CLIENT *client)
+{
+  struct sockaddr_un addr;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  uint8_t byte = (uint8_t)mode;
+  int fds[2];
+  void *addr_ring;
+
+  client->sock_fd     = -1;
+  client->doorbell_fd = -1;
+  client->mode        = mode;
+  client->ring        = NULL;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return BASICD_FAILURE;
+  }
+  strcpy(addr.sun_path, path);
+
+  client->sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if ( (client->sock_fd == -1) ||
+       (connect(client->sock_fd,
+		(struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+       (write(client->sock_fd, &byte, 1) != 1) ) {
+    goto failed;
+  }
+
+  /* Status and descriptors */
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base       = &byte;
+  iov.iov_len        = 1;
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  if (recvmsg(client->sock_fd, &msg, MSG_CMSG_CLOEXEC) != 1) {
+    goto failed;
+  }
+  if (byte != BASICD_RING_STATUS_OK) {
+    errno = (byte == BASICD_RING_STATUS_BAD_MODE ? EINVAL : EBUSY);
+    goto failed;
+  }
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if ( (!cmsg) ||
+       (cmsg->cmsg_level != SOL_SOCKET) ||
+       (cmsg->cmsg_type != SCM_RIGHTS) ||
+       (cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) ) {
+    errno = EPROTO;
+    goto failed;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  client->doorbell_fd = fds[1];
+
+  addr_ring = mmap(NULL, sizeof(BASICD_RING),
+		   PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+  close(fds[0]);
+  if (addr_ring == MAP_FAILED) {
+    goto failed;
+  }
+  client->ring = (BASICD_RING *)addr_ring;
+
+  if ( (client->ring->header.magic != BASICD_RING_MAGIC) ||
+       (client->ring->header.version != BASICD_RING_VERSION) ||
+       (client->ring->header.size != sizeof(BASICD_RING)) ||
+       (client->ring->header.mode != mode) ) {
+    errno = EPROTO;
+    goto failed;
+  }
+
+  return BASICD_SUCCESS;
+
+ failed:
+  {
+    const int saved_errno = errno;
+    if (client->ring) {
+      munmap(client->ring, sizeof(BASICD_RING));
+      client->ring = NULL;
+    }
+    if (client->doorbell_fd != -1) {
+      close(client->doorbell_fd);
+      client->doorbell_fd = -1;
+    }
+    if (client->sock_fd != -1) {
+      close(client->sock_fd);
+      client->sock_fd = -1;
+    }
+    errno = saved_errno;
+  }
+  return BASICD_FAILURE;
+}
+
+/****************************************************************************
+*
+* Name basicd_ring_reserve
+*
+* Description Reserves the next slot of the ring. The record is written
+*             directly in the returned buffer, BASICD_RING_MAX_RECORD
+*             bytes, and made visible by basicd_ring_commit.
+*
+* Parameters client  IN  The connected ring
+*
+* Error handling Returns NULL when the ring is full.
+*
+****************************************************************************/
+static __inline__ uint8_t *basicd_ring_reserve(BASICD_RING_CLIENT *client)
+{
+  BASICD_RING *ring = client->ring;
+  BASICD_RING_SLOT *slot;
+  uint64_t pos;
+  uint64_t seq;
+
+  pos = __atomic_load_n(&ring->producer.head, __ATOMIC_RELAXED);
+  for (;;) {
+    slot = &ring->slots[pos & (BASICD_RING_NR_SLOTS - 1)];
+    seq  = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq != pos) {
+      if (seq < pos) {
+	return NULL; /* Full, not yet consumed */
+      }
+      /* Taken by another producer */
+      pos = __atomic_load_n(&ring->producer.head, __ATOMIC_RELAXED);
+      continue;
+    }
+    if (client->mode == BASICD_RING_SPSC) {
+      __atomic_store_n(&ring->producer.head, pos + 1, __ATOMIC_RELAXED);
+      return slot->data;
+    }
+    if (__atomic_compare_exchange_n(&ring->producer.head, &pos, pos + 1,
+				    0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      return slot->data;
+    }
+    /* Lost the race, pos now holds current head */
+  }
+}
+
+/****************************************************************************
+*
+* Name basicd_ring_commit
+*
+* Description Hands a reserved record over to the daemon, and rings the
+*             doorbell if the daemon waits for records.
+*
+* Parameters client  IN  The connected ring
+*            record  IN  Buffer returned by basicd_ring_reserve
+*            len     IN  Record length (max BASICD_RING_MAX_RECORD)
+*
+* Error handling None
+*
+****************************************************************************/
+static __inline__ void basicd_ring_commit(BASICD_RING_CLIENT *client,
+					  uint8_t *record,
+					  uint32_t len)
+{
+  BASICD_RING *ring = client->ring;
+  BASICD_RING_SLOT *slot =
+    (BASICD_RING_SLOT *)(record - offsetof(BASICD_RING_SLOT, data));
+  const uint64_t pos = slot->seq; /* Owned, equal to reserved position */
+  const uint64_t value = 1;
+
+  slot->len = len;
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+  /* Pairs with the consumer, that sets 'sleeping' and then looks
+     for records. Either it sees this record, or this sees 'sleeping'. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if ( __atomic_load_n(&ring->consumer.sleeping, __ATOMIC_RELAXED) &&
+       __atomic_exchange_n(&ring->consumer.sleeping, 0, __ATOMIC_RELAXED) ) {
+    if (write(client->doorbell_fd, &value, sizeof(value)) == -1) {
+      /* Counter full, consumer is already signaled */
+    }
+  }
+}
+
+/****************************************************************************
+*
+* Name basicd_ring_close
+*
+* Description Unmaps the ring and closes the connection. Committed
+*             records are still consumed by the daemon.
+*
+* Parameters client  IN  The connected ring
+*
+* Error handling None
+*
+****************************************************************************/
+static __inline__ void basicd_ring_close(BASICD_RING_CLIENT *client)
+{
+  if (client->ring) {
+    munmap(client->ring, sizeof(BASICD_RING));
+    client->ring = NULL;
+  }
+  if (client->doorbell_fd != -1) {
+    close(client->doorbell_fd);
+    client->doorbell_fd = -1;
+  }
+  if (client->sock_fd != -1) {
+    close(client->sock_fd);
+    client->sock_fd = -1;
+  }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BASICD_RING_H__ */
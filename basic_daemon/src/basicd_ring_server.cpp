@@ -0,0 +1,603 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "basicd_ring_server.h"
+#include "listen_socket.h"
+
+// Slots are indexed by position, and fill the slot size
+typedef char check_nr_slots[((BASICD_RING_NR_SLOTS &
+			      (BASICD_RING_NR_SLOTS - 1)) == 0) ? 1 : -1];
+typedef char check_slot_size[(sizeof(BASICD_RING_SLOT) ==
+			      BASICD_RING_SLOT_SIZE) ? 1 : -1];
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define RING_MASK  (BASICD_RING_NR_SLOTS - 1)
+
+// Busy-poll time is doubled when records were found
+// and halved when not, within these limits
+#define SPIN_MIN_NS     1000ULL // 1 us
+#define SPIN_MAX_NS    50000ULL // 50 us
+
+// Other rings and the cyclic work get their turn after this
+#define MAX_RECORDS_PER_POLL  4096
+
+// A record reserved by a gone producer is skipped after this
+#define STALLED_RECORD_NS  1000000000ULL // 1 s
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+basicd_ring_server::basicd_ring_server(void)
+{
+  m_listen_fd = -1;
+  m_spin_ns   = 0;
+
+  for (unsigned i=0; i < BASICD_RING_SERVER_MAX_RINGS; i++) {
+    m_rings[i].ring        = NULL;
+    m_rings[i].memfd       = -1;
+    m_rings[i].doorbell_fd = -1;
+    m_rings[i].tail        = 0;
+    m_rings[i].orphaned    = false;
+    m_rings[i].dead_below  = 0;
+    m_rings[i].stalled_ns  = 0;
+  }
+  for (unsigned i=0; i < BASICD_RING_SERVER_MAX_CLIENTS; i++) {
+    m_clients[i].server = this;
+    m_clients[i].fd     = -1;
+    m_clients[i].ring   = -1;
+  }
+
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+////////////////////////////////////////////////////////////////
+
+basicd_ring_server::~basicd_ring_server(void)
+{
+  close();
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_ring_server::open(const char *path)
+{
+  if (m_loop.open() != EVENT_LOOP_SUCCESS) {
+    return BASICD_RING_SERVER_FAILURE;
+  }
+
+  m_listen_fd = open_listen_socket(path, 0, BASICD_RING_SERVER_MAX_CLIENTS);
+  if (m_listen_fd == -1) {
+    const int saved_errno = errno;
+    close();
+    errno = saved_errno;
+    return BASICD_RING_SERVER_FAILURE;
+  }
+
+  // Shared ring is always there
+  if ( (chmod(path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) == -1) ||
+       (m_loop.add_fd(m_listen_fd, EPOLLIN,
+		      on_accept, this) != EVENT_LOOP_SUCCESS) ||
+       (create_ring(0, BASICD_RING_MPSC) != BASICD_RING_SERVER_SUCCESS) ) {
+    const int saved_errno = errno;
+    close();
+    errno = saved_errno;
+    return BASICD_RING_SERVER_FAILURE;
+  }
+
+  return BASICD_RING_SERVER_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ring_server::close(void)
+{
+  for (unsigned i=0; i < BASICD_RING_SERVER_MAX_CLIENTS; i++) {
+    close_client(&m_clients[i]);
+  }
+  for (unsigned i=0; i < BASICD_RING_SERVER_MAX_RINGS; i++) {
+    destroy_ring(i);
+  }
+
+  m_loop.close();
+
+  if (m_listen_fd != -1) {
+    close_listen_socket(m_listen_fd); // Socket path is removed
+    m_listen_fd = -1;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+int basicd_ring_server::get_fd(void)
+{
+  return m_loop.get_fd();
+}
+
+////////////////////////////////////////////////////////////////
+
+unsigned basicd_ring_server::poll(BASICD_RING_HANDLER handler, void *arg)
+{
+  struct timespec start;
+  struct timespec now;
+  unsigned total = 0;
+  unsigned n;
+
+  // New clients, hang ups and doorbells
+  m_loop.run_once(0);
+
+  for (;;) {
+    while ( (n = consume_all(handler, arg)) > 0 ) {
+      total += n;
+      if (total >= MAX_RECORDS_PER_POLL) {
+	// Wake up again at once, without waiting for a doorbell
+	const uint64_t value = 1;
+	if (write(m_rings[0].doorbell_fd, &value, sizeof(value)) == -1) {
+	  // Counter full, already signaled
+	}
+	return total;
+      }
+    }
+
+    // Records are coming, try to get next ones without sleeping
+    if ( (total) && (m_spin_ns < SPIN_MIN_NS) ) {
+      m_spin_ns = SPIN_MIN_NS;
+    }
+
+    n = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (m_spin_ns) {
+      n = consume_all(handler, arg);
+      if (n) {
+	break;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if ( (uint64_t)(now.tv_sec - start.tv_sec) * 1000000000ULL +
+	   now.tv_nsec - start.tv_nsec >= m_spin_ns ) {
+	break;
+      }
+    }
+
+    if (n) {
+      total += n;
+      __atomic_add_fetch(&m_stats.spin_hits, 1, __ATOMIC_RELAXED);
+      m_spin_ns = (m_spin_ns * 2 < SPIN_MAX_NS ? m_spin_ns * 2 : SPIN_MAX_NS);
+      continue;
+    }
+
+    // Spinning did not pay off
+    m_spin_ns = (m_spin_ns / 2 >= SPIN_MIN_NS ? m_spin_ns / 2 : 0);
+
+    if (arm_doorbells()) {
+      break; // Sleep until next doorbell
+    }
+  }
+
+  __atomic_store_n(&m_stats.spin_ns, m_spin_ns, __ATOMIC_RELAXED);
+
+  return total;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ring_server::get_stats(BASICD_RING_STATS *stats)
+{
+  stats->clients     = __atomic_load_n(&m_stats.clients,     __ATOMIC_RELAXED);
+  stats->connects    = __atomic_load_n(&m_stats.connects,    __ATOMIC_RELAXED);
+  stats->records     = __atomic_load_n(&m_stats.records,     __ATOMIC_RELAXED);
+  stats->bytes       = __atomic_load_n(&m_stats.bytes,       __ATOMIC_RELAXED);
+  stats->bad_records = __atomic_load_n(&m_stats.bad_records, __ATOMIC_RELAXED);
+  stats->doorbells   = __atomic_load_n(&m_stats.doorbells,   __ATOMIC_RELAXED);
+  stats->spin_hits   = __atomic_load_n(&m_stats.spin_hits,   __ATOMIC_RELAXED);
+  stats->spin_ns     = __atomic_load_n(&m_stats.spin_ns,     __ATOMIC_RELAXED);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+long basicd_ring_server::create_ring(unsigned index, unsigned mode)
+{
+  RING *r = &m_rings[index];
+
+  // Size is sealed, a producer can't make the daemon fault
+  r->memfd = memfd_create(BASICD_NAME ".ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if ( (r->memfd == -1) ||
+       (ftruncate(r->memfd, sizeof(BASICD_RING)) == -1) ||
+       (fcntl(r->memfd, F_ADD_SEALS,
+	      F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) ) {
+    destroy_ring(index);
+    return BASICD_RING_SERVER_FAILURE;
+  }
+
+  void *addr = mmap(NULL, sizeof(BASICD_RING),
+		    PROT_READ | PROT_WRITE, MAP_SHARED, r->memfd, 0);
+  if (addr == MAP_FAILED) {
+    destroy_ring(index);
+    return BASICD_RING_SERVER_FAILURE;
+  }
+  r->ring       = (BASICD_RING *)addr;
+  r->tail       = 0;
+  r->orphaned   = false;
+  r->dead_below = 0;
+  r->stalled_ns = 0;
+
+  // All slots free for first lap, memfd is zero filled
+  for (unsigned i=0; i < BASICD_RING_NR_SLOTS; i++) {
+    r->ring->slots[i].seq = i;
+  }
+  r->ring->header.version   = BASICD_RING_VERSION;
+  r->ring->header.size      = sizeof(BASICD_RING);
+  r->ring->header.mode      = mode;
+  r->ring->header.nr_slots  = BASICD_RING_NR_SLOTS;
+  r->ring->header.slot_size = BASICD_RING_SLOT_SIZE;
+  __atomic_store_n(&r->ring->header.magic, BASICD_RING_MAGIC, __ATOMIC_RELEASE);
+
+  r->doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if ( (r->doorbell_fd == -1) ||
+       (m_loop.add_fd(r->doorbell_fd, EPOLLIN,
+		      on_doorbell, this) != EVENT_LOOP_SUCCESS) ) {
+    destroy_ring(index);
+    return BASICD_RING_SERVER_FAILURE;
+  }
+
+  return BASICD_RING_SERVER_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ring_server::destroy_ring(unsigned index)
+{
+  RING *r = &m_rings[index];
+
+  if (r->doorbell_fd != -1) {
+    m_loop.remove_fd(r->doorbell_fd);
+    ::close(r->doorbell_fd);
+    r->doorbell_fd = -1;
+  }
+  if (r->ring) {
+    munmap(r->ring, sizeof(BASICD_RING));
+    r->ring = NULL;
+  }
+  if (r->memfd != -1) {
+    ::close(r->memfd);
+    r->memfd = -1;
+  }
+  r->orphaned = false;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ring_server::on_accept(int fd, uint32_t events, void *arg)
+{
+  ((basicd_ring_server *)arg)->accept_client();
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ring_server::on_client(int fd, uint32_t events, void *arg)
+{
+  CLIENT *client = (CLIENT *)arg;
+
+  client->server->serve_client(client);
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ring_server::on_doorbell(int fd, uint32_t events, void *arg)
+{
+  basicd_ring_server *server = (basicd_ring_server *)arg;
+  uint64_t value;
+
+  // Records are consumed by poll
+  if (read(fd, &value, sizeof(value)) == sizeof(value)) {
+    __atomic_add_fetch(&server->m_stats.doorbells, 1, __ATOMIC_RELAXED);
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ring_server::accept_client(void)
+{
+  int fd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd == -1) {
+    return; // Client gone, or out of descriptors
+  }
+
+  // Find a free slot, if none the client is refused
+  CLIENT *client = NULL;
+  for (unsigned i=0; i < BASICD_RING_SERVER_MAX_CLIENTS; i++) {
+    if (m_clients[i].fd == -1) {
+      client = &m_clients[i];
+      break;
+    }
+  }
+  if ( (!client) ||
+       (m_loop.add_fd(fd, EPOLLIN, on_client, client) != EVENT_LOOP_SUCCESS) ) {
+    ::close(fd);
+    return;
+  }
+
+  client->fd   = fd;
+  client->ring = -1;
+
+  __atomic_add_fetch(&m_stats.clients, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&m_stats.connects, 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ring_server::serve_client(CLIENT *client)
+{
+  uint8_t buffer[16];
+
+  const ssize_t n = read(client->fd, buffer, sizeof(buffer));
+  if ( (n == 0) ||
+       ((n == -1) && (errno != EAGAIN) && (errno != EINTR)) ) {
+    close_client(client); // Producer is gone
+    return;
+  }
+
+  // First byte is the mode, nothing more is expected
+  if ( (n > 0) && (client->ring == -1) ) {
+    attach_client(client, buffer[0]);
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ring_server::attach_client(CLIENT *client, unsigned mode)
+{
+  uint8_t status = BASICD_RING_STATUS_OK;
+  int index = -1;
+
+  if (mode == BASICD_RING_MPSC) {
+    index = 0;
+  }
+  else if (mode == BASICD_RING_SPSC) {
+    for (unsigned i=1; i < BASICD_RING_SERVER_MAX_RINGS; i++) {
+      if (!m_rings[i].ring) {
+	index = i;
+	break;
+      }
+    }
+    if ( (index < 0) ||
+	 (create_ring(index, BASICD_RING_SPSC) != BASICD_RING_SERVER_SUCCESS) ) {
+      index  = -1;
+      status = BASICD_RING_STATUS_NO_RING;
+    }
+  }
+  else {
+    status = BASICD_RING_STATUS_BAD_MODE;
+  }
+
+  // Status, and when ok the ring and its doorbell
+  struct msghdr msg;
+  struct iovec iov;
+  union {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base   = &status;
+  iov.iov_len    = 1;
+  msg.msg_iov    = &iov;
+  msg.msg_iovlen = 1;
+
+  if (index >= 0) {
+    const int fds[2] = {m_rings[index].memfd, m_rings[index].doorbell_fd};
+
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  }
+
+  // Fresh connection, the send buffer has room
+  if ( (sendmsg(client->fd, &msg, MSG_NOSIGNAL) != 1) ||
+       (index < 0) ) {
+    if (index > 0) {
+      destroy_ring(index);
+    }
+    close_client(client);
+    return;
+  }
+
+  client->ring = index;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_ring_server::close_client(CLIENT *client)
+{
+  if (client->fd == -1) {
+    return;
+  }
+
+  m_loop.remove_fd(client->fd);
+  ::close(client->fd);
+  client->fd = -1;
+
+  // Committed records are still consumed
+  if (client->ring > 0) {
+    m_rings[client->ring].orphaned = true;
+  }
+
+  // A producer of the shared ring that exits between reserve and
+  // commit leaves a record that is never committed. It is below the
+  // head of now, and skipped if it stays uncommitted.
+  if ( (client->ring == 0) && (m_rings[0].ring) ) {
+    m_rings[0].dead_below =
+      __atomic_load_n(&m_rings[0].ring->producer.head, __ATOMIC_RELAXED);
+  }
+  client->ring = -1;
+
+  __atomic_sub_fetch(&m_stats.clients, 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////
+
+unsigned basicd_ring_server::consume(RING *ring,
+				     unsigned max_records,
+				     BASICD_RING_HANDLER handler,
+				     void *arg)
+{
+  uint64_t bytes = 0;
+  unsigned bad = 0;
+  unsigned n;
+
+  for (n=0; n < max_records; n++) {
+    BASICD_RING_SLOT *slot = &ring->ring->slots[ring->tail & RING_MASK];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->tail + 1) {
+      if (skip_stalled(ring, slot)) {
+	bad++;
+	continue;
+      }
+      break; // Empty, or record not yet committed
+    }
+    ring->stalled_ns = 0;
+
+    // Written by another process, trust nothing
+    const uint32_t len = slot->len;
+    if (len <= BASICD_RING_MAX_RECORD) {
+      handler(slot->data, len, arg);
+      bytes += len;
+    }
+    else {
+      bad++;
+    }
+
+    // Free for the producer in next lap
+    __atomic_store_n(&slot->seq,
+		     ring->tail + BASICD_RING_NR_SLOTS, __ATOMIC_RELEASE);
+    ring->tail++;
+  }
+
+  if (n) {
+    __atomic_add_fetch(&m_stats.records, n - bad, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_stats.bytes, bytes, __ATOMIC_RELAXED);
+  }
+  if (bad) {
+    __atomic_add_fetch(&m_stats.bad_records, bad, __ATOMIC_RELAXED);
+  }
+
+  return n;
+}
+
+////////////////////////////////////////////////////////////////
+
+bool basicd_ring_server::skip_stalled(RING *ring, BASICD_RING_SLOT *slot)
+{
+  // Only a position that may be held by a gone producer, a producer
+  // that is still connected commits its record when it runs again
+  if (ring->tail >= ring->dead_below) {
+    ring->stalled_ns = 0;
+    return false;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  const uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+  if (!ring->stalled_ns) {
+    ring->stalled_ns = now_ns;
+    return false;
+  }
+  if (now_ns - ring->stalled_ns < STALLED_RECORD_NS) {
+    return false;
+  }
+
+  // Free for the producer in next lap, unless committed meanwhile
+  uint64_t expected = ring->tail;
+  if (!__atomic_compare_exchange_n(&slot->seq, &expected,
+				   ring->tail + BASICD_RING_NR_SLOTS, 0,
+				   __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    return false;
+  }
+  ring->tail++;
+  ring->stalled_ns = 0;
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////
+
+unsigned basicd_ring_server::consume_all(BASICD_RING_HANDLER handler,
+					 void *arg)
+{
+  unsigned total = 0;
+
+  // One batch from each ring, no ring can starve the others
+  for (unsigned i=0; i < BASICD_RING_SERVER_MAX_RINGS; i++) {
+    RING *ring = &m_rings[i];
+    if (!ring->ring) {
+      continue;
+    }
+
+    const unsigned n = consume(ring, BASICD_RING_SERVER_BATCH, handler, arg);
+    total += n;
+
+    if ( (ring->orphaned) && (n < BASICD_RING_SERVER_BATCH) ) {
+      destroy_ring(i); // Empty, no more records
+    }
+  }
+
+  return total;
+}
+
+////////////////////////////////////////////////////////////////
+
+bool basicd_ring_server::arm_doorbells(void)
+{
+  for (unsigned i=0; i < BASICD_RING_SERVER_MAX_RINGS; i++) {
+    if (m_rings[i].ring) {
+      __atomic_store_n(&m_rings[i].ring->consumer.sleeping, 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  // Pairs with basicd_ring_commit, records committed before a
+  // producer could see 'sleeping' are found here
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  for (unsigned i=0; i < BASICD_RING_SERVER_MAX_RINGS; i++) {
+    const RING *ring = &m_rings[i];
+    if ( (ring->ring) &&
+	 (__atomic_load_n(&ring->ring->slots[ring->tail & RING_MASK].seq,
+			  __ATOMIC_ACQUIRE) == ring->tail + 1) ) {
+      return false;
+    }
+  }
+
+  return true;
+}
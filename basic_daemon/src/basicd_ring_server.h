@@ -0,0 +1,121 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __BASICD_RING_SERVER_H__
+#define __BASICD_RING_SERVER_H__
+
+#include <stdint.h>
+#include <string>
+
+#include "basicd.h"
+#include "basicd_ring.h"
+#include "event_loop.h"
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define BASICD_RING_SERVER_SUCCESS   0
+#define BASICD_RING_SERVER_FAILURE  -1
+
+#define BASICD_RING_SERVER_MAX_CLIENTS  16
+#define BASICD_RING_SERVER_MAX_RINGS    (BASICD_RING_SERVER_MAX_CLIENTS + 1)
+
+// Records consumed from one ring before next ring is served
+#define BASICD_RING_SERVER_BATCH  64
+
+/////////////////////////////////////////////////////////////////////////////
+//               Class support types
+/////////////////////////////////////////////////////////////////////////////
+
+// Called for each record, in place in the ring. The record
+// is released when the handler returns.
+typedef void (*BASICD_RING_HANDLER)(const uint8_t *record,
+				    uint32_t len,
+				    void *arg);
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// Owns the rings and serves the ring socket. Except for open, close
+// and get_stats, it is only used by the consuming thread. That thread
+// waits for get_fd to become readable, and then calls poll.
+
+class basicd_ring_server {
+
+ public:
+  basicd_ring_server(void);
+  ~basicd_ring_server(void);
+
+  long open(const char *path);
+  void close(void);
+
+  int get_fd(void); // Readable on new clients and doorbells
+
+  // Accepts clients and consumes records until all rings are empty,
+  // busy-polls a while if records keep coming. Returns nof records.
+  unsigned poll(BASICD_RING_HANDLER handler, void *arg);
+
+  void get_stats(BASICD_RING_STATS *stats);
+
+ private:
+  typedef struct {
+    BASICD_RING *ring;        // NULL when slot is free
+    int          memfd;
+    int          doorbell_fd;
+    uint64_t     tail;        // Next position to consume
+    bool         orphaned;    // Producer gone, released when empty
+    uint64_t     dead_below;  // Positions below may be held by a gone producer
+    uint64_t     stalled_ns;  // When record at tail was found uncommitted
+  } RING;
+
+  typedef struct {
+    basicd_ring_server *server;
+    int                 fd;   // -1 when slot is free
+    int                 ring; // Index, -1 until mode received
+  } CLIENT;
+
+  int      m_listen_fd;
+  event_loop m_loop;
+
+  RING     m_rings[BASICD_RING_SERVER_MAX_RINGS]; // First is MPSC
+  CLIENT   m_clients[BASICD_RING_SERVER_MAX_CLIENTS];
+
+  uint64_t m_spin_ns; // Current busy-poll time, adapted to load
+
+  BASICD_RING_STATS m_stats; // Updated atomically
+
+  long create_ring(unsigned index, unsigned mode);
+  void destroy_ring(unsigned index);
+
+  static void on_accept(int fd, uint32_t events, void *arg);
+  static void on_client(int fd, uint32_t events, void *arg);
+  static void on_doorbell(int fd, uint32_t events, void *arg);
+
+  void accept_client(void);
+  void serve_client(CLIENT *client);
+  void attach_client(CLIENT *client, unsigned mode);
+  void close_client(CLIENT *client);
+
+  unsigned consume(RING *ring,
+		   unsigned max_records,
+		   BASICD_RING_HANDLER handler,
+		   void *arg);
+  bool skip_stalled(RING *ring, BASICD_RING_SLOT *slot);
+  unsigned consume_all(BASICD_RING_HANDLER handler, void *arg);
+  bool arm_doorbells(void);
+};
+
+#endif // __BASICD_RING_SERVER_H__
@@ -0,0 +1,106 @@
+/************************************************************************
+ *                                                                      *
+ * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+ *                                                                      *
+ * This program is free software; you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation; either version 2 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ ************************************************************************/
+
+#ifndef __BASICD_STAT_H__
+#define __BASICD_STAT_H__
+
+#include <stdint.h>
+
+#include "basicd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * BASICD statistics segment
+ *
+ * Published by the daemon as POSIX shared memory (shm_open), to be
+ * mapped read-only by monitors. Reading never calls into the daemon.
+ *
+ * The header is written at start, the magic number last, and only
+ * 'nr_threads' changes later. All other records
+ * are cache line aligned and guarded by a sequence lock 'seq', which is
+ * odd while the record is written. A reader copies a record and makes
+ * a new copy if 'seq' was odd or has changed meanwhile (see seqlock.h).
+ *
+ * The segment lives as long as the daemon process. The thread records
+ * survive a restart of the daemon core, 'pid' tells which daemon.
+ */
+#define BASICD_STAT_SHM_NAME     "/" BASICD_NAME ".stat"
+#define BASICD_STAT_MAGIC        0x42435354 /* "BCST" */
+#define BASICD_STAT_VERSION      3
+
+#define BASICD_STAT_MAX_THREADS  4
+#define BASICD_STAT_ALIGN        64 /* Cache line size */
+
+/* Bucket i counts execution times up to 10^i us, last bucket the rest */
+#define BASICD_STAT_NR_BUCKETS   8
+
+/* Events counted during cyclic work: CPU cycles, instructions, last
+   level cache misses, branch misses, context switches, page faults */
+#define BASICD_STAT_NR_PERF_COUNTERS  6
+
+#define BASICD_STAT_ALIGNED __attribute__((aligned(BASICD_STAT_ALIGN)))
+
+typedef struct {
+  uint32_t magic;       /* BASICD_STAT_MAGIC when valid */
+  uint32_t version;     /* BASICD_STAT_VERSION */
+  uint32_t size;        /* sizeof(BASICD_STAT_SEGMENT) */
+  uint32_t nr_threads;  /* Nof used thread records */
+  int32_t  pid;         /* Daemon process */
+  int64_t  start_time;  /* Seconds since the Epoch */
+} BASICD_STAT_ALIGNED BASICD_STAT_HEADER;
+
+typedef struct {
+  uint32_t seq;
+  char     name[20];
+  int32_t  tid;                    /* Linux thread ID */
+  uint32_t state;                  /* THREAD_STATE_xxx */
+  uint32_t status;                 /* Bitmask of THREAD_STATUS_xxx */
+  uint32_t exe_cnt;                /* Thread execution counter */
+  double   frequency;              /* Hz */
+  uint64_t cycles;                 /* Nof completed cycles */
+  uint64_t overruns;               /* Cycles that ended after next start */
+  uint64_t exec_time_last_ns;      /* Duration of cyclic work */
+  uint64_t exec_time_min_ns;
+  uint64_t exec_time_max_ns;
+  uint64_t exec_time_sum_ns;       /* Average is sum / cycles */
+  uint64_t wakeup_latency_last_ns; /* Actual minus planned start of cycle */
+  uint64_t wakeup_latency_max_ns;
+  uint64_t cpu_time_ns;            /* Consumed by thread */
+  uint64_t exec_time_hist[BASICD_STAT_NR_BUCKETS];
+  uint32_t perf_available;         /* Bitmask, bit i => event i counted */
+  uint64_t perf_sum[BASICD_STAT_NR_PERF_COUNTERS]; /* All cycles */
+  uint64_t perf_max[BASICD_STAT_NR_PERF_COUNTERS]; /* Cycle with max exec time */
+} BASICD_STAT_ALIGNED BASICD_STAT_THREAD;
+
+typedef struct {
+  uint32_t seq;
+  int32_t  error_source;  /* BASICD_ERROR_SOURCE */
+  int64_t  error_code;    /* BASICD internal error code */
+  int32_t  linux_errno;
+  uint64_t nr_errors;     /* Nof errors since start, zero => no error */
+  int64_t  time;          /* Seconds since the Epoch */
+  char     info[128];     /* Truncated error information */
+} BASICD_STAT_ALIGNED BASICD_STAT_ERROR;
+
+typedef struct {
+  BASICD_STAT_HEADER header;
+  BASICD_STAT_THREAD thread[BASICD_STAT_MAX_THREADS];
+  BASICD_STAT_ERROR  last_error;
+} BASICD_STAT_SEGMENT;
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* __BASICD_STAT_H__ */
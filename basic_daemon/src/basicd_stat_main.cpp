@@ -0,0 +1,232 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "basicd_stat.h"
+#include "seqlock.h"
+#include "delay.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Function prototypes
+/////////////////////////////////////////////////////////////////////////////
+
+static void stat_usage(const char *prog);
+static const BASICD_STAT_SEGMENT *stat_map(const char *shm_name);
+static void stat_print_perf(const char *title,
+			    const BASICD_STAT_THREAD *thread,
+			    const uint64_t *values);
+static void stat_print(const BASICD_STAT_SEGMENT *segment);
+
+////////////////////////////////////////////////////////////////
+
+static void stat_usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-i interval_in_sec] [-n count] "
+	  "[-p instance]\n", prog);
+  fprintf(stderr, "Prints statistics published by %s, "
+	  "without calling the daemon\n", BASICD_NAME);
+  fprintf(stderr, "With -p, of one of several daemon processes (1..)\n");
+}
+
+////////////////////////////////////////////////////////////////
+
+static const BASICD_STAT_SEGMENT *stat_map(const char *shm_name)
+{
+  int fd;
+  void *addr;
+
+  fd = shm_open(shm_name, O_RDONLY, 0);
+  if (fd == -1) {
+    fprintf(stderr, "Can't open %s, code=%d (%s)\n",
+	    shm_name, errno, strerror(errno));
+    return NULL;
+  }
+
+  addr = mmap(NULL, sizeof(BASICD_STAT_SEGMENT),
+	      PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "Can't map %s, code=%d (%s)\n",
+	    shm_name, errno, strerror(errno));
+    return NULL;
+  }
+
+  const BASICD_STAT_SEGMENT *segment = (const BASICD_STAT_SEGMENT *)addr;
+
+  if ( (__atomic_load_n(&segment->header.magic, __ATOMIC_ACQUIRE) !=
+	BASICD_STAT_MAGIC) ||
+       (segment->header.version != BASICD_STAT_VERSION) ||
+       (segment->header.size != sizeof(BASICD_STAT_SEGMENT)) ) {
+    fprintf(stderr, "Bad segment %s, not published or other version\n",
+	    shm_name);
+    munmap(addr, sizeof(BASICD_STAT_SEGMENT));
+    return NULL;
+  }
+
+  return segment;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void stat_print_perf(const char *title,
+			    const BASICD_STAT_THREAD *thread,
+			    const uint64_t *values)
+{
+  static const char *names[BASICD_STAT_NR_PERF_COUNTERS] =
+    {"cycles", "instr", "llc_miss", "br_miss", "ctx_sw", "faults"};
+
+  // Events not counted by the host are left out
+  printf("\t%s:", title);
+  for (unsigned i=0; i < BASICD_STAT_NR_PERF_COUNTERS; i++) {
+    if (thread->perf_available & (1 << i)) {
+      printf(" %s:%llu", names[i], (unsigned long long) values[i]);
+    }
+  }
+  printf("\n");
+}
+
+////////////////////////////////////////////////////////////////
+
+static void stat_print(const BASICD_STAT_SEGMENT *segment)
+{
+  BASICD_STAT_THREAD thread;
+  BASICD_STAT_ERROR  error;
+  uint32_t seq;
+
+  printf("pid:%d, started:%lld\n",
+	 segment->header.pid, (long long) segment->header.start_time);
+
+  const uint32_t nr_threads =
+    __atomic_load_n(&segment->header.nr_threads, __ATOMIC_ACQUIRE);
+
+  for (uint32_t i=0; (i < nr_threads) && (i < BASICD_STAT_MAX_THREADS); i++) {
+    // Consistent copy of record
+    do {
+      seq = seqlock_read_begin(&segment->thread[i].seq);
+      memcpy(&thread, &segment->thread[i], sizeof(thread));
+    } while (seqlock_read_retry(&segment->thread[i].seq, seq));
+
+    thread.name[sizeof(thread.name) - 1] = '\0';
+    const double avg_us = thread.cycles ?
+      (double) thread.exec_time_sum_ns / thread.cycles / 1000.0 : 0.0;
+
+    printf("thread:%s, tid:%d, state:%u, status:0x%x, exe_cnt:%u, freq:%.3f\n",
+	   thread.name, thread.tid, thread.state, thread.status,
+	   thread.exe_cnt, thread.frequency);
+    printf("\tcycles:%llu, overruns:%llu\n",
+	   (unsigned long long) thread.cycles,
+	   (unsigned long long) thread.overruns);
+    printf("\texec us, last:%.1f, min:%.1f, avg:%.1f, max:%.1f\n",
+	   thread.exec_time_last_ns / 1000.0,
+	   thread.exec_time_min_ns / 1000.0,
+	   avg_us,
+	   thread.exec_time_max_ns / 1000.0);
+    printf("\twakeup latency us, last:%.1f, max:%.1f\n",
+	   thread.wakeup_latency_last_ns / 1000.0,
+	   thread.wakeup_latency_max_ns / 1000.0);
+    printf("\tcpu s:%.6f, exec histogram (10^i us):",
+	   thread.cpu_time_ns / 1e9);
+    for (unsigned b=0; b < BASICD_STAT_NR_BUCKETS; b++) {
+      printf(" %llu", (unsigned long long) thread.exec_time_hist[b]);
+    }
+    printf("\n");
+    if (thread.perf_available) {
+      stat_print_perf("perf sum", &thread, thread.perf_sum);
+      stat_print_perf("perf max, slowest cycle", &thread, thread.perf_max);
+    }
+  }
+
+  do {
+    seq = seqlock_read_begin(&segment->last_error.seq);
+    memcpy(&error, &segment->last_error, sizeof(error));
+  } while (seqlock_read_retry(&segment->last_error.seq, seq));
+
+  error.info[sizeof(error.info) - 1] = '\0';
+  if (error.nr_errors) {
+    printf("errors:%llu, last source:%d, code:%lld, errno:%d, time:%lld\n"
+	   "\tinfo:%s\n",
+	   (unsigned long long) error.nr_errors,
+	   error.error_source, (long long) error.error_code,
+	   error.linux_errno, (long long) error.time, error.info);
+  }
+  else {
+    printf("errors:0\n");
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+  double interval = 0.0;
+  long count = 1;
+  long instance = 0;
+  char shm_name[64];
+  int opt;
+
+  while ( (opt = getopt(argc, argv, "i:n:p:h")) != -1 ) {
+    switch (opt) {
+    case 'i':
+      interval = atof(optarg);
+      if (count == 1) {
+	count = -1; // Forever, unless given
+      }
+      break;
+    case 'n':
+      count = atol(optarg);
+      break;
+    case 'p':
+      instance = atol(optarg);
+      if (instance <= 0) {
+	stat_usage(argv[0]);
+	exit(EXIT_FAILURE);
+      }
+      break;
+    default:
+      stat_usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Segment of each process is suffixed by its instance
+  if (instance) {
+    snprintf(shm_name, sizeof(shm_name), "%s.%ld",
+	     BASICD_STAT_SHM_NAME, instance);
+  }
+  else {
+    snprintf(shm_name, sizeof(shm_name), "%s", BASICD_STAT_SHM_NAME);
+  }
+
+  const BASICD_STAT_SEGMENT *segment = stat_map(shm_name);
+  if (!segment) {
+    exit(EXIT_FAILURE);
+  }
+
+  for (long i=0; (count < 0) || (i < count); i++) {
+    if (i) {
+      printf("\n");
+      delay(interval);
+    }
+    stat_print(segment);
+    fflush(stdout);
+  }
+
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,170 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "basicd_stat_segment.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+basicd_stat_segment::basicd_stat_segment(void)
+{
+  m_shm_name = "";
+  m_fd       = -1;
+  m_segment  = 0;
+}
+
+////////////////////////////////////////////////////////////////
+
+basicd_stat_segment::~basicd_stat_segment(void)
+{
+  close();
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_stat_segment::open(string shm_name)
+{
+  int fd;
+
+  // Readable by everyone, segment left by a previous instance is reused
+  fd = shm_open(shm_name.c_str(),
+		O_RDWR | O_CREAT,
+		S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    return BASICD_STAT_SEGMENT_FAILURE;
+  }
+
+  if ( (ftruncate(fd, sizeof(BASICD_STAT_SEGMENT)) == -1) ||
+       (map(fd) != BASICD_STAT_SEGMENT_SUCCESS) ) {
+    ::close(fd);
+    return BASICD_STAT_SEGMENT_FAILURE;
+  }
+  m_shm_name = shm_name;
+
+  // Invalidate while initialized
+  __atomic_store_n(&m_segment->header.magic, 0, __ATOMIC_RELEASE);
+  memset(m_segment, 0, sizeof(*m_segment));
+
+  m_segment->header.version    = BASICD_STAT_VERSION;
+  m_segment->header.size       = sizeof(BASICD_STAT_SEGMENT);
+  m_segment->header.nr_threads = 0;
+  m_segment->header.pid        = getpid();
+  m_segment->header.start_time = time(NULL);
+
+  __atomic_store_n(&m_segment->header.magic, BASICD_STAT_MAGIC, __ATOMIC_RELEASE);
+
+  return BASICD_STAT_SEGMENT_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long basicd_stat_segment::inherit(string shm_name, int fd)
+{
+  struct stat st;
+
+  // Must be a complete segment of this version
+  if ( (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) ||
+       (fstat(fd, &st) == -1) ||
+       (st.st_size != sizeof(BASICD_STAT_SEGMENT)) ||
+       (map(fd) != BASICD_STAT_SEGMENT_SUCCESS) ) {
+    ::close(fd);
+    return BASICD_STAT_SEGMENT_FAILURE;
+  }
+  m_shm_name = shm_name;
+
+  if ( (m_segment->header.magic != BASICD_STAT_MAGIC) ||
+       (m_segment->header.version != BASICD_STAT_VERSION) ) {
+    close();
+    return BASICD_STAT_SEGMENT_FAILURE;
+  }
+
+  return BASICD_STAT_SEGMENT_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void basicd_stat_segment::close(void)
+{
+  if (m_segment) {
+    munmap(m_segment, sizeof(BASICD_STAT_SEGMENT));
+    shm_unlink(m_shm_name.c_str());
+  }
+  if (m_fd != -1) {
+    ::close(m_fd);
+  }
+  m_segment  = 0;
+  m_fd       = -1;
+  m_shm_name = "";
+}
+
+////////////////////////////////////////////////////////////////
+
+BASICD_STAT_THREAD *basicd_stat_segment::add_thread(unsigned index,
+						    const char *name)
+{
+  if ( (!m_segment) || (index >= BASICD_STAT_MAX_THREADS) ) {
+    return NULL;
+  }
+
+  BASICD_STAT_THREAD *record = &m_segment->thread[index];
+
+  seqlock_write_begin(&record->seq);
+  strncpy(record->name, name, sizeof(record->name) - 1);
+  seqlock_write_end(&record->seq);
+
+  if (index >= m_segment->header.nr_threads) {
+    __atomic_store_n(&m_segment->header.nr_threads, index + 1, __ATOMIC_RELEASE);
+  }
+
+  return record;
+}
+
+////////////////////////////////////////////////////////////////
+
+BASICD_STAT_ERROR *basicd_stat_segment::get_last_error(void)
+{
+  if (!m_segment) {
+    return NULL;
+  }
+
+  return &m_segment->last_error;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+long basicd_stat_segment::map(int fd)
+{
+  void *addr = mmap(NULL, sizeof(BASICD_STAT_SEGMENT),
+		    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    return BASICD_STAT_SEGMENT_FAILURE;
+  }
+
+  // Kept for a new image
+  m_fd      = fd;
+  m_segment = (BASICD_STAT_SEGMENT *)addr;
+
+  return BASICD_STAT_SEGMENT_SUCCESS;
+}
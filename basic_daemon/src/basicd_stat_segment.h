@@ -0,0 +1,67 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __BASICD_STAT_SEGMENT_H__
+#define __BASICD_STAT_SEGMENT_H__
+
+#include <string>
+
+#include "basicd_stat.h"
+#include "seqlock.h"
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define BASICD_STAT_SEGMENT_SUCCESS   0
+#define BASICD_STAT_SEGMENT_FAILURE  -1
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// Owner of the statistics segment. Each record has one writer,
+// which updates it using seqlock_write_begin/seqlock_write_end.
+
+class basicd_stat_segment {
+
+ public:
+  basicd_stat_segment(void);
+  ~basicd_stat_segment(void);
+
+  long open(string shm_name); // Create and publish segment
+  void close(void);           // Remove segment
+
+  // Take over segment published by a previous image, contents
+  // are kept and readers are not disturbed. Owns fd, also on failure.
+  long inherit(string shm_name, int fd);
+
+  int get_fd(void) {return m_fd;} // Open while segment is open
+
+  bool is_open(void) {return (m_segment != 0);}
+
+  // Returns NULL if index is out of range or not open
+  BASICD_STAT_THREAD *add_thread(unsigned index, const char *name);
+
+  BASICD_STAT_ERROR *get_last_error(void);
+
+ private:
+  string               m_shm_name;
+  int                  m_fd;
+  BASICD_STAT_SEGMENT *m_segment;
+
+  long map(int fd);
+};
+
+#endif // __BASICD_STAT_SEGMENT_H__
@@ -10,16 +10,39 @@
 // ************************************************************************
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "cfg_file.h"
+#include "delay.h"
+#include "metrics_registry.h"
+#include "sdt_probe.h"
 
 /////////////////////////////////////////////////////////////////////////////
 //               Definition of macros
 /////////////////////////////////////////////////////////////////////////////
 
-#define CFG_FILE_MAX_LINE_LENGTH  100
+#define CFG_FILE_MAX_NUMBER_LENGTH  64
+
+#define NR_PARSE_TIME_BOUNDS  5
+
+#define HASH_TABLE_MIN_SIZE  16
+#define HASH_SLOT_EMPTY      -1
+
+#define IS_BLANK(c) ( ((c) == ' ') || ((c) == '\t') || ((c) == '\r') )
+
+/////////////////////////////////////////////////////////////////////////////
+//               Module global variables
+/////////////////////////////////////////////////////////////////////////////
+
+// Parse time buckets (ns), 10 us .. 100 ms
+static const uint64_t g_parse_time_bounds[NR_PARSE_TIME_BOUNDS] =
+  {10000, 100000, 1000000, 10000000, 100000000};
 
 /////////////////////////////////////////////////////////////////////////////
 //               Public member functions
@@ -30,195 +53,374 @@
 cfg_file::cfg_file(string file_name)
 {
   m_file_name = file_name;
+
+  rehash(HASH_TABLE_MIN_SIZE);
+
+  metrics_registry *metrics = metrics_registry::instance();
+  m_parses_id     = metrics->add_counter("cfg_file_parses_total", "", 1.0);
+  m_failures_id   = metrics->add_counter("cfg_file_parse_failures_total",
+					 "", 1.0);
+  m_parse_time_id = metrics->add_histogram("cfg_file_parse_seconds", "", 1e-9,
+					   g_parse_time_bounds,
+					   NR_PARSE_TIME_BOUNDS);
 }
 
 ////////////////////////////////////////////////////////////////
 
 cfg_file::~cfg_file(void)
 {
-  // Free any memory allocated by 'set_default_item_value'
-  for (unsigned i=0; i < m_item_list.size(); i++) {
-    delete m_item_list[i];
-  }
 }
 
 ////////////////////////////////////////////////////////////////
 
 long cfg_file::parse(void)
 {
-  FILE *fd = NULL;
-  char row[CFG_FILE_MAX_LINE_LENGTH];
+  struct timespec start;
+  struct timespec end;
+
+  BASICD_PROBE1(cfg_parse, m_file_name.c_str());
+  clock_gettime(get_clock_id(), &start);
+  const long rc = parse_file();
+  clock_gettime(get_clock_id(), &end);
+
+  const uint64_t parse_time =
+    (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+    end.tv_nsec - start.tv_nsec;
+  BASICD_PROBE3(cfg_parsed, m_file_name.c_str(), rc, parse_time);
+
+  metrics_registry *metrics = metrics_registry::instance();
+  metrics->inc(m_parses_id);
+  if (rc != CFG_FILE_SUCCESS) {
+    metrics->inc(m_failures_id);
+  }
+  metrics->observe(m_parse_time_id, parse_time);
+
+  return rc;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Protected member functions
+/////////////////////////////////////////////////////////////////////////////
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+long cfg_file::parse_file(void)
+{
+  int fd;
+  struct stat st;
 
   // Open config file
-  fd = fopen(m_file_name.c_str(), "r");
-  if (fd == NULL) {
+  fd = open(m_file_name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
     if (errno == ENOENT) {
       return CFG_FILE_FILE_NOT_FOUND;
     }    
     return CFG_FILE_FILE_IO_ERROR;
   }
 
-  // Parse file, line by line
-  while (fgets(row, CFG_FILE_MAX_LINE_LENGTH, fd) != NULL) {
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return CFG_FILE_FILE_IO_ERROR;
+  }
+
+  // Read the whole file, normally with one read. The file is watched
+  // for changes and may be rewritten meanwhile, so read until end of
+  // file rather than trusting the size (a mapping of a file that is
+  // truncated faults). One byte more than the size shows growth.
+  vector<char> data((size_t)st.st_size + 1);
+  size_t size = 0;
+  for (;;) {
+    if (size == data.size()) {
+      data.resize(2 * data.size());
+    }
+    const ssize_t n = read(fd, &data[size], data.size() - size);
+    if (n == 0) {
+      break;
+    }
+    if (n == -1) {
+      if (errno == EINTR) {
+	continue;
+      }
+      close(fd);
+      return CFG_FILE_FILE_IO_ERROR;
+    }
+    size += n;
+  }
+  close(fd);
+
+  return parse_buffer(&data[0], size);
+}
+
+////////////////////////////////////////////////////////////////
+
+int cfg_file::find_item(const char *item_name)
+{
+  return find_item(item_name, strlen(item_name));
+}
+
+////////////////////////////////////////////////////////////////
+
+int cfg_file::find_item(const char *item_name, unsigned len)
+{
+  const unsigned mask = m_hash_table.size() - 1;
+  unsigned slot = hash(item_name, len) & mask;
+
+  // Probe until item or an empty slot is found,
+  // the table is never allowed to be full
+  while (m_hash_table[slot] != HASH_SLOT_EMPTY) {
+    const int index = m_hash_table[slot];
+    const string &name = m_items[index].m_name;
+    if ( (name.size() == len) &&
+	 (memcmp(name.data(), item_name, len) == 0) ) {
+      return index;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  return HASH_SLOT_EMPTY;
+}
+
+////////////////////////////////////////////////////////////////
+
+int cfg_file::add_item(const item &the_item)
+{
+  // Keep load factor below 0.5
+  if ( (m_items.size() + 1) * 2 > m_hash_table.size() ) {
+    rehash(m_hash_table.size() * 2);
+  }
+
+  const int index = m_items.size();
+  m_items.push_back(the_item);
+
+  const unsigned mask = m_hash_table.size() - 1;
+  unsigned slot = hash(the_item.m_name.data(), the_item.m_name.size()) & mask;
+  while (m_hash_table[slot] != HASH_SLOT_EMPTY) {
+    slot = (slot + 1) & mask;
+  }
+  m_hash_table[slot] = index;
+
+  return index;
+}
+
+////////////////////////////////////////////////////////////////
+
+void cfg_file::rehash(unsigned size)
+{
+  m_hash_table.assign(size, HASH_SLOT_EMPTY);
+
+  const unsigned mask = size - 1;
+  for (unsigned i=0; i < m_items.size(); i++) {
+    const string &name = m_items[i].m_name;
+    unsigned slot = hash(name.data(), name.size()) & mask;
+    while (m_hash_table[slot] != HASH_SLOT_EMPTY) {
+      slot = (slot + 1) & mask;
+    }
+    m_hash_table[slot] = i;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+unsigned cfg_file::hash(const char *str, unsigned len)
+{
+  // FNV-1a, 32 bits
+  unsigned h = 2166136261U;
+  for (unsigned i=0; i < len; i++) {
+    h ^= (unsigned char)str[i];
+    h *= 16777619U;
+  }
+  return h;
+}
+
+////////////////////////////////////////////////////////////////
+
+long cfg_file::parse_buffer(const char *data,
+			    size_t size)
+{
+  const char *end = data + size;
+  const char *row = data;
+
+  // Configuration file format:
+  // # This is a comment
+  // item=value
+  //
+  // Blanks around item and value are ignored.
+  // No limit on row length, the last row may lack newline.
+
+  while (row < end) {
+    const char *eol = (const char *)memchr(row, '\n', end - row);
+    if (eol == NULL) {
+      eol = end;
+    }
 
-    // Configuration file format:
-    // # This is a comment
-    // item=value
+    // Strip leading and trailing blanks
+    const char *first = row;
+    const char *last  = eol;
+    while ( (first < last) && IS_BLANK(*first) ) {
+      first++;
+    }
+    while ( (last > first) && IS_BLANK(*(last - 1)) ) {
+      last--;
+    }
 
-    // Remove all white spaces and tabs
-    string trimmed_row = trim_all(row);
+    row = eol + 1;
 
     // Skip commented or empty rows
-    if ( (trimmed_row[0] == '#') || (trimmed_row[0] == '\n') ) {
+    if ( (first == last) || (*first == '#') ) {
       continue;
     }
 
-    // Check row format
-    if (!row_format_ok(trimmed_row)) {
-      fclose(fd);
+    // Check row format, '=' must not be first or last char
+    const char *eq = (const char *)memchr(first, '=', last - first);
+    if ( (eq == NULL) || (eq == first) || (eq == last - 1) ) {
       return CFG_FILE_BAD_FILE_FORMAT;
     }
 
-    strncpy(row, trimmed_row.c_str(), CFG_FILE_MAX_LINE_LENGTH);
-
-    char *item = strtok(row, "=");
-    if (item != NULL) {
-      char *value = strtok(NULL, "\r\n");
-      if (value != NULL) {
-	long rc = populate_item(item, value);
-	if (rc != CFG_FILE_SUCCESS) {
-	  fclose(fd);
-	  return rc;
-	}
-      }
+    const char *item_end    = eq;
+    const char *value_begin = eq + 1;
+    while ( IS_BLANK(*(item_end - 1)) ) {
+      item_end--;
+    }
+    while ( IS_BLANK(*value_begin) ) {
+      value_begin++;
     }
-  }
 
-  // Check if error reading from file
-  if (ferror(fd)) {
-    fclose(fd);
-    return CFG_FILE_FILE_IO_ERROR;
+    long rc = populate_item(first, item_end - first,
+			    value_begin, last - value_begin);
+    if (rc != CFG_FILE_SUCCESS) {
+      return rc;
+    }
   }
 
-  fclose(fd);
-
   return CFG_FILE_SUCCESS;
 }
 
-/////////////////////////////////////////////////////////////////////////////
-//               Protected member functions
-/////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
 
-/////////////////////////////////////////////////////////////////////////////
-//               Private member functions
-/////////////////////////////////////////////////////////////////////////////
+long cfg_file::populate_item(const char *item_name,
+			     unsigned item_name_len,
+			     const char *value,
+			     unsigned value_len)
+{
+  // Try to find item.
+  // If item is found then update value properly.
+  const int index = find_item(item_name, item_name_len);
+  if (index < 0) {
+    return CFG_FILE_SUCCESS; // Unknown items are ignored
+  }
+
+  item &the_item = m_items[index];
+
+  // Interpret value according to type tag
+  switch (the_item.m_type) {
+  case CFG_ITEM_STRING:
+    // No error handling needed, everything can be seen as a string
+    // Format specifier not used
+    the_item.m_string.assign(value, value_len);
+    return CFG_FILE_SUCCESS;
+  case CFG_ITEM_DOUBLE:
+    return populate_number<double>(the_item, value, value_len);
+  case CFG_ITEM_INT:
+    return populate_number<int>(the_item, value, value_len);
+  case CFG_ITEM_BOOL:
+    return populate_number<bool>(the_item, value, value_len);
+  }
+
+  return CFG_FILE_SUCCESS;
+}
 
 ////////////////////////////////////////////////////////////////
 
-string cfg_file::trim_all(const string &row)
+long cfg_file::parse_value(const char *value,
+			   unsigned len,
+			   ios_base& (*f)(ios_base&),
+			   double &num)
 {
-  string s = row;
+  char buffer[CFG_FILE_MAX_NUMBER_LENGTH];
+  char *endptr;
 
-  if(s.size() == 0) {
-    return s;
+  if ( (f != dec) || (len >= sizeof(buffer)) ) {
+    return CFG_FILE_BAD_VALUE_FORMAT;
   }
-  
-  int val = 0;
 
-  // Remove all white spaces and tabs
-  for (unsigned cur = 0; cur < s.size(); cur++) {
-    if( (s[cur] != ' ') &&
-	(s[cur] != '\t')) {
-      s[val] = s[cur];
-      val++;
-    }
+  // The value is not terminated in the read buffer
+  memcpy(buffer, value, len);
+  buffer[len] = '\0';
+
+  // Only decimal notation, no hex floats, inf or nan
+  if (strspn(buffer, "0123456789+-.eE") < len) {
+    return CFG_FILE_BAD_VALUE_FORMAT;
   }
-  s.resize(val);
 
-  return s;
+  errno = 0;
+  num = strtod(buffer, &endptr);
+  if ( (endptr != buffer + len) || (errno == ERANGE) ) {
+    return CFG_FILE_BAD_VALUE_FORMAT;
+  }
+
+  return CFG_FILE_SUCCESS;
 }
 
 ////////////////////////////////////////////////////////////////
 
-bool cfg_file::row_format_ok(const string &row)
+long cfg_file::parse_value(const char *value,
+			   unsigned len,
+			   ios_base& (*f)(ios_base&),
+			   int &num)
 {
-  // Minimum requirement is 4 chars => 'a=b\n'
-  // and row must include '='
-  if ( (row.size() < 4) ||
-       (row.find('=') == string::npos) ) {
-    return false;
+  char buffer[CFG_FILE_MAX_NUMBER_LENGTH];
+  char *endptr;
+  int base = 10;
+
+  if (f == hex) {
+    base = 16;
   }
+  else if (f == oct) {
+    base = 8;
+  }
+
+  if ( (len >= sizeof(buffer)) || IS_BLANK(*value) ) {
+    return CFG_FILE_BAD_VALUE_FORMAT;
+  }
+
+  // The value is not terminated in the read buffer
+  memcpy(buffer, value, len);
+  buffer[len] = '\0';
 
-  // '=' must not be first or last char
-  if ( (row.find('=') == 0) ||
-       (row.find('=') == (row.size() - 2)) ) {
-    return false;
+  errno = 0;
+  long tmp = strtol(buffer, &endptr, base);
+  if ( (endptr != buffer + len) || (errno == ERANGE) ||
+       (tmp > INT_MAX) || (tmp < INT_MIN) ) {
+    return CFG_FILE_BAD_VALUE_FORMAT;
   }
+  num = tmp;
 
-  return true;
+  return CFG_FILE_SUCCESS;
 }
 
 ////////////////////////////////////////////////////////////////
 
-long cfg_file::populate_item(const char *item,
-			     const char *value)
+long cfg_file::parse_value(const char *value,
+			   unsigned len,
+			   ios_base& (*f)(ios_base&),
+			   bool &num)
 {
-  // Try to find item in list.
-  // If item is found then update value properly.
-  for (unsigned i=0; i < m_item_list.size(); i++) {
-    if (m_item_list[i]->m_name == item) {
-
-      // Determine how to interpret value
-      typed_item<string> *item_string;
-      typed_item<double> *item_double;
-      typed_item<int> *item_int;
-      typed_item<bool> *item_bool;
-      item_string = dynamic_cast<typed_item<string>*>(m_item_list[i]);
-      item_double = dynamic_cast<typed_item<double>*>(m_item_list[i]);
-      item_int    = dynamic_cast<typed_item<int>*>(m_item_list[i]);
-      item_bool   = dynamic_cast<typed_item<bool>*>(m_item_list[i]);
-
-      // Interpret as string      
-      // No error handling needed, everything can be seen as a strin
-      // Format specifier not used
-      if (item_string) {
-	item_string->m_value = value;
-	break;
-      }
+  // Same rules as iostreams, 'true'/'false' or '1'/'0'
+  const char *t = (f == boolalpha) ? "true"  : "1";
+  const char *n = (f == boolalpha) ? "false" : "0";
 
-      // Interpret as double
-      if (item_double) {
-	if (!is_string_type_t<double>(value, item_double->m_f)) {
-	  return CFG_FILE_BAD_VALUE_FORMAT;
-	}
-	from_string<double>(item_double->m_value,
-			    value,
-			    item_double->m_f);
-	break;
-      }
-
-      // Interpret as int
-      if (item_int) {
-	if (!is_string_type_t<int>(value, item_int->m_f)) {	  
-	  return CFG_FILE_BAD_VALUE_FORMAT;
-	}
-	from_string<int>(item_int->m_value,
-			 value,
-			 item_int->m_f);
-	break;
-      }
-
-      // Interpret as bool
-      if (item_bool) {
-	if (!is_string_type_t<bool>(value, item_bool->m_f)) {
-	  return CFG_FILE_BAD_VALUE_FORMAT;
-	}
-	from_string<bool>(item_bool->m_value,
-			  value,
-			  item_bool->m_f);
-	break;
-      }
-    }
+  if ( (len == strlen(t)) && (memcmp(value, t, len) == 0) ) {
+    num = true;
+  }
+  else if ( (len == strlen(n)) && (memcmp(value, n, len) == 0) ) {
+    num = false;
+  }
+  else {
+    return CFG_FILE_BAD_VALUE_FORMAT;
   }
 
   return CFG_FILE_SUCCESS;
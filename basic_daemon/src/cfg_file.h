@@ -14,8 +14,7 @@
 
 #include <string>
 #include <vector>
-#include <typeinfo>
-#include <sstream>
+#include <ios>
 
 using namespace std;
 
@@ -24,39 +23,59 @@ using namespace std;
 /////////////////////////////////////////////////////////////////////////////
 
 // Return codes
-#define CFG_FILE_SUCCESS           0
-#define CFG_FILE_FILE_NOT_FOUND   -1
-#define CFG_FILE_FILE_IO_ERROR    -2
-#define CFG_FILE_BAD_FILE_FORMAT  -3
-#define CFG_FILE_BAD_VALUE_FORMAT -4
-#define CFG_FILE_ITEM_NOT_DEFINED -5
+#define CFG_FILE_SUCCESS             0
+#define CFG_FILE_FILE_NOT_FOUND     -1
+#define CFG_FILE_FILE_IO_ERROR      -2
+#define CFG_FILE_BAD_FILE_FORMAT    -3
+#define CFG_FILE_BAD_VALUE_FORMAT   -4
+#define CFG_FILE_ITEM_NOT_DEFINED   -5
+#define CFG_FILE_VALUE_OUT_OF_RANGE -6
 
 /////////////////////////////////////////////////////////////////////////////
 //               Class support types
 /////////////////////////////////////////////////////////////////////////////
 
+typedef enum {CFG_ITEM_STRING,
+	      CFG_ITEM_DOUBLE,
+	      CFG_ITEM_INT,
+	      CFG_ITEM_BOOL} CFG_ITEM_TYPE;
+
+// Maps a supported value type to its type tag
+template <typename T> struct cfg_item_type;
+template <> struct cfg_item_type<string> {static const CFG_ITEM_TYPE tag = CFG_ITEM_STRING;};
+template <> struct cfg_item_type<double> {static const CFG_ITEM_TYPE tag = CFG_ITEM_DOUBLE;};
+template <> struct cfg_item_type<int>    {static const CFG_ITEM_TYPE tag = CFG_ITEM_INT;};
+template <> struct cfg_item_type<bool>   {static const CFG_ITEM_TYPE tag = CFG_ITEM_BOOL;};
+
+// A type-tagged item, all items are stored by value in one vector
 class item {
 
  public:
  item(const string &name,
-      ios_base& (*f)(ios_base&)) : m_name(name), m_f(f) {}
-  virtual ~item(void) {}
-  
-  string m_name;
-  ios_base& (*m_f)(ios_base&);
-};
+      CFG_ITEM_TYPE type,
+      ios_base& (*f)(ios_base&)) : m_name(name), m_type(type), m_f(f) {}
 
-template< typename T >
-class typed_item : public item {
+  void set(const string &value) {m_string = value;}
+  void set(double value)        {m_double = value;}
+  void set(int value)           {m_int    = value;}
+  void set(bool value)          {m_bool   = value;}
 
- public:
-  typed_item(const string &name,
-	     const T &value,
-	     ios_base& (*f)(ios_base&))
-    : item(name, f), m_value(value) {}
-   ~typed_item(void) {}
-  
-  T m_value;
+  void get(string &value) const {value = m_string;}
+  void get(double &value) const {value = m_double;}
+  void get(int &value) const    {value = m_int;}
+  void get(bool &value) const   {value = m_bool;}
+
+  string        m_name;
+  CFG_ITEM_TYPE m_type;
+  ios_base& (*m_f)(ios_base&);
+
+  // Value, interpreted according to type tag
+  string m_string;
+  union {
+    double m_double;
+    int    m_int;
+    bool   m_bool;
+  };
 };
 
 /////////////////////////////////////////////////////////////////////////////
@@ -76,74 +95,112 @@ class cfg_file {
   ////////////////////////////////////////////////////////////////
 
   template <typename T>
-    void set_default_item_value(const char *item,
+    void set_default_item_value(const char *item_name,
 				const T value,
 				ios_base& (*f)(ios_base&))
     {
-      m_item_list.push_back(new typed_item<T>(item, value, f));
+      int index = find_item(item_name);
+      if (index < 0) {
+	index = add_item(item(item_name, cfg_item_type<T>::tag, f));
+      }
+      else {
+	m_items[index] = item(item_name, cfg_item_type<T>::tag, f);
+      }
+      m_items[index].set(value);
     }
 
   ////////////////////////////////////////////////////////////////
 
   template <typename T>
-    long get_item_value(const char *item,
+    long get_item_value(const char *item_name,
 			T &value)
     {
-      bool defined = false;
-      value = 0.0;
-      
-      for (unsigned i=0; i < m_item_list.size(); i++) {
-	if (m_item_list[i]->m_name == item) {
-	  typed_item<T> *item_T;
-	  item_T = dynamic_cast<typed_item<T>*>(m_item_list[i]);
-	  if (item_T) {
-	    value = item_T->m_value;
-	    defined = true;
-	    break;
-	  }
-	}
-      }
-      
-      if (!defined) {
+      int index = find_item(item_name);
+
+      if ( (index < 0) ||
+	   (m_items[index].m_type != cfg_item_type<T>::tag) ) {
 	return CFG_FILE_ITEM_NOT_DEFINED;
       }
-      
-      return CFG_FILE_SUCCESS;
-    }
-
- private:
-  string m_file_name;
 
-  // List of populated items from config file
-  vector<item*> m_item_list;
+      m_items[index].get(value);
 
-  string trim_all(const string &row);
-
-  bool row_format_ok(const string &row);
-
-  long populate_item(const char *item,
-		     const char *value);
+      return CFG_FILE_SUCCESS;
+    }
 
   ////////////////////////////////////////////////////////////////
 
   template <typename T>
-    bool is_string_type_t(const string &value,
-			  ios_base& (*f)(ios_base&))
+    long get_item_value_at(unsigned index,
+			   T &value)
     {
-      istringstream iss(value);
-      T num;
-      return !(iss >> f >> num).fail();
+      // Direct access, index is the order of 'set_default_item_value'
+      if ( (index >= m_items.size()) ||
+	   (m_items[index].m_type != cfg_item_type<T>::tag) ) {
+	return CFG_FILE_ITEM_NOT_DEFINED;
+      }
+
+      m_items[index].get(value);
+
+      return CFG_FILE_SUCCESS;
     }
 
+ private:
+  string m_file_name;
+
+  // Populated items from config file, stored contiguously
+  vector<item> m_items;
+
+  // Open addressing hash table (linear probing) of indexes
+  // into m_items, size is always a power of two.
+  vector<int>  m_hash_table;
+
+  // Ids in the metrics registry
+  int m_parses_id;
+  int m_failures_id;
+  int m_parse_time_id;
+
+  long parse_file(void);
+
+  int find_item(const char *item_name);
+  int find_item(const char *item_name, unsigned len);
+  int add_item(const item &the_item);
+  void rehash(unsigned size);
+  static unsigned hash(const char *str, unsigned len);
+
+  long parse_buffer(const char *data,
+		    size_t size);
+
+  long populate_item(const char *item_name,
+		     unsigned item_name_len,
+		     const char *value,
+		     unsigned value_len);
+
+  static long parse_value(const char *value,
+			  unsigned len,
+			  ios_base& (*f)(ios_base&),
+			  double &num);
+  static long parse_value(const char *value,
+			  unsigned len,
+			  ios_base& (*f)(ios_base&),
+			  int &num);
+  static long parse_value(const char *value,
+			  unsigned len,
+			  ios_base& (*f)(ios_base&),
+			  bool &num);
+
   ////////////////////////////////////////////////////////////////
 
   template <typename T>
-    void from_string(T& num,
-		     const string &value,
-		     ios_base& (*f)(ios_base&))
+    long populate_number(item &the_item,
+			 const char *value,
+			 unsigned len)
     {
-      istringstream iss(value);
-      (iss >> f >> num);
+      T num;
+      long rc = parse_value(value, len, the_item.m_f, num);
+      if (rc == CFG_FILE_SUCCESS) {
+	the_item.set(num);
+      }
+      return rc;
     }
 };
 
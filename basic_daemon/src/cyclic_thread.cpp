@@ -9,8 +9,40 @@
 // *                                                                      *
 // ************************************************************************
 
+#include <string.h>
+
 #include "cyclic_thread.h"
 #include "delay.h"
+#include "metrics_registry.h"
+#include "trace.h"
+#include "sdt_probe.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define NR_LATENCY_BOUNDS  6
+
+/////////////////////////////////////////////////////////////////////////////
+//               Module global variables
+/////////////////////////////////////////////////////////////////////////////
+
+// Wakeup latency buckets (ns), 1 us .. 100 ms
+static const uint64_t g_latency_bounds[NR_LATENCY_BOUNDS] =
+  {1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+static inline int64_t diff_in_ns(const struct timespec *t1,
+				 const struct timespec *t2)
+{
+  return ( (int64_t)(t2->tv_sec - t1->tv_sec) * 1000000000LL +
+	   (int64_t)(t2->tv_nsec - t1->tv_nsec) );
+}
 
 /////////////////////////////////////////////////////////////////////////////
 //               Public member functions
@@ -22,6 +54,16 @@ cyclic_thread::cyclic_thread(string thread_name,
 			     double frequency) : thread(thread_name)
 {
   m_frequency = frequency;
+  memset(&m_stats, 0, sizeof(m_stats));
+  memset(&m_resume_stats, 0, sizeof(m_resume_stats));
+  memset(&m_heartbeat, 0, sizeof(m_heartbeat));
+  m_perf_enabled = false;
+  m_perf_applied = false;
+
+  const string labels = "thread=\"" + thread_name + "\"";
+  m_latency_id = metrics_registry::instance()->
+    add_histogram("thread_wakeup_latency_seconds", labels.c_str(), 1e-9,
+		  g_latency_bounds, NR_LATENCY_BOUNDS);
 }
 
 ////////////////////////////////////////////////////////////////
@@ -34,7 +76,45 @@ cyclic_thread::~cyclic_thread(void)
 
 double cyclic_thread::get_frequency(void)
 {
-  return m_frequency;
+  double frequency;
+  __atomic_load(&m_frequency, &frequency, __ATOMIC_RELAXED);
+  return frequency;
+}
+
+////////////////////////////////////////////////////////////////
+
+void cyclic_thread::set_frequency(double frequency)
+{
+  __atomic_store(&m_frequency, &frequency, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////
+
+void cyclic_thread::set_perf_counters(bool enabled)
+{
+  __atomic_store_n(&m_perf_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////
+
+void cyclic_thread::get_stats(CYCLIC_THREAD_STATS &stats)
+{
+  stats = m_stats;
+}
+
+////////////////////////////////////////////////////////////////
+
+void cyclic_thread::resume_stats(const CYCLIC_THREAD_STATS &stats)
+{
+  m_resume_stats = stats;
+}
+
+////////////////////////////////////////////////////////////////
+
+void cyclic_thread::get_heartbeat(CYCLIC_THREAD_HEARTBEAT &heartbeat)
+{
+  heartbeat.cycles = __atomic_load_n(&m_heartbeat.cycles, __ATOMIC_ACQUIRE);
+  heartbeat.time   = __atomic_load_n(&m_heartbeat.time, __ATOMIC_ACQUIRE);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -45,44 +125,226 @@ double cyclic_thread::get_frequency(void)
 
 long cyclic_thread::execute(void *arg)
 {
-  const float delay_interval = 1.0 / m_frequency;
-
-  struct timespec t1;
-  struct timespec t2; 
-
   // Make GCC happy (-Wextra)
   if (arg) {
     return THREAD_INTERNAL_ERROR;
   }
 
+  const long rc = execute_cycles();
+
+  // Counters follow this thread, not the next start
+  m_perf.close();
+  m_perf_applied = false;
+
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////
+
+void cyclic_thread::cycle_done(const CYCLIC_THREAD_STATS &)
+{
+}
+
+////////////////////////////////////////////////////////////////
+
+long cyclic_thread::event_execute(void)
+{
+  return THREAD_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+long cyclic_thread::execute_cycles(void)
+{
+  struct timespec t1;
+  struct timespec t2; 
+  struct timespec start;
+  struct timespec end;
+  uint64_t perf_start[PERF_COUNTERS_NR];
+  uint64_t perf_end[PERF_COUNTERS_NR];
+  long rc;
+
+  // Counting continues from any resumed statistics,
+  // the CPU time of this thread is added to the resumed
+  m_stats = m_resume_stats;
+  set_exe_cnt(m_stats.cycles);
+
   // Prepare first run
   if ( clock_gettime(get_clock_id(), &t1) ) {
     return THREAD_TIME_ERROR;
   }
-  if ( get_new_time(&t1, delay_interval, &t2) != DELAY_SUCCESS ) {
+  beat(&t1);
+  if ( get_new_time(&t1, 1.0 / get_frequency(), &t2) != DELAY_SUCCESS ) {
     return THREAD_TIME_ERROR;
   }
-  if ( delay_until(&t2) != DELAY_SUCCESS) {
-    return THREAD_TIME_ERROR;
+  rc = sleep_until_next(&t2);
+  if (rc != THREAD_SUCCESS) {
+    return rc;
   }
 
   while ( !is_stopped() ) {
 
     // Do cyclic work
-    if ( cyclic_execute() != THREAD_SUCCESS ) {
-      return THREAD_INTERNAL_ERROR;
+    if ( clock_gettime(get_clock_id(), &start) ) {
+      return THREAD_TIME_ERROR;
     }
-
-    // Calculate next interval
-    if ( get_new_time(&t2, delay_interval, &t2) != DELAY_SUCCESS ) {
+    beat(&start);
+    BASICD_PROBE3(cycle_wake, get_name_c_str(), m_stats.cycles,
+		  diff_in_ns(&t2, &start));
+    const bool counting = ( count_perf() &&
+			    (m_perf.read(perf_start) == PERF_COUNTERS_SUCCESS) );
+    {
+      TRACE_SCOPE("cyclic_execute");
+      if ( cyclic_execute() != THREAD_SUCCESS ) {
+	return THREAD_INTERNAL_ERROR;
+      }
+    }
+    if ( clock_gettime(get_clock_id(), &end) ) {
       return THREAD_TIME_ERROR;
     }
-    if ( delay_until(&t2) != DELAY_SUCCESS) {
+    BASICD_PROBE3(cycle_done, get_name_c_str(), m_stats.cycles,
+		  diff_in_ns(&start, &end));
+    const bool counted = ( counting &&
+			   (m_perf.read(perf_end) == PERF_COUNTERS_SUCCESS) );
+    if (counted) {
+      for (unsigned i=0; i < PERF_COUNTERS_NR; i++) {
+	perf_end[i] -= perf_start[i];
+      }
+    }
+
+    // Calculate next interval, sleep is cut short on stop.
+    // Frequency may have been changed during this cycle
+    t1 = t2;
+    if ( get_new_time(&t1, 1.0 / get_frequency(), &t2) != DELAY_SUCCESS ) {
       return THREAD_TIME_ERROR;
     }
 
+    update_stats(&t1, &start, &end, &t2, (counted ? perf_end : NULL));
+    cycle_done(m_stats);
+
+    rc = sleep_until_next(&t2);
+    if (rc != THREAD_SUCCESS) {
+      return rc;
+    }
+
     update_exe_cnt();
   }
 
   return THREAD_SUCCESS;
 }
+
+////////////////////////////////////////////////////////////////
+
+void cyclic_thread::beat(const struct timespec *now)
+{
+  // A thread stuck in a cycle stops beating
+  __atomic_store_n(&m_heartbeat.cycles, m_stats.cycles, __ATOMIC_RELEASE);
+  __atomic_store_n(&m_heartbeat.time,
+		   (uint64_t)now->tv_sec * 1000000000ULL + now->tv_nsec,
+		   __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////
+
+bool cyclic_thread::count_perf(void)
+{
+  const bool enabled = __atomic_load_n(&m_perf_enabled, __ATOMIC_RELAXED);
+
+  // Counters are opened and closed between cycles, a failed
+  // open is not retried until enabled again
+  if (enabled != m_perf_applied) {
+    m_perf_applied = enabled;
+    if (enabled) {
+      m_perf.open();
+    }
+    else {
+      m_perf.close();
+    }
+  }
+
+  return m_perf.is_open();
+}
+
+////////////////////////////////////////////////////////////////
+
+long cyclic_thread::sleep_until_next(const struct timespec *next_start)
+{
+  long rc;
+
+  // Events are handled between cycles, the cycle
+  // start times are not affected
+  while ( (rc = sleep_until(next_start)) == THREAD_EVENT ) {
+    if ( event_execute() != THREAD_SUCCESS ) {
+      return THREAD_INTERNAL_ERROR;
+    }
+  }
+
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////
+
+void cyclic_thread::update_stats(const struct timespec *planned_start,
+				 const struct timespec *start,
+				 const struct timespec *end,
+				 const struct timespec *next_start,
+				 const uint64_t *perf)
+{
+  const int64_t exec_time = diff_in_ns(start, end);
+  const int64_t latency   = diff_in_ns(planned_start, start);
+
+  m_stats.exec_time_last = (exec_time > 0 ? exec_time : 0);
+  if ( (!m_stats.cycles) || (m_stats.exec_time_last < m_stats.exec_time_min) ) {
+    m_stats.exec_time_min = m_stats.exec_time_last;
+  }
+  const bool new_max = ( (!m_stats.cycles) ||
+			 (m_stats.exec_time_last > m_stats.exec_time_max) );
+  if (new_max) {
+    m_stats.exec_time_max = m_stats.exec_time_last;
+  }
+  m_stats.exec_time_sum += m_stats.exec_time_last;
+
+  m_stats.perf_available = m_perf.get_available();
+  if (perf) {
+    for (unsigned i=0; i < PERF_COUNTERS_NR; i++) {
+      m_stats.perf_sum[i] += perf[i];
+      if (new_max) {
+	m_stats.perf_max[i] = perf[i];
+      }
+    }
+  }
+
+  unsigned bucket = 0;
+  uint64_t bound  = 1000; // 1 us
+  while ( (bucket < CYCLIC_THREAD_NR_BUCKETS - 1) &&
+	  (m_stats.exec_time_last > bound) ) {
+    bucket++;
+    bound *= 10;
+  }
+  m_stats.exec_time_hist[bucket]++;
+
+  m_stats.wakeup_latency_last = (latency > 0 ? latency : 0);
+  metrics_registry::instance()->observe(m_latency_id,
+					m_stats.wakeup_latency_last);
+  if (m_stats.wakeup_latency_last > m_stats.wakeup_latency_max) {
+    m_stats.wakeup_latency_max = m_stats.wakeup_latency_last;
+  }
+
+  if (diff_in_ns(end, next_start) < 0) {
+    m_stats.overruns++;
+    BASICD_PROBE3(cycle_overrun, get_name_c_str(), m_stats.cycles,
+		  diff_in_ns(next_start, end));
+  }
+
+  struct timespec cpu_time;
+  if ( clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_time) == 0 ) {
+    m_stats.cpu_time = ( m_resume_stats.cpu_time +
+			 (uint64_t)cpu_time.tv_sec * 1000000000ULL + cpu_time.tv_nsec );
+  }
+
+  m_stats.cycles++;
+}
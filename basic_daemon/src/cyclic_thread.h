@@ -12,7 +12,10 @@
 #ifndef __CYCLIC_THREAD_H__
 #define __CYCLIC_THREAD_H__
 
+#include <stdint.h>
+
 #include "thread.h"
+#include "perf_counters.h"
 
 using namespace std;
 
@@ -20,6 +23,38 @@ using namespace std;
 //               Definition of macros
 /////////////////////////////////////////////////////////////////////////////
 
+// Histogram of execution time, bucket i counts cycles with an execution
+// time up to 10^i microseconds. The last bucket counts the rest.
+#define CYCLIC_THREAD_NR_BUCKETS  8
+
+/////////////////////////////////////////////////////////////////////////////
+//               Class support types
+/////////////////////////////////////////////////////////////////////////////
+
+// Timing of cycles, all times in nanoseconds
+typedef struct {
+  uint64_t cycles;                 // Nof completed cycles
+  uint64_t overruns;               // Cycles that ended after next start
+  uint64_t exec_time_last;         // Duration of cyclic_execute
+  uint64_t exec_time_min;
+  uint64_t exec_time_max;
+  uint64_t exec_time_sum;
+  uint64_t wakeup_latency_last;    // Actual minus planned start of cycle
+  uint64_t wakeup_latency_max;
+  uint64_t cpu_time;               // Consumed by thread
+  uint64_t exec_time_hist[CYCLIC_THREAD_NR_BUCKETS];
+  // Events during cyclic_execute, see set_perf_counters
+  unsigned perf_available;             // Bitmask (1 << PERF_COUNTERS_xxx)
+  uint64_t perf_sum[PERF_COUNTERS_NR]; // All counted cycles
+  uint64_t perf_max[PERF_COUNTERS_NR]; // Cycle with exec_time_max
+} CYCLIC_THREAD_STATS;
+
+// Progress of the thread, published when each cycle starts
+typedef struct {
+  uint64_t cycles; // Nof completed cycles
+  uint64_t time;   // When last cycle started (ns, see get_clock_id)
+} CYCLIC_THREAD_HEARTBEAT;
+
 /////////////////////////////////////////////////////////////////////////////
 //               Definition of classes
 /////////////////////////////////////////////////////////////////////////////
@@ -32,6 +67,23 @@ class cyclic_thread : public thread {
   ~cyclic_thread(void);
 
   double get_frequency(void);
+  void set_frequency(double frequency); // Applied at next cycle boundary
+
+  // Count hardware and software events of each cycle (see perf_counters.h),
+  // default off. Applied at next cycle boundary.
+  void set_perf_counters(bool enabled);
+
+  // Only valid when the thread is not executing
+  void get_stats(CYCLIC_THREAD_STATS &stats);
+
+  // Statistics of next start continue from these, e.g. the
+  // final statistics of a thread in a previous image
+  void resume_stats(const CYCLIC_THREAD_STATS &stats);
+
+  // May be read at any time, e.g. by a watchdog. Time is zero until
+  // the thread executes. Each field is atomic, the pair may be from
+  // two consecutive cycles.
+  void get_heartbeat(CYCLIC_THREAD_HEARTBEAT &heartbeat);
 
  protected:
   virtual long setup(void) = 0;    // Pure virtual function
@@ -39,9 +91,37 @@ class cyclic_thread : public thread {
   virtual long cleanup(void) = 0;  // Pure virtual function
 
   virtual long cyclic_execute(void) = 0; // Pure virtual function
+
+  // Called by the thread after each cycle, default does nothing
+  virtual void cycle_done(const CYCLIC_THREAD_STATS &stats);
+
+  // Called between cycles when the event fd (see set_event_fd) is
+  // readable, must consume the event. Default does nothing.
+  virtual long event_execute(void);
     
  private:
-  double m_frequency;
+  double              m_frequency; // Accessed atomically
+  CYCLIC_THREAD_STATS m_stats;     // Only accessed by the thread
+  CYCLIC_THREAD_STATS m_resume_stats;  // Initial statistics of next start
+  CYCLIC_THREAD_HEARTBEAT m_heartbeat; // Accessed atomically
+  int                 m_latency_id;    // In metrics registry
+  bool                m_perf_enabled;  // Accessed atomically
+  bool                m_perf_applied;  // Only accessed by the thread
+  perf_counters       m_perf;          // Only accessed by the thread
+
+  long execute_cycles(void);
+
+  void beat(const struct timespec *now);
+
+  bool count_perf(void);
+
+  long sleep_until_next(const struct timespec *next_start);
+
+  void update_stats(const struct timespec *planned_start,
+		    const struct timespec *start,
+		    const struct timespec *end,
+		    const struct timespec *next_start,
+		    const uint64_t *perf);
 };
 
 #endif // __CYCLIC_THREAD_H__
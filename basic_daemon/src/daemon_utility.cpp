@@ -19,6 +19,9 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <pwd.h>
 
@@ -92,14 +95,14 @@ void syslog_open(const char *ident)
 void syslog_info(const char *format, ...)
 {
   // Retrieve any additional arguments for the format string
-  char info_buffer[512];
+  char info_buffer[SYSLOG_MAX_MESSAGE_LENGTH];
   va_list info_args;
   va_start(info_args, format);
-  vsprintf(info_buffer, format, info_args);
+  vsnprintf(info_buffer, sizeof(info_buffer), format, info_args);
   va_end(info_args);
 
   // Log message
-  syslog(LOG_NOTICE, info_buffer);
+  syslog(LOG_NOTICE, "%s", info_buffer);
 }
 
 ////////////////////////////////////////////////////////////////
@@ -107,14 +110,14 @@ void syslog_info(const char *format, ...)
 void syslog_error(const char *format, ...)
 {
   // Retrieve any additional arguments for the format string
-  char info_buffer[512];
+  char info_buffer[SYSLOG_MAX_MESSAGE_LENGTH];
   va_list info_args;
   va_start(info_args, format);
-  vsprintf(info_buffer, format, info_args);
+  vsnprintf(info_buffer, sizeof(info_buffer), format, info_args);
   va_end(info_args);
 
   // Log message
-  syslog(LOG_ERR, info_buffer);
+  syslog(LOG_ERR, "%s", info_buffer);
 }
 
 ////////////////////////////////////////////////////////////////
@@ -247,3 +250,48 @@ long become_daemon(const char *run_as_user,
 
   return DAEMON_SUCCESS;
 }
+
+////////////////////////////////////////////////////////////////
+
+long notify_service_manager(const char *format, ...)
+{
+  const char *path = getenv("NOTIFY_SOCKET");
+  if ( (!path) || (!path[0]) ) {
+    return DAEMON_SUCCESS; // Not started by a service manager
+  }
+
+  struct sockaddr_un addr;
+  const size_t path_len = strlen(path);
+  if (path_len >= sizeof(addr.sun_path)) {
+    return DAEMON_FAILURE;
+  }
+
+  // A leading '@' is an abstract socket
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, path_len);
+  if (addr.sun_path[0] == '@') {
+    addr.sun_path[0] = '\0';
+  }
+
+  char state[SYSLOG_MAX_MESSAGE_LENGTH];
+  va_list state_args;
+  va_start(state_args, format);
+  const int state_len = vsnprintf(state, sizeof(state), format, state_args);
+  va_end(state_args);
+  if ( (state_len < 0) || (state_len >= (int)sizeof(state)) ) {
+    return DAEMON_FAILURE;
+  }
+
+  // One datagram per state change
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return DAEMON_FAILURE;
+  }
+  const ssize_t n = sendto(fd, state, state_len, MSG_NOSIGNAL,
+			   (struct sockaddr *)&addr,
+			   offsetof(struct sockaddr_un, sun_path) + path_len);
+  close(fd);
+
+  return (n == state_len ? DAEMON_SUCCESS : DAEMON_FAILURE);
+}
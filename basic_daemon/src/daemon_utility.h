@@ -22,6 +22,8 @@
 
 #define DAEMON_BAD_FD_LOCK_FILE -1
 
+#define SYSLOG_MAX_MESSAGE_LENGTH  2048
+
 /////////////////////////////////////////////////////////////////////////////
 //               Definition of exported functions
 /////////////////////////////////////////////////////////////////////////////
@@ -38,4 +40,8 @@ extern long become_daemon(const char *run_as_user,  // IN
 			  const char *lock_file,    // IN
 			  int *fd_lock_file);       // OUT
 
+// Sends state (e.g. "READY=1") to the service manager through
+// $NOTIFY_SOCKET, the sd_notify protocol. Does nothing when not set.
+extern long notify_service_manager(const char *format, ...);
+
 #endif // __DAEMON_UTILITY_H__
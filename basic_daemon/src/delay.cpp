@@ -11,8 +11,10 @@
 
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
 
 #include "delay.h"
+#include "trace.h"
 
 // Use best available clock identifer
 #if defined CLOCK_MONOTONIC
@@ -132,5 +134,50 @@ long delay(double time_in_sec)
 
 long delay_until(const struct timespec *the_time)
 {
-  return do_clock_nanosleep(the_time);
+  TRACE_BEGIN("sleep");
+  const long rc = do_clock_nanosleep(the_time);
+  TRACE_END("sleep");
+
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////
+
+long delay_until_poll(const struct timespec *the_time,
+		      struct pollfd *fds,
+		      unsigned nr_fds)
+{
+  struct timespec now_time;
+  struct timespec timeout;
+  int rc;
+
+  for (;;) {
+    for (unsigned i=0; i < nr_fds; i++) {
+      fds[i].revents = 0;
+    }
+
+    // Get relative time left, ppoll has no absolute timeout
+    if ( clock_gettime(CLK_ID, &now_time) ) {
+      return DELAY_FAILURE;
+    }
+    timeout.tv_sec  = the_time->tv_sec  - now_time.tv_sec;
+    timeout.tv_nsec = the_time->tv_nsec - now_time.tv_nsec;
+    if (timeout.tv_nsec < 0) {
+      timeout.tv_nsec += NSEC_PER_SEC;
+      timeout.tv_sec--;
+    }
+    if (timeout.tv_sec < 0) {
+      return DELAY_SUCCESS; // Already passed
+    }
+
+    TRACE_BEGIN("sleep");
+    rc = ppoll(fds, nr_fds, &timeout, NULL);
+    TRACE_END("sleep");
+    if (rc >= 0) {
+      return DELAY_SUCCESS; // Time passed or event
+    }
+    if (errno != EINTR) {
+      return DELAY_FAILURE;
+    }
+  }
 }
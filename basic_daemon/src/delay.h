@@ -13,6 +13,7 @@
 #define __DELAY_H__
 
 #include <time.h>
+#include <poll.h>
 
 /////////////////////////////////////////////////////////////////////////////
 //               Definition of macros
@@ -36,4 +37,9 @@ extern long delay(double time_in_sec);
 
 extern long delay_until(const struct timespec *the_time);
 
+// Returns early (success) when any fd has an event, see revents
+extern long delay_until_poll(const struct timespec *the_time,
+			     struct pollfd *fds,
+			     unsigned nr_fds);
+
 #endif // __DELAY_H__
@@ -0,0 +1,92 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <execinfo.h>
+
+#include "error_pool.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+error_pool::error_pool(unsigned capacity) : m_mutex("error_pool")
+{
+  m_records  = new ERROR_RECORD[capacity];
+  m_capacity = capacity;
+  m_head     = 0;
+  m_count    = 0;
+  m_dropped  = 0;
+
+  // The first call to backtrace loads libgcc, which allocates memory.
+  // Do it now, so it doesn't happen when the first error is created.
+  void *frame;
+  backtrace(&frame, 1);
+}
+
+////////////////////////////////////////////////////////////////
+
+error_pool::~error_pool(void)
+{
+  delete [] m_records;
+}
+
+////////////////////////////////////////////////////////////////
+
+bool error_pool::put(const ERROR_RECORD &record)
+{
+  bool stored = false;
+
+  m_mutex.lock();
+  if (m_count < m_capacity) {
+    m_records[(m_head + m_count) % m_capacity] = record;
+    m_count++;
+    stored = true;
+  }
+  else {
+    m_dropped++;
+  }
+  m_mutex.unlock();
+
+  return stored;
+}
+
+////////////////////////////////////////////////////////////////
+
+bool error_pool::get(ERROR_RECORD &record)
+{
+  bool taken = false;
+
+  m_mutex.lock();
+  if (m_count > 0) {
+    record = m_records[m_head];
+    m_head = (m_head + 1) % m_capacity;
+    m_count--;
+    taken = true;
+  }
+  m_mutex.unlock();
+
+  return taken;
+}
+
+////////////////////////////////////////////////////////////////
+
+unsigned error_pool::get_dropped(void)
+{
+  unsigned dropped;
+
+  m_mutex.lock();
+  dropped = m_dropped;
+  m_mutex.unlock();
+
+  return dropped;
+}
@@ -0,0 +1,50 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __ERROR_POOL_H__
+#define __ERROR_POOL_H__
+
+#include <pthread.h>
+
+#include "excep.h"
+#include "profiled_mutex.h"
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// A fixed number of error records, all allocated when the pool
+// is created. Records are queued (FIFO) until they are taken,
+// so no memory is ever allocated when an error is reported.
+
+class error_pool {
+
+ public:
+  error_pool(unsigned capacity);
+  ~error_pool(void);
+
+  bool put(const ERROR_RECORD &record); // False if pool full (record dropped)
+  bool get(ERROR_RECORD &record);       // False if pool empty
+
+  unsigned get_dropped(void);           // Nof records dropped
+
+ private:
+  ERROR_RECORD    *m_records;
+  unsigned         m_capacity;
+  unsigned         m_head;    // Oldest record
+  unsigned         m_count;   // Nof queued records
+  unsigned         m_dropped;
+  profiled_mutex   m_mutex;
+};
+
+#endif // __ERROR_POOL_H__
@@ -0,0 +1,307 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "event_loop.h"
+#include "delay.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define MAX_EVENTS_PER_BATCH  16
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+static void sec_to_timespec(double sec, struct timespec *ts)
+{
+  struct timespec zero = {0, 0};
+  get_new_time(&zero, sec, ts);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+int create_timer_fd(void)
+{
+  return timerfd_create(get_clock_id(), TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+////////////////////////////////////////////////////////////////
+
+long set_timer_fd(int fd, double initial_in_sec, double interval_in_sec)
+{
+  struct itimerspec its;
+
+  sec_to_timespec(initial_in_sec,  &its.it_value);
+  sec_to_timespec(interval_in_sec, &its.it_interval);
+
+  // All zero would disarm timer
+  if ( (its.it_value.tv_sec == 0) && (its.it_value.tv_nsec == 0) ) {
+    its.it_value.tv_nsec = 1;
+  }
+
+  if (timerfd_settime(fd, 0, &its, NULL) == -1) {
+    return EVENT_LOOP_FAILURE;
+  }
+
+  return EVENT_LOOP_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long read_timer_fd(int fd, uint64_t *expirations)
+{
+  *expirations = 0;
+
+  if (read(fd, expirations, sizeof(*expirations)) == -1) {
+    if (errno == EAGAIN) {
+      return EVENT_LOOP_SUCCESS; // Not expired
+    }
+    return EVENT_LOOP_FAILURE;
+  }
+
+  return EVENT_LOOP_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long clear_timer_fd(int fd)
+{
+  struct itimerspec its = {{0, 0}, {0, 0}};
+
+  if (timerfd_settime(fd, 0, &its, NULL) == -1) {
+    return EVENT_LOOP_FAILURE;
+  }
+
+  return EVENT_LOOP_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+int create_signal_fd(const sigset_t *mask)
+{
+  // Signals must be blocked, or they are handled the normal way.
+  // Threads created after this point inherit the mask.
+  if (pthread_sigmask(SIG_BLOCK, mask, NULL)) {
+    return -1;
+  }
+
+  return signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+////////////////////////////////////////////////////////////////
+
+event_loop::event_loop(void)
+{
+  m_epoll_fd = -1;
+  m_stop     = false;
+
+  for (unsigned i=0; i < EVENT_LOOP_MAX_FDS; i++) {
+    m_slots[i].fd         = -1;
+    m_slots[i].generation = 0;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+event_loop::~event_loop(void)
+{
+  close();
+}
+
+////////////////////////////////////////////////////////////////
+
+long event_loop::open(void)
+{
+  m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (m_epoll_fd == -1) {
+    return EVENT_LOOP_FAILURE;
+  }
+
+  return EVENT_LOOP_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void event_loop::close(void)
+{
+  if (m_epoll_fd != -1) {
+    ::close(m_epoll_fd);
+  }
+  m_epoll_fd = -1;
+
+  for (unsigned i=0; i < EVENT_LOOP_MAX_FDS; i++) {
+    m_slots[i].fd = -1;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+long event_loop::add_fd(int fd,
+			uint32_t events,
+			EVENT_HANDLER handler,
+			void *arg)
+{
+  // Find a free slot
+  int slot = find_slot(-1);
+  if (slot < 0) {
+    return EVENT_LOOP_FAILURE;
+  }
+
+  // Events still pending for a previous fd in this slot are skipped
+  m_slots[slot].generation++;
+
+  struct epoll_event ev;
+  ev.events   = events;
+  ev.data.u64 = event_data(slot);
+  if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    return EVENT_LOOP_FAILURE;
+  }
+
+  m_slots[slot].fd      = fd;
+  m_slots[slot].handler = handler;
+  m_slots[slot].arg     = arg;
+
+  return EVENT_LOOP_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long event_loop::modify_fd(int fd, uint32_t events)
+{
+  int slot = find_slot(fd);
+  if (slot < 0) {
+    return EVENT_LOOP_FAILURE;
+  }
+
+  struct epoll_event ev;
+  ev.events   = events;
+  ev.data.u64 = event_data(slot);
+  if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+    return EVENT_LOOP_FAILURE;
+  }
+
+  return EVENT_LOOP_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long event_loop::remove_fd(int fd)
+{
+  int slot = find_slot(fd);
+  if (slot < 0) {
+    return EVENT_LOOP_FAILURE;
+  }
+
+  // Slot is free at once. Events already returned for this fd are
+  // not dispatched, also if the slot is taken by a new fd meanwhile.
+  m_slots[slot].fd = -1;
+
+  if (epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, NULL) == -1) {
+    return EVENT_LOOP_FAILURE;
+  }
+
+  return EVENT_LOOP_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long event_loop::run(void)
+{
+  m_stop = false;
+
+  while (!m_stop) {
+    if (run_once(-1) != EVENT_LOOP_SUCCESS) {
+      return EVENT_LOOP_FAILURE;
+    }
+  }
+
+  return EVENT_LOOP_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long event_loop::run_once(int timeout_in_ms)
+{
+  struct epoll_event events[MAX_EVENTS_PER_BATCH];
+  int n;
+
+  n = epoll_wait(m_epoll_fd, events, MAX_EVENTS_PER_BATCH, timeout_in_ms);
+  if (n == -1) {
+    if (errno == EINTR) {
+      return EVENT_LOOP_SUCCESS;
+    }
+    return EVENT_LOOP_FAILURE;
+  }
+
+  for (int i=0; i < n; i++) {
+    const unsigned slot = (unsigned)(events[i].data.u64 & 0xffffffff);
+    const uint32_t generation = (uint32_t)(events[i].data.u64 >> 32);
+    const int fd = m_slots[slot].fd;
+
+    // Skip fd removed by an earlier handler in this batch,
+    // and a new fd given the same slot
+    if ( (fd == -1) || (m_slots[slot].generation != generation) ) {
+      continue;
+    }
+
+    m_slots[slot].handler(fd, events[i].events, m_slots[slot].arg);
+
+    if (m_stop) {
+      break;
+    }
+  }
+
+  return EVENT_LOOP_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void event_loop::stop(void)
+{
+  m_stop = true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+int event_loop::find_slot(int fd)
+{
+  for (int i=0; i < EVENT_LOOP_MAX_FDS; i++) {
+    if (m_slots[i].fd == fd) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+////////////////////////////////////////////////////////////////
+
+uint64_t event_loop::event_data(int slot)
+{
+  return ((uint64_t)m_slots[slot].generation << 32) | (uint32_t)slot;
+}
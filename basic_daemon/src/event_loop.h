@@ -0,0 +1,95 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define EVENT_LOOP_SUCCESS   0
+#define EVENT_LOOP_FAILURE  -1
+
+#define EVENT_LOOP_MAX_FDS  256
+
+/////////////////////////////////////////////////////////////////////////////
+//               Class support types
+/////////////////////////////////////////////////////////////////////////////
+
+// Called when fd is ready, events is a mask of EPOLLxxx
+typedef void (*EVENT_HANDLER)(int fd, uint32_t events, void *arg);
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of exported functions
+/////////////////////////////////////////////////////////////////////////////
+
+// Timer file descriptors (timerfd), zero interval => one-shot
+extern int  create_timer_fd(void);
+extern long set_timer_fd(int fd, double initial_in_sec, double interval_in_sec);
+extern long read_timer_fd(int fd, uint64_t *expirations);
+extern long clear_timer_fd(int fd);
+
+// Signal file descriptor, signals in mask are also blocked
+extern int  create_signal_fd(const sigset_t *mask);
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+class event_loop {
+
+ public:
+  event_loop(void);
+  ~event_loop(void);
+
+  long open(void);
+  void close(void);
+
+  long add_fd(int fd,
+	      uint32_t events,
+	      EVENT_HANDLER handler,
+	      void *arg);
+  long modify_fd(int fd, uint32_t events);
+  long remove_fd(int fd);
+
+  long run(void);                   // Dispatch events until stopped
+  long run_once(int timeout_in_ms); // Dispatch one batch of events
+  void stop(void);                  // Return from 'run'
+
+  // Readable when events are pending, to wait in another poll
+  int get_fd(void) {return m_epoll_fd;}
+
+ private:
+  int  m_epoll_fd;
+  bool m_stop;
+
+  // Events carry slot and generation, a slot that is freed and given
+  // to another fd within one batch gets a new generation
+  struct {
+    int            fd; // -1 when slot is free
+    uint32_t       generation;
+    EVENT_HANDLER  handler;
+    void          *arg;
+  } m_slots[EVENT_LOOP_MAX_FDS];
+
+  int find_slot(int fd);
+  uint64_t event_data(int slot);
+};
+
+#endif // __EVENT_LOOP_H__
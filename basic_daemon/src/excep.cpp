@@ -12,10 +12,10 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <execinfo.h>
 #include <strings.h>
-#include <sstream>
-#include <iomanip>
 
 #include "excep.h"
 
@@ -25,18 +25,47 @@
 
 ////////////////////////////////////////////////////////////////
 
-excep::excep(void)
+void get_class_method(const char *pretty_function,
+		      char *buffer,
+		      unsigned len)
 {
-  m_file = "";
-  m_line = 0;
-  m_pretty_function = "";
+  const char *begin = pretty_function;
+  const char *end;
+
+  if (len == 0) {
+    return;
+  }
 
-  m_source = 0;
-  m_code   = 0;
-  m_info   = "";
+  // Strip the parameter list
+  end = strchr(pretty_function, '(');
+  if (end == NULL) {
+    end = pretty_function + strlen(pretty_function); // Degenerated case
+  }
+  else {
+    // Strip the return type
+    for (const char *p = pretty_function; p < end; p++) {
+      if (*p == ' ') {
+	begin = p + 1;
+      }
+    }
+  }
 
-  m_nr_frames = 0;
-  *m_stack_frames = NULL;
+  // The stripped name = class::method
+  unsigned n = end - begin;
+  if (n >= len) {
+    n = len - 1;
+  }
+  memcpy(buffer, begin, n);
+  buffer[n] = '\0';
+}
+
+////////////////////////////////////////////////////////////////
+
+excep::excep(void)
+{
+  bzero(&m_record, sizeof(m_record));
+  m_record.file = "";
+  m_record.pretty_function = "";
 }
 
 ////////////////////////////////////////////////////////////////
@@ -48,27 +77,40 @@ excep::excep(const char *file,
 	     long code,
 	     const char *info_format, ...)
 {
+  // Save errno before anything else can change it
+  m_record.linux_errno = errno;
+
   // Get list of void pointers, return addresses for each stack frame
-  bzero(m_stack_frames, sizeof(void *) * MAX_NR_STACK_FRAMES);
-  m_nr_frames = backtrace(m_stack_frames, MAX_NR_STACK_FRAMES);
+  void *stack_frames[MAX_NR_STACK_FRAMES];
+  int nr_frames = backtrace(stack_frames, MAX_NR_STACK_FRAMES);
+
+  m_record.stack.active_frames = nr_frames;
+  for (int i=0; i < nr_frames; i++) {
+    m_record.stack.frames[i] = (uint64_t)stack_frames[i];
+  }
+  for (int i=nr_frames; i < MAX_NR_STACK_FRAMES; i++) {
+    m_record.stack.frames[i] = 0;
+  }
 
   // Handle the standard predefined macros
-  m_file = file;
-  m_line = line;
-  m_pretty_function = pretty_function;
+  m_record.file = file;
+  m_record.line = line;
+  m_record.pretty_function = pretty_function;
 
   // Handle internal error info
-  m_source = source;
-  m_code   = code;
+  m_record.source = source;
+  m_record.code   = code;
 
   // Retrieve any additional arguments for the format string
-  char info_buffer[512];
   va_list info_args;
   va_start(info_args, info_format);
-  vsprintf(info_buffer, info_format, info_args);
+  if (info_format) {
+    vsnprintf(m_record.info, sizeof(m_record.info), info_format, info_args);
+  }
+  else {
+    m_record.info[0] = '\0';
+  }
   va_end(info_args);
-
-  m_info = info_buffer;
 }
 
 ////////////////////////////////////////////////////////////////
@@ -79,82 +121,30 @@ excep::~excep(void) throw()
 
 ////////////////////////////////////////////////////////////////
 
-string excep::get_function(void)
+void excep::get_function(char *buffer, unsigned len) const
 {
-  return get_class_method(m_pretty_function);
+  get_class_method(m_record.pretty_function, buffer, len);
 }
 
 ////////////////////////////////////////////////////////////////
 
-void excep::get_stack_frames(STACK_FRAMES &frames)
+void excep::get_stack_frames(STACK_FRAMES &frames) const
 {
-  unsigned i = 0;
-
-  bzero(&frames, sizeof(frames));
-
-  while ( m_stack_frames[i] ) {
-    frames.frames[i] = (uint64_t)m_stack_frames[i];
-    i++;
-  }
-
-  frames.active_frames = i;
+  frames = m_record.stack;
 }
 
 ////////////////////////////////////////////////////////////////
 
-const char* excep::what() const throw()
+void excep::get_record(ERROR_RECORD &record) const
 {
-  ostringstream oss_msg;
-
-  // Writes the output into the in-memory ostringstream class object,
-  // converting values into string representation
-  oss_msg << "------------ EXCEP : BEGIN ------------\n";
-  oss_msg << "source:" << m_source << ", code:" << m_code << "\n"
-	  << "info:" << m_info << "\n"
-	  << "stack frames:" << m_nr_frames << "\n";
-
-  // Write the stack trace
-  unsigned i=0;
-  char buffer[18];
-  while ( m_stack_frames[i] ) {
-    sprintf(buffer, "0x%016lx", (uint64_t)m_stack_frames[i]);
-    oss_msg << "frame:" << dec << setw(2) << setfill('0') << i++
-	    << "  addr:" << buffer << "\n";
-  }
-
-  // Write info from predefined macros
-  oss_msg << m_file 
-	  << ":" << m_line
-	  << ", " << m_pretty_function << "\n";
-  oss_msg << "------------ EXCEP : END ------------\n";
-
-  // Return the const char* representation
-  return oss_msg.str().c_str();
+  record = m_record;
 }
 
-/////////////////////////////////////////////////////////////////////////////
-//               Private member functions
-/////////////////////////////////////////////////////////////////////////////
-
 ////////////////////////////////////////////////////////////////
 
-string excep::get_class_method(const string pretty_function)
+const char* excep::what() const throw()
 {
-  string class_method = pretty_function;
-
-  // Strip the parameter list
-  size_t index = class_method.find("(");
-  if (index == string::npos) {
-    return class_method;  // Degenerated case 
-  }
-  class_method.erase( index );
-
-  // Strip the return type
-  index = class_method.rfind(" ");
-  if (index == string::npos) {
-    return class_method;  // Degenerated case
-  }
-  class_method.erase(0, index + 1);
-
-  return class_method; // The stripped name = class::method
+  // The full report (stack trace etc.) is produced by the
+  // owner of the error record, this is only the info text
+  return m_record.info;
 }
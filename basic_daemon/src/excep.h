@@ -14,14 +14,14 @@
 
 #include <stdint.h>
 #include <exception>
-#include <string>
 
 using namespace std;
 
 /////////////////////////////////////////////////////////////////////////////
 //               Definitions of macros
 /////////////////////////////////////////////////////////////////////////////
-#define MAX_NR_STACK_FRAMES  32
+#define MAX_NR_STACK_FRAMES    32
+#define EXCEP_MAX_INFO_LENGTH 512
 
 #define EXP(source, code, info_format, ...) \
   excep(__FILE__, __LINE__, __PRETTY_FUNCTION__, \
@@ -39,6 +39,29 @@ typedef struct {
   uint64_t frames[MAX_NR_STACK_FRAMES];
 } STACK_FRAMES;
 
+// Fixed-size and trivially copyable error record.
+// File and function refer to the string literals of the
+// predefined macros, so a record never owns any heap memory.
+typedef struct {
+  const char   *file;
+  int           line;
+  const char   *pretty_function;
+  long          source;
+  long          code;
+  int           linux_errno; // Value of errno when error was created
+  char          info[EXCEP_MAX_INFO_LENGTH];
+  STACK_FRAMES  stack;
+} ERROR_RECORD;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of exported functions
+/////////////////////////////////////////////////////////////////////////////
+
+// Strips return type and parameter list => class::method
+extern void get_class_method(const char *pretty_function,
+			     char *buffer,
+			     unsigned len);
+
 /////////////////////////////////////////////////////////////////////////////
 //               Definition of classes
 /////////////////////////////////////////////////////////////////////////////
@@ -55,31 +78,22 @@ public:
 	const char *info_format, ...);
   ~excep(void) throw();
 
-  string get_file(void) {return m_file;}
-  int get_line(void)    {return m_line;}
-  string get_function(void);
+  const char *get_file(void) const {return m_record.file;}
+  int get_line(void) const         {return m_record.line;}
+  void get_function(char *buffer, unsigned len) const;
 
-  long get_source(void) {return m_source;}
-  long get_code(void)   {return m_code;}
-  string get_info(void) {return m_info;}
+  long get_source(void) const      {return m_record.source;}
+  long get_code(void) const        {return m_record.code;}
+  const char *get_info(void) const {return m_record.info;}
+  int get_errno(void) const        {return m_record.linux_errno;}
 
-  void get_stack_frames(STACK_FRAMES &frames);
+  void get_stack_frames(STACK_FRAMES &frames) const;
+  void get_record(ERROR_RECORD &record) const;
 
   const char* what() const throw();
 
 private:
-  string m_file;
-  int    m_line;
-  string m_pretty_function;
-
-  long   m_source;
-  long   m_code;
-  string m_info;
-
-  int  m_nr_frames;
-  void *m_stack_frames[MAX_NR_STACK_FRAMES];
-
-  string get_class_method(const string pretty_function);
+  ERROR_RECORD m_record;
 };
 
 #endif // __EXCEP_H__
@@ -0,0 +1,119 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "file_watch.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Events in directory that may change the watched file
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE)
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+file_watch::file_watch(void)
+{
+  m_fd = -1;
+  m_wd = -1;
+}
+
+////////////////////////////////////////////////////////////////
+
+file_watch::~file_watch(void)
+{
+  close();
+}
+
+////////////////////////////////////////////////////////////////
+
+long file_watch::open(const char *file_name)
+{
+  // Split into directory and base name
+  string path = file_name;
+  string dir  = ".";
+  size_t index = path.rfind('/');
+  if (index != string::npos) {
+    dir = (index == 0) ? "/" : path.substr(0, index);
+    m_file_base_name = path.substr(index + 1);
+  }
+  else {
+    m_file_base_name = path;
+  }
+
+  m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_fd == -1) {
+    return FILE_WATCH_FAILURE;
+  }
+
+  m_wd = inotify_add_watch(m_fd, dir.c_str(), WATCH_EVENTS);
+  if (m_wd == -1) {
+    close();
+    return FILE_WATCH_FAILURE;
+  }
+
+  return FILE_WATCH_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void file_watch::close(void)
+{
+  if (m_fd != -1) {
+    ::close(m_fd); // Also removes the watch
+  }
+  m_fd = -1;
+  m_wd = -1;
+}
+
+////////////////////////////////////////////////////////////////
+
+long file_watch::check_changed(bool &changed)
+{
+  char buffer[4096]
+    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  changed = false;
+
+  for (;;) {
+    len = read(m_fd, buffer, sizeof(buffer));
+    if (len == -1) {
+      if (errno == EAGAIN) {
+	return FILE_WATCH_SUCCESS; // No more events
+      }
+      if (errno == EINTR) {
+	continue;
+      }
+      return FILE_WATCH_FAILURE;
+    }
+
+    // Check if any of the events concerns the watched file
+    const struct inotify_event *event;
+    for (char *ptr = buffer; ptr < buffer + len;
+	 ptr += sizeof(struct inotify_event) + event->len) {
+      event = (const struct inotify_event *)ptr;
+      if ( (event->mask & IN_Q_OVERFLOW) ||
+	   ( (event->len > 0) && (m_file_base_name == event->name) ) ) {
+	changed = true;
+      }
+    }
+  }
+}
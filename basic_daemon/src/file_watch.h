@@ -0,0 +1,56 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __FILE_WATCH_H__
+#define __FILE_WATCH_H__
+
+#include <string>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define FILE_WATCH_SUCCESS   0
+#define FILE_WATCH_FAILURE  -1
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// Watches a file for changes using inotify.
+// The directory of the file is watched, so changes are detected
+// also when the file is replaced (written to a temporary file and
+// renamed), which is what most editors and deploy tools do.
+
+class file_watch {
+
+ public:
+  file_watch(void);
+  ~file_watch(void);
+
+  long open(const char *file_name);
+  void close(void);
+
+  int get_fd(void) {return m_fd;} // Readable when there are events
+
+  long check_changed(bool &changed); // Reads all pending events,
+                                     // never blocks
+
+ private:
+  int    m_fd;
+  int    m_wd;
+  string m_file_base_name;
+};
+
+#endif // __FILE_WATCH_H__
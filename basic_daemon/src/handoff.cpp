@@ -0,0 +1,249 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "handoff.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define HANDOFF_MAGIC    0x48444f46 // "HDOF"
+#define HANDOFF_VERSION  1          // Layout of file and all records
+
+// Records are 8-byte aligned
+#define HANDOFF_ALIGN(len)  (((len) + 7) & ~7U)
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of types
+/////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+} HANDOFF_HEADER;
+
+typedef struct {
+  uint32_t tag;
+  uint32_t len; // Of data, which follows
+} HANDOFF_RECORD;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+static long read_all(int fd, void *data, size_t len, off_t pos)
+{
+  if (pread(fd, data, len, pos) != (ssize_t) len) {
+    errno = EBADMSG; // Truncated
+    return HANDOFF_FAILURE;
+  }
+  return HANDOFF_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+static long write_all(int fd, const void *data, size_t len, off_t pos)
+{
+  if (pwrite(fd, data, len, pos) != (ssize_t) len) {
+    return HANDOFF_FAILURE;
+  }
+  return HANDOFF_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+static long check_header(int fd)
+{
+  HANDOFF_HEADER header;
+
+  if (read_all(fd, &header, sizeof(header), 0) != HANDOFF_SUCCESS) {
+    return HANDOFF_FAILURE;
+  }
+  if ( (header.magic != HANDOFF_MAGIC) ||
+       (header.version != HANDOFF_VERSION) ) {
+    errno = EPROTO;
+    return HANDOFF_FAILURE;
+  }
+
+  return HANDOFF_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+int handoff_create(void)
+{
+  HANDOFF_HEADER header;
+
+  const int fd = memfd_create("handoff", MFD_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+
+  header.magic   = HANDOFF_MAGIC;
+  header.version = HANDOFF_VERSION;
+  if (write_all(fd, &header, sizeof(header), 0) != HANDOFF_SUCCESS) {
+    const int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+
+  return fd;
+}
+
+////////////////////////////////////////////////////////////////
+
+long handoff_put(int fd,
+		 uint32_t tag,
+		 const void *data,
+		 uint32_t len)
+{
+  struct stat st;
+  HANDOFF_RECORD record;
+
+  if (fstat(fd, &st) == -1) {
+    return HANDOFF_FAILURE;
+  }
+
+  record.tag = tag;
+  record.len = len;
+
+  // Padding is left as a hole by next record
+  if ( (write_all(fd, &record, sizeof(record),
+		  st.st_size) != HANDOFF_SUCCESS) ||
+       (write_all(fd, data, len,
+		  st.st_size + sizeof(record)) != HANDOFF_SUCCESS) ||
+       (ftruncate(fd, st.st_size + sizeof(record) +
+		  HANDOFF_ALIGN(len)) == -1) ) {
+    return HANDOFF_FAILURE;
+  }
+
+  return HANDOFF_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long handoff_get(int fd,
+		 uint32_t tag,
+		 void *data,
+		 uint32_t len)
+{
+  struct stat st;
+  HANDOFF_RECORD record;
+
+  if ( (fstat(fd, &st) == -1) ||
+       (check_header(fd) != HANDOFF_SUCCESS) ) {
+    return HANDOFF_FAILURE;
+  }
+
+  off_t pos = sizeof(HANDOFF_HEADER);
+  while (pos + (off_t) sizeof(record) <= st.st_size) {
+    if (read_all(fd, &record, sizeof(record), pos) != HANDOFF_SUCCESS) {
+      return HANDOFF_FAILURE;
+    }
+    pos += sizeof(record);
+
+    if (record.tag == tag) {
+      if (record.len != len) {
+	errno = EBADMSG; // Layout changed between images
+	return HANDOFF_FAILURE;
+      }
+      return read_all(fd, data, len, pos);
+    }
+    pos += HANDOFF_ALIGN(record.len);
+  }
+
+  errno = ENOENT;
+  return HANDOFF_FAILURE;
+}
+
+////////////////////////////////////////////////////////////////
+
+long handoff_keep_fd(int fd)
+{
+  const int flags = fcntl(fd, F_GETFD);
+
+  if ( (flags == -1) ||
+       (fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC) == -1) ) {
+    return HANDOFF_FAILURE;
+  }
+
+  return HANDOFF_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long handoff_exec(int fd,
+		  const char *path,
+		  char *const argv[])
+{
+  char value[16];
+
+  snprintf(value, sizeof(value), "%d", fd);
+  if ( (handoff_keep_fd(fd) != HANDOFF_SUCCESS) ||
+       (setenv(HANDOFF_ENV, value, 1) == -1) ) {
+    return HANDOFF_FAILURE;
+  }
+
+  execv(path, argv);
+
+  // Still the old image
+  const int error = errno;
+  unsetenv(HANDOFF_ENV);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  errno = error;
+
+  return HANDOFF_FAILURE;
+}
+
+////////////////////////////////////////////////////////////////
+
+int handoff_inherit(void)
+{
+  const char *value = getenv(HANDOFF_ENV);
+  char *endptr;
+
+  if (!value) {
+    return -1;
+  }
+
+  long fd = strtol(value, &endptr, 10);
+  if (*endptr != '\0') {
+    fd = -1;
+  }
+  unsetenv(HANDOFF_ENV);
+  if ( (fd < 0) ||
+       (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) ) {
+    return -1;
+  }
+
+  // Written by an incompatible image
+  if (check_header(fd) != HANDOFF_SUCCESS) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
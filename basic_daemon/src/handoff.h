@@ -0,0 +1,70 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __HANDOFF_H__
+#define __HANDOFF_H__
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define HANDOFF_SUCCESS   0
+#define HANDOFF_FAILURE  -1
+
+// Names the handoff file in the environment of the new image
+#define HANDOFF_ENV  "BASICD_HANDOFF"
+
+// Record tags, one record for each owner of state
+#define HANDOFF_TAG_DAEMON          1 // Main loop, lock file
+#define HANDOFF_TAG_CORE            2 // Daemon core, statistics
+#define HANDOFF_TAG_LISTEN_SOCKETS  3 // See listen_socket.h
+#define HANDOFF_TAG_PREFORK         4 // Instance of a child, see prefork.h
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of exported functions
+/////////////////////////////////////////////////////////////////////////////
+
+// State is handed over to a new image of the process (execve) in a
+// memory file of tagged records. The file, and any other descriptor
+// that is kept, is inherited by the new image.
+
+// Creates an empty handoff file. Returns the file, or -1 with errno set.
+extern int handoff_create(void);
+
+// Appends one record
+extern long handoff_put(int fd,
+			uint32_t tag,
+			const void *data,
+			uint32_t len);
+
+// Reads a record, which must have exactly this length.
+// Fails with errno ENOENT if not found, EBADMSG if length differs.
+extern long handoff_get(int fd,
+			uint32_t tag,
+			void *data,
+			uint32_t len);
+
+// The descriptor is kept open over execve
+extern long handoff_keep_fd(int fd);
+
+// Executes the new image, only returns on failure
+extern long handoff_exec(int fd,
+			 const char *path,
+			 char *const argv[]);
+
+// Returns the handoff file from a previous image, or -1 if none.
+// Not inherited by any further images.
+extern int handoff_inherit(void);
+
+#endif // __HANDOFF_H__
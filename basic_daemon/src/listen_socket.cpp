@@ -0,0 +1,388 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "listen_socket.h"
+#include "handoff.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of types
+/////////////////////////////////////////////////////////////////////////////
+
+typedef enum {
+  SOCKET_FREE,
+  SOCKET_OPEN,      // Returned by open_listen_socket
+  SOCKET_KEPT,      // Closed while handing over
+  SOCKET_INHERITED  // Waiting to be taken over
+} SOCKET_STATE;
+
+// Sharing with other processes
+#define SOCKET_LENT      0x01 // Also passed to child processes
+#define SOCKET_BORROWED  0x02 // Owned by parent process, never closed here
+
+typedef struct {
+  SOCKET_STATE state;
+  unsigned     sharing;
+  int          fd;
+  char         address[LISTEN_SOCKET_MAX_ADDRESS];
+} LISTEN_SOCKET;
+
+// Record in handoff file
+typedef struct {
+  uint32_t nr_sockets;
+  struct {
+    int32_t  fd;
+    uint32_t sharing;
+    char     address[LISTEN_SOCKET_MAX_ADDRESS];
+  } socket[LISTEN_SOCKET_MAX_SOCKETS];
+} LISTEN_SOCKET_HANDOFF;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Global variables
+/////////////////////////////////////////////////////////////////////////////
+
+// All listening sockets of the process, so they can be handed over
+static LISTEN_SOCKET   g_sockets[LISTEN_SOCKET_MAX_SOCKETS];
+static bool            g_handoff = false;
+static pthread_mutex_t g_sockets_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+static int bind_unix(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return -1;
+  }
+
+  // Remove socket left by a previous instance
+  unlink(path);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if ( bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+////////////////////////////////////////////////////////////////
+
+static int bind_tcp(const char *address, unsigned flags)
+{
+  struct sockaddr_in addr;
+  char host[INET_ADDRSTRLEN];
+  char *endptr;
+  int fd;
+
+  // Format is a.b.c.d:port
+  const char *colon = strrchr(address, ':');
+  if ( (!colon) || ((unsigned)(colon - address) >= sizeof(host)) ) {
+    errno = EINVAL;
+    return -1;
+  }
+  memcpy(host, address, colon - address);
+  host[colon - address] = '\0';
+
+  const long port = strtol(colon + 1, &endptr, 10);
+  if ( (*endptr != '\0') || (port <= 0) || (port > 65535) ) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons((uint16_t) port);
+  if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if ( (flags & LISTEN_SOCKET_LOOPBACK_ONLY) &&
+       ((ntohl(addr.sin_addr.s_addr) >> 24) != 127) ) {
+    errno = EADDRNOTAVAIL;
+    return -1;
+  }
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return -1;
+  }
+
+  const int on = 1;
+  if ( (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1) ||
+       (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+////////////////////////////////////////////////////////////////
+
+static LISTEN_SOCKET *find_socket(SOCKET_STATE state,
+				  int fd,
+				  const char *address)
+{
+  // Match on address if given, else on fd if not -1
+  for (unsigned i=0; i < LISTEN_SOCKET_MAX_SOCKETS; i++) {
+    LISTEN_SOCKET *sock = &g_sockets[i];
+    if ( (sock->state == state) &&
+	 ( address ? !strcmp(sock->address, address) :
+	   ( (fd == -1) || (sock->fd == fd) ) ) ) {
+      return sock;
+    }
+  }
+  return NULL;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void close_socket(LISTEN_SOCKET *sock)
+{
+  close(sock->fd);
+  if (sock->address[0] == '/') {
+    unlink(sock->address);
+  }
+  sock->state   = SOCKET_FREE;
+  sock->sharing = 0;
+  sock->fd      = -1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+int open_listen_socket(const char *address,
+		       unsigned flags,
+		       int backlog)
+{
+  LISTEN_SOCKET *sock;
+  int fd;
+
+  if (strlen(address) >= LISTEN_SOCKET_MAX_ADDRESS) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  pthread_mutex_lock(&g_sockets_mutex);
+
+  // Take over socket from previous image, already listening
+  sock = find_socket(SOCKET_INHERITED, -1, address);
+  if (sock) {
+    fcntl(sock->fd, F_SETFD, FD_CLOEXEC);
+    sock->state = SOCKET_OPEN;
+    pthread_mutex_unlock(&g_sockets_mutex);
+    return sock->fd;
+  }
+
+  sock = find_socket(SOCKET_FREE, -1, NULL);
+  if (!sock) {
+    pthread_mutex_unlock(&g_sockets_mutex);
+    errno = ENFILE;
+    return -1;
+  }
+
+  if (address[0] == '/') {
+    fd = bind_unix(address);
+  }
+  else {
+    fd = bind_tcp(address, flags);
+  }
+  if ( (fd != -1) && (listen(fd, backlog) == -1) ) {
+    const int error = errno;
+    close(fd);
+    errno = error;
+    fd = -1;
+  }
+
+  if (fd != -1) {
+    sock->state   = SOCKET_OPEN;
+    sock->sharing = 0;
+    sock->fd      = fd;
+    strcpy(sock->address, address);
+  }
+
+  pthread_mutex_unlock(&g_sockets_mutex);
+
+  return fd;
+}
+
+////////////////////////////////////////////////////////////////
+
+void close_listen_socket(int fd)
+{
+  pthread_mutex_lock(&g_sockets_mutex);
+
+  LISTEN_SOCKET *sock = find_socket(SOCKET_OPEN, fd, NULL);
+  if (!sock) {
+    close(fd);
+  }
+  else if (g_handoff) {
+    sock->state = SOCKET_KEPT;
+  }
+  else if (sock->sharing & SOCKET_BORROWED) {
+    sock->state = SOCKET_INHERITED; // Still used by other processes
+  }
+  else {
+    close_socket(sock);
+  }
+
+  pthread_mutex_unlock(&g_sockets_mutex);
+}
+
+////////////////////////////////////////////////////////////////
+
+void lend_listen_socket(int fd)
+{
+  pthread_mutex_lock(&g_sockets_mutex);
+
+  LISTEN_SOCKET *sock = find_socket(SOCKET_OPEN, fd, NULL);
+  if (sock) {
+    sock->sharing |= SOCKET_LENT;
+  }
+
+  pthread_mutex_unlock(&g_sockets_mutex);
+}
+
+////////////////////////////////////////////////////////////////
+
+void handoff_listen_sockets(bool on)
+{
+  pthread_mutex_lock(&g_sockets_mutex);
+
+  g_handoff = on;
+  if (!on) {
+    for (unsigned i=0; i < LISTEN_SOCKET_MAX_SOCKETS; i++) {
+      if (g_sockets[i].state == SOCKET_KEPT) {
+	g_sockets[i].state = SOCKET_INHERITED;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&g_sockets_mutex);
+}
+
+////////////////////////////////////////////////////////////////
+
+long save_listen_sockets(int handoff_fd)
+{
+  LISTEN_SOCKET_HANDOFF record;
+  long rc = LISTEN_SOCKET_SUCCESS;
+
+  memset(&record, 0, sizeof(record));
+
+  pthread_mutex_lock(&g_sockets_mutex);
+  for (unsigned i=0; i < LISTEN_SOCKET_MAX_SOCKETS; i++) {
+    const LISTEN_SOCKET *sock = &g_sockets[i];
+    const bool borrowed = ( (sock->state == SOCKET_INHERITED) &&
+			    (sock->sharing & SOCKET_BORROWED) );
+    if ( (sock->state != SOCKET_KEPT) &&
+	 (!borrowed) &&
+	 (!(sock->sharing & SOCKET_LENT)) ) {
+      continue;
+    }
+    if (handoff_keep_fd(sock->fd) != HANDOFF_SUCCESS) {
+      rc = LISTEN_SOCKET_FAILURE;
+    }
+    record.socket[record.nr_sockets].fd = sock->fd;
+    record.socket[record.nr_sockets].sharing =
+      ( (sock->sharing & SOCKET_LENT) ? SOCKET_BORROWED :
+	(sock->sharing & SOCKET_BORROWED) );
+    strcpy(record.socket[record.nr_sockets].address, sock->address);
+    record.nr_sockets++;
+  }
+  pthread_mutex_unlock(&g_sockets_mutex);
+
+  if ( (rc != LISTEN_SOCKET_SUCCESS) ||
+       (handoff_put(handoff_fd, HANDOFF_TAG_LISTEN_SOCKETS,
+		    &record, sizeof(record)) != HANDOFF_SUCCESS) ) {
+    return LISTEN_SOCKET_FAILURE;
+  }
+
+  return LISTEN_SOCKET_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long restore_listen_sockets(int handoff_fd)
+{
+  LISTEN_SOCKET_HANDOFF record;
+
+  if ( (handoff_get(handoff_fd, HANDOFF_TAG_LISTEN_SOCKETS,
+		    &record, sizeof(record)) != HANDOFF_SUCCESS) ||
+       (record.nr_sockets > LISTEN_SOCKET_MAX_SOCKETS) ) {
+    return LISTEN_SOCKET_FAILURE;
+  }
+
+  pthread_mutex_lock(&g_sockets_mutex);
+  for (unsigned i=0; i < record.nr_sockets; i++) {
+    LISTEN_SOCKET *sock = find_socket(SOCKET_FREE, -1, NULL);
+    const int fd = record.socket[i].fd;
+    if ( (!sock) || (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) ) {
+      continue; // Not usable, a new socket is created
+    }
+    sock->state   = SOCKET_INHERITED;
+    sock->sharing = record.socket[i].sharing & SOCKET_BORROWED;
+    sock->fd      = fd;
+    memcpy(sock->address, record.socket[i].address, sizeof(sock->address));
+    sock->address[sizeof(sock->address) - 1] = '\0';
+  }
+  pthread_mutex_unlock(&g_sockets_mutex);
+
+  return LISTEN_SOCKET_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void close_unused_listen_sockets(void)
+{
+  pthread_mutex_lock(&g_sockets_mutex);
+
+  for (unsigned i=0; i < LISTEN_SOCKET_MAX_SOCKETS; i++) {
+    if ( (g_sockets[i].state == SOCKET_INHERITED) &&
+	 (!(g_sockets[i].sharing & SOCKET_BORROWED)) ) {
+      close_socket(&g_sockets[i]);
+    }
+  }
+
+  pthread_mutex_unlock(&g_sockets_mutex);
+}
@@ -0,0 +1,62 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __LISTEN_SOCKET_H__
+#define __LISTEN_SOCKET_H__
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Flags
+#define LISTEN_SOCKET_LOOPBACK_ONLY  0x01 // Refuse TCP addresses not 127/8
+
+// Return codes
+#define LISTEN_SOCKET_SUCCESS   0
+#define LISTEN_SOCKET_FAILURE  -1
+
+#define LISTEN_SOCKET_MAX_SOCKETS   16  // Open at a time in the process
+#define LISTEN_SOCKET_MAX_ADDRESS  108  // Including terminator
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of exported functions
+/////////////////////////////////////////////////////////////////////////////
+
+// Creates a non-blocking listening socket. Address is a unix socket
+// path ("/...", any old socket is removed) or a TCP address
+// ("a.b.c.d:port"). A socket inherited from a previous image with the
+// same address is taken over instead, queued connections included.
+// Returns the socket, or -1 with errno set.
+extern int open_listen_socket(const char *address,
+			      unsigned flags,
+			      int backlog);
+
+// Closes a socket from open_listen_socket, a unix socket path is
+// removed. While handing over, the socket is kept open instead.
+extern void close_listen_socket(int fd);
+
+// The socket is also passed to child processes by save_listen_sockets.
+// When closed by a child, it is only released, never closed or removed.
+extern void lend_listen_socket(int fd);
+
+// Handing over on: closed sockets are kept for a new image.
+// Handing over off: kept sockets are offered to open_listen_socket again.
+extern void handoff_listen_sockets(bool on);
+
+// Kept and lent sockets are passed in the handoff file (see handoff.h)
+extern long save_listen_sockets(int handoff_fd);
+extern long restore_listen_sockets(int handoff_fd);
+
+// Closes inherited sockets that were not taken over,
+// e.g. when the address has been reconfigured
+extern void close_unused_listen_sockets(void);
+
+#endif // __LISTEN_SOCKET_H__
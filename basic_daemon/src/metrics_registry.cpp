@@ -0,0 +1,248 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <string.h>
+#include <memory>
+
+#include "metrics_registry.h"
+
+metrics_registry* metrics_registry::m_instance = NULL;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+metrics_registry::~metrics_registry(void)
+{
+  pthread_mutex_destroy(&m_mutex);
+}
+
+////////////////////////////////////////////////////////////////
+
+metrics_registry* metrics_registry::instance(void)
+{
+  if (!m_instance) {
+    m_instance = new metrics_registry;
+    static auto_ptr<metrics_registry> m_auto =
+      auto_ptr<metrics_registry>(m_instance);
+  }
+  return m_instance;
+}
+
+////////////////////////////////////////////////////////////////
+
+int metrics_registry::add_counter(const char *name,
+				  const char *labels,
+				  double scale)
+{
+  return add_metric(name, labels, METRICS_COUNTER, scale, NULL, 0);
+}
+
+////////////////////////////////////////////////////////////////
+
+int metrics_registry::add_gauge(const char *name,
+				const char *labels,
+				double scale)
+{
+  return add_metric(name, labels, METRICS_GAUGE, scale, NULL, 0);
+}
+
+////////////////////////////////////////////////////////////////
+
+int metrics_registry::add_histogram(const char *name,
+				    const char *labels,
+				    double scale,
+				    const uint64_t *bounds,
+				    unsigned nr_bounds)
+{
+  if (nr_bounds > METRICS_REGISTRY_MAX_BOUNDS) {
+    return METRICS_REGISTRY_FAILURE;
+  }
+  return add_metric(name, labels, METRICS_HISTOGRAM, scale, bounds, nr_bounds);
+}
+
+////////////////////////////////////////////////////////////////
+
+void metrics_registry::add(int id, uint64_t value)
+{
+  if (id < 0) {
+    return;
+  }
+  m_counters.add(m_metrics[id].slot, value);
+}
+
+////////////////////////////////////////////////////////////////
+
+void metrics_registry::change(int id, int64_t delta)
+{
+  if (id < 0) {
+    return;
+  }
+  // Two's complement, the merged sum is the signed value
+  m_counters.add(m_metrics[id].slot, (uint64_t)delta);
+}
+
+////////////////////////////////////////////////////////////////
+
+void metrics_registry::observe(int id, uint64_t value)
+{
+  if (id < 0) {
+    return;
+  }
+  const METRIC *metric = &m_metrics[id];
+
+  // Few bounds, a linear search is fastest
+  unsigned bucket = 0;
+  while ( (bucket < metric->nr_bounds) &&
+	  (value > metric->bounds[bucket]) ) {
+    bucket++;
+  }
+  m_counters.inc(metric->slot + bucket);
+  m_counters.add(metric->slot + metric->nr_bounds + 1, value);
+}
+
+////////////////////////////////////////////////////////////////
+
+unsigned metrics_registry::get_nr_metrics(void)
+{
+  return __atomic_load_n(&m_nr_metrics, __ATOMIC_ACQUIRE);
+}
+
+////////////////////////////////////////////////////////////////
+
+const char *metrics_registry::get_name(unsigned index)
+{
+  return ( (index < get_nr_metrics()) ? m_metrics[index].name : "" );
+}
+
+////////////////////////////////////////////////////////////////
+
+long metrics_registry::snapshot(unsigned index, METRICS_SNAPSHOT *snapshot)
+{
+  if (index >= get_nr_metrics()) {
+    return METRICS_REGISTRY_FAILURE;
+  }
+  const METRIC *metric = &m_metrics[index];
+
+  memcpy(snapshot->name,   metric->name,   sizeof(snapshot->name));
+  memcpy(snapshot->labels, metric->labels, sizeof(snapshot->labels));
+  snapshot->type      = metric->type;
+  snapshot->scale     = metric->scale;
+  snapshot->value     = 0;
+  snapshot->nr_bounds = metric->nr_bounds;
+  snapshot->sum       = 0;
+
+  if (metric->type != METRICS_HISTOGRAM) {
+    uint64_t value;
+    m_counters.snapshot_range(metric->slot, &value, 1);
+    snapshot->value = (int64_t)value;
+    return METRICS_REGISTRY_SUCCESS;
+  }
+
+  memcpy(snapshot->bounds, metric->bounds,
+	 metric->nr_bounds * sizeof(uint64_t));
+  m_counters.snapshot_range(metric->slot, snapshot->buckets,
+			    metric->nr_bounds + 1);
+  m_counters.snapshot_range(metric->slot + metric->nr_bounds + 1,
+			    &snapshot->sum, 1);
+
+  return METRICS_REGISTRY_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+uint64_t metrics_registry::read(int id)
+{
+  uint64_t value = 0;
+
+  if ( (id >= 0) && ((unsigned)id < get_nr_metrics()) &&
+       (m_metrics[id].type != METRICS_HISTOGRAM) ) {
+    m_counters.snapshot_range(m_metrics[id].slot, &value, 1);
+  }
+
+  return value;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+metrics_registry::metrics_registry(void) :
+  m_counters(METRICS_REGISTRY_MAX_SLOTS)
+{
+  m_nr_metrics = 0;
+  m_nr_slots   = 0;
+  memset(m_metrics, 0, sizeof(m_metrics));
+
+  pthread_mutex_init(&m_mutex, NULL); // Use default mutex attributes
+}
+
+////////////////////////////////////////////////////////////////
+
+int metrics_registry::add_metric(const char *name,
+				 const char *labels,
+				 METRICS_TYPE type,
+				 double scale,
+				 const uint64_t *bounds,
+				 unsigned nr_bounds)
+{
+  int id = METRICS_REGISTRY_FAILURE;
+
+  if ( (strlen(name) >= METRICS_REGISTRY_NAME_LEN) ||
+       (strlen(labels) >= METRICS_REGISTRY_LABELS_LEN) ) {
+    return METRICS_REGISTRY_FAILURE;
+  }
+
+  pthread_mutex_lock(&m_mutex);
+
+  // Registered before, e.g. by a previous start of the subsystem
+  for (unsigned i=0; i < m_nr_metrics; i++) {
+    if ( (!strcmp(m_metrics[i].name, name)) &&
+	 (!strcmp(m_metrics[i].labels, labels)) ) {
+      if (m_metrics[i].type == type) {
+	id = i;
+      }
+      pthread_mutex_unlock(&m_mutex);
+      return id;
+    }
+  }
+
+  // Histogram: buckets and sum
+  const unsigned nr_slots = ( (type == METRICS_HISTOGRAM) ?
+			      nr_bounds + 2 : 1 );
+
+  if ( (m_nr_metrics < METRICS_REGISTRY_MAX_METRICS) &&
+       (m_nr_slots + nr_slots <= METRICS_REGISTRY_MAX_SLOTS) ) {
+    METRIC *metric = &m_metrics[m_nr_metrics];
+    strcpy(metric->name,   name);
+    strcpy(metric->labels, labels);
+    metric->type      = type;
+    metric->scale     = scale;
+    metric->slot      = m_nr_slots;
+    metric->nr_bounds = nr_bounds;
+    for (unsigned i=0; i < nr_bounds; i++) {
+      metric->bounds[i] = bounds[i];
+    }
+    m_nr_slots += nr_slots;
+
+    // Visible to snapshots when complete
+    id = m_nr_metrics;
+    __atomic_store_n(&m_nr_metrics, m_nr_metrics + 1, __ATOMIC_RELEASE);
+  }
+
+  pthread_mutex_unlock(&m_mutex);
+
+  return id;
+}
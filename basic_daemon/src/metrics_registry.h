@@ -0,0 +1,134 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __METRICS_REGISTRY_H__
+#define __METRICS_REGISTRY_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "sharded_counters.h"
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define METRICS_REGISTRY_SUCCESS   0
+#define METRICS_REGISTRY_FAILURE  -1
+
+#define METRICS_REGISTRY_MAX_METRICS  128
+#define METRICS_REGISTRY_MAX_SLOTS    512 // Counters of all metrics
+#define METRICS_REGISTRY_MAX_BOUNDS    15 // Histogram buckets, +Inf excluded
+#define METRICS_REGISTRY_NAME_LEN      64
+#define METRICS_REGISTRY_LABELS_LEN    64
+
+/////////////////////////////////////////////////////////////////////////////
+//               Class support types
+/////////////////////////////////////////////////////////////////////////////
+
+typedef enum {METRICS_COUNTER,    // Only increases
+	      METRICS_GAUGE,      // Up and down, a sum of signed changes
+	      METRICS_HISTOGRAM}  METRICS_TYPE;
+
+// A metric merged from all shards
+typedef struct {
+  char         name[METRICS_REGISTRY_NAME_LEN];     // Family, e.g. "log_lines_total"
+  char         labels[METRICS_REGISTRY_LABELS_LEN]; // e.g. "thread=\"x\"", or ""
+  METRICS_TYPE type;
+  double       scale;   // Unit of exposition per unit of value, e.g. 1e-9
+  int64_t      value;   // Counter or gauge
+  unsigned     nr_bounds;
+  uint64_t     bounds[METRICS_REGISTRY_MAX_BOUNDS];      // Upper, inclusive
+  uint64_t     buckets[METRICS_REGISTRY_MAX_BOUNDS + 1]; // Not cumulative
+  uint64_t     sum;     // Of observed values
+} METRICS_SNAPSHOT;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// Process wide registry of named metrics. Metrics are registered when a
+// subsystem is initialized, which returns an id used for updates.
+// Registering the same name and labels again returns the same id, so
+// counting continues over a restart of the subsystem.
+//
+// Updates are lock free and a few nanoseconds, each thread updates its
+// own cache line aligned shard (see sharded_counters.h). The shards are
+// merged when a snapshot is taken. A snapshot may be taken at any time.
+
+class metrics_registry {
+
+ public:
+  ~metrics_registry(void);
+  static metrics_registry* instance(void);
+
+  // Registration, returns id or METRICS_REGISTRY_FAILURE when full.
+  // Bounds of a histogram are increasing, the last bucket is +Inf.
+  int add_counter(const char *name,
+		  const char *labels,
+		  double scale);
+  int add_gauge(const char *name,
+		const char *labels,
+		double scale);
+  int add_histogram(const char *name,
+		    const char *labels,
+		    double scale,
+		    const uint64_t *bounds,
+		    unsigned nr_bounds);
+
+  // Updates, an id < 0 (failed registration) is ignored
+  void add(int id, uint64_t value);          // Counter
+  void inc(int id) {add(id, 1);}             // Counter
+  void change(int id, int64_t delta);        // Gauge
+  void observe(int id, uint64_t value);      // Histogram
+
+  // Snapshots, index is the order of registration
+  unsigned get_nr_metrics(void);
+  const char *get_name(unsigned index); // Family, fixed when registered
+  long snapshot(unsigned index, METRICS_SNAPSHOT *snapshot);
+  uint64_t read(int id); // Counter or gauge, zero for a bad id
+
+ private:
+  typedef struct {
+    char         name[METRICS_REGISTRY_NAME_LEN];
+    char         labels[METRICS_REGISTRY_LABELS_LEN];
+    METRICS_TYPE type;
+    double       scale;
+    unsigned     slot;      // First counter, see below
+    unsigned     nr_bounds;
+    uint64_t     bounds[METRICS_REGISTRY_MAX_BOUNDS];
+  } METRIC;
+
+  // Counter and gauge use one slot. A histogram uses one slot per
+  // bucket followed by the sum.
+
+  static metrics_registry *m_instance;
+  pthread_mutex_t   m_mutex;      // Registration
+  METRIC            m_metrics[METRICS_REGISTRY_MAX_METRICS];
+  unsigned          m_nr_metrics; // Accessed atomically
+  unsigned          m_nr_slots;
+  sharded_counters  m_counters;
+
+  metrics_registry(void); // Private constructor
+                          // so it can't be called
+
+  int add_metric(const char *name,
+		 const char *labels,
+		 METRICS_TYPE type,
+		 double scale,
+		 const uint64_t *bounds,
+		 unsigned nr_bounds);
+};
+
+#endif // __METRICS_REGISTRY_H__
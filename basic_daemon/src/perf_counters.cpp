@@ -0,0 +1,155 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "perf_counters.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Module global variables
+/////////////////////////////////////////////////////////////////////////////
+
+// Indexed by PERF_COUNTERS_EVENT
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} g_events[PERF_COUNTERS_NR] = {
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+perf_counters::perf_counters(void)
+{
+  for (unsigned i=0; i < PERF_COUNTERS_NR; i++) {
+    m_fds[i] = -1;
+  }
+  m_group_fd  = -1;
+  m_nr_open   = 0;
+  m_available = 0;
+}
+
+////////////////////////////////////////////////////////////////
+
+perf_counters::~perf_counters(void)
+{
+  close();
+}
+
+////////////////////////////////////////////////////////////////
+
+long perf_counters::open(void)
+{
+  close();
+
+  // The first available event leads the group
+  for (unsigned i=0; i < PERF_COUNTERS_NR; i++) {
+    m_fds[i] = open_event(g_events[i].type, g_events[i].config);
+    if (m_fds[i] == -1) {
+      continue;
+    }
+    if (m_group_fd == -1) {
+      m_group_fd = m_fds[i];
+    }
+    m_nr_open++;
+    m_available |= (1 << i);
+  }
+
+  if (m_group_fd == -1) {
+    return PERF_COUNTERS_FAILURE;
+  }
+
+  return PERF_COUNTERS_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void perf_counters::close(void)
+{
+  // Members before leader
+  for (int i=PERF_COUNTERS_NR - 1; i >= 0; i--) {
+    if (m_fds[i] != -1) {
+      ::close(m_fds[i]);
+      m_fds[i] = -1;
+    }
+  }
+  m_group_fd  = -1;
+  m_nr_open   = 0;
+  m_available = 0;
+}
+
+////////////////////////////////////////////////////////////////
+
+long perf_counters::read(uint64_t *values)
+{
+  // Nof events followed by their values, in order of open
+  uint64_t group[1 + PERF_COUNTERS_NR];
+
+  if (m_group_fd == -1) {
+    return PERF_COUNTERS_FAILURE;
+  }
+
+  const ssize_t n = ::read(m_group_fd, group, sizeof(group));
+  if ( (n < (ssize_t)((1 + m_nr_open) * sizeof(uint64_t))) ||
+       (group[0] != m_nr_open) ) {
+    return PERF_COUNTERS_FAILURE;
+  }
+
+  unsigned value = 1;
+  for (unsigned i=0; i < PERF_COUNTERS_NR; i++) {
+    values[i] = ( (m_fds[i] != -1) ? group[value++] : 0 );
+  }
+
+  return PERF_COUNTERS_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+int perf_counters::open_event(uint32_t type, uint64_t config)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size        = sizeof(attr);
+  attr.type        = type;
+  attr.config      = config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_hv  = 1;
+
+  // Calling thread on any CPU, not inherited by an upgraded image
+  int fd = syscall(SYS_perf_event_open, &attr, 0, -1, m_group_fd,
+		   PERF_FLAG_FD_CLOEXEC);
+  if ( (fd == -1) && (errno == EACCES) ) {
+    // Not allowed to count kernel code, user space only
+    attr.exclude_kernel = 1;
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, m_group_fd,
+		 PERF_FLAG_FD_CLOEXEC);
+  }
+
+  return fd;
+}
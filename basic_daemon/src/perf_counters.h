@@ -0,0 +1,79 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __PERF_COUNTERS_H__
+#define __PERF_COUNTERS_H__
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define PERF_COUNTERS_SUCCESS   0
+#define PERF_COUNTERS_FAILURE  -1
+
+#define PERF_COUNTERS_NR  6
+
+/////////////////////////////////////////////////////////////////////////////
+//               Class support types
+/////////////////////////////////////////////////////////////////////////////
+
+// Counted events, index of values
+typedef enum {PERF_COUNTERS_CYCLES,           // Hardware
+	      PERF_COUNTERS_INSTRUCTIONS,     // Hardware
+	      PERF_COUNTERS_CACHE_MISSES,     // Hardware, last level cache
+	      PERF_COUNTERS_BRANCH_MISSES,    // Hardware
+	      PERF_COUNTERS_CONTEXT_SWITCHES, // Software
+	      PERF_COUNTERS_PAGE_FAULTS}      // Software
+  PERF_COUNTERS_EVENT;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// Counts events of the calling thread, using perf_event_open(2). All
+// events are one group, so they are counted over the same time and
+// are read with one system call.
+//
+// Events the kernel refuses are left out, e.g. hardware events in a
+// virtual machine without a virtual PMU. The software events remain.
+// Kernel code is only counted if allowed (perf_event_paranoid).
+
+class perf_counters {
+
+ public:
+  perf_counters(void);
+  ~perf_counters(void);
+
+  long open(void);  // Start counting the calling thread
+  void close(void); // Stop counting
+
+  bool is_open(void) {return (m_group_fd != -1);}
+
+  // Bitmask of counted events (1 << PERF_COUNTERS_xxx)
+  unsigned get_available(void) {return m_available;}
+
+  // Events counted since open, PERF_COUNTERS_NR values.
+  // Zero for events that are not available.
+  long read(uint64_t *values);
+
+ private:
+  int      m_fds[PERF_COUNTERS_NR]; // -1 if not available
+  int      m_group_fd;              // First available event
+  unsigned m_nr_open;
+  unsigned m_available;
+
+  int open_event(uint32_t type, uint64_t config);
+};
+
+#endif // __PERF_COUNTERS_H__
@@ -0,0 +1,130 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <string.h>
+#include <time.h>
+
+#include "phase_timer.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+phase_timer::phase_timer(void)
+{
+  reset();
+}
+
+////////////////////////////////////////////////////////////////
+
+phase_timer::~phase_timer(void)
+{
+}
+
+////////////////////////////////////////////////////////////////
+
+void phase_timer::reset(void)
+{
+  memset(m_phases, 0, sizeof(m_phases));
+  m_nr_phases = 0;
+  m_running   = false;
+}
+
+////////////////////////////////////////////////////////////////
+
+void phase_timer::begin(const char *name)
+{
+  const uint64_t t = now();
+
+  if (m_running) {
+    m_phases[m_nr_phases - 1].end = t;
+    m_running = false;
+  }
+
+  if (m_nr_phases < PHASE_TIMER_MAX_PHASES) {
+    strncpy(m_phases[m_nr_phases].name, name, PHASE_TIMER_MAX_NAME - 1);
+    m_phases[m_nr_phases].name[PHASE_TIMER_MAX_NAME - 1] = '\0';
+    m_phases[m_nr_phases].begin = t;
+    m_nr_phases++;
+    m_running = true;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+void phase_timer::end(void)
+{
+  if (m_running) {
+    m_phases[m_nr_phases - 1].end = now();
+    m_running = false;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+unsigned phase_timer::get_nr_phases(void)
+{
+  return m_nr_phases;
+}
+
+////////////////////////////////////////////////////////////////
+
+const char *phase_timer::get_name(unsigned index)
+{
+  return (index < m_nr_phases ? m_phases[index].name : "");
+}
+
+////////////////////////////////////////////////////////////////
+
+uint64_t phase_timer::get_duration(unsigned index)
+{
+  if (index >= m_nr_phases) {
+    return 0;
+  }
+
+  // Current phase, so far
+  const uint64_t end = ( (m_running && (index == m_nr_phases - 1)) ?
+			 now() : m_phases[index].end );
+
+  return end - m_phases[index].begin;
+}
+
+////////////////////////////////////////////////////////////////
+
+uint64_t phase_timer::get_total(void)
+{
+  if (!m_nr_phases) {
+    return 0;
+  }
+
+  const uint64_t end = ( m_running ?
+			 now() : m_phases[m_nr_phases - 1].end );
+
+  return end - m_phases[0].begin;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+uint64_t phase_timer::now(void)
+{
+  struct timespec t;
+
+  // Not affected by changes of the system time
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
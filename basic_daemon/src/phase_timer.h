@@ -0,0 +1,60 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __PHASE_TIMER_H__
+#define __PHASE_TIMER_H__
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define PHASE_TIMER_MAX_PHASES  12
+#define PHASE_TIMER_MAX_NAME    16 // Including terminator
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// Times consecutive phases using the monotonic clock,
+// no allocation. Phases beyond the max are not timed.
+
+class phase_timer {
+
+ public:
+  phase_timer(void);
+  ~phase_timer(void);
+
+  void reset(void);
+
+  void begin(const char *name); // Ends current phase, if any
+  void end(void);               // Ends current phase
+
+  unsigned get_nr_phases(void);
+  const char *get_name(unsigned index);
+  uint64_t get_duration(unsigned index); // Nanoseconds
+  uint64_t get_total(void);              // First begin to last end
+
+ private:
+  struct {
+    char     name[PHASE_TIMER_MAX_NAME];
+    uint64_t begin;
+    uint64_t end;
+  } m_phases[PHASE_TIMER_MAX_PHASES];
+
+  unsigned m_nr_phases;
+  bool     m_running; // Last phase not yet ended
+
+  static uint64_t now(void);
+};
+
+#endif // __PHASE_TIMER_H__
@@ -0,0 +1,595 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "prefork.h"
+#include "handoff.h"
+#include "listen_socket.h"
+#include "event_loop.h"
+#include "daemon_utility.h"
+#include "seqlock.h"
+#include "delay.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define PREFORK_MIN_BACKOFF    0.1  // Seconds before first start again
+#define PREFORK_MAX_BACKOFF   30.0  // Seconds, doubled up to this
+#define PREFORK_STABLE_TIME   10.0  // Seconds running, backoff is reset
+
+#define PREFORK_START_TIMEOUT      10.0 // Seconds to first heartbeat
+#define PREFORK_MISSED_HEARTBEATS  3    // Then considered hung
+
+#define PREFORK_STOP_POLL  0.01 // Seconds between checks when stopping
+
+#define PREFORK_HEALTH_SIZE  (sizeof(PREFORK_HEALTH) * PREFORK_MAX_CHILDREN)
+
+#define PREFORK_READ_RETRIES  100 // Then a health record is stale
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of types
+/////////////////////////////////////////////////////////////////////////////
+
+// Record in handoff file, given to a child
+typedef struct {
+  uint32_t instance;  // 1..
+  int32_t  health_fd; // All health records
+} PREFORK_HANDOFF;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Global variables
+/////////////////////////////////////////////////////////////////////////////
+
+// In a child process
+static unsigned        g_instance  = 0;
+static int             g_health_fd = -1;
+static PREFORK_HEALTH *g_health    = NULL; // Of this child only
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+prefork::prefork(void)
+{
+  m_nr_children  = 0;
+  m_pin_children = false;
+  m_exe_path     = NULL;
+  m_argv         = NULL;
+  m_stopping     = false;
+  m_timer_fd     = -1;
+  m_health_fd    = -1;
+  m_health       = NULL;
+
+  memset(m_children, 0, sizeof(m_children));
+}
+
+////////////////////////////////////////////////////////////////
+
+prefork::~prefork(void)
+{
+  close();
+}
+
+////////////////////////////////////////////////////////////////
+
+long prefork::open(unsigned nr_children,
+		   bool pin_children,
+		   const char *exe_path,
+		   char *const argv[])
+{
+  if ( (nr_children == 0) || (nr_children > PREFORK_MAX_CHILDREN) ) {
+    errno = EINVAL;
+    return PREFORK_FAILURE;
+  }
+
+  m_nr_children  = nr_children;
+  m_pin_children = pin_children;
+  m_exe_path     = exe_path;
+  m_argv         = argv;
+  m_stopping     = false;
+
+  // Health records, inherited by children
+  m_health_fd = memfd_create("prefork_health", MFD_CLOEXEC);
+  if ( (m_health_fd == -1) ||
+       (ftruncate(m_health_fd, PREFORK_HEALTH_SIZE) == -1) ) {
+    close();
+    return PREFORK_FAILURE;
+  }
+  void *addr = mmap(NULL, PREFORK_HEALTH_SIZE,
+		    PROT_READ | PROT_WRITE, MAP_SHARED, m_health_fd, 0);
+  if (addr == MAP_FAILED) {
+    close();
+    return PREFORK_FAILURE;
+  }
+  m_health = (PREFORK_HEALTH *)addr;
+
+  m_timer_fd = create_timer_fd();
+  if (m_timer_fd == -1) {
+    close();
+    return PREFORK_FAILURE;
+  }
+
+  // All children are due now
+  const uint64_t t = now();
+  memset(m_children, 0, sizeof(m_children));
+  for (unsigned i=0; i < m_nr_children; i++) {
+    m_children[i].next_start = t;
+    m_children[i].backoff    = PREFORK_MIN_BACKOFF;
+  }
+  assign_cpus();
+
+  return PREFORK_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void prefork::close(void)
+{
+  // Children are left as they are, see stop
+  if (m_health) {
+    munmap(m_health, PREFORK_HEALTH_SIZE);
+    m_health = NULL;
+  }
+  if (m_health_fd != -1) {
+    ::close(m_health_fd);
+    m_health_fd = -1;
+  }
+  if (m_timer_fd != -1) {
+    ::close(m_timer_fd);
+    m_timer_fd = -1;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+void prefork::start_due(void)
+{
+  uint64_t expirations;
+
+  read_timer_fd(m_timer_fd, &expirations); // Also called directly
+
+  const uint64_t t = now();
+  for (unsigned i=0; (i < m_nr_children) && (!m_stopping); i++) {
+    CHILD *child = &m_children[i];
+    if ( (!child->pid) && child->next_start && (child->next_start <= t) ) {
+      start_child(i);
+    }
+  }
+
+  schedule();
+}
+
+////////////////////////////////////////////////////////////////
+
+void prefork::reap(void)
+{
+  pid_t pid;
+  int status;
+
+  while ( (pid = waitpid(-1, &status, WNOHANG)) > 0 ) {
+    CHILD *child = NULL;
+    unsigned index;
+    for (index=0; index < m_nr_children; index++) {
+      if (m_children[index].pid == pid) {
+	child = &m_children[index];
+	break;
+      }
+    }
+    if (!child) {
+      continue;
+    }
+
+    child->pid = 0;
+    if (WIFSIGNALED(status)) {
+      syslog_error("Process %u (pid %d) killed by signal %d",
+		   index + 1, (int) pid, WTERMSIG(status));
+    }
+    else if (WEXITSTATUS(status) != EXIT_SUCCESS) {
+      syslog_error("Process %u (pid %d) exited, status:%d",
+		   index + 1, (int) pid, WEXITSTATUS(status));
+    }
+    else {
+      syslog_info("Process %u (pid %d) exited",
+		  index + 1, (int) pid);
+    }
+    if (m_stopping) {
+      continue;
+    }
+
+    // A child that keeps failing is started less often
+    const uint64_t t = now();
+    if ((t - child->started) / 1e9 >= PREFORK_STABLE_TIME) {
+      child->backoff = PREFORK_MIN_BACKOFF;
+    }
+    child->next_start = t + (uint64_t)(child->backoff * 1e9);
+    syslog_info("Process %u is started again in %.1f s",
+		index + 1, child->backoff);
+    child->backoff *= 2.0;
+    if (child->backoff > PREFORK_MAX_BACKOFF) {
+      child->backoff = PREFORK_MAX_BACKOFF;
+    }
+    child->restarts++;
+  }
+
+  schedule();
+}
+
+////////////////////////////////////////////////////////////////
+
+void prefork::check_health(void)
+{
+  PREFORK_HEALTH health;
+
+  const uint64_t t = now();
+  for (unsigned i=0; i < m_nr_children; i++) {
+    const CHILD *child = &m_children[i];
+    if (!child->pid) {
+      continue;
+    }
+
+    read_health(i, &health);
+
+    // A record left by a previous child is not yet replaced
+    double age;
+    double limit;
+    if (health.pid != child->pid) {
+      age   = (t - child->started) / 1e9;
+      limit = PREFORK_START_TIMEOUT;
+    }
+    else {
+      age   = (t - health.heartbeat_time) / 1e9;
+      limit = PREFORK_MISSED_HEARTBEATS * health.heartbeat_period / 1e9;
+    }
+
+    if (age > limit) {
+      syslog_error("Process %u (pid %d) not responding for %.1f s, killed",
+		   i + 1, (int) child->pid, age);
+      kill(child->pid, SIGKILL); // Reaped and started again
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+void prefork::signal_all(int sig)
+{
+  for (unsigned i=0; i < m_nr_children; i++) {
+    if (m_children[i].pid) {
+      kill(m_children[i].pid, sig);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+void prefork::stop(double timeout)
+{
+  // No more starts
+  m_stopping = true;
+  if (m_timer_fd != -1) {
+    clear_timer_fd(m_timer_fd);
+  }
+
+  signal_all(SIGTERM);
+  for (double waited=0.0; get_nr_running() && (waited < timeout);
+       waited += PREFORK_STOP_POLL) {
+    delay(PREFORK_STOP_POLL);
+    reap();
+  }
+
+  if (get_nr_running()) {
+    syslog_error("Processes not terminated within %.1f s, killed", timeout);
+    signal_all(SIGKILL);
+    while (get_nr_running()) {
+      delay(PREFORK_STOP_POLL);
+      reap();
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+unsigned prefork::get_nr_running(void)
+{
+  unsigned nr_running = 0;
+
+  for (unsigned i=0; i < m_nr_children; i++) {
+    if (m_children[i].pid) {
+      nr_running++;
+    }
+  }
+
+  return nr_running;
+}
+
+////////////////////////////////////////////////////////////////
+
+void prefork::get_child_stats(unsigned index, PREFORK_CHILD_STATS *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  if (index >= m_nr_children) {
+    return;
+  }
+
+  const CHILD *child = &m_children[index];
+  stats->pid      = child->pid;
+  stats->restarts = child->restarts;
+  stats->uptime   = ( child->pid ? (now() - child->started) / 1e9 : 0.0 );
+  stats->backoff  = child->backoff;
+
+  read_health(index, &stats->health);
+  if (stats->health.pid != child->pid) {
+    memset(&stats->health, 0, sizeof(stats->health));
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+void prefork::assign_cpus(void)
+{
+  cpu_set_t allowed;
+  int cpus[CPU_SETSIZE];
+  unsigned nr_cpus = 0;
+
+  // Children share the CPUs this process may use
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    for (int cpu=0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed)) {
+	cpus[nr_cpus++] = cpu;
+      }
+    }
+  }
+  if (!nr_cpus) {
+    m_pin_children = false;
+    return;
+  }
+
+  // Consecutive CPUs to each child, or several children per CPU
+  for (unsigned i=0; i < m_nr_children; i++) {
+    cpu_set_t *set = &m_children[i].cpus;
+    CPU_ZERO(set);
+    if (nr_cpus >= m_nr_children) {
+      const unsigned first = i * nr_cpus / m_nr_children;
+      const unsigned last  = (i + 1) * nr_cpus / m_nr_children;
+      for (unsigned c=first; c < last; c++) {
+	CPU_SET(cpus[c], set);
+      }
+    }
+    else {
+      CPU_SET(cpus[i % nr_cpus], set);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+void prefork::start_child(unsigned index)
+{
+  CHILD *child = &m_children[index];
+  PREFORK_HANDOFF record;
+
+  child->next_start = 0;
+
+  const pid_t parent = getpid();
+  const pid_t pid = fork();
+  if (pid == -1) {
+    syslog_error("Can't start process %u, code=%d (%s)",
+		 index + 1, errno, strerror(errno));
+    child->next_start = now() + (uint64_t)(child->backoff * 1e9);
+    return;
+  }
+
+  if (pid) {
+    child->pid     = pid;
+    child->started = now();
+    syslog_info("Started process %u, pid %d", index + 1, (int) pid);
+    return;
+  }
+
+  // Note!!
+  // The child, until executed again. The parent is single threaded,
+  // so its state is consistent here. Nothing is logged.
+
+  // Terminated with the parent, even if the parent is killed
+  if ( (prctl(PR_SET_PDEATHSIG, SIGTERM) == -1) ||
+       (getppid() != parent) ) {
+    _exit(EXIT_FAILURE);
+  }
+
+  // Only the parent talks to the service manager
+  unsetenv("NOTIFY_SOCKET");
+
+  if (m_pin_children) {
+    sched_setaffinity(0, sizeof(child->cpus), &child->cpus);
+  }
+
+  record.instance  = index + 1;
+  record.health_fd = m_health_fd;
+
+  const int handoff_fd = handoff_create();
+  if ( (handoff_fd != -1) &&
+       (handoff_keep_fd(m_health_fd) == HANDOFF_SUCCESS) &&
+       (handoff_put(handoff_fd, HANDOFF_TAG_PREFORK,
+		    &record, sizeof(record)) == HANDOFF_SUCCESS) &&
+       (save_listen_sockets(handoff_fd) == LISTEN_SOCKET_SUCCESS) ) {
+    handoff_exec(handoff_fd, m_exe_path, m_argv);
+  }
+
+  _exit(EXIT_FAILURE);
+}
+
+////////////////////////////////////////////////////////////////
+
+void prefork::schedule(void)
+{
+  uint64_t next = 0;
+
+  for (unsigned i=0; i < m_nr_children; i++) {
+    const CHILD *child = &m_children[i];
+    if ( (!child->pid) && child->next_start &&
+	 ( (!next) || (child->next_start < next) ) ) {
+      next = child->next_start;
+    }
+  }
+
+  if ( (!next) || m_stopping ) {
+    clear_timer_fd(m_timer_fd);
+    return;
+  }
+
+  const uint64_t t = now();
+  set_timer_fd(m_timer_fd, (next > t) ? (next - t) / 1e9 : 0.0, 0.0);
+}
+
+////////////////////////////////////////////////////////////////
+
+uint64_t prefork::now(void)
+{
+  struct timespec t;
+
+  // Same clock in all processes
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////
+
+bool prefork::read_health(unsigned index, PREFORK_HEALTH *health)
+{
+  uint32_t seq;
+
+  // A child killed while writing leaves the record odd until it is
+  // started again, so never wait for it. A record that is not stable
+  // is zero, i.e. stale.
+  for (unsigned i=0; i < PREFORK_READ_RETRIES; i++) {
+    if (seqlock_try_read_begin(&m_health[index].seq, &seq)) {
+      memcpy(health, &m_health[index], sizeof(*health));
+      if (!seqlock_read_retry(&m_health[index].seq, seq)) {
+	return true;
+      }
+    }
+    sched_yield();
+  }
+  memset(health, 0, sizeof(*health));
+
+  return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of exported functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+unsigned prefork_child_inherit(int handoff_fd)
+{
+  PREFORK_HANDOFF record;
+
+  if ( (handoff_get(handoff_fd, HANDOFF_TAG_PREFORK,
+		    &record, sizeof(record)) != HANDOFF_SUCCESS) ||
+       (record.instance == 0) ||
+       (record.instance > PREFORK_MAX_CHILDREN) ) {
+    return 0;
+  }
+
+  g_instance  = record.instance;
+  g_health_fd = record.health_fd;
+  if (fcntl(g_health_fd, F_SETFD, FD_CLOEXEC) == -1) {
+    g_health_fd = -1;
+    return g_instance; // Not reporting, restarted by the parent
+  }
+
+  void *addr = mmap(NULL, PREFORK_HEALTH_SIZE,
+		    PROT_READ | PROT_WRITE, MAP_SHARED, g_health_fd, 0);
+  if (addr != MAP_FAILED) {
+    g_health = (PREFORK_HEALTH *)addr + (g_instance - 1);
+  }
+
+  return g_instance;
+}
+
+////////////////////////////////////////////////////////////////
+
+long prefork_child_save(int handoff_fd)
+{
+  PREFORK_HANDOFF record;
+
+  if (!g_instance) {
+    return PREFORK_SUCCESS; // Not a child
+  }
+
+  record.instance  = g_instance;
+  record.health_fd = g_health_fd;
+  if ( ( (g_health_fd != -1) &&
+	 (handoff_keep_fd(g_health_fd) != HANDOFF_SUCCESS) ) ||
+       (handoff_put(handoff_fd, HANDOFF_TAG_PREFORK,
+		    &record, sizeof(record)) != HANDOFF_SUCCESS) ) {
+    return PREFORK_FAILURE;
+  }
+
+  return PREFORK_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void prefork_child_heartbeat(double period,
+			     uint64_t cycles,
+			     uint64_t overruns,
+			     uint64_t errors)
+{
+  struct timespec t;
+
+  if (!g_health) {
+    return;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  // A previous child may have been killed while writing,
+  // leaving the sequence number odd. Its record is not trusted
+  // anyway, since the parent checks the pid.
+  const bool take_over = (g_health->pid != getpid());
+  if (take_over) {
+    __atomic_store_n(&g_health->seq, g_health->seq & ~1U, __ATOMIC_RELAXED);
+  }
+
+  // Parent only trusts a record with the pid of the child
+  seqlock_write_begin(&g_health->seq);
+  if (take_over) {
+    g_health->pid        = getpid();
+    g_health->heartbeats = 0;
+  }
+  g_health->heartbeats++;
+  g_health->heartbeat_time   = (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+  g_health->heartbeat_period = (uint64_t)(period * 1e9);
+  g_health->cycles           = cycles;
+  g_health->overruns         = overruns;
+  g_health->errors           = errors;
+  seqlock_write_end(&g_health->seq);
+}
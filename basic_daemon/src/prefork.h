@@ -0,0 +1,136 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __PREFORK_H__
+#define __PREFORK_H__
+
+#include <sys/types.h>
+#include <sched.h>
+#include <stdint.h>
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define PREFORK_SUCCESS   0
+#define PREFORK_FAILURE  -1
+
+#define PREFORK_MAX_CHILDREN  16
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of types
+/////////////////////////////////////////////////////////////////////////////
+
+// Health of a child process, in memory shared with the parent.
+// Only written by the child, guarded by a sequence lock (see seqlock.h).
+typedef struct {
+  uint32_t seq;
+  int32_t  pid;              // Child that wrote the record
+  uint64_t heartbeats;       // Nof passed status checks
+  uint64_t heartbeat_time;   // Monotonic clock (ns) at last check
+  uint64_t heartbeat_period; // Nanoseconds between checks
+  uint64_t cycles;           // Worker thread
+  uint64_t overruns;
+  uint64_t errors;           // Nof reported errors
+} __attribute__((aligned(64))) PREFORK_HEALTH;
+
+// A child process, as seen by the parent
+typedef struct {
+  pid_t          pid;       // 0 when not running
+  unsigned       restarts;
+  double         uptime;    // Seconds, of running process
+  double         backoff;   // Seconds before a start after an exit
+  PREFORK_HEALTH health;    // Zero until first reported
+} PREFORK_CHILD_STATS;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// Supervising parent of several daemon processes. Each child is
+// forked, pinned to its share of the allowed CPUs and executes this
+// binary again. A child is told its instance (1..) and gets the lent
+// listening sockets in a handoff file (see handoff.h, listen_socket.h).
+// A child that exits is started again after a backoff, doubled for
+// each exit shortly after start. A child that stops reporting its
+// health is killed, and then started again.
+
+class prefork {
+
+ public:
+  prefork(void);
+  ~prefork(void);
+
+  long open(unsigned nr_children,
+	    bool pin_children,
+	    const char *exe_path,
+	    char *const argv[]);
+  void close(void);
+
+  int get_fd(void) {return m_timer_fd;} // Readable when a start is due
+
+  void start_due(void);       // Starts children, on readable fd
+  void reap(void);            // Collects exited children, on SIGCHLD
+  void check_health(void);    // Kills children not reporting
+  void signal_all(int sig);   // Forwards signal to running children
+  void stop(double timeout);  // SIGTERM, then SIGKILL after timeout
+
+  unsigned get_nr_children(void) {return m_nr_children;}
+  unsigned get_nr_running(void);
+  void get_child_stats(unsigned index, PREFORK_CHILD_STATS *stats);
+
+ private:
+  typedef struct {
+    pid_t     pid;
+    unsigned  restarts;
+    uint64_t  started;    // Monotonic clock (ns)
+    uint64_t  next_start; // Monotonic clock (ns), 0 if none pending
+    double    backoff;
+    cpu_set_t cpus;
+  } CHILD;
+
+  unsigned        m_nr_children;
+  bool            m_pin_children;
+  const char     *m_exe_path;
+  char *const    *m_argv;
+  CHILD           m_children[PREFORK_MAX_CHILDREN];
+  bool            m_stopping;
+
+  int             m_timer_fd;  // Next due start
+  int             m_health_fd; // Shared with children
+  PREFORK_HEALTH *m_health;
+
+  void assign_cpus(void);
+  void start_child(unsigned index);
+  void schedule(void);
+  bool read_health(unsigned index, PREFORK_HEALTH *health);
+  static uint64_t now(void);
+};
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of exported functions
+/////////////////////////////////////////////////////////////////////////////
+
+// In a child process: the instance (1..) from the handoff file,
+// 0 if not started by a prefork parent. Health is then reported.
+extern unsigned prefork_child_inherit(int handoff_fd);
+
+// In a child process: passes the instance on to a new image
+extern long prefork_child_save(int handoff_fd);
+
+// In a child process: reports health to the parent
+extern void prefork_child_heartbeat(double period,
+				    uint64_t cycles,
+				    uint64_t overruns,
+				    uint64_t errors);
+
+#endif // __PREFORK_H__
@@ -0,0 +1,398 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+
+#include "profiled_mutex.h"
+#include "metrics_registry.h"
+#include "delay.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Tells the CPU that this is a spin loop
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX()  __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX()  __asm__ __volatile__ ("yield" : : : "memory")
+#else
+#define CPU_RELAX()  __asm__ __volatile__ ("" : : : "memory")
+#endif
+
+#define NR_BOUNDS  12
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of types
+/////////////////////////////////////////////////////////////////////////////
+
+// Metrics of a name, shared by all mutexes with the name
+typedef struct {
+  char name[PROFILED_MUTEX_NAME_LEN];
+  int  acquisitions_id;
+  int  contentions_id;
+  int  wait_id;
+  int  hold_id;
+} LOCK_NAME;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Module global variables
+/////////////////////////////////////////////////////////////////////////////
+
+// Wait and hold time, nanoseconds
+static const uint64_t g_bounds[NR_BOUNDS] = {250,
+					     1000,
+					     4000,
+					     16000,
+					     64000,
+					     256000,
+					     1000000,
+					     4000000,
+					     16000000,
+					     64000000,
+					     256000000,
+					     1000000000};
+
+static pthread_mutex_t g_names_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LOCK_NAME       g_names[PROFILED_MUTEX_MAX_LOCKS];
+static unsigned        g_nr_names = 0;
+
+// Read by every lock, relaxed
+static int g_profiling = 0;
+static int g_adaptive  = 0;
+
+// Time profiled, guarded by names mutex
+static uint64_t g_profiled_ns    = 0; // Earlier periods
+static uint64_t g_profiled_since = 0; // Current period, zero if none
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+static uint64_t now_ns(void)
+{
+  struct timespec now;
+
+  if (clock_gettime(get_clock_id(), &now)) {
+    return 0;
+  }
+
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void report_printf(char *buffer, unsigned size, unsigned *len,
+			  const char *format, ...)
+{
+  if (*len >= size) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  const int n = vsnprintf(buffer + *len, size - *len, format, args);
+  va_end(args);
+
+  if (n > 0) {
+    *len = ( ((unsigned)n < size - *len) ? *len + n : size - 1 );
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+profiled_mutex::profiled_mutex(const char *name)
+{
+  pthread_mutex_init(&m_mutex, NULL); // Use default mutex attributes
+  m_locked_at = 0;
+  m_spins     = 0;
+  m_lock      = -1;
+
+  pthread_mutex_lock(&g_names_mutex);
+
+  for (unsigned i=0; i < g_nr_names; i++) {
+    if (!strcmp(g_names[i].name, name)) {
+      m_lock = i;
+    }
+  }
+
+  // New name, unmeasured if no room
+  if ( (m_lock == -1) && (g_nr_names < PROFILED_MUTEX_MAX_LOCKS) ) {
+    char labels[METRICS_REGISTRY_LABELS_LEN];
+    snprintf(labels, sizeof(labels), "lock=\"%s\"", name);
+
+    metrics_registry *metrics = metrics_registry::instance();
+    LOCK_NAME *lock = &g_names[g_nr_names];
+    strncpy(lock->name, name, sizeof(lock->name) - 1);
+    lock->name[sizeof(lock->name) - 1] = '\0';
+    lock->acquisitions_id =
+      metrics->add_counter("lock_acquisitions_total", labels, 1.0);
+    lock->contentions_id =
+      metrics->add_counter("lock_contentions_total", labels, 1.0);
+    lock->wait_id =
+      metrics->add_histogram("lock_wait_seconds", labels, 1e-9,
+			     g_bounds, NR_BOUNDS);
+    lock->hold_id =
+      metrics->add_histogram("lock_hold_seconds", labels, 1e-9,
+			     g_bounds, NR_BOUNDS);
+    m_lock = g_nr_names++;
+  }
+
+  pthread_mutex_unlock(&g_names_mutex);
+}
+
+////////////////////////////////////////////////////////////////
+
+profiled_mutex::~profiled_mutex(void)
+{
+  pthread_mutex_destroy(&m_mutex);
+}
+
+////////////////////////////////////////////////////////////////
+
+int profiled_mutex::lock(void)
+{
+  const bool profiling =
+    ( (m_lock != -1) && __atomic_load_n(&g_profiling, __ATOMIC_RELAXED) );
+  const bool adaptive = __atomic_load_n(&g_adaptive, __ATOMIC_RELAXED);
+  int rc;
+
+  // Plain mutex
+  if ( (!profiling) && (!adaptive) ) {
+    rc = pthread_mutex_lock(&m_mutex);
+    if (!rc) {
+      m_locked_at = 0;
+    }
+    return rc;
+  }
+
+  uint64_t wait_begin = 0;
+  bool contended = false;
+
+  rc = pthread_mutex_trylock(&m_mutex);
+  if (rc == EBUSY) {
+    contended = true;
+    if (profiling) {
+      wait_begin = now_ns();
+    }
+    rc = ( adaptive ? lock_adaptive() : pthread_mutex_lock(&m_mutex) );
+  }
+  if (rc) {
+    return rc;
+  }
+
+  if (!profiling) {
+    m_locked_at = 0;
+    return 0;
+  }
+
+  // Metrics are updated under the lock, included in held time
+  // but not in wait time
+  const LOCK_NAME *lock = &g_names[m_lock];
+  metrics_registry *metrics = metrics_registry::instance();
+  m_locked_at = now_ns();
+  metrics->inc(lock->acquisitions_id);
+  if (contended) {
+    metrics->inc(lock->contentions_id);
+    metrics->observe(lock->wait_id, m_locked_at - wait_begin);
+  }
+
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////
+
+int profiled_mutex::unlock(void)
+{
+  // Ends hold before another thread may lock
+  const uint64_t locked_at = m_locked_at;
+  const uint64_t unlocked_at = ( locked_at ? now_ns() : 0 );
+
+  const int rc = pthread_mutex_unlock(&m_mutex);
+  if ( (!rc) && locked_at ) {
+    metrics_registry::instance()->observe(g_names[m_lock].hold_id,
+					  unlocked_at - locked_at);
+  }
+
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////
+
+int profiled_mutex::wait(pthread_cond_t *cond,
+			 const struct timespec *abstime)
+{
+  // Mutex is released while waiting, two holds
+  const uint64_t locked_at = m_locked_at;
+  if (locked_at) {
+    metrics_registry::instance()->observe(g_names[m_lock].hold_id,
+					  now_ns() - locked_at);
+  }
+
+  const int rc = ( abstime ?
+		   pthread_cond_timedwait(cond, &m_mutex, abstime) :
+		   pthread_cond_wait(cond, &m_mutex) );
+
+  // Locked again, also on timeout
+  m_locked_at = ( locked_at ? now_ns() : 0 );
+
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////
+
+void profiled_mutex::set_profiling(bool enabled)
+{
+  pthread_mutex_lock(&g_names_mutex);
+
+  if ( enabled && (!g_profiled_since) ) {
+    g_profiled_since = now_ns();
+  }
+  else if ( (!enabled) && g_profiled_since ) {
+    g_profiled_ns += now_ns() - g_profiled_since;
+    g_profiled_since = 0;
+  }
+  __atomic_store_n(&g_profiling, (int) enabled, __ATOMIC_RELAXED);
+
+  pthread_mutex_unlock(&g_names_mutex);
+}
+
+////////////////////////////////////////////////////////////////
+
+void profiled_mutex::set_adaptive(bool enabled)
+{
+  __atomic_store_n(&g_adaptive, (int) enabled, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////
+
+unsigned profiled_mutex::report(char *buffer, unsigned size)
+{
+  metrics_registry *metrics = metrics_registry::instance();
+  METRICS_SNAPSHOT wait;
+  METRICS_SNAPSHOT hold;
+  uint64_t acquisitions[PROFILED_MUTEX_MAX_LOCKS];
+  uint64_t contentions[PROFILED_MUTEX_MAX_LOCKS];
+  uint64_t wait_ns[PROFILED_MUTEX_MAX_LOCKS];
+  uint64_t hold_ns[PROFILED_MUTEX_MAX_LOCKS];
+  unsigned order[PROFILED_MUTEX_MAX_LOCKS];
+  unsigned len = 0;
+
+  if (!size) {
+    return 0;
+  }
+  buffer[0] = '\0';
+
+  pthread_mutex_lock(&g_names_mutex);
+
+  const unsigned nr_names = g_nr_names;
+  const uint64_t profiled_ns =
+    g_profiled_ns + ( g_profiled_since ? now_ns() - g_profiled_since : 0 );
+
+  for (unsigned i=0; i < nr_names; i++) {
+    const LOCK_NAME *lock = &g_names[i];
+    acquisitions[i] = metrics->read(lock->acquisitions_id);
+    contentions[i]  = metrics->read(lock->contentions_id);
+    wait_ns[i] = ( (metrics->snapshot(lock->wait_id, &wait) ==
+		    METRICS_REGISTRY_SUCCESS) ? wait.sum : 0 );
+    hold_ns[i] = ( (metrics->snapshot(lock->hold_id, &hold) ==
+		    METRICS_REGISTRY_SUCCESS) ? hold.sum : 0 );
+  }
+
+  // Most waited for first. As threads are added, waiting grows
+  // fastest for the lock held the largest part of the time.
+  for (unsigned i=0; i < nr_names; i++) {
+    unsigned j = i;
+    for (; (j > 0) && (wait_ns[order[j - 1]] < wait_ns[i]); j--) {
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+  }
+
+  report_printf(buffer, size, &len,
+		"%-15s %12s %10s %12s %12s %12s %7s\n",
+		"lock", "acquisitions", "contended", "wait_ms",
+		"wait_avg_us", "hold_avg_us", "held_%");
+  for (unsigned i=0; i < nr_names; i++) {
+    const unsigned k = order[i];
+    report_printf(buffer, size, &len,
+		  "%-15s %12llu %9.1f%% %12.3f %12.2f %12.2f %7.1f\n",
+		  g_names[k].name,
+		  (unsigned long long) acquisitions[k],
+		  ( acquisitions[k] ?
+		    100.0 * contentions[k] / acquisitions[k] : 0.0 ),
+		  wait_ns[k] / 1e6,
+		  ( contentions[k] ? wait_ns[k] / 1e3 / contentions[k] : 0.0 ),
+		  ( acquisitions[k] ? hold_ns[k] / 1e3 / acquisitions[k] : 0.0 ),
+		  ( profiled_ns ? 100.0 * hold_ns[k] / profiled_ns : 0.0 ));
+  }
+
+  if (!profiled_ns) {
+    report_printf(buffer, size, &len, "Not profiled\n");
+  }
+  else if ( (!nr_names) || (!wait_ns[order[0]]) ) {
+    report_printf(buffer, size, &len,
+		  "No contention in %.3f s profiled\n", profiled_ns / 1e9);
+  }
+  else {
+    report_printf(buffer, size, &len,
+		  "Limiting: %s, %.3f ms waited in %.3f s profiled\n",
+		  g_names[order[0]].name,
+		  wait_ns[order[0]] / 1e6, profiled_ns / 1e9);
+  }
+
+  pthread_mutex_unlock(&g_names_mutex);
+
+  return len;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+int profiled_mutex::lock_adaptive(void)
+{
+  // Retries up to twice the recent need, then blocks. The estimate
+  // is only updated by the owner, under the mutex.
+  const unsigned recent = __atomic_load_n(&m_spins, __ATOMIC_RELAXED);
+  const unsigned max_spins = ( (2 * recent + 10 < PROFILED_MUTEX_MAX_SPINS) ?
+			       2 * recent + 10 : PROFILED_MUTEX_MAX_SPINS );
+  unsigned spins = 0;
+  int rc;
+
+  do {
+    if (spins++ >= max_spins) {
+      rc = pthread_mutex_lock(&m_mutex);
+      break;
+    }
+    CPU_RELAX();
+    rc = pthread_mutex_trylock(&m_mutex);
+  } while (rc == EBUSY);
+
+  if (!rc) {
+    const int change = ((int)spins - (int)recent) / 8;
+    __atomic_store_n(&m_spins, (unsigned)((int)recent + change),
+		     __ATOMIC_RELAXED);
+  }
+
+  return rc;
+}
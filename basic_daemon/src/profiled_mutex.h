@@ -0,0 +1,85 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __PROFILED_MUTEX_H__
+#define __PROFILED_MUTEX_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define PROFILED_MUTEX_SUCCESS   0
+#define PROFILED_MUTEX_FAILURE  -1
+
+#define PROFILED_MUTEX_MAX_LOCKS  16  // Names, mutexes may share a name
+#define PROFILED_MUTEX_NAME_LEN   16
+#define PROFILED_MUTEX_MAX_SPINS  100 // Adaptive, attempts before blocking
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// A mutex that measures how it is used, per name, in the metrics
+// registry (label lock="name"):
+//
+//   lock_acquisitions_total  All acquisitions
+//   lock_contentions_total   Acquisitions that found the mutex locked
+//   lock_wait_seconds        Histogram, wait of contended acquisitions
+//   lock_hold_seconds        Histogram, from acquired until unlocked
+//
+// Nothing is measured until profiling is enabled, then an acquisition
+// costs a trylock and two clock readings more than a plain mutex.
+//
+// A contended acquisition normally blocks at once (futex). Adaptive
+// locking first retries for a while, as PTHREAD_MUTEX_ADAPTIVE_NP.
+// The nof retries follows the retries that were needed recently.
+// Spinning pays off when the mutex is held for a short time by a
+// thread running on another CPU.
+
+class profiled_mutex {
+
+ public:
+  profiled_mutex(const char *name);
+  ~profiled_mutex(void);
+
+  // Return codes as pthread_mutex_lock and pthread_mutex_unlock
+  int lock(void);
+  int unlock(void);
+
+  // As pthread_cond_wait, or pthread_cond_timedwait with abstime.
+  // Mutex locked by caller. Time waiting is not held time.
+  int wait(pthread_cond_t *cond, const struct timespec *abstime = NULL);
+
+  // Process wide, applied at next lock
+  static void set_profiling(bool enabled);
+  static void set_adaptive(bool enabled);
+
+  // Text report, one line per name, the lock that limits scaling
+  // first. Returns length of report, truncated to fit size.
+  static unsigned report(char *buffer, unsigned size);
+
+ private:
+  pthread_mutex_t m_mutex;
+  int             m_lock;      // Name index, -1 if not measured
+  uint64_t        m_locked_at; // Owner only, zero if not profiled
+  unsigned        m_spins;     // Estimate for adaptive locking
+
+  int lock_adaptive(void); // Contended, spin then block
+};
+
+#endif // __PROFILED_MUTEX_H__
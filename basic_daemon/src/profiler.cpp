@@ -0,0 +1,452 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/syscall.h>
+#include <execinfo.h>
+#include <ucontext.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <cxxabi.h>
+#include <string>
+#include <map>
+
+#include "profiler.h"
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define PROFILER_SIGNAL    SIGPROF
+#define PROFILER_NAME_LEN  16
+
+// Older C libraries lack the name of the field
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id  _sigev_un._tid
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of types
+/////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  bool      used;
+  pthread_t thread;
+  pid_t     tid;
+  uintptr_t stack_low;  // Frame pointers are within the stack
+  uintptr_t stack_high;
+  char      name[PROFILER_NAME_LEN];
+  bool      armed;      // Timer created
+  timer_t   timer;
+} PROFILER_THREAD;
+
+typedef struct {
+  int       ready;      // Written completely, accessed atomically
+  unsigned  nr_frames;
+  uintptr_t frames[PROFILER_MAX_FRAMES]; // Leaf first
+  char      thread[PROFILER_NAME_LEN];
+} PROFILER_SAMPLE;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Global variables
+/////////////////////////////////////////////////////////////////////////////
+
+// Attach, detach, start and stop
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PROFILER_THREAD g_threads[PROFILER_MAX_THREADS];
+static double          g_frequency = 0.0; // Zero when stopped
+static bool            g_handler_installed = false;
+
+// Written by the signal handler, accessed atomically
+static int              g_running = 0;
+static unsigned         g_nr_samples = 0; // Claimed, may exceed buffer
+static unsigned         g_nr_dropped = 0;
+static PROFILER_SAMPLE *g_samples = NULL; // Allocated at first start, kept
+
+static __thread PROFILER_THREAD *t_thread = NULL;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+static unsigned unwind(const ucontext_t *context,
+		       const PROFILER_THREAD *thread,
+		       uintptr_t *frames)
+{
+  uintptr_t pc;
+  uintptr_t fp;
+
+#if defined(__x86_64__)
+  pc = context->uc_mcontext.gregs[REG_RIP];
+  fp = context->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+  pc = context->uc_mcontext.pc;
+  fp = context->uc_mcontext.regs[29];
+#else
+  return 0; // No unwinder
+#endif
+
+  unsigned nr_frames = 0;
+  frames[nr_frames++] = pc;
+
+  // Each frame holds the frame pointer and return address of the caller.
+  // Only frames within the stack are followed, and only towards the
+  // root, so a function without frame pointer ends the stack.
+  while ( (nr_frames < PROFILER_MAX_FRAMES) &&
+	  (fp >= thread->stack_low) &&
+	  (fp + 2 * sizeof(uintptr_t) <= thread->stack_high) &&
+	  ((fp & (sizeof(uintptr_t) - 1)) == 0) ) {
+    const uintptr_t *frame = (const uintptr_t *)fp;
+    if (!frame[1]) {
+      break;
+    }
+    frames[nr_frames++] = frame[1];
+    if (frame[0] <= fp) {
+      break;
+    }
+    fp = frame[0];
+  }
+
+  return nr_frames;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void on_signal(int sig, siginfo_t *info, void *context)
+{
+  const int saved_errno = errno;
+
+  // A signal arriving after stop is ignored
+  const PROFILER_THREAD *thread = t_thread;
+  if ( thread &&
+       __atomic_load_n(&g_running, __ATOMIC_ACQUIRE) ) {
+    const unsigned index =
+      __atomic_fetch_add(&g_nr_samples, 1, __ATOMIC_RELAXED);
+    if (index < PROFILER_MAX_SAMPLES) {
+      PROFILER_SAMPLE *sample = &g_samples[index];
+      sample->nr_frames = unwind((const ucontext_t *)context, thread,
+				 sample->frames);
+      memcpy(sample->thread, thread->name, sizeof(sample->thread));
+      __atomic_store_n(&sample->ready, 1, __ATOMIC_RELEASE);
+    }
+    else {
+      __atomic_fetch_add(&g_nr_dropped, 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  errno = saved_errno;
+}
+
+////////////////////////////////////////////////////////////////
+
+static long arm_thread(PROFILER_THREAD *thread)
+{
+  struct sigevent event;
+  struct itimerspec spec;
+  clockid_t clock_id;
+
+  // Timer on the CPU time of the thread, signal to the thread itself
+  if (pthread_getcpuclockid(thread->thread, &clock_id) != 0) {
+    return PROFILER_FAILURE;
+  }
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo  = PROFILER_SIGNAL;
+  event.sigev_notify_thread_id = thread->tid;
+  if (timer_create(clock_id, &event, &thread->timer) == -1) {
+    return PROFILER_FAILURE;
+  }
+
+  const long period_ns = (long)(1000000000.0 / g_frequency);
+  spec.it_interval.tv_sec  = period_ns / 1000000000L;
+  spec.it_interval.tv_nsec = period_ns % 1000000000L;
+  spec.it_value            = spec.it_interval;
+  if (timer_settime(thread->timer, 0, &spec, NULL) == -1) {
+    timer_delete(thread->timer);
+    return PROFILER_FAILURE;
+  }
+  thread->armed = true;
+
+  return PROFILER_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void disarm_thread(PROFILER_THREAD *thread)
+{
+  if (thread->armed) {
+    timer_delete(thread->timer);
+    thread->armed = false;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+static string frame_name(char *symbol)
+{
+  // Format is "binary(function+0x12) [0x4005d2]",
+  // or "binary(+0x12) [0x4005d2]" without a dynamic symbol
+  char *open  = strchr(symbol, '(');
+  char *plus  = (open ? strchr(open, '+') : NULL);
+  char *close = (plus ? strchr(plus, ')') : NULL);
+  if (!close) {
+    return symbol;
+  }
+  *open  = '\0';
+  *plus  = '\0';
+  *close = '\0';
+
+  if (open + 1 == plus) {
+    const char *binary = strrchr(symbol, '/');
+    return string(binary ? binary + 1 : symbol) + "+" + (plus + 1);
+  }
+
+  int status;
+  char *demangled = abi::__cxa_demangle(open + 1, NULL, NULL, &status);
+  if (!demangled) {
+    return open + 1; // C function
+  }
+  const string name = demangled;
+  free(demangled);
+
+  return name;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+long profiler_thread_attach(const char *name)
+{
+  pthread_attr_t attr;
+  void *stack;
+  size_t stack_size;
+
+  pthread_mutex_lock(&g_mutex);
+
+  PROFILER_THREAD *thread = t_thread;
+  for (unsigned i=0; (!thread) && (i < PROFILER_MAX_THREADS); i++) {
+    if (!g_threads[i].used) {
+      thread = &g_threads[i];
+    }
+  }
+  if ( (!thread) ||
+       (pthread_getattr_np(pthread_self(), &attr) != 0) ) {
+    pthread_mutex_unlock(&g_mutex);
+    return PROFILER_FAILURE;
+  }
+  pthread_attr_getstack(&attr, &stack, &stack_size);
+  pthread_attr_destroy(&attr);
+
+  disarm_thread(thread);
+  thread->used       = true;
+  thread->thread     = pthread_self();
+  thread->tid        = syscall(SYS_gettid);
+  thread->stack_low  = (uintptr_t)stack;
+  thread->stack_high = (uintptr_t)stack + stack_size;
+  strncpy(thread->name, name, sizeof(thread->name) - 1);
+  thread->name[sizeof(thread->name) - 1] = '\0';
+  t_thread = thread;
+
+  // Joins a running profiler
+  if (g_frequency > 0.0) {
+    arm_thread(thread);
+  }
+
+  pthread_mutex_unlock(&g_mutex);
+
+  return PROFILER_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void profiler_thread_detach(void)
+{
+  pthread_mutex_lock(&g_mutex);
+
+  // No more signals to this thread
+  if (t_thread) {
+    disarm_thread(t_thread);
+    t_thread->used = false;
+    t_thread = NULL;
+  }
+
+  pthread_mutex_unlock(&g_mutex);
+}
+
+////////////////////////////////////////////////////////////////
+
+long profiler_start(double frequency)
+{
+  struct sigaction action;
+
+  if ( (frequency <= 0.0) || (frequency > PROFILER_MAX_FREQUENCY) ) {
+    errno = EINVAL;
+    return PROFILER_FAILURE;
+  }
+
+  pthread_mutex_lock(&g_mutex);
+
+  if (g_frequency > 0.0) {
+    pthread_mutex_unlock(&g_mutex);
+    return PROFILER_SUCCESS; // Already running
+  }
+
+  if (!g_samples) {
+    g_samples = (PROFILER_SAMPLE *)calloc(PROFILER_MAX_SAMPLES,
+					  sizeof(PROFILER_SAMPLE));
+  }
+  if (!g_handler_installed) {
+    // The first backtrace loads the unwinder, done here
+    // since it allocates (symbols are looked up by dump)
+    void *frame;
+    backtrace(&frame, 1);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_signal;
+    action.sa_flags     = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    g_handler_installed =
+      (sigaction(PROFILER_SIGNAL, &action, NULL) == 0);
+  }
+  if ( (!g_samples) || (!g_handler_installed) ) {
+    pthread_mutex_unlock(&g_mutex);
+    return PROFILER_FAILURE;
+  }
+
+  // Discard previous samples, the handler is idle when not running
+  for (unsigned i=0; i < PROFILER_MAX_SAMPLES; i++) {
+    g_samples[i].ready = 0;
+  }
+  __atomic_store_n(&g_nr_samples, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&g_nr_dropped, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&g_running, 1, __ATOMIC_RELEASE);
+
+  g_frequency = frequency;
+  long rc = PROFILER_SUCCESS;
+  for (unsigned i=0; i < PROFILER_MAX_THREADS; i++) {
+    if ( g_threads[i].used &&
+	 (arm_thread(&g_threads[i]) != PROFILER_SUCCESS) ) {
+      rc = PROFILER_FAILURE;
+    }
+  }
+
+  pthread_mutex_unlock(&g_mutex);
+
+  if (rc != PROFILER_SUCCESS) {
+    profiler_stop();
+  }
+
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////
+
+void profiler_stop(void)
+{
+  pthread_mutex_lock(&g_mutex);
+
+  __atomic_store_n(&g_running, 0, __ATOMIC_RELEASE);
+  for (unsigned i=0; i < PROFILER_MAX_THREADS; i++) {
+    disarm_thread(&g_threads[i]);
+  }
+  g_frequency = 0.0;
+
+  pthread_mutex_unlock(&g_mutex);
+}
+
+////////////////////////////////////////////////////////////////
+
+bool profiler_is_running(void)
+{
+  return __atomic_load_n(&g_running, __ATOMIC_ACQUIRE);
+}
+
+////////////////////////////////////////////////////////////////
+
+void profiler_get_stats(unsigned *samples, unsigned *dropped)
+{
+  const unsigned nr_samples =
+    __atomic_load_n(&g_nr_samples, __ATOMIC_RELAXED);
+  *dropped = __atomic_load_n(&g_nr_dropped, __ATOMIC_RELAXED);
+  *samples = ( (nr_samples < PROFILER_MAX_SAMPLES) ?
+	       nr_samples : PROFILER_MAX_SAMPLES );
+}
+
+////////////////////////////////////////////////////////////////
+
+long profiler_dump(const char *path)
+{
+  map<string, unsigned long> stacks;  // Folded stack => nof samples
+  map<uintptr_t, string>     symbols; // Cache of looked up addresses
+  void *addresses[PROFILER_MAX_FRAMES];
+
+  unsigned nr_samples;
+  unsigned nr_dropped;
+  profiler_get_stats(&nr_samples, &nr_dropped);
+
+  for (unsigned i=0; (g_samples) && (i < nr_samples); i++) {
+    const PROFILER_SAMPLE *sample = &g_samples[i];
+    if (!__atomic_load_n(&sample->ready, __ATOMIC_ACQUIRE)) {
+      continue; // Being written
+    }
+
+    // Return addresses point after the call, which may be
+    // the start of next function
+    for (unsigned f=0; f < sample->nr_frames; f++) {
+      addresses[f] = (void *)(sample->frames[f] - (f ? 1 : 0));
+    }
+    char **names = backtrace_symbols(addresses, sample->nr_frames);
+    if (!names) {
+      return PROFILER_FAILURE;
+    }
+
+    string stack = sample->thread;
+    for (int f=sample->nr_frames - 1; f >= 0; f--) {
+      const uintptr_t address = (uintptr_t)addresses[f];
+      if (!symbols.count(address)) {
+	symbols[address] = frame_name(names[f]);
+      }
+      stack += ";" + symbols[address];
+    }
+    free(names);
+
+    stacks[stack]++;
+  }
+
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    return PROFILER_FAILURE;
+  }
+  for (map<string, unsigned long>::const_iterator it = stacks.begin();
+       it != stacks.end(); ++it) {
+    fprintf(file, "%s %lu\n", it->first.c_str(), it->second);
+  }
+
+  const bool failed = ferror(file);
+  if ( (fclose(file) != 0) || failed ) {
+    return PROFILER_FAILURE;
+  }
+
+  return PROFILER_SUCCESS;
+}
@@ -0,0 +1,64 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define PROFILER_SUCCESS   0
+#define PROFILER_FAILURE  -1
+
+#define PROFILER_MAX_THREADS    64    // Threads beyond this are not sampled
+#define PROFILER_MAX_FRAMES     32    // Deeper stacks are cut at the root
+#define PROFILER_MAX_SAMPLES    16384 // Later samples are dropped
+
+#define PROFILER_MAX_FREQUENCY  1000  // Samples per second of CPU time
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of exported functions
+/////////////////////////////////////////////////////////////////////////////
+
+// In-process sampling profiler. Each attached thread is sampled by a
+// timer on its own CPU time, so idle threads cost nothing. A sample
+// is the stack of the thread, found by following frame pointers
+// (-fno-omit-frame-pointer) in the SIGPROF handler. Samples are
+// written to a preallocated buffer without locks. Code built without
+// frame pointers (e.g. libc) ends a stack, and the caller of a leaf
+// function that has no frame of its own is left out.
+//
+// Nothing is done until started, and stopping deletes the timers.
+
+// Calling thread may be sampled, until detached. Attaching again
+// (e.g. after a fork) refreshes the thread. Name is truncated to
+// 15 characters.
+extern long profiler_thread_attach(const char *name);
+extern void profiler_thread_detach(void);
+
+// Samples of a previous start are discarded
+extern long profiler_start(double frequency);
+extern void profiler_stop(void);
+
+extern bool profiler_is_running(void);
+
+// Nof samples taken and dropped (buffer full) since start
+extern void profiler_get_stats(unsigned *samples, unsigned *dropped);
+
+// Writes samples as folded stacks, one line per unique stack:
+// "thread;root;..;leaf count". Input to flamegraph.pl or speedscope.
+// Functions without a dynamic symbol are written as binary+offset,
+// resolved by addr2line. Samples being written meanwhile are left out.
+extern long profiler_dump(const char *path);
+
+#endif // __PROFILER_H__
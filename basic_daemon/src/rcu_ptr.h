@@ -0,0 +1,183 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __RCU_PTR_H__
+#define __RCU_PTR_H__
+
+#include <sched.h>
+
+#include "sharded_counters.h" // CACHE_LINE_SIZE
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define RCU_MAX_READERS   16
+#define RCU_MAX_RETIRED   16
+
+#define RCU_BAD_READER    -1
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// Pointer to an immutable object, replaced by one writer and read
+// by any number of registered readers without locks (RCU style).
+//
+// Replaced objects are reclaimed using epochs. A reader announces
+// the global epoch when entering a read-side section and clears it
+// when leaving. An object retired in epoch E can be deleted when no
+// reader is still inside a section it entered in epoch E or earlier.
+//
+// Only one thread may call 'publish' and 'reclaim'.
+
+template <typename T>
+class rcu_ptr {
+
+ public:
+
+  ////////////////////////////////////////////////////////////////
+
+  rcu_ptr(void)
+  {
+    m_ptr        = 0;
+    m_epoch      = 1;
+    m_nr_retired = 0;
+    for (unsigned i=0; i < RCU_MAX_READERS; i++) {
+      m_readers[i].in_use = 0;
+      m_readers[i].epoch  = 0;
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////
+
+  ~rcu_ptr(void)
+  {
+    // No readers are allowed at this point
+    for (unsigned i=0; i < m_nr_retired; i++) {
+      delete m_retired[i].ptr;
+    }
+    delete m_ptr;
+  }
+
+  ////////////////////////////////////////////////////////////////
+
+  int register_reader(void)
+  {
+    for (int i=0; i < RCU_MAX_READERS; i++) {
+      if ( __sync_bool_compare_and_swap(&m_readers[i].in_use, 0, 1) ) {
+	return i;
+      }
+    }
+    return RCU_BAD_READER;
+  }
+
+  ////////////////////////////////////////////////////////////////
+
+  void unregister_reader(int reader)
+  {
+    __atomic_store_n(&m_readers[reader].epoch, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&m_readers[reader].in_use, 0, __ATOMIC_SEQ_CST);
+  }
+
+  ////////////////////////////////////////////////////////////////
+
+  const T *read_lock(int reader)
+  {
+    // Announce epoch before the pointer is read
+    __atomic_store_n(&m_readers[reader].epoch,
+		     __atomic_load_n(&m_epoch, __ATOMIC_SEQ_CST),
+		     __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&m_ptr, __ATOMIC_SEQ_CST);
+  }
+
+  ////////////////////////////////////////////////////////////////
+
+  void read_unlock(int reader)
+  {
+    // Object must not be used after this point
+    __atomic_store_n(&m_readers[reader].epoch, 0, __ATOMIC_RELEASE);
+  }
+
+  ////////////////////////////////////////////////////////////////
+
+  void publish(T *new_ptr)
+  {
+    T *old_ptr = __atomic_exchange_n(&m_ptr, new_ptr, __ATOMIC_SEQ_CST);
+
+    if (old_ptr) {
+      // Wait for space to retire the old object (normally never)
+      while (m_nr_retired == RCU_MAX_RETIRED) {
+	reclaim();
+	if (m_nr_retired == RCU_MAX_RETIRED) {
+	  sched_yield();
+	}
+      }
+      m_retired[m_nr_retired].ptr   = old_ptr;
+      m_retired[m_nr_retired].epoch = __atomic_load_n(&m_epoch,
+						      __ATOMIC_SEQ_CST);
+      m_nr_retired++;
+    }
+
+    // Readers entering from now on can't see the old object
+    __atomic_add_fetch(&m_epoch, 1, __ATOMIC_SEQ_CST);
+
+    reclaim();
+  }
+
+  ////////////////////////////////////////////////////////////////
+
+  void reclaim(void)
+  {
+    // Find oldest epoch still in use by a reader
+    unsigned long oldest = __atomic_load_n(&m_epoch, __ATOMIC_SEQ_CST);
+    for (unsigned i=0; i < RCU_MAX_READERS; i++) {
+      unsigned long epoch = __atomic_load_n(&m_readers[i].epoch,
+					    __ATOMIC_SEQ_CST);
+      if ( epoch && (epoch < oldest) ) {
+	oldest = epoch;
+      }
+    }
+
+    // Delete objects retired before that epoch
+    unsigned kept = 0;
+    for (unsigned i=0; i < m_nr_retired; i++) {
+      if (m_retired[i].epoch < oldest) {
+	delete m_retired[i].ptr;
+      }
+      else {
+	m_retired[kept++] = m_retired[i];
+      }
+    }
+    m_nr_retired = kept;
+  }
+
+ private:
+  T             *m_ptr;
+  unsigned long  m_epoch;
+
+  // Each reader on its own cache line
+  struct {
+    int           in_use;
+    unsigned long epoch; // Zero when outside read-side section
+  } __attribute__ ((aligned(CACHE_LINE_SIZE))) m_readers[RCU_MAX_READERS];
+
+  // Replaced objects not yet deleted
+  struct {
+    T             *ptr;
+    unsigned long  epoch;
+  } m_retired[RCU_MAX_RETIRED];
+  unsigned m_nr_retired;
+};
+
+#endif // __RCU_PTR_H__
@@ -0,0 +1,725 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "request_server.h"
+#include "listen_socket.h"
+#include "delay.h"
+#include "timer.h"
+#include "metrics_registry.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define THREAD_START_TIMEOUT  1.0 // Seconds
+#define THREAD_STOP_TIMEOUT   1.0 // Seconds
+#define THREAD_STOP_RETRIES   10  // Busy handler, then thread is leaked
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+request_server_io_thread::request_server_io_thread(string thread_name,
+						   request_server *server) : thread(thread_name)
+{
+  m_server = server;
+}
+
+////////////////////////////////////////////////////////////////
+
+request_server_io_thread::~request_server_io_thread(void)
+{
+}
+
+////////////////////////////////////////////////////////////////
+
+request_server_worker::request_server_worker(string thread_name,
+					     request_server *server) : thread(thread_name)
+{
+  m_server = server;
+}
+
+////////////////////////////////////////////////////////////////
+
+request_server_worker::~request_server_worker(void)
+{
+}
+
+////////////////////////////////////////////////////////////////
+
+request_server::request_server(void) : m_queue_mutex("server_queue")
+{
+  m_listen_fd   = -1;
+  m_done_fd     = -1;
+  m_handler     = NULL;
+  m_arg         = NULL;
+  m_connections = NULL;
+  m_closing     = false;
+  m_io_thread   = NULL;
+  m_nr_workers  = 0;
+
+  memset(&m_request_queue, 0, sizeof(m_request_queue));
+  memset(&m_done_queue, 0, sizeof(m_done_queue));
+
+  metrics_registry *metrics = metrics_registry::instance();
+  m_connections_id =
+    metrics->add_counter("server_connections_total", "", 1.0);
+  m_refused_id  = metrics->add_counter("server_refused_total", "", 1.0);
+  m_requests_id = metrics->add_counter("server_requests_total", "", 1.0);
+  m_bad_frames_id =
+    metrics->add_counter("server_bad_frames_total", "", 1.0);
+
+  pthread_cond_init(&m_queue_cond, NULL);
+}
+
+////////////////////////////////////////////////////////////////
+
+request_server::~request_server(void)
+{
+  close();
+
+  pthread_cond_destroy(&m_queue_cond);
+}
+
+////////////////////////////////////////////////////////////////
+
+long request_server::open(const char *address,
+			  unsigned nr_workers,
+			  REQUEST_HANDLER handler,
+			  void *arg)
+{
+  if ( (nr_workers == 0) || (nr_workers > REQUEST_SERVER_MAX_WORKERS) ) {
+    errno = EINVAL;
+    return REQUEST_SERVER_FAILURE;
+  }
+
+  m_handler = handler;
+  m_arg     = arg;
+  m_closing = false;
+
+  // All connection buffers, allocated once
+  m_connections = new CONNECTION[REQUEST_SERVER_MAX_CONNECTIONS];
+  for (unsigned i=0; i < REQUEST_SERVER_MAX_CONNECTIONS; i++) {
+    m_connections[i].server = this;
+    m_connections[i].index  = i;
+    m_connections[i].fd     = -1;
+    m_connections[i].in_use = false;
+  }
+
+  m_listen_fd = open_listen_socket(address, 0, REQUEST_SERVER_MAX_CONNECTIONS);
+  if (m_listen_fd == -1) {
+    close_on_error();
+    return REQUEST_SERVER_FAILURE;
+  }
+
+  m_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if ( (m_done_fd == -1) ||
+       ( (address[0] == '/') &&
+	 (chmod(address, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) == -1) ) ||
+       (m_loop.open() != EVENT_LOOP_SUCCESS) ||
+       (m_loop.add_fd(m_listen_fd, EPOLLIN,
+		      on_accept, this) != EVENT_LOOP_SUCCESS) ||
+       (m_loop.add_fd(m_done_fd, EPOLLIN,
+		      on_done, this) != EVENT_LOOP_SUCCESS) ) {
+    close_on_error();
+    return REQUEST_SERVER_FAILURE;
+  }
+
+  // Workers first, they wait for requests
+  for (unsigned i=0; i < nr_workers; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "BASICD_RW%02u", i);
+    m_workers[i] = new request_server_worker(name, this);
+    m_nr_workers++;
+    if (start_thread(m_workers[i]) != REQUEST_SERVER_SUCCESS) {
+      close_on_error();
+      return REQUEST_SERVER_FAILURE;
+    }
+  }
+
+  m_io_thread = new request_server_io_thread("BASICD_RIO", this);
+  if (start_thread(m_io_thread) != REQUEST_SERVER_SUCCESS) {
+    close_on_error();
+    return REQUEST_SERVER_FAILURE;
+  }
+
+  return REQUEST_SERVER_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::close(void)
+{
+  bool leaked = false;
+
+  // Stop I/O thread first, no more requests are dispatched
+  if (m_io_thread) {
+    if (stop_thread(m_io_thread)) {
+      delete m_io_thread;
+    }
+    else {
+      leaked = true;
+    }
+    m_io_thread = NULL;
+  }
+
+  // Wake up all idle workers, busy ones complete their request
+  m_queue_mutex.lock();
+  m_closing = true;
+  pthread_cond_broadcast(&m_queue_cond);
+  m_queue_mutex.unlock();
+
+  for (unsigned i=0; i < m_nr_workers; i++) {
+    if (stop_thread(m_workers[i])) {
+      delete m_workers[i];
+    }
+    else {
+      leaked = true;
+    }
+  }
+  m_nr_workers = 0;
+
+  // A thread that did not stop may still use the connection buffers
+  // and descriptors, they are leaked rather than freed under it
+  if (leaked) {
+    m_connections = NULL;
+    m_listen_fd   = -1;
+    m_done_fd     = -1;
+    return;
+  }
+
+  if (m_connections) {
+    for (unsigned i=0; i < REQUEST_SERVER_MAX_CONNECTIONS; i++) {
+      if (m_connections[i].fd != -1) {
+	::close(m_connections[i].fd);
+      }
+    }
+    delete [] m_connections;
+    m_connections = NULL;
+  }
+
+  m_loop.close();
+
+  if (m_listen_fd != -1) {
+    close_listen_socket(m_listen_fd); // Any socket path is removed
+    m_listen_fd = -1;
+  }
+  if (m_done_fd != -1) {
+    ::close(m_done_fd);
+    m_done_fd = -1;
+  }
+
+  memset(&m_request_queue, 0, sizeof(m_request_queue));
+  memset(&m_done_queue, 0, sizeof(m_done_queue));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Protected member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+long request_server_io_thread::setup(void)
+{
+  // Leave the loop when ordered to stop
+  if (m_server->m_loop.add_fd(get_wake_fd(), EPOLLIN,
+			      on_stop, m_server) != EVENT_LOOP_SUCCESS) {
+    return THREAD_INTERNAL_ERROR;
+  }
+
+  return THREAD_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long request_server_io_thread::execute(void *arg)
+{
+  // Not able to stop without the wake up registered
+  if (get_status() != THREAD_STATUS_OK) {
+    return THREAD_INTERNAL_ERROR;
+  }
+
+  // All socket I/O is done by handlers called from here
+  if (m_server->m_loop.run() != EVENT_LOOP_SUCCESS) {
+    return THREAD_INTERNAL_ERROR;
+  }
+
+  return THREAD_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long request_server_io_thread::cleanup(void)
+{
+  m_server->m_loop.remove_fd(get_wake_fd());
+
+  return THREAD_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long request_server_worker::setup(void)
+{
+  return THREAD_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long request_server_worker::execute(void *arg)
+{
+  // Returns false when server is closing
+  while ( m_server->execute_next_request() ) {
+    update_exe_cnt();
+  }
+
+  return THREAD_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+long request_server_worker::cleanup(void)
+{
+  return THREAD_SUCCESS;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+void request_server_io_thread::on_stop(int fd, uint32_t events, void *arg)
+{
+  ((request_server *)arg)->m_loop.stop();
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::push(QUEUE *queue, unsigned item)
+{
+  const unsigned tail =
+    (queue->head + queue->count) % REQUEST_SERVER_MAX_CONNECTIONS;
+
+  queue->items[tail] = item;
+  queue->count++;
+}
+
+////////////////////////////////////////////////////////////////
+
+unsigned request_server::pop(QUEUE *queue)
+{
+  const unsigned item = queue->items[queue->head];
+
+  queue->head = (queue->head + 1) % REQUEST_SERVER_MAX_CONNECTIONS;
+  queue->count--;
+
+  return item;
+}
+
+////////////////////////////////////////////////////////////////
+
+long request_server::start_thread(thread *the_thread)
+{
+  timer thread_timer;
+
+  if (the_thread->start(NULL) != THREAD_SUCCESS) {
+    return REQUEST_SERVER_FAILURE;
+  }
+
+  // Wait for setup, then release
+  thread_timer.reset();
+  while (the_thread->get_state() != THREAD_STATE_SETUP_DONE) {
+    if (thread_timer.get_elapsed_time() > THREAD_START_TIMEOUT) {
+      return REQUEST_SERVER_FAILURE;
+    }
+    delay(0.001);
+  }
+  if ( (the_thread->get_status() != THREAD_STATUS_OK) ||
+       (the_thread->release() != THREAD_SUCCESS) ) {
+    return REQUEST_SERVER_FAILURE;
+  }
+
+  // Wait for thread to start executing
+  thread_timer.reset();
+  while (the_thread->get_state() == THREAD_STATE_SETUP_DONE) {
+    if (thread_timer.get_elapsed_time() > THREAD_START_TIMEOUT) {
+      return REQUEST_SERVER_FAILURE;
+    }
+    delay(0.001);
+  }
+
+  return REQUEST_SERVER_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+bool request_server::stop_thread(thread *the_thread)
+{
+  // Never created
+  if (the_thread->get_state() == THREAD_STATE_NOT_STARTED) {
+    return true;
+  }
+
+  // A thread in setup is released when setup is done,
+  // it then executes and sees at once that it is stopped
+  while (the_thread->get_state() == THREAD_STATE_STARTED) {
+    delay(0.001);
+  }
+  if (the_thread->get_state() == THREAD_STATE_SETUP_DONE) {
+    if (the_thread->release() != THREAD_SUCCESS) {
+      return false;
+    }
+    while (the_thread->get_state() == THREAD_STATE_SETUP_DONE) {
+      delay(0.001);
+    }
+  }
+
+  if (the_thread->stop() != THREAD_SUCCESS) {
+    return false;
+  }
+
+  // A busy worker completes its request first, joined when done
+  for (unsigned i=0; i < THREAD_STOP_RETRIES; i++) {
+    if (the_thread->wait_timed(THREAD_STOP_TIMEOUT) == THREAD_SUCCESS) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::close_on_error(void)
+{
+  // Keep cause of the failure for caller
+  const int saved_errno = errno;
+  close();
+  errno = saved_errno;
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::on_accept(int fd, uint32_t events, void *arg)
+{
+  ((request_server *)arg)->accept_connection();
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::on_connection(int fd, uint32_t events, void *arg)
+{
+  CONNECTION *conn = (CONNECTION *)arg;
+
+  conn->server->serve_connection(conn->index, events);
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::on_done(int fd, uint32_t events, void *arg)
+{
+  request_server *server = (request_server *)arg;
+  unsigned done[REQUEST_SERVER_MAX_CONNECTIONS];
+  unsigned nr_done = 0;
+  uint64_t value;
+
+  if (read(fd, &value, sizeof(value)) == -1) {
+    return; // Nothing completed
+  }
+
+  // Take all completed requests at once
+  server->m_queue_mutex.lock();
+  while (server->m_done_queue.count) {
+    done[nr_done++] = pop(&server->m_done_queue);
+  }
+  server->m_queue_mutex.unlock();
+
+  for (unsigned i=0; i < nr_done; i++) {
+    server->complete_request(done[i]);
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::accept_connection(void)
+{
+  int fd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd == -1) {
+    return; // Client gone, or out of descriptors
+  }
+
+  // Find a free slot, if none the client is refused
+  CONNECTION *conn = NULL;
+  for (unsigned i=0; i < REQUEST_SERVER_MAX_CONNECTIONS; i++) {
+    if (!m_connections[i].in_use) {
+      conn = &m_connections[i];
+      break;
+    }
+  }
+  if ( (!conn) ||
+       (m_loop.add_fd(fd, EPOLLIN, on_connection, conn) != EVENT_LOOP_SUCCESS) ) {
+    ::close(fd);
+    metrics_registry::instance()->inc(m_refused_id);
+    return;
+  }
+
+  conn->fd      = fd;
+  conn->in_use  = true;
+  conn->busy    = false;
+  conn->writing = false;
+  conn->in_len  = 0;
+  conn->out_len = 0;
+  conn->out_pos = 0;
+
+  metrics_registry::instance()->inc(m_connections_id);
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::serve_connection(unsigned index, uint32_t events)
+{
+  CONNECTION *conn = &m_connections[index];
+
+  // Hang up is reported even when not waiting for anything
+  if (conn->busy) {
+    if (events & (EPOLLHUP | EPOLLERR)) {
+      close_connection(index);
+    }
+    return;
+  }
+
+  if (conn->writing) {
+    if (!send_response(conn)) {
+      close_connection(index);
+      return;
+    }
+    if (conn->writing) {
+      return; // Not yet sent
+    }
+  }
+  else if (events & EPOLLIN) {
+    const ssize_t n = read(conn->fd,
+			   conn->in + conn->in_len,
+			   REQUEST_SERVER_FRAME_SIZE - conn->in_len);
+    if ( (n == 0) ||
+	 ((n == -1) && (errno != EAGAIN) && (errno != EINTR)) ) {
+      close_connection(index); // Client closed connection
+      return;
+    }
+    if (n > 0) {
+      conn->in_len += n;
+    }
+  }
+  else if (events & (EPOLLHUP | EPOLLERR)) {
+    close_connection(index);
+    return;
+  }
+
+  dispatch_request(index);
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::dispatch_request(unsigned index)
+{
+  CONNECTION *conn = &m_connections[index];
+  uint32_t len;
+
+  if (conn->in_len >= sizeof(len)) {
+    memcpy(&len, conn->in, sizeof(len));
+    len = ntohl(len);
+
+    if (len > REQUEST_SERVER_MAX_MESSAGE) {
+      metrics_registry::instance()->inc(m_bad_frames_id);
+      close_connection(index); // Can't find next request
+      return;
+    }
+
+    // Complete request, hand over buffers to a worker
+    if (conn->in_len >= sizeof(len) + len) {
+      conn->busy = true;
+      m_queue_mutex.lock();
+      push(&m_request_queue, index);
+      pthread_cond_signal(&m_queue_cond);
+      m_queue_mutex.unlock();
+    }
+  }
+
+  set_interest(index);
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::complete_request(unsigned index)
+{
+  CONNECTION *conn = &m_connections[index];
+  uint32_t len;
+
+  conn->busy = false;
+
+  // Connection closed while request was executed
+  if (conn->fd == -1) {
+    conn->in_use = false;
+    return;
+  }
+
+  // Remove request, keep any pipelined data
+  memcpy(&len, conn->in, sizeof(len));
+  const uint32_t frame_len = sizeof(len) + ntohl(len);
+  conn->in_len -= frame_len;
+  memmove(conn->in, conn->in + frame_len, conn->in_len);
+
+  // Send response, remaining part when writable
+  conn->writing = true;
+  if (!send_response(conn)) {
+    close_connection(index);
+    return;
+  }
+
+  if (conn->writing) {
+    set_interest(index);
+  }
+  else {
+    dispatch_request(index);
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+bool request_server::send_response(CONNECTION *conn)
+{
+  while (conn->out_pos < conn->out_len) {
+    const ssize_t n = send(conn->fd,
+			   conn->out + conn->out_pos,
+			   conn->out_len - conn->out_pos,
+			   MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EAGAIN) {
+	return true; // Continue when writable
+      }
+      if (errno == EINTR) {
+	continue;
+      }
+      return false;
+    }
+    conn->out_pos += n;
+  }
+
+  // Response completed
+  conn->writing = false;
+  conn->out_len = 0;
+  conn->out_pos = 0;
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::set_interest(unsigned index)
+{
+  CONNECTION *conn = &m_connections[index];
+  uint32_t events;
+
+  if (conn->busy) {
+    events = 0;        // Only hang up
+  }
+  else if (conn->writing) {
+    events = EPOLLOUT;
+  }
+  else {
+    events = EPOLLIN;
+  }
+
+  if (m_loop.modify_fd(conn->fd, events) != EVENT_LOOP_SUCCESS) {
+    close_connection(index);
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+void request_server::close_connection(unsigned index)
+{
+  CONNECTION *conn = &m_connections[index];
+
+  if (conn->fd != -1) {
+    m_loop.remove_fd(conn->fd);
+    ::close(conn->fd);
+    conn->fd = -1;
+  }
+
+  // A worker owns the buffers until request is completed
+  if (!conn->busy) {
+    conn->in_use = false;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
+bool request_server::execute_next_request(void)
+{
+  unsigned index;
+  uint32_t len;
+
+  m_queue_mutex.lock();
+  while ( (!m_closing) && (!m_request_queue.count) ) {
+    m_queue_mutex.wait(&m_queue_cond);
+  }
+  if (m_closing) {
+    m_queue_mutex.unlock();
+    return false;
+  }
+  index = pop(&m_request_queue);
+  m_queue_mutex.unlock();
+
+  // Buffers are owned by this worker until completed
+  CONNECTION *conn = &m_connections[index];
+
+  memcpy(&len, conn->in, sizeof(len));
+  len = ntohl(len);
+
+  uint32_t rsp_len = m_handler(conn->in + sizeof(len), len,
+			       conn->out + sizeof(len),
+			       m_arg);
+  if (rsp_len > REQUEST_SERVER_MAX_MESSAGE) {
+    rsp_len = 0;
+  }
+
+  len = htonl(rsp_len);
+  memcpy(conn->out, &len, sizeof(len));
+  conn->out_len = sizeof(len) + rsp_len;
+  conn->out_pos = 0;
+
+  metrics_registry::instance()->inc(m_requests_id);
+
+  // Hand back to I/O thread
+  m_queue_mutex.lock();
+  push(&m_done_queue, index);
+  m_queue_mutex.unlock();
+
+  const uint64_t value = 1;
+  if (write(m_done_fd, &value, sizeof(value)) == -1) {
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,187 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __REQUEST_SERVER_H__
+#define __REQUEST_SERVER_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+
+#include "thread.h"
+#include "event_loop.h"
+#include "profiled_mutex.h"
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define REQUEST_SERVER_SUCCESS   0
+#define REQUEST_SERVER_FAILURE  -1
+
+#define REQUEST_SERVER_MAX_CONNECTIONS  128
+#define REQUEST_SERVER_MAX_WORKERS       32
+#define REQUEST_SERVER_MAX_MESSAGE     4096 // Payload bytes
+
+// Each message is a 32-bit length in network byte order followed by
+// the payload. Every request gets one response, in order.
+#define REQUEST_SERVER_FRAME_SIZE \
+  (sizeof(uint32_t) + REQUEST_SERVER_MAX_MESSAGE)
+
+/////////////////////////////////////////////////////////////////////////////
+//               Class support types
+/////////////////////////////////////////////////////////////////////////////
+
+// Executes one request in a worker thread. Response payload is written
+// to response (at most REQUEST_SERVER_MAX_MESSAGE bytes).
+// Returns nof response bytes.
+typedef uint32_t (*REQUEST_HANDLER)(const uint8_t *request,
+				    uint32_t request_len,
+				    uint8_t *response,
+				    void *arg);
+
+class request_server;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// Accepts connections and does all socket I/O, non-blocking
+
+class request_server_io_thread : public thread {
+
+ public:
+  request_server_io_thread(string thread_name, request_server *server);
+  ~request_server_io_thread(void);
+
+ protected:
+  virtual long setup(void);
+  virtual long execute(void *arg);
+  virtual long cleanup(void);
+
+ private:
+  request_server *m_server;
+
+  static void on_stop(int fd, uint32_t events, void *arg);
+};
+
+// Executes requests handed over by the I/O thread
+
+class request_server_worker : public thread {
+
+ public:
+  request_server_worker(string thread_name, request_server *server);
+  ~request_server_worker(void);
+
+ protected:
+  virtual long setup(void);
+  virtual long execute(void *arg);
+  virtual long cleanup(void);
+
+ private:
+  request_server *m_server;
+};
+
+// Request serving front end, one I/O thread and a pool of workers.
+// A connection has at most one request in a worker at a time, and
+// buffers are allocated when opened, not per request.
+
+class request_server {
+
+ public:
+  request_server(void);
+  ~request_server(void);
+
+  // Address is a unix socket path ("/...") or a TCP address ("a.b.c.d:port")
+  long open(const char *address,
+	    unsigned nr_workers,
+	    REQUEST_HANDLER handler,
+	    void *arg);
+
+  void close(void); // Stops all threads
+
+ private:
+  friend class request_server_io_thread;
+  friend class request_server_worker;
+
+  typedef struct {
+    request_server *server;
+    unsigned        index;
+    int      fd;       // -1 when closed
+    bool     in_use;   // Slot taken, also while a closed one is busy
+    bool     busy;     // Request in a worker, buffers owned by worker
+    bool     writing;  // Waiting for EPOLLOUT
+    uint32_t in_len;
+    uint32_t out_len;
+    uint32_t out_pos;
+    uint8_t  in[REQUEST_SERVER_FRAME_SIZE];
+    uint8_t  out[REQUEST_SERVER_FRAME_SIZE];
+  } CONNECTION;
+
+  // Bounded queue of connection indexes, never more
+  // entries than connections (one request each)
+  typedef struct {
+    unsigned head;
+    unsigned count;
+    unsigned items[REQUEST_SERVER_MAX_CONNECTIONS];
+  } QUEUE;
+
+  int              m_listen_fd;
+  int              m_done_fd;  // eventfd, signals completed requests
+  REQUEST_HANDLER  m_handler;
+  void            *m_arg;
+
+  event_loop       m_loop;     // Only used by the I/O thread
+  CONNECTION      *m_connections;
+
+  profiled_mutex   m_queue_mutex;
+  pthread_cond_t   m_queue_cond;
+  QUEUE            m_request_queue; // To workers
+  QUEUE            m_done_queue;    // Back to I/O thread
+  bool             m_closing;
+
+  request_server_io_thread *m_io_thread;
+  request_server_worker    *m_workers[REQUEST_SERVER_MAX_WORKERS];
+  unsigned                  m_nr_workers;
+
+  // Statistics, ids in the metrics registry
+  int  m_connections_id; // Accepted
+  int  m_refused_id;     // No free connection slot
+  int  m_requests_id;    // Served
+  int  m_bad_frames_id;  // Connection closed, too large request
+
+  static void push(QUEUE *queue, unsigned item);
+  static unsigned pop(QUEUE *queue);
+
+  long start_thread(thread *the_thread);
+  bool stop_thread(thread *the_thread); // False if not joined
+  void close_on_error(void);
+
+  // Executed by the I/O thread
+  static void on_accept(int fd, uint32_t events, void *arg);
+  static void on_connection(int fd, uint32_t events, void *arg);
+  static void on_done(int fd, uint32_t events, void *arg);
+  void accept_connection(void);
+  void serve_connection(unsigned index, uint32_t events);
+  void dispatch_request(unsigned index);
+  void complete_request(unsigned index);
+  bool send_response(CONNECTION *conn);
+  void set_interest(unsigned index);
+  void close_connection(unsigned index);
+
+  // Executed by the workers
+  bool execute_next_request(void);
+};
+
+#endif // __REQUEST_SERVER_H__
@@ -0,0 +1,130 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __SDT_PROBE_H__
+#define __SDT_PROBE_H__
+
+#include <stdint.h>
+
+// Statically defined tracepoints (USDT), as made by <sys/sdt.h> of
+// SystemTap, so bpftrace, perf and SystemTap can attach to a running
+// daemon:
+//
+//   bpftrace -l 'usdt:/path/to/basicd_rel.x86_64:*'
+//   bpftrace -e 'usdt:/path/to/basicd_rel.x86_64:basicd:cycle_overrun
+//                {printf("%s late %d ns\n", str(arg0), arg2);}'
+//
+// A probe is a nop instruction, described by an ELF note (.note.stapsdt)
+// with its address and where each argument is found (register, stack or
+// constant). A tool replaces the nop by a breakpoint when attaching.
+// Not attached, the cost is the nop and keeping the arguments available,
+// nothing is called.
+//
+// Arguments are passed as int64_t, pointers included (use str() in
+// bpftrace for strings). At most four arguments.
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+// Note and its base address, as expected by the tools (note type 3).
+// The base section lets tools correct the address of a prelinked binary.
+#define SDT_PROBE_ASM(provider, name, args)				\
+  "990: nop\n"								\
+  ".pushsection .note.stapsdt,\"\",\"note\"\n"				\
+  ".balign 4\n"								\
+  ".4byte 992f-991f, 994f-993f, 3\n"					\
+  "991: .asciz \"stapsdt\"\n"						\
+  "992: .balign 4\n"							\
+  "993: .8byte 990b\n"							\
+  ".8byte _.stapsdt.base\n"						\
+  ".8byte 0\n"								\
+  ".asciz \"" #provider "\"\n"						\
+  ".asciz \"" #name "\"\n"						\
+  ".asciz \"" args "\"\n"						\
+  "994: .balign 4\n"							\
+  ".popsection\n"							\
+  ".ifndef _.stapsdt.base\n"						\
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  ".weak _.stapsdt.base\n"						\
+  ".hidden _.stapsdt.base\n"						\
+  "_.stapsdt.base: .space 1\n"						\
+  ".size _.stapsdt.base, 1\n"						\
+  ".popsection\n"							\
+  ".endif\n"
+
+// Argument in a register, in memory or a constant
+#define SDT_PROBE_ARG(x)  "nor" ((int64_t)(x))
+
+#define SDT_PROBE0(provider, name)					\
+  __asm__ __volatile__ (SDT_PROBE_ASM(provider, name, ""))
+
+#define SDT_PROBE1(provider, name, a1)					\
+  __asm__ __volatile__ (SDT_PROBE_ASM(provider, name, "-8@%0")		\
+			: : SDT_PROBE_ARG(a1))
+
+#define SDT_PROBE2(provider, name, a1, a2)				\
+  __asm__ __volatile__ (SDT_PROBE_ASM(provider, name, "-8@%0 -8@%1")	\
+			: : SDT_PROBE_ARG(a1), SDT_PROBE_ARG(a2))
+
+#define SDT_PROBE3(provider, name, a1, a2, a3)				\
+  __asm__ __volatile__ (SDT_PROBE_ASM(provider, name,			\
+				      "-8@%0 -8@%1 -8@%2")		\
+			: : SDT_PROBE_ARG(a1), SDT_PROBE_ARG(a2),	\
+			SDT_PROBE_ARG(a3))
+
+#define SDT_PROBE4(provider, name, a1, a2, a3, a4)			\
+  __asm__ __volatile__ (SDT_PROBE_ASM(provider, name,			\
+				      "-8@%0 -8@%1 -8@%2 -8@%3")	\
+			: : SDT_PROBE_ARG(a1), SDT_PROBE_ARG(a2),	\
+			SDT_PROBE_ARG(a3), SDT_PROBE_ARG(a4))
+
+#else
+
+// No probes on other architectures
+#define SDT_PROBE0(provider, name)                  do {} while (0)
+#define SDT_PROBE1(provider, name, a1)              do {} while (0)
+#define SDT_PROBE2(provider, name, a1, a2)          do {} while (0)
+#define SDT_PROBE3(provider, name, a1, a2, a3)      do {} while (0)
+#define SDT_PROBE4(provider, name, a1, a2, a3, a4)  do {} while (0)
+
+#endif
+
+// Probes of the daemon, provider "basicd". Arguments in order:
+//
+// thread_state   name (string), tid, state (THREAD_STATE_xxx)
+//                On each state change in thread::run.
+// cycle_wake     name (string), cycle, wakeup latency (ns)
+//                Cycle starts, before cyclic_execute.
+// cycle_done     name (string), cycle, execution time (ns)
+//                After cyclic_execute.
+// cycle_overrun  name (string), cycle, time past next start (ns)
+//                Cycle ended after the next should have started.
+// log_write      message (string with newline), length (bytes)
+//                Before a line is written to the internal log.
+// log_written    length (bytes)
+//                After a line is written to the internal log.
+// cfg_parse      file name (string)
+//                Before a configuration file is parsed.
+// cfg_parsed     file name (string), return code, duration (ns)
+//                After a configuration file is parsed.
+// error          source, code, errno, info (string)
+//                Error reported by basicd_core::set_error.
+
+#define BASICD_PROBE0(name)                  SDT_PROBE0(basicd, name)
+#define BASICD_PROBE1(name, a1)              SDT_PROBE1(basicd, name, a1)
+#define BASICD_PROBE2(name, a1, a2)          SDT_PROBE2(basicd, name, a1, a2)
+#define BASICD_PROBE3(name, a1, a2, a3)      SDT_PROBE3(basicd, name, a1, a2, a3)
+#define BASICD_PROBE4(name, a1, a2, a3, a4)  SDT_PROBE4(basicd, name, a1, a2, a3, a4)
+
+#endif // __SDT_PROBE_H__
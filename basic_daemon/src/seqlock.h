@@ -0,0 +1,68 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __SEQLOCK_H__
+#define __SEQLOCK_H__
+
+#include <stdint.h>
+#include <sched.h>
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of exported functions
+/////////////////////////////////////////////////////////////////////////////
+
+// Sequence lock, protects a record with one writer and any number of
+// readers that never block the writer. The sequence number is odd
+// while the record is written. A reader copies the record and retries
+// if the sequence number was odd or changed meanwhile.
+//
+// Writer:  seqlock_write_begin(&r->seq); ...update r...; seqlock_write_end(&r->seq);
+// Reader:  do { s = seqlock_read_begin(&r->seq); copy = *r; }
+//          while (seqlock_read_retry(&r->seq, s));
+
+static inline void seqlock_write_begin(uint32_t *seq)
+{
+  __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE); // Odd before any data
+}
+
+static inline void seqlock_write_end(uint32_t *seq)
+{
+  __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE); // Data before even
+}
+
+static inline uint32_t seqlock_read_begin(const uint32_t *seq)
+{
+  uint32_t start;
+
+  while ( (start = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1 ) {
+    sched_yield(); // Writer is active
+  }
+  return start;
+}
+
+// As seqlock_read_begin, but does not wait for an active writer.
+// For a record in memory shared with a process that may be killed
+// while writing, leaving the sequence number odd.
+static inline bool seqlock_try_read_begin(const uint32_t *seq,
+					  uint32_t *start)
+{
+  *start = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+  return !(*start & 1);
+}
+
+static inline bool seqlock_read_retry(const uint32_t *seq, uint32_t start)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE); // Data before sequence number
+  return __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+#endif // __SEQLOCK_H__
@@ -0,0 +1,111 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "sharded_counters.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define COUNTERS_PER_CACHE_LINE  (CACHE_LINE_SIZE / sizeof(uint64_t))
+
+/////////////////////////////////////////////////////////////////////////////
+//               Module global variables
+/////////////////////////////////////////////////////////////////////////////
+
+static unsigned g_next_shard = 0;
+
+static __thread int t_shard = -1; // Shard used by this thread
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+sharded_counters::sharded_counters(unsigned nr_counters)
+{
+  m_nr_counters = nr_counters;
+
+  // Pad each shard to a whole number of cache lines
+  m_shard_size = ( (nr_counters + COUNTERS_PER_CACHE_LINE - 1) /
+		   COUNTERS_PER_CACHE_LINE ) * COUNTERS_PER_CACHE_LINE;
+
+  const size_t nbytes =
+    SHARDED_COUNTERS_NR_SHARDS * m_shard_size * sizeof(uint64_t);
+
+  void *mem;
+  if ( posix_memalign(&mem, CACHE_LINE_SIZE, nbytes) ) {
+    throw bad_alloc();
+  }
+  memset(mem, 0, nbytes);
+
+  m_counters = (uint64_t *)mem;
+}
+
+////////////////////////////////////////////////////////////////
+
+sharded_counters::~sharded_counters(void)
+{
+  free(m_counters);
+}
+
+////////////////////////////////////////////////////////////////
+
+void sharded_counters::add(unsigned index, uint64_t value)
+{
+  if (index >= m_nr_counters) {
+    return;
+  }
+
+  uint64_t *counter = &m_counters[get_shard() * m_shard_size + index];
+
+  // Shards may be shared when there are more threads than shards
+  __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////
+
+void sharded_counters::snapshot_range(unsigned first,
+				      uint64_t *values,
+				      unsigned nr_values)
+{
+  for (unsigned i=0; i < nr_values; i++) {
+    values[i] = 0;
+    if (first + i >= m_nr_counters) {
+      continue;
+    }
+    for (unsigned s=0; s < SHARDED_COUNTERS_NR_SHARDS; s++) {
+      values[i] += __atomic_load_n(&m_counters[s * m_shard_size + first + i],
+				   __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+unsigned sharded_counters::get_shard(void)
+{
+  // Each thread is given a shard on first use
+  if (t_shard < 0) {
+    t_shard = __atomic_fetch_add(&g_next_shard, 1, __ATOMIC_RELAXED) %
+      SHARDED_COUNTERS_NR_SHARDS;
+  }
+  return t_shard;
+}
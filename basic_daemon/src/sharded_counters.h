@@ -0,0 +1,59 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __SHARDED_COUNTERS_H__
+#define __SHARDED_COUNTERS_H__
+
+#include <stdint.h>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define CACHE_LINE_SIZE               64
+#define SHARDED_COUNTERS_NR_SHARDS    16
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// A set of counters, where each thread updates its own cache-line
+// aligned shard using relaxed atomics (no locks, no false sharing).
+// The shards are summed when a snapshot is read.
+
+class sharded_counters {
+
+ public:
+  sharded_counters(unsigned nr_counters);
+  ~sharded_counters(void);
+
+  void add(unsigned index, uint64_t value);
+  void inc(unsigned index) {add(index, 1);}
+
+  void snapshot(uint64_t *values,    // OUT, sum of all shards
+		unsigned nr_values) {snapshot_range(0, values, nr_values);}
+  void snapshot_range(unsigned first, // Counters from this index
+		      uint64_t *values,
+		      unsigned nr_values);
+
+  unsigned get_nr_counters(void) {return m_nr_counters;}
+
+ private:
+  unsigned  m_nr_counters;
+  unsigned  m_shard_size;  // Nof counters in a shard, padded to cache line
+  uint64_t *m_counters;    // All shards, cache line aligned
+
+  static unsigned get_shard(void);
+};
+
+#endif // __SHARDED_COUNTERS_H__
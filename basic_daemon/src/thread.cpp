@@ -12,11 +12,18 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/syscall.h>
+#include <sys/eventfd.h>
 #include <sched.h>
 #include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "thread.h"
 #include "delay.h"
+#include "metrics_registry.h"
+#include "trace.h"
+#include "profiler.h"
+#include "sdt_probe.h"
 
 /////////////////////////////////////////////////////////////////////////////
 //               Public member functions
@@ -24,14 +31,14 @@
 
 ////////////////////////////////////////////////////////////////
 
-thread::thread(string thread_name)
+thread::thread(string thread_name) : m_mutex_thread_done("thread_done")
 {
   m_thread_name = thread_name;
 
   // Init semaphore that releases thread
   sem_init(&m_sem_release, 0, 0); // Initial value is busy
 
-  // Init condition variable/mutex for 'thread done'
+  // Init condition variable for 'thread done'
   pthread_condattr_init(&m_condattr_thread_done);
 
   pthread_condattr_setclock(&m_condattr_thread_done,
@@ -40,8 +47,14 @@ thread::thread(string thread_name)
   pthread_cond_init(&m_cond_thread_done,
 		    &m_condattr_thread_done);
 
-  pthread_mutex_init(&m_mutex_thread_done,
-		     NULL); // Use default mutex attributes
+  // Wakes up a sleeping thread when stopped
+  m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  // Shared by all threads
+  metrics_registry *metrics = metrics_registry::instance();
+  m_runs_id     = metrics->add_counter("thread_runs_total", "", 1.0);
+  m_running_id  = metrics->add_gauge("threads_running", "", 1.0);
+  m_failures_id = metrics->add_counter("thread_failures_total", "", 1.0);
 
   init_members(); 
 }
@@ -50,8 +63,10 @@ thread::thread(string thread_name)
 
 thread::~thread(void)
 {
+  if (m_wake_fd != -1) {
+    close(m_wake_fd);
+  }
   sem_destroy(&m_sem_release);
-  pthread_mutex_destroy(&m_mutex_thread_done);
   pthread_cond_destroy(&m_cond_thread_done);
   pthread_condattr_destroy(&m_condattr_thread_done);
 }
@@ -84,9 +99,21 @@ long thread::start(void *p_arg)
 
   init_members();
 
-  // Create thread
+  // Discard wake up from any previous stop
+  if (m_wake_fd == -1) {
+    return THREAD_INTERNAL_ERROR;
+  }
+  uint64_t value;
+  if ( (read(m_wake_fd, &value, sizeof(value)) == -1) &&
+       (errno != EAGAIN) ) {
+    return THREAD_INTERNAL_ERROR;
+  }
+
+  // Create thread, started as seen by the caller from now on
+  m_state = THREAD_STATE_STARTED;
   rc = pthread_create(&m_thread, NULL, thread::entry_point, this);
   if ( rc ) {
+    m_state = THREAD_STATE_NOT_STARTED;
     return THREAD_PTHREAD_ERROR;
   }
 
@@ -125,7 +152,13 @@ long thread::stop(void)
     return THREAD_WRONG_STATE;
   }
 
-  m_stop = true;
+  __atomic_store_n(&m_stop, true, __ATOMIC_RELEASE);
+
+  // Wake up thread if sleeping
+  const uint64_t value = 1;
+  if (write(m_wake_fd, &value, sizeof(value)) == -1) {
+    return THREAD_INTERNAL_ERROR;
+  }
 
   return THREAD_SUCCESS;
 }
@@ -178,7 +211,7 @@ long thread::wait_timed(double timeout_in_sec)
     return THREAD_TIME_ERROR;
   }
 
-  if (pthread_mutex_lock(&m_mutex_thread_done)) {
+  if (m_mutex_thread_done.lock()) {
     return THREAD_MUTEX_ERROR;
   }
 
@@ -186,16 +219,14 @@ long thread::wait_timed(double timeout_in_sec)
   if (m_state != THREAD_STATE_DONE) {
 
     // Wait for thread to complete using timeout
-    rc = pthread_cond_timedwait(&m_cond_thread_done,
-				&m_mutex_thread_done,
-				&t2);
+    rc = m_mutex_thread_done.wait(&m_cond_thread_done, &t2);
     if ( rc ) {
-      pthread_mutex_unlock(&m_mutex_thread_done);
+      m_mutex_thread_done.unlock();
       return THREAD_PTHREAD_ERROR;
     }
   }
 
-  if (pthread_mutex_unlock(&m_mutex_thread_done)) {
+  if (m_mutex_thread_done.unlock()) {
     return THREAD_MUTEX_ERROR;
   }
 
@@ -228,7 +259,7 @@ pid_t thread::get_pid(void)
 
 unsigned thread::get_exe_cnt(void)
 {
-  return m_exe_cnt;
+  return __atomic_load_n(&m_exe_cnt, __ATOMIC_RELAXED);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -246,20 +277,36 @@ void thread::run(void *p_arg)
   m_tid = syscall(SYS_gettid);
   m_pid = getpid();
 
+  trace_set_thread_name(m_thread_name.c_str());
+  profiler_thread_attach(m_thread_name.c_str());
+
   m_state = THREAD_STATE_STARTED;
+  BASICD_PROBE3(thread_state, m_thread_name.c_str(), m_tid, m_state);
+
+  metrics_registry::instance()->inc(m_runs_id);
+  metrics_registry::instance()->change(m_running_id, 1);
 
   /////////////////////////////
   // Setup
   /////////////////////////////
   try {
     // Call virtual function, implemented in derived class
-    if (setup() != THREAD_SUCCESS) {
-      m_status |= THREAD_STATUS_SETUP_FAILED;
-    }       
+    {
+      TRACE_SCOPE("setup");
+      if (setup() != THREAD_SUCCESS) {
+	m_status |= THREAD_STATUS_SETUP_FAILED;
+      }
+    }
     m_state = THREAD_STATE_SETUP_DONE;
+    BASICD_PROBE3(thread_state, m_thread_name.c_str(), m_tid, m_state);
 
     // Wait until thread is released
-    int rc = sem_wait(&m_sem_release);
+    TRACE_BEGIN("release_wait");
+    int rc;
+    do {
+      rc = sem_wait(&m_sem_release); // Not restarted after a signal
+    } while ( (rc != 0) && (errno == EINTR) );
+    TRACE_END("release_wait");
     if ( rc != 0 ) {
       m_status |= THREAD_STATUS_SETUP_FAILED;
     }    
@@ -275,8 +322,10 @@ void thread::run(void *p_arg)
     if (m_state == THREAD_STATE_SETUP_DONE) {
 
       m_state = THREAD_STATE_EXECUTING;
+      BASICD_PROBE3(thread_state, m_thread_name.c_str(), m_tid, m_state);
 
       // Call virtual function, implemented in derived class
+      TRACE_SCOPE("execute");
       if (execute(p_arg) != THREAD_SUCCESS) {
 	m_status |= THREAD_STATUS_EXECUTE_FAILED;
       }
@@ -291,6 +340,7 @@ void thread::run(void *p_arg)
   /////////////////////////////
   try {
     // Call virtual function, implemented in derived class
+    TRACE_SCOPE("cleanup");
     if (cleanup() != THREAD_SUCCESS) {
       m_status |= THREAD_STATUS_CLEANUP_FAILED;
     }
@@ -299,17 +349,27 @@ void thread::run(void *p_arg)
     m_status |= THREAD_STATUS_CLEANUP_FAILED;
   }
 
+  // Not sampled or traced after this
+  profiler_thread_detach();
+  trace_thread_exit();
+
   /////////////////////////////
   // Done
   /////////////////////////////
   try {
-    if (pthread_mutex_lock(&m_mutex_thread_done)) {
+    if (m_mutex_thread_done.lock()) {
       m_status |= THREAD_STATUS_DONE_FAILED;
     }
 
     m_state = THREAD_STATE_DONE;
+    BASICD_PROBE3(thread_state, m_thread_name.c_str(), m_tid, m_state);
+
+    metrics_registry::instance()->change(m_running_id, -1);
+    if (m_status != THREAD_STATUS_OK) {
+      metrics_registry::instance()->inc(m_failures_id);
+    }
 
-    if (pthread_mutex_unlock(&m_mutex_thread_done)) {
+    if (m_mutex_thread_done.unlock()) {
       m_status |= THREAD_STATUS_DONE_FAILED;
     }
     
@@ -337,14 +397,44 @@ void *thread::entry_point(void *p_this)
 
 void thread::update_exe_cnt(void)
 {
-  m_exe_cnt++;
+  __atomic_add_fetch(&m_exe_cnt, 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////
+
+void thread::set_exe_cnt(unsigned exe_cnt)
+{
+  __atomic_store_n(&m_exe_cnt, exe_cnt, __ATOMIC_RELAXED);
 }
 
 ////////////////////////////////////////////////////////////////
 
 bool thread::is_stopped(void)
 {
-  return m_stop;
+  return __atomic_load_n(&m_stop, __ATOMIC_ACQUIRE);
+}
+
+////////////////////////////////////////////////////////////////
+
+long thread::sleep_until(const struct timespec *the_time)
+{
+  struct pollfd fds[2];
+
+  fds[0].fd     = m_wake_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd     = m_event_fd; // Ignored by poll if -1
+  fds[1].events = POLLIN;
+
+  if ( delay_until_poll(the_time, fds, 2) != DELAY_SUCCESS ) {
+    return THREAD_TIME_ERROR;
+  }
+
+  // Stop has precedence
+  if ( (fds[1].revents) && (!fds[0].revents) ) {
+    return THREAD_EVENT;
+  }
+
+  return THREAD_SUCCESS;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -363,4 +453,5 @@ void thread::init_members(void)
   m_pid     = 0;
   m_exe_cnt = 0;
   m_stop    = false;
+  m_event_fd = -1;
 }
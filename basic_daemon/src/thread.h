@@ -15,6 +15,8 @@
 #include <string>
 #include <semaphore.h>
 
+#include "profiled_mutex.h"
+
 using namespace std;
 
 /////////////////////////////////////////////////////////////////////////////
@@ -30,6 +32,9 @@ using namespace std;
 #define THREAD_TIME_ERROR       -5
 #define THREAD_INTERNAL_ERROR   -6 // Used by derived class
 
+// Not an error, sleep ended early by the event fd
+#define THREAD_EVENT             1
+
 /////////////////////////////////////////////////////////////////////////////
 //               Class support types
 /////////////////////////////////////////////////////////////////////////////
@@ -69,6 +74,7 @@ class thread {
   unsigned get_status(void) {return m_status;}   // Thread status
 
   string get_name(void);
+  const char *get_name_c_str(void) {return m_thread_name.c_str();} // No copy
 
   pid_t get_tid(void);
   pid_t get_pid(void);
@@ -84,7 +90,19 @@ class thread {
   static void *entry_point(void *p_this);
 
   void update_exe_cnt(void);
+  void set_exe_cnt(unsigned exe_cnt); // Counting continues from here
   bool is_stopped(void);
+
+  // Sleep that returns at once when thread is ordered to stop,
+  // returns THREAD_EVENT when the event fd becomes readable
+  long sleep_until(const struct timespec *the_time);
+
+  // Also end sleep on this fd (-1 for none), must be called by the
+  // thread itself. The event is not consumed by sleep_until.
+  void set_event_fd(int fd) {m_event_fd = fd;}
+
+  // Readable when thread is ordered to stop, for threads that poll
+  int get_wake_fd(void) {return m_wake_fd;}
   
   virtual long setup(void) = 0;        // Pure virtual function
   virtual long execute(void *arg) = 0; // Pure virtual function
@@ -105,13 +123,20 @@ class thread {
   // Handles/signals 'thread done'
   pthread_cond_t     m_cond_thread_done;
   pthread_condattr_t m_condattr_thread_done;
-  pthread_mutex_t    m_mutex_thread_done;
+  profiled_mutex     m_mutex_thread_done;
   
   unsigned m_exe_cnt;  // Thread execution counter
   bool     m_stop;     // Thread has been ordered to stop
+  int      m_wake_fd;  // Signaled (eventfd) when ordered to stop
+  int      m_event_fd; // Optional, ends sleep
 
   sem_t m_sem_release; // Released when thread shall execute
 
+  // Ids in the metrics registry
+  int m_runs_id;
+  int m_running_id;
+  int m_failures_id;
+
   void init_members(void);
 };
 
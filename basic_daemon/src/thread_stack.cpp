@@ -0,0 +1,141 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/syscall.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "thread_stack.h"
+#include "delay.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define THREAD_STACK_SIGNAL  (SIGRTMIN + 1)
+
+#define THREAD_STACK_POLL  0.0005 // Seconds between checks for the stack
+
+// Frames of the signal handler itself, and of the kernel trampoline
+#define THREAD_STACK_SKIP_FRAMES  2
+
+// State of a capture
+#define CAPTURE_IDLE       0
+#define CAPTURE_REQUESTED  1 // Signal sent
+#define CAPTURE_DONE       2 // Stack written by handler
+
+/////////////////////////////////////////////////////////////////////////////
+//               Global variables
+/////////////////////////////////////////////////////////////////////////////
+
+// One capture at a time, the state is accessed atomically
+static pthread_mutex_t g_capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int             g_capture_state = CAPTURE_IDLE;
+static void           *g_frames[THREAD_STACK_MAX_FRAMES +
+				THREAD_STACK_SKIP_FRAMES];
+static int             g_nr_frames;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+static void on_signal(int sig)
+{
+  const int saved_errno = errno;
+
+  // A signal arriving after the capture has timed out is ignored
+  if (__atomic_load_n(&g_capture_state, __ATOMIC_ACQUIRE) ==
+      CAPTURE_REQUESTED) {
+    g_nr_frames = backtrace(g_frames,
+			    THREAD_STACK_MAX_FRAMES + THREAD_STACK_SKIP_FRAMES);
+    __atomic_store_n(&g_capture_state, CAPTURE_DONE, __ATOMIC_RELEASE);
+  }
+
+  errno = saved_errno;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+long thread_stack_init(void)
+{
+  struct sigaction action;
+  void *frame;
+
+  // The first backtrace loads the unwinder, which is not
+  // async-signal-safe, so it is done here and not in the handler
+  backtrace(&frame, 1);
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal;
+  action.sa_flags   = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(THREAD_STACK_SIGNAL, &action, NULL) == -1) {
+    return THREAD_STACK_FAILURE;
+  }
+
+  return THREAD_STACK_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////
+
+int thread_stack_capture(pid_t tid,
+			 void **frames,
+			 int max_frames,
+			 double timeout_in_sec)
+{
+  int nr_frames = -1;
+  int error = ETIMEDOUT;
+
+  pthread_mutex_lock(&g_capture_mutex);
+
+  __atomic_store_n(&g_capture_state, CAPTURE_REQUESTED, __ATOMIC_RELEASE);
+  if (syscall(SYS_tgkill, getpid(), tid, THREAD_STACK_SIGNAL) == -1) {
+    error = errno;
+  }
+  else {
+    for (double waited=0.0; waited < timeout_in_sec;
+	 waited += THREAD_STACK_POLL) {
+      if (__atomic_load_n(&g_capture_state, __ATOMIC_ACQUIRE) ==
+	  CAPTURE_DONE) {
+	nr_frames = g_nr_frames - THREAD_STACK_SKIP_FRAMES;
+	if (nr_frames < 0) {
+	  nr_frames = 0;
+	}
+	if (nr_frames > max_frames) {
+	  nr_frames = max_frames;
+	}
+	memcpy(frames, g_frames + THREAD_STACK_SKIP_FRAMES,
+	       nr_frames * sizeof(void *));
+	break;
+      }
+      delay(THREAD_STACK_POLL);
+    }
+  }
+  __atomic_store_n(&g_capture_state, CAPTURE_IDLE, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&g_capture_mutex);
+
+  if (nr_frames < 0) {
+    errno = error;
+  }
+
+  return nr_frames;
+}
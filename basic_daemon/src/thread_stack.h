@@ -0,0 +1,46 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __THREAD_STACK_H__
+#define __THREAD_STACK_H__
+
+#include <sys/types.h>
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define THREAD_STACK_SUCCESS   0
+#define THREAD_STACK_FAILURE  -1
+
+#define THREAD_STACK_MAX_FRAMES  32
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of exported functions
+/////////////////////////////////////////////////////////////////////////////
+
+// The stack of another thread in this process is captured by the
+// thread itself, in a handler of a real-time signal. A thread that
+// blocks the signal, or never returns to user space, is not captured.
+
+// Installs the signal handler, once per process
+extern long thread_stack_init(void);
+
+// Return addresses of the thread (Linux thread ID), innermost first,
+// for backtrace_symbols. Returns nof frames, or -1 with errno set
+// (ETIMEDOUT if the thread did not respond in time).
+extern int thread_stack_capture(pid_t tid,
+				void **frames,
+				int max_frames,
+				double timeout_in_sec);
+
+#endif // __THREAD_STACK_H__
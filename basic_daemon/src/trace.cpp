@@ -0,0 +1,253 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "trace.h"
+#include "delay.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+#define TRACE_NAME_LEN  16
+
+// Ring buffer index, size is a power of two
+#define EVENT_INDEX(n)  ((n) & (TRACE_BUFFER_EVENTS - 1))
+
+// State of a buffer
+#define BUFFER_FREE    0 // Claimed by next traced thread
+#define BUFFER_LIVE    1 // Written by its thread
+#define BUFFER_EXITED  2 // Thread exited, free when dumped
+
+typedef char check_buffer_events[((TRACE_BUFFER_EVENTS &
+				   (TRACE_BUFFER_EVENTS - 1)) == 0) ? 1 : -1];
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of types
+/////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  uint64_t    time;  // Nanoseconds, see get_clock_id
+  const char *name;  // String literal
+  char        phase; // 'B' or 'E'
+} TRACE_EVENT;
+
+typedef struct {
+  uint64_t    head;  // Nof written events, accessed atomically
+  pid_t       tid;
+  char        name[TRACE_NAME_LEN];
+  TRACE_EVENT events[TRACE_BUFFER_EVENTS];
+} TRACE_BUFFER;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Global variables
+/////////////////////////////////////////////////////////////////////////////
+
+int trace_enabled = 0;
+
+// Buffers of all traced threads, allocated when first claimed and
+// then reused. States are guarded by the mutex, events are not.
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TRACE_BUFFER   *g_buffers[TRACE_MAX_THREADS];
+static int             g_states[TRACE_MAX_THREADS];
+
+static __thread TRACE_BUFFER *t_buffer = NULL;
+static __thread bool          t_untraced = false; // No buffer left
+static __thread char          t_name[TRACE_NAME_LEN];
+
+/////////////////////////////////////////////////////////////////////////////
+//               Private member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+static TRACE_BUFFER *claim_buffer(void)
+{
+  pthread_mutex_lock(&g_mutex);
+
+  // A free buffer, or else one of an exited thread not yet dumped
+  int index = -1;
+  for (unsigned i=0; (i < TRACE_MAX_THREADS) && (index == -1); i++) {
+    if (g_states[i] == BUFFER_FREE) {
+      index = i;
+    }
+  }
+  for (unsigned i=0; (i < TRACE_MAX_THREADS) && (index == -1); i++) {
+    if (g_states[i] == BUFFER_EXITED) {
+      index = i;
+    }
+  }
+  if ( (index != -1) && (!g_buffers[index]) ) {
+    g_buffers[index] = (TRACE_BUFFER *)malloc(sizeof(TRACE_BUFFER));
+  }
+  if ( (index == -1) || (!g_buffers[index]) ) {
+    pthread_mutex_unlock(&g_mutex);
+    t_untraced = true;
+    return NULL;
+  }
+
+  TRACE_BUFFER *buffer = g_buffers[index];
+  buffer->head = 0;
+  buffer->tid  = syscall(SYS_gettid);
+  if (t_name[0]) {
+    memcpy(buffer->name, t_name, sizeof(buffer->name));
+  }
+  else {
+    snprintf(buffer->name, sizeof(buffer->name), "%d", buffer->tid);
+  }
+  g_states[index] = BUFFER_LIVE;
+
+  pthread_mutex_unlock(&g_mutex);
+
+  return buffer;
+}
+
+////////////////////////////////////////////////////////////////
+
+static void dump_buffer(FILE *file, pid_t pid,
+			const TRACE_BUFFER *buffer, bool *first)
+{
+  fprintf(file,
+	  "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+	  "\"args\":{\"name\":\"%s\"}}",
+	  (*first ? "" : ","), pid, buffer->tid, buffer->name);
+  *first = false;
+
+  // Oldest events may be overwritten while copied, they are skipped
+  const uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+  const uint64_t start = ( (head > TRACE_BUFFER_EVENTS) ?
+			   head - TRACE_BUFFER_EVENTS : 0 );
+
+  for (uint64_t n=start; n < head; n++) {
+    const TRACE_EVENT event = buffer->events[EVENT_INDEX(n)];
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE); // Event before head
+    const uint64_t now_head = __atomic_load_n(&buffer->head,
+					      __ATOMIC_RELAXED);
+    if (n + TRACE_BUFFER_EVENTS <= now_head) {
+      continue;
+    }
+
+    // Microseconds, as expected by the trace viewers
+    fprintf(file,
+	    ",\n{\"name\":\"%s\",\"cat\":\"basicd\",\"ph\":\"%c\","
+	    "\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%d}",
+	    event.name, event.phase,
+	    (unsigned long long)(event.time / 1000),
+	    (unsigned)(event.time % 1000),
+	    pid, buffer->tid);
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//               Public member functions
+/////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////
+
+void trace_set_enabled(bool enabled)
+{
+  __atomic_store_n(&trace_enabled, (enabled ? 1 : 0), __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////
+
+void trace_set_thread_name(const char *name)
+{
+  strncpy(t_name, name, sizeof(t_name) - 1);
+  t_name[sizeof(t_name) - 1] = '\0';
+}
+
+////////////////////////////////////////////////////////////////
+
+void trace_thread_exit(void)
+{
+  t_untraced = true;
+  if (!t_buffer) {
+    return;
+  }
+
+  pthread_mutex_lock(&g_mutex);
+  for (unsigned i=0; i < TRACE_MAX_THREADS; i++) {
+    if (g_buffers[i] == t_buffer) {
+      g_states[i] = BUFFER_EXITED;
+    }
+  }
+  pthread_mutex_unlock(&g_mutex);
+
+  t_buffer = NULL;
+}
+
+////////////////////////////////////////////////////////////////
+
+void trace_event(const char *name, char phase)
+{
+  struct timespec now;
+
+  if ( (!t_buffer) &&
+       (t_untraced || !(t_buffer = claim_buffer())) ) {
+    return;
+  }
+  if (clock_gettime(get_clock_id(), &now)) {
+    return;
+  }
+
+  // Only this thread writes, the event is published by the head
+  const uint64_t head = t_buffer->head;
+  TRACE_EVENT *event = &t_buffer->events[EVENT_INDEX(head)];
+  event->time  = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+  event->name  = name;
+  event->phase = phase;
+  __atomic_store_n(&t_buffer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////
+
+long trace_dump(const char *path)
+{
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    return TRACE_FAILURE;
+  }
+
+  const pid_t pid = getpid();
+  bool first = true;
+
+  // No buffer is claimed meanwhile, live ones are still written
+  pthread_mutex_lock(&g_mutex);
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (unsigned i=0; i < TRACE_MAX_THREADS; i++) {
+    if (g_states[i] == BUFFER_FREE) {
+      continue;
+    }
+    dump_buffer(file, pid, g_buffers[i], &first);
+    if (g_states[i] == BUFFER_EXITED) {
+      g_states[i] = BUFFER_FREE; // Dumped once
+    }
+  }
+  fprintf(file, "\n]}\n");
+  pthread_mutex_unlock(&g_mutex);
+
+  const bool failed = ferror(file);
+  if ( (fclose(file) != 0) || failed ) {
+    return TRACE_FAILURE;
+  }
+
+  return TRACE_SUCCESS;
+}
@@ -0,0 +1,115 @@
+// ************************************************************************
+// *                                                                      *
+// * Copyright (C) 2013 Bonden i Nol (hakanbrolin@hotmail.com)            *
+// *                                                                      *
+// * This program is free software; you can redistribute it and/or modify *
+// * it under the terms of the GNU General Public License as published by *
+// * the Free Software Foundation; either version 2 of the License, or    *
+// * (at your option) any later version.                                  *
+// *                                                                      *
+// ************************************************************************
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <sys/types.h>
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of macros
+/////////////////////////////////////////////////////////////////////////////
+
+// Return codes
+#define TRACE_SUCCESS   0
+#define TRACE_FAILURE  -1
+
+#define TRACE_MAX_THREADS    64   // Running, more are not traced
+#define TRACE_BUFFER_EVENTS  4096 // Latest events kept per thread
+
+// Begin and end of a span, name is a string literal.
+// Disabled tracing costs one load and a predicted branch.
+#define TRACE_BEGIN(name) \
+  do { \
+    if (__builtin_expect(__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED), 0)) { \
+      trace_event(name, 'B'); \
+    } \
+  } while (0)
+
+#define TRACE_END(name) \
+  do { \
+    if (__builtin_expect(__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED), 0)) { \
+      trace_event(name, 'E'); \
+    } \
+  } while (0)
+
+// Span until end of scope, also ended by a return or an exception
+#define TRACE_SCOPE(name)  trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+// Pastes after expansion, __LINE__ becomes the line number
+#define TRACE_CONCAT(a, b)   TRACE_CONCAT_(a, b)
+#define TRACE_CONCAT_(a, b)  a##b
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of exported variables
+/////////////////////////////////////////////////////////////////////////////
+
+// Non-zero when events are recorded, see trace_set_enabled
+extern int trace_enabled;
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of exported functions
+/////////////////////////////////////////////////////////////////////////////
+
+// Events are recorded in a ring buffer per thread, claimed on the
+// first event of the thread. Only the thread writes to its buffer,
+// without locks. Buffers are kept when tracing is disabled.
+//
+// The buffer of an exited thread is included in the next dump, and
+// is then reused. It is reused before that if no buffer is free.
+
+extern void trace_set_enabled(bool enabled);
+
+// Name of the calling thread in a dump, truncated to 15 characters
+extern void trace_set_thread_name(const char *name);
+
+// Calling thread records no more events, its buffer may be reused
+extern void trace_thread_exit(void);
+
+// Use TRACE_BEGIN and TRACE_END
+extern void trace_event(const char *name, char phase);
+
+// Writes all buffers as Chrome trace event JSON (chrome://tracing,
+// ui.perfetto.dev). May be called while events are recorded, events
+// overwritten meanwhile are left out.
+extern long trace_dump(const char *path);
+
+/////////////////////////////////////////////////////////////////////////////
+//               Definition of classes
+/////////////////////////////////////////////////////////////////////////////
+
+// Use TRACE_SCOPE. A span begun is always ended, even if tracing is
+// disabled meanwhile.
+
+class trace_scope {
+
+ public:
+  trace_scope(const char *name) {
+    m_name  = name;
+    m_begun = __builtin_expect(__atomic_load_n(&trace_enabled,
+					       __ATOMIC_RELAXED), 0);
+    if (m_begun) {
+      trace_event(m_name, 'B');
+    }
+  }
+
+  ~trace_scope(void) {
+    if (m_begun) {
+      trace_event(m_name, 'E');
+    }
+  }
+
+ private:
+  const char *m_name;
+  bool        m_begun;
+};
+
+#endif // __TRACE_H__